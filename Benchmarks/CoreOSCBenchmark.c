@@ -0,0 +1,347 @@
+//
+// CoreOSCBenchmark.c
+// CoreOSC Framework
+//
+// Encode and send benchmarks. Results are written as JSON to stdout, one
+// entry per benchmark with nanoseconds and operations per second, so runs
+// can be compared by scripts.
+//
+//   CoreOSCBenchmark [-t seconds per benchmark] [-p port]
+//
+
+#include <CoreFoundation/CoreFoundation.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "CoreOSC.h"
+
+typedef void (*BenchmarkFunction)(void *context, long iterations);
+
+typedef struct {
+  OSCRef osc;
+  OSCAddressHandle handle;
+  OSCAddressHandle *handles;
+  CFIndex handlesCount;
+  CFMutableDataRef data;
+  CFTypeRef value;
+  CFDictionaryRef dictionary;
+  Float32 floats[16];
+  UInt8 blob[256];
+} BenchmarkContext;
+
+static double benchmarkDuration = 0.25;
+static int benchmarksCount = 0;
+
+static double BenchmarkNow(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+// Run function in growing rounds until it takes at least benchmarkDuration.
+static void BenchmarkRun(const char *group, const char *name, CFIndex size, BenchmarkFunction function, void *context) {
+  long iterations = 1;
+  double elapsed = 0;
+  function(context, 1); // Warm up
+  for (;;) {
+    double start = BenchmarkNow();
+    function(context, iterations);
+    elapsed = BenchmarkNow() - start;
+    if (elapsed >= benchmarkDuration || iterations > (1L << 40))
+      break;
+    long next = elapsed > 0 ? (long)(iterations * benchmarkDuration * 1.2 / elapsed) : iterations * 100;
+    iterations = next > iterations * 100 ? iterations * 100 : next > iterations ? next : iterations * 2;
+  }
+  printf("%s\n    {\"group\": \"%s\", \"name\": \"%s\", \"size\": %ld, \"iterations\": %ld, \"ns_per_op\": %.2f, \"ops_per_sec\": %.0f}",
+         benchmarksCount++ ? "," : "", group, name, (long)size, iterations, elapsed * 1e9 / iterations, iterations / elapsed);
+  fflush(stdout);
+}
+
+#pragma mark OSCSend*
+
+static void BenchmarkSendTrue(void *context, long n) {
+  BenchmarkContext *c = context;
+  for (long i = 0; i < n; i++)
+    OSCSendTrue(c->osc, CFSTR("/benchmark/true"));
+}
+
+static void BenchmarkSendSInt32(void *context, long n) {
+  BenchmarkContext *c = context;
+  for (long i = 0; i < n; i++)
+    OSCSendSInt32(c->osc, CFSTR("/benchmark/sint32"), (SInt32)i);
+}
+
+static void BenchmarkSendFloat32(void *context, long n) {
+  BenchmarkContext *c = context;
+  for (long i = 0; i < n; i++)
+    OSCSendFloat32(c->osc, CFSTR("/benchmark/float32"), (Float32)i);
+}
+
+static void BenchmarkSendFloats32(void *context, long n) {
+  BenchmarkContext *c = context;
+  for (long i = 0; i < n; i++)
+    OSCSendFloats32(c->osc, CFSTR("/benchmark/floats32"), c->floats, 16);
+}
+
+static void BenchmarkSendCString(void *context, long n) {
+  BenchmarkContext *c = context;
+  for (long i = 0; i < n; i++)
+    OSCSendCString(c->osc, CFSTR("/benchmark/cstring"), (const UInt8 *)"benchmark");
+}
+
+static void BenchmarkSendString(void *context, long n) {
+  BenchmarkContext *c = context;
+  for (long i = 0; i < n; i++)
+    OSCSendString(c->osc, CFSTR("/benchmark/string"), CFSTR("benchmark"));
+}
+
+static void BenchmarkSendBlob(void *context, long n) {
+  BenchmarkContext *c = context;
+  for (long i = 0; i < n; i++)
+    OSCSendBlob(c->osc, CFSTR("/benchmark/blob"), c->blob, sizeof(c->blob));
+}
+
+static void BenchmarkSendArguments(void *context, long n) {
+  BenchmarkContext *c = context;
+  OSCArgumentValue values[4];
+  values[1].s = "benchmark";
+  values[2].d = 0.5;
+  values[3].h = 42;
+  for (long i = 0; i < n; i++) {
+    values[0].f = (Float32)i;
+    OSCSendArgumentsWithHandle(c->osc, c->handle, "fsdh", values);
+  }
+}
+
+static void BenchmarkSendValue(void *context, long n) {
+  BenchmarkContext *c = context;
+  for (long i = 0; i < n; i++)
+    OSCSendValue(c->osc, CFSTR("/benchmark/value"), c->value);
+}
+
+static void BenchmarkSendFloat32WithHandle(void *context, long n) {
+  BenchmarkContext *c = context;
+  for (long i = 0; i < n; i++)
+    OSCSendFloat32WithHandle(c->osc, c->handle, (Float32)i);
+}
+
+static void BenchmarkSendFloats32WithHandle(void *context, long n) {
+  BenchmarkContext *c = context;
+  for (long i = 0; i < n; i++)
+    OSCSendFloats32WithHandle(c->osc, c->handle, c->floats, 16);
+}
+
+#pragma mark OSCDataAppend*
+
+static void BenchmarkDataAppendMessage(void *context, long n) {
+  BenchmarkContext *c = context;
+  for (long i = 0; i < n; i++) {
+    CFDataSetLength(c->data, 0);
+    OSCDataAppendMessage(NULL, c->data, CFSTR("/benchmark/message"), c->value);
+  }
+}
+
+static void BenchmarkDataAppendBundle(void *context, long n) {
+  BenchmarkContext *c = context;
+  for (long i = 0; i < n; i++) {
+    CFDataSetLength(c->data, 0);
+    OSCDataAppendBundleWithDictionary(NULL, c->data, c->dictionary);
+  }
+}
+
+#pragma mark Run loop timer
+
+static void BenchmarkTimerTick(void *context, long n) {
+  BenchmarkContext *c = context;
+  for (long i = 0; i < n; i++) {
+    for (CFIndex j = 0; j < c->handlesCount; j++)
+      OSCSetFloat32WithHandle(c->osc, c->handles[j], (Float32)(i + j));
+    __OSCRunLoopTimerCallBack(NULL, c->osc);
+  }
+}
+
+#pragma mark Loopback
+
+typedef struct {
+  int sockfd;
+  volatile long received;
+  volatile bool running;
+} LoopbackReceiver;
+
+static void *LoopbackReceiverMain(void *info) {
+  LoopbackReceiver *receiver = info;
+  UInt8 buffer[2048];
+  while (receiver->running)
+    if (recv(receiver->sockfd, buffer, sizeof(buffer), 0) > 0)
+      __atomic_add_fetch(&receiver->received, 1, __ATOMIC_RELAXED);
+  return NULL;
+}
+
+// Packets sent and received per second through loopback with the receiver
+// on its own thread. Loss is reported, throughput counts received packets.
+static void BenchmarkLoopback(UInt16 port, CFIndex batchCapacity, OSCTransport transport) {
+  LoopbackReceiver receiver = { socket(AF_INET, SOCK_DGRAM, 0), 0, true };
+  struct sockaddr_in address;
+  memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_port = htons(port);
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  int size = 4 * 1024 * 1024;
+  struct timeval timeout = { 0, 100000 };
+  setsockopt(receiver.sockfd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+  setsockopt(receiver.sockfd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  if (bind(receiver.sockfd, (struct sockaddr *)&address, sizeof(address)) != 0) {
+    fprintf(stderr, "can't bind loopback receiver to port %i\n", port);
+    close(receiver.sockfd);
+    return;
+  }
+  pthread_t thread;
+  pthread_create(&thread, NULL, LoopbackReceiverMain, &receiver);
+
+  OSCRef osc = OSCCreateWithTransport(NULL, NULL, transport);
+  OSCConnect(osc, CFSTR("127.0.0.1"), port);
+  OSCSetBatchCapacity(osc, batchCapacity);
+  OSCAddressHandle handle = OSCAddressesAppendWithString(osc, CFSTR("/benchmark/loopback"));
+  long sent = 0;
+  double start = BenchmarkNow(), elapsed = 0;
+  while ((elapsed = BenchmarkNow() - start) < benchmarkDuration * 4) {
+    for (int i = 0; i < 1024; i++)
+      OSCSendFloat32WithHandle(osc, handle, (Float32)i);
+    sent += 1024;
+  }
+  OSCFlush(osc);
+  elapsed = BenchmarkNow() - start;
+  usleep(200000);
+  receiver.running = false;
+  pthread_join(thread, NULL);
+  long received = __atomic_load_n(&receiver.received, __ATOMIC_RELAXED);
+
+  UInt64 packetsCount = 0, callsCount = 0;
+  OSCGetSendStatistics(osc, &packetsCount, &callsCount);
+  const char *names[] = { "udp", "io_uring", "io_uring_polled" };
+  printf(",\n    {\"group\": \"loopback\", \"name\": \"%s_batch_%ld\", \"size\": %ld, \"iterations\": %ld, \"ns_per_op\": %.2f, \"ops_per_sec\": %.0f, \"received\": %ld, \"loss\": %.4f, \"packets_per_call\": %.2f}",
+         names[OSCGetTransport(osc)], (long)batchCapacity, (long)batchCapacity, sent, elapsed * 1e9 / sent, received / elapsed, received,
+         sent ? 1.0 - (double)received / sent : 0, callsCount ? (double)packetsCount / callsCount : 0);
+  benchmarksCount++;
+  OSCRelease(osc);
+  close(receiver.sockfd);
+}
+
+int main(int argc, char * const argv[]) {
+  UInt16 port = 61234;
+  int option;
+  while ((option = getopt(argc, argv, "t:p:")) != -1) {
+    if (option == 't')
+      benchmarkDuration = atof(optarg);
+    else if (option == 'p')
+      port = (UInt16)atoi(optarg);
+    else {
+      fprintf(stderr, "usage: %s [-t seconds] [-p port]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  // Packets go to a bound socket nobody reads, the kernel drops them once
+  // its buffer is full which doesn't affect the sending side.
+  int sink = socket(AF_INET, SOCK_DGRAM, 0);
+  struct sockaddr_in address;
+  memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_port = htons(port + 1);
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  bind(sink, (struct sockaddr *)&address, sizeof(address));
+
+  BenchmarkContext c;
+  memset(&c, 0, sizeof(c));
+  c.osc = OSCCreateWithUserInfo(NULL, NULL);
+  OSCConnect(c.osc, CFSTR("127.0.0.1"), port + 1);
+  c.data = CFDataCreateMutable(NULL, 0);
+  for (int i = 0; i < 16; i++)
+    c.floats[i] = i * 0.5f;
+
+  printf("{\n  \"duration\": %.3f,\n  \"benchmarks\": [", benchmarkDuration);
+
+  BenchmarkRun("send", "OSCSendTrue", 0, BenchmarkSendTrue, &c);
+  BenchmarkRun("send", "OSCSendSInt32", 0, BenchmarkSendSInt32, &c);
+  BenchmarkRun("send", "OSCSendFloat32", 0, BenchmarkSendFloat32, &c);
+  BenchmarkRun("send", "OSCSendFloats32", 16, BenchmarkSendFloats32, &c);
+  BenchmarkRun("send", "OSCSendCString", 0, BenchmarkSendCString, &c);
+  BenchmarkRun("send", "OSCSendString", 0, BenchmarkSendString, &c);
+  BenchmarkRun("send", "OSCSendBlob", sizeof(c.blob), BenchmarkSendBlob, &c);
+  c.handle = OSCAddressesAppendWithString(c.osc, CFSTR("/benchmark/handle"));
+  BenchmarkRun("send", "OSCSendFloat32WithHandle", 0, BenchmarkSendFloat32WithHandle, &c);
+  BenchmarkRun("send", "OSCSendFloats32WithHandle", 16, BenchmarkSendFloats32WithHandle, &c);
+  BenchmarkRun("send", "OSCSendArgumentsWithHandle", 4, BenchmarkSendArguments, &c);
+
+  Float32 f = 3.14f;
+  SInt32 i = 42;
+  CFNumberRef float32 = CFNumberCreate(NULL, kCFNumberFloat32Type, &f);
+  CFNumberRef sint32 = CFNumberCreate(NULL, kCFNumberSInt32Type, &i);
+  CFDataRef data = CFDataCreate(NULL, c.blob, 64);
+  struct { const char *name; CFTypeRef value; } values[] = {
+    { "true", kCFBooleanTrue },
+    { "sint32", sint32 },
+    { "float32", float32 },
+    { "string", CFSTR("benchmark") },
+    { "data", data }
+  };
+  for (size_t j = 0; j < sizeof(values) / sizeof(values[0]); j++) {
+    c.value = values[j].value;
+    BenchmarkRun("send_value", values[j].name, 0, BenchmarkSendValue, &c);
+  }
+  for (size_t j = 0; j < sizeof(values) / sizeof(values[0]); j++) {
+    c.value = values[j].value;
+    BenchmarkRun("data_append_message", values[j].name, 0, BenchmarkDataAppendMessage, &c);
+  }
+
+  CFIndex sizes[] = { 10, 100, 1000, 10000 };
+  for (size_t j = 0; j < sizeof(sizes) / sizeof(sizes[0]); j++) {
+    CFMutableDictionaryRef dictionary = CFDictionaryCreateMutable(NULL, 0, &kCFTypeDictionaryKeyCallBacks, &kCFTypeDictionaryValueCallBacks);
+    for (CFIndex k = 0; k < sizes[j]; k++) {
+      char name[64];
+      snprintf(name, sizeof(name), "/benchmark/%ld/value", (long)k);
+      CFStringRef key = CFStringCreateWithCString(NULL, name, kCFStringEncodingUTF8);
+      CFDictionarySetValue(dictionary, key, k % 2 ? (CFTypeRef)float32 : (CFTypeRef)sint32);
+      CFRelease(key);
+    }
+    c.dictionary = dictionary;
+    BenchmarkRun("data_append_bundle", "OSCDataAppendBundleWithDictionary", sizes[j], BenchmarkDataAppendBundle, &c);
+    CFRelease(dictionary);
+  }
+
+  CFIndex dirtyCounts[] = { 0, 10, 100, 1000 };
+  OSCAddressHandle handles[1000];
+  for (CFIndex k = 0; k < 1000; k++) {
+    char name[64];
+    snprintf(name, sizeof(name), "/benchmark/timer/%ld", (long)k);
+    CFStringRef name_ = CFStringCreateWithCString(NULL, name, kCFStringEncodingUTF8);
+    handles[k] = OSCAddressesAppendWithString(c.osc, name_);
+    CFRelease(name_);
+  }
+  c.handles = handles;
+  for (size_t j = 0; j < sizeof(dirtyCounts) / sizeof(dirtyCounts[0]); j++) {
+    c.handlesCount = dirtyCounts[j];
+    BenchmarkRun("timer", "__OSCRunLoopTimerCallBack", dirtyCounts[j], BenchmarkTimerTick, &c);
+  }
+
+  BenchmarkLoopback(port, 0, kOSCTransportSocket);
+  BenchmarkLoopback(port, 64, kOSCTransportSocket);
+  BenchmarkLoopback(port, 0, kOSCTransportIOUring);
+  BenchmarkLoopback(port, 64, kOSCTransportIOUring);
+  BenchmarkLoopback(port, 64, kOSCTransportIOUringPolled);
+
+  printf("\n  ]\n}\n");
+
+  CFRelease(float32);
+  CFRelease(sint32);
+  CFRelease(data);
+  CFRelease(c.data);
+  OSCRelease(c.osc);
+  close(sink);
+  return 0;
+}
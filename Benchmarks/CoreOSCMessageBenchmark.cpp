@@ -0,0 +1,139 @@
+//
+// CoreOSCMessageBenchmark.cpp
+// CoreOSC Framework
+//
+// Typed osc::message<Ts...> against the equivalent C encoders. Output is
+// the same JSON format as CoreOSCBenchmark. Exits with 1 if a typed message
+// doesn't encode the same bytes as OSCEncodeMessage, so the ctest smoke run
+// covers the C++ header.
+//
+//   CoreOSCMessageBenchmark [-t seconds per benchmark] [-p port]
+//
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "CoreOSC.hpp"
+
+static double benchmarkDuration = 0.25;
+static int benchmarksCount = 0;
+
+static double BenchmarkNow() {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+// Run function in growing rounds until it takes at least benchmarkDuration.
+template <typename Function>
+static void BenchmarkRun(const char *group, const char *name, Function function) {
+  long iterations = 1;
+  double elapsed = 0;
+  function(1); // Warm up
+  for (;;) {
+    double start = BenchmarkNow();
+    function(iterations);
+    elapsed = BenchmarkNow() - start;
+    if (elapsed >= benchmarkDuration || iterations > (1L << 40))
+      break;
+    long next = elapsed > 0 ? (long)(iterations * benchmarkDuration * 1.2 / elapsed) : iterations * 100;
+    iterations = next > iterations * 100 ? iterations * 100 : next > iterations ? next : iterations * 2;
+  }
+  printf("%s\n    {\"group\": \"%s\", \"name\": \"%s\", \"size\": 0, \"iterations\": %ld, \"ns_per_op\": %.2f, \"ops_per_sec\": %.0f}",
+         benchmarksCount++ ? "," : "", group, name, iterations, elapsed * 1e9 / iterations, iterations / elapsed);
+  fflush(stdout);
+}
+
+static OSCArgumentValue BenchmarkValue(float value) { OSCArgumentValue result; result.f = value; return result; }
+static OSCArgumentValue BenchmarkValue(double value) { OSCArgumentValue result; result.d = value; return result; }
+static OSCArgumentValue BenchmarkValue(int32_t value) { OSCArgumentValue result; result.i = value; return result; }
+static OSCArgumentValue BenchmarkValue(int64_t value) { OSCArgumentValue result; result.h = value; return result; }
+static OSCArgumentValue BenchmarkValue(std::string_view value) { OSCArgumentValue result; result.s = value.data(); return result; }
+
+// Typed message has to encode the same bytes as OSCEncodeMessage, checked
+// before anything is measured. Strings have to be 0 terminated.
+template <typename... Ts>
+static bool BenchmarkCheck(const OSCAddress &address, Ts... values) {
+  using Message = osc::message<Ts...>;
+  UInt8 encoded[Message::maximumLength], expected[Message::maximumLength];
+  OSCArgumentValue arguments[] = { BenchmarkValue(values)... };
+  CFIndex length = 0;
+  size_t encodedLength = Message::encode(encoded, address, values...);
+  bool result = OSCEncodeMessage(expected, sizeof(expected), &address, Message::tags.data() + 1, arguments, &length) == kOSCResultSuccess;
+  result = result && encodedLength == (size_t)length && memcmp(encoded, expected, encodedLength) == 0;
+  if (!result)
+    fprintf(stderr, "message<%s> doesn't match OSCEncodeMessage\n", std::string(Message::tags.data() + 1, sizeof...(Ts)).c_str());
+  return result;
+}
+
+int main(int argc, char * const argv[]) {
+  UInt16 port = 61236;
+  int option;
+  while ((option = getopt(argc, argv, "t:p:")) != -1) {
+    if (option == 't')
+      benchmarkDuration = atof(optarg);
+    else if (option == 'p')
+      port = (UInt16)atoi(optarg);
+    else {
+      fprintf(stderr, "usage: %s [-t seconds] [-p port]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  int sink = socket(AF_INET, SOCK_DGRAM, 0);
+  struct sockaddr_in address;
+  memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_port = htons(port);
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  bind(sink, (struct sockaddr *)&address, sizeof(address));
+
+  OSCRef osc = OSCCreateWithUserInfo(NULL, NULL);
+  OSCConnect(osc, CFSTR("127.0.0.1"), port);
+  OSCAddressHandle handle = OSCAddressesAppendWithString(osc, CFSTR("/benchmark/message"));
+  OSCAddress message = *OSCAddressesGetAddress(osc, handle);
+  UInt8 buffer[osc::message<float, int32_t, std::string_view>::maximumLength];
+
+  bool valid = BenchmarkCheck(message, 1.5f) && BenchmarkCheck(message, -0.0f) && BenchmarkCheck(message, 1e100) &&
+               BenchmarkCheck(message, (int32_t)-7) && BenchmarkCheck(message, -((int64_t)1 << 40)) &&
+               BenchmarkCheck(message, 1.5f, (int32_t)2, std::string_view("abc"), 3.0, (int64_t)1 << 40);
+  const char *strings[] = { "", "a", "ab", "abc", "abcd", "abcde", "abcdefgh" };
+  for (const char *string : strings)
+    valid = valid && BenchmarkCheck(message, std::string_view(string)) && BenchmarkCheck(message, std::string_view(string), (int32_t)1);
+  if (!valid)
+    return 1;
+
+  printf("{\n  \"duration\": %.3f,\n  \"benchmarks\": [", benchmarkDuration);
+
+  BenchmarkRun("encode", "message<float>", [&](long n) {
+    for (long i = 0; i < n; i++)
+      osc::message<float>::encode(buffer, message, (float)i);
+  });
+  BenchmarkRun("encode", "message<float,int32_t,string_view>", [&](long n) {
+    for (long i = 0; i < n; i++)
+      osc::message<float, int32_t, std::string_view>::encode(buffer, message, (float)i, (int32_t)i, "benchmark");
+  });
+  BenchmarkRun("send", "OSCSendFloat32WithHandle", [&](long n) {
+    for (long i = 0; i < n; i++)
+      OSCSendFloat32WithHandle(osc, handle, (Float32)i);
+  });
+  BenchmarkRun("send", "message<float>", [&](long n) {
+    for (long i = 0; i < n; i++)
+      osc::message<float>::send(osc, handle, (float)i);
+  });
+  BenchmarkRun("send", "message<float,int32_t,string_view>", [&](long n) {
+    for (long i = 0; i < n; i++)
+      osc::message<float, int32_t, std::string_view>::send(osc, handle, (float)i, (int32_t)i, "benchmark");
+  });
+
+  printf("\n  ]\n}\n");
+
+  OSCRelease(osc);
+  close(sink);
+  return 0;
+}
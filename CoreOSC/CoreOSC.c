@@ -6,37 +6,48 @@
 // Copyright 2011 Inteliv Ltd. All rights reserved.
 //
 
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE // sendmmsg
+#endif
+
 #include "CoreOSC.h"
 
+#if defined(__AVX2__) || defined(__SSSE3__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
 #pragma mark Internal string helper for fast UTF8 buffer access
 
-inline __OSCUTF8String __OSCUTF8StringMake(CFAllocatorRef allocator, CFStringRef string) {
-  __OSCUTF8String utf8String;
-  utf8String.allocator = allocator;
-  utf8String.string = string;
-  utf8String.maximumSize = CFStringGetMaximumSizeForEncoding(CFStringGetLength(string), kCFStringEncodingUTF8) + 1;
-  if ((utf8String.pointer = (const char *)CFStringGetCStringPtr(string, kCFStringEncodingUTF8))) {
-    utf8String.buffer = NULL;
-  } else {
-    utf8String.buffer = CFAllocatorAllocate(allocator, utf8String.maximumSize, 0);
-    if (utf8String.buffer) {
-      CFStringGetCString(string, (char *)utf8String.buffer, utf8String.maximumSize, kCFStringEncodingUTF8);
+inline void __OSCUTF8StringInit(__OSCUTF8String *utf8String, CFAllocatorRef allocator, CFStringRef string) {
+  utf8String->allocator = allocator;
+  utf8String->string = string;
+  utf8String->maximumSize = CFStringGetMaximumSizeForEncoding(CFStringGetLength(string), kCFStringEncodingUTF8) + 1;
+  utf8String->buffer = NULL;
+  if ((utf8String->pointer = (const char *)CFStringGetCStringPtr(string, kCFStringEncodingUTF8)) == NULL) {
+    if (CFStringGetCString(string, utf8String->storage, sizeof(utf8String->storage), kCFStringEncodingUTF8)) {
+      utf8String->pointer = utf8String->storage;
+    } else {
+      utf8String->buffer = CFAllocatorAllocate(allocator, utf8String->maximumSize, 0);
+      if (utf8String->buffer)
+        CFStringGetCString(string, (char *)utf8String->buffer, utf8String->maximumSize, kCFStringEncodingUTF8);
     }
   }
-  return utf8String;
 }
 
-inline const char *__OSCUTF8StringGetBuffer(__OSCUTF8String utf8String) {
-  return utf8String.pointer ? utf8String.pointer : utf8String.buffer;
+inline const char *__OSCUTF8StringGetBuffer(const __OSCUTF8String *utf8String) {
+  return utf8String->pointer ? utf8String->pointer : utf8String->buffer;
 }
 
-inline CFIndex __OSCUTF8StringGetMaximumSize(__OSCUTF8String utf8String) {
-  return utf8String.maximumSize;
+inline CFIndex __OSCUTF8StringGetMaximumSize(const __OSCUTF8String *utf8String) {
+  return utf8String->maximumSize;
 }
 
-inline void __OSCUTF8StringDestroy(__OSCUTF8String utf8String) {
-  if (utf8String.buffer)
-    CFAllocatorDeallocate(utf8String.allocator, (void *)utf8String.buffer);
+inline void __OSCUTF8StringDestroy(__OSCUTF8String *utf8String) {
+  if (utf8String->buffer)
+    CFAllocatorDeallocate(utf8String->allocator, (void *)utf8String->buffer);
+  utf8String->buffer = NULL;
 }
 
 void __OSCBufferAppendAddressWithString(void *buffer, CFStringRef name, int *i) {
@@ -49,6 +60,23 @@ void __OSCBufferAppendAddressWithString(void *buffer, CFStringRef name, int *i)
     __OSCBufferAppend(buffer, address, n, *i);
 }
 
+// Encode address for the wire, zero terminated and padded to 32bit boundary.
+// Returns false if the address doesn't fit OSC_STATIC_ADDRESS_LENGTH.
+inline bool __OSCAddressInitWithString(OSCAddress *address, CFStringRef name) {
+  bool result = false;
+  address->name = name;
+  if (CFStringGetCString(name, (char *)address->buffer, OSC_STATIC_ADDRESS_LENGTH, kCFStringEncodingUTF8)) {
+    CFIndex n = strlen((const char *)address->buffer);
+    address->hash = __OSCHash(address->buffer, n);
+    address->length = __OSCGet32BitAlignedLength(n + 1);
+    if (address->length <= OSC_STATIC_ADDRESS_LENGTH) {
+      memset(address->buffer + n, 0, address->length - n);
+      result = true;
+    }
+  }
+  return result;
+}
+
 #pragma mark Internal, diagnostics
 
 // Internal, for diagnostics, print osc buffer where the top line are chars,
@@ -75,15 +103,18 @@ inline void OSCDataAppendZeroBytesFor32Alignment(CFMutableDataRef data) {
   CFDataAppendBytes(data, (const UInt8 *)"\0\0\0", (4 - CFDataGetLength(data) % 4) % 4);
 }
 
+// Encode string directly into data, without temporary buffer. Allocator is
+// no longer used and is kept for API compatibility.
 inline void OSCDataAppendString(CFAllocatorRef allocator, CFMutableDataRef data, CFStringRef value) {
+  (void)allocator;
+  CFIndex offset = CFDataGetLength(data);
   CFIndex bufferLength = CFStringGetMaximumSizeForEncoding(CFStringGetLength(value), kCFStringEncodingUTF8);
   CFIndex usedBufferLength = 0;
-  UInt8 *buffer = CFAllocatorAllocate(allocator, bufferLength, 0);
-  CFStringGetBytes(value, CFRangeMake(0, CFStringGetLength(value)), kCFStringEncodingUTF8, 0, 0, buffer, bufferLength, &usedBufferLength);
-  CFDataAppendBytes(data, buffer, usedBufferLength);
+  CFDataIncreaseLength(data, bufferLength + 1);
+  CFStringGetBytes(value, CFRangeMake(0, CFStringGetLength(value)), kCFStringEncodingUTF8, 0, 0, CFDataGetMutableBytePtr(data) + offset, bufferLength, &usedBufferLength);
+  CFDataSetLength(data, offset + usedBufferLength);
   CFDataAppendBytes(data, (const UInt8 *)"\0", 1);
   OSCDataAppendZeroBytesFor32Alignment(data);
-  CFAllocatorDeallocate(allocator, buffer);
 }
 
 inline void OSCDataAppendSInt32(CFMutableDataRef data, SInt32 value) {
@@ -109,50 +140,39 @@ inline void OSCDataAppendMessage(CFAllocatorRef allocator, CFMutableDataRef data
   if (valueType == CFNumberGetTypeID()) {
     if (CFNumberIsFloatType(value)) {
       OSCDataAppendString(allocator, data, name);
-      OSCDataAppendString(allocator, data, CFSTR(",f"));
+      CFDataAppendBytes(data, (const UInt8 *)",f\0\0", 4);
       OSCDataAppendNumberAsFloat32(data, value);
     } else {
       OSCDataAppendString(allocator, data, name);
-      OSCDataAppendString(allocator, data, CFSTR(",i"));
+      CFDataAppendBytes(data, (const UInt8 *)",i\0\0", 4);
       OSCDataAppendNumberAsSInt32(data, value);
     }
   } else if (valueType == CFBooleanGetTypeID()) {
     OSCDataAppendString(allocator, data, name);
     if (CFBooleanGetValue(value))
-      OSCDataAppendString(allocator, data, CFSTR(",T"));
+      CFDataAppendBytes(data, (const UInt8 *)",T\0\0", 4);
     else
-      OSCDataAppendString(allocator, data, CFSTR(",F"));
+      CFDataAppendBytes(data, (const UInt8 *)",F\0\0", 4);
   } else if (valueType == CFStringGetTypeID()) {
     OSCDataAppendString(allocator, data, name);
+    CFDataAppendBytes(data, (const UInt8 *)",s\0\0", 4);
     OSCDataAppendString(allocator, data, value);
   } else if (valueType == CFDataGetTypeID()) {
     OSCDataAppendString(allocator, data, name);
-    OSCDataAppendString(allocator, data, CFSTR(",b"));
+    CFDataAppendBytes(data, (const UInt8 *)",b\0\0", 4);
     OSCDataAppendSInt32(data, CFDataGetLength(value));
     CFDataAppendBytes(data, CFDataGetBytePtr(value), CFDataGetLength(value));
     OSCDataAppendZeroBytesFor32Alignment(data);
   }
 }
 
-//inline void OSCDataAppendTimeTagWithAboluteTimeInterval(CFDataRef data, CFTimeInterval timeInterval) {
-//  const unsigned long long EPOCH = 2208988800ULL;
-//  const unsigned long long NTP_SCALE_FRAC = 4294967295ULL;
-//  
-//  unsigned long long tv_to_ntp(struct timeval tv)
-//  {
-//    unsigned long long tv_ntp, tv_usecs;
-//    
-//    tv_ntp = tv.tv_sec + EPOCH;
-//    tv_usecs = (NTP_SCALE_FRAC * tv.tv_usec) / 1000000UL;
-//    
-//    return (tv_ntp << 32) | tv_usecs;
-//  }
-//  
-//}
+inline void OSCDataAppendTimeTag(CFMutableDataRef data, OSCTimeTag timeTag) {
+  uint64_t swapped = CFSwapInt64HostToBig(timeTag);
+  CFDataAppendBytes(data, (const UInt8 *)&swapped, 8);
+}
 
 inline void OSCDataAppendImmediateTimeTag(CFMutableDataRef data) {
-  uint64_t immediate = CFSwapInt64HostToBig(1);
-  CFDataAppendBytes(data, (const UInt8 *)&immediate, 8);
+  OSCDataAppendTimeTag(data, kOSCTimeTagImmediately);
 }
 
 inline void OSCDataAppendData(CFMutableDataRef data, CFDataRef value) {
@@ -161,431 +181,2494 @@ inline void OSCDataAppendData(CFMutableDataRef data, CFDataRef value) {
 }
 
 inline void OSCDataAppendBundleWithDictionary(CFAllocatorRef allocator, CFMutableDataRef data, CFDictionaryRef keyValuePairs) {
+  OSCDataAppendBundleWithDictionaryAndTimeTag(allocator, data, keyValuePairs, kOSCTimeTagImmediately);
+}
+
+// Elements are encoded in place, element size is reserved first and filled
+// in after the message is appended.
+inline void OSCDataAppendBundleWithDictionaryAndTimeTag(CFAllocatorRef allocator, CFMutableDataRef data, CFDictionaryRef keyValuePairs, OSCTimeTag timeTag) {
   if (CFGetTypeID(keyValuePairs) == CFDictionaryGetTypeID()) {
     OSCDataAppendString(allocator, data, CFSTR("#bundle"));
-    OSCDataAppendImmediateTimeTag(data);
+    OSCDataAppendTimeTag(data, timeTag);
     CFIndex n = CFDictionaryGetCount(keyValuePairs);
-    CFTypeRef *keys = CFAllocatorAllocate(allocator, sizeof(CFTypeRef) * n, 0);
-    CFTypeRef *values = CFAllocatorAllocate(allocator, sizeof(CFTypeRef) * n, 0);
+    CFTypeRef stack[2 * OSC_STACK_VALUES_LENGTH];
+    CFTypeRef *keys = n <= OSC_STACK_VALUES_LENGTH ? stack : CFAllocatorAllocate(allocator, sizeof(CFTypeRef) * n, 0);
+    CFTypeRef *values = n <= OSC_STACK_VALUES_LENGTH ? stack + n : CFAllocatorAllocate(allocator, sizeof(CFTypeRef) * n, 0);
     CFDictionaryGetKeysAndValues(keyValuePairs, keys, values);
     for (CFIndex i = 0; i < n; i++) {
-      CFMutableDataRef message = CFDataCreateMutable(allocator, 0);
-      OSCDataAppendMessage(allocator, message, keys[i], values[i]);
-      OSCDataAppendSInt32(data, CFDataGetLength(message));
-      OSCDataAppendData(data, message);
-      CFRelease(message);
+      CFIndex offset = CFDataGetLength(data);
+      OSCDataAppendSInt32(data, 0);
+      OSCDataAppendMessage(allocator, data, keys[i], values[i]);
+      uint32_t size = CFSwapInt32HostToBig((uint32_t)(CFDataGetLength(data) - offset - 4));
+      if (size)
+        memcpy(CFDataGetMutableBytePtr(data) + offset, &size, sizeof(uint32_t));
+      else
+        CFDataSetLength(data, offset); // Unsupported value type, drop empty element
+    }
+    if (keys != stack) {
+      CFAllocatorDeallocate(allocator, values);
+      CFAllocatorDeallocate(allocator, keys);
     }
-    CFAllocatorDeallocate(allocator, values);
-    CFAllocatorDeallocate(allocator, keys);
   }
 }
 
-#pragma mark OSC API
+#pragma mark Time tags
 
-// Iterate over all keys in the cache. Fetch first inserted value and send it.
-// Please note this callback behaves the same for different osc schedule modes,
-// the only difference is how the values are being added (insert or replace).
-inline void __OSCRunLoopTimerCallBack(CFRunLoopTimerRef timer, void *info) {
-  OSCRef osc = info;
-  
-  CFMutableDictionaryRef dict = CFDictionaryCreateMutable(NULL, 0, &kCFTypeDictionaryKeyCallBacks, &kCFTypeDictionaryValueCallBacks);
-  
-  if (osc) {
-    if (osc->cache) {
-      CFIndex n = CFDictionaryGetCount(osc->cache);
-      if (n > 0) {
-        CFTypeRef *keys = CFAllocatorAllocate(osc->allocator, sizeof(CFTypeRef) * n, 0);
-        CFTypeRef *arrays = CFAllocatorAllocate(osc->allocator, sizeof(CFTypeRef) * n, 0);
-        CFDictionaryGetKeysAndValues(osc->cache, keys, arrays);
-        for (CFIndex i = 0; i < n; i++) {
-          CFStringRef key = keys[i];
-          CFMutableArrayRef array = (CFMutableArrayRef)arrays[i];
-          if (CFArrayGetCount(array) > 0) { // If there is a value in the array, remove it and send
-            CFTypeRef value = CFRetain(CFArrayGetValueAtIndex(array, 0));
-            CFArrayRemoveValueAtIndex(array, 0);
-//            OSCSendValue(osc, key, value);
-            
-            CFDictionarySetValue(dict, key, value);
-            
-//            printf("sending");
-//            CFShow(value);
-            CFRelease(value);
-//            break;
-          }
-        }
-        CFAllocatorDeallocate(osc->allocator, arrays);
-        CFAllocatorDeallocate(osc->allocator, keys);
-      }
-    }
-  }
-  
-//  CFShow(dict);
-  
-  if (CFDictionaryGetCount(dict) > 0) {
-    CFMutableDataRef data = CFDataCreateMutable(NULL, 0);
-    OSCDataAppendBundleWithDictionary(NULL, data, dict);
-    
-    OSCSendRawBufferWithData(osc, data);
-    
-//    __OSCBufferPrint((char *)CFDataGetBytePtr(data), CFDataGetLength(data));
-  }
-  
-  CFRelease(dict);
-  
+// NTP time tag - seconds since 1900 in upper 32 bits, fraction in lower.
+inline OSCTimeTag OSCTimeTagMakeWithAbsoluteTime(CFAbsoluteTime time) {
+  Float64 seconds = time + kOSCTimeTagAbsoluteTimeOffset;
+  UInt64 integral = (UInt64)seconds;
+  UInt64 fraction = (UInt64)((seconds - (Float64)integral) * 4294967296.0);
+  return (integral << 32) | (fraction & 0xffffffff);
 }
 
-inline OSCRef OSCCreateWithUserInfo(CFAllocatorRef allocator, void *userInfo) {
-  OSCRef osc = CFAllocatorAllocate(allocator, sizeof(OSC), 0);
-  if (osc) {
-    osc->allocator = allocator ? CFRetain(allocator) : NULL;
-    osc->retainCount = 1;
-    osc->userInfo = userInfo;
-    osc->runLoopTimer = NULL;
-    osc->sockfd = 0;
-    osc->p = NULL;
-    osc->cache = CFDictionaryCreateMutable(osc->allocator, 0, &kCFTypeDictionaryKeyCallBacks, &kCFTypeDictionaryValueCallBacks);
+inline OSCTimeTag OSCTimeTagMakeWithTimeIntervalSinceNow(CFTimeInterval timeInterval) {
+  return OSCTimeTagMakeWithAbsoluteTime(CFAbsoluteTimeGetCurrent() + timeInterval);
+}
+
+inline CFAbsoluteTime OSCTimeTagGetAbsoluteTime(OSCTimeTag timeTag) {
+  return (Float64)(timeTag >> 32) + (Float64)(timeTag & 0xffffffff) / 4294967296.0 - kOSCTimeTagAbsoluteTimeOffset;
+}
+
+#pragma mark Writer
+
+inline OSCWriterRef OSCWriterCreate(CFAllocatorRef allocator, CFIndex capacity) {
+  OSCWriterRef writer = CFAllocatorAllocate(allocator, sizeof(OSCWriter), 0);
+  if (writer) {
+    writer->allocator = allocator ? CFRetain(allocator) : NULL;
+    writer->retainCount = 1;
+    writer->length = 0;
+    writer->depth = 0;
+    writer->capacity = capacity > 0 ? capacity : 0;
+    writer->bytes = writer->capacity ? CFAllocatorAllocate(allocator, writer->capacity, 0) : NULL;
+    if (!writer->bytes)
+      writer->capacity = 0;
   }
-  return osc;
+  return writer;
 }
 
-inline OSCRef OSCRetain(OSCRef osc) {
-  if (osc)
-    osc->retainCount++;
-  return osc;
+inline OSCWriterRef OSCWriterRetain(OSCWriterRef writer) {
+  if (writer)
+    writer->retainCount++;
+  return writer;
 }
 
-inline OSCRef OSCRelease(OSCRef osc) {
-  if (osc) {
-    if (--osc->retainCount == 0) {
-      CFAllocatorRef allocator = osc->allocator;
-      
-      OSCDeactivateRunLoopTimer(osc);
-      
-      if (osc->cache) {
-        CFRelease(osc->cache);
-        osc->cache = NULL;
-      }
-      
-      if (osc->servinfo)
-        freeaddrinfo(osc->servinfo);
-      
-      if (osc->sockfd)
-        close(osc->sockfd);
-      
-      CFAllocatorDeallocate(allocator, osc);
-      osc = NULL;
-      
+inline OSCWriterRef OSCWriterRelease(OSCWriterRef writer) {
+  if (writer) {
+    if (--writer->retainCount == 0) {
+      CFAllocatorRef allocator = writer->allocator;
+      if (writer->bytes)
+        CFAllocatorDeallocate(allocator, writer->bytes);
+      CFAllocatorDeallocate(allocator, writer);
+      writer = NULL;
       if (allocator)
         CFRelease(allocator);
     }
   }
-  return osc;
+  return writer;
 }
 
-inline struct addrinfo *OSCConnect(OSCRef osc, CFStringRef host, UInt16 port) {
-  osc->servinfo = NULL;
-  osc->sockfd = 0;
-  
-  char hostBuffer[256];
-  char portBuffer[256];
-  
-  CFStringGetCString(host, hostBuffer, sizeof(hostBuffer), kCFStringEncodingUTF8);
-  sprintf(portBuffer, "%i", port);
-  
-//  printf("OSCConnect -> '%s:%s'\n", hostBuffer, portBuffer);
-  
-  memset(&osc->hints, 0, sizeof(osc->hints));
-  osc->hints.ai_family = AF_UNSPEC;
-  osc->hints.ai_socktype = SOCK_DGRAM;
-  
-  if ((osc->rv = getaddrinfo(hostBuffer, portBuffer, &osc->hints, &osc->servinfo)) != 0) {
-    printf("gai_strerror(osc->rv)\n");
-    // TODO: gai_strerror(osc->rv)
-  } else {
-    
-    // Loop through all the results and make a socket
-    for (osc->p = osc->servinfo; osc->p != NULL; osc->p = osc->p->ai_next) {
-      if ((osc->sockfd = socket(osc->p->ai_family, osc->p->ai_socktype, osc->p->ai_protocol)) == -1)
-        continue;
-      break;
-    }
-    
-    if (osc->p == NULL) {
-      printf("failed to bind socket\n");
-    }
+// Forget contents, keep the memory.
+inline void OSCWriterReset(OSCWriterRef writer) {
+  if (writer) {
+    writer->length = 0;
+    writer->depth = 0;
   }
-  return osc->p;
 }
 
-inline void OSCDisconnect(OSCRef osc) {
-  
+inline const UInt8 *OSCWriterGetBytePtr(OSCWriterRef writer) {
+  return writer ? writer->bytes : NULL;
 }
 
-#pragma mark Addresses
+inline CFIndex OSCWriterGetLength(OSCWriterRef writer) {
+  return writer ? writer->length : 0;
+}
 
-CFArrayRef OSCCreateAddressArray(OSCRef osc) {
-  CFArrayRef array = NULL;
-  if (osc) {
-    if (osc->cache) {
-      CFIndex n = CFDictionaryGetCount(osc->cache);
-      CFTypeRef *keys = CFAllocatorAllocate(osc->allocator, sizeof(CFTypeRef) * n, 0);
-      CFDictionaryGetKeysAndValues(osc->cache, keys, NULL);
-      array = CFArrayCreate(osc->allocator, keys, n, &kCFTypeArrayCallBacks);
-      CFAllocatorDeallocate(osc->allocator, keys);
+// Extend writer by length bytes and return pointer to them, growing the
+// buffer geometrically if needed.
+inline UInt8 *__OSCWriterReserve(OSCWriterRef writer, CFIndex length) {
+  UInt8 *result = NULL;
+  if (writer->length + length > writer->capacity) {
+    CFIndex capacity = writer->capacity ? writer->capacity * 2 : 256;
+    while (capacity < writer->length + length)
+      capacity *= 2;
+    UInt8 *bytes = CFAllocatorAllocate(writer->allocator, capacity, 0);
+    if (bytes) {
+      if (writer->bytes) {
+        memcpy(bytes, writer->bytes, writer->length);
+        CFAllocatorDeallocate(writer->allocator, writer->bytes);
+      }
+      writer->bytes = bytes;
+      writer->capacity = capacity;
     }
   }
-  return array;
+  if (writer->length + length <= writer->capacity) {
+    result = writer->bytes + writer->length;
+    writer->length += length;
+  }
+  return result;
 }
 
-#pragma mark Run Loop Timer
-
-inline void OSCActivateRunLoopTimer(OSCRef osc, CFTimeInterval timeInterval) {
-  if (osc) {
-    if (osc->runLoopTimer)
-      OSCDeactivateRunLoopTimer(osc);
-    CFRunLoopTimerContext context = { 0, osc, NULL, NULL, NULL };
-    osc->runLoopTimer = CFRunLoopTimerCreate(osc->allocator, CFAbsoluteTimeGetCurrent(), timeInterval, 0, 0, __OSCRunLoopTimerCallBack, &context);
-    CFRunLoopAddTimer(CFRunLoopGetCurrent(), osc->runLoopTimer, kCFRunLoopCommonModes);
-  }
+inline bool OSCWriterAppendBytes(OSCWriterRef writer, const void *bytes, CFIndex length) {
+  UInt8 *b = __OSCWriterReserve(writer, length);
+  if (b)
+    memcpy(b, bytes, length);
+  return b != NULL;
 }
 
-inline void OSCDeactivateRunLoopTimer(OSCRef osc) {
-  if (osc) {
-    if (osc->runLoopTimer) {
-      CFRunLoopTimerInvalidate(osc->runLoopTimer);
-      CFRelease(osc->runLoopTimer);
-      osc->runLoopTimer = NULL;
-    }
+// Append zero terminated, 32bit padded string.
+inline bool OSCWriterAppendCString(OSCWriterRef writer, const char *value, CFIndex length) {
+  CFIndex n = __OSCGet32BitAlignedLength(length + 1);
+  UInt8 *b = __OSCWriterReserve(writer, n);
+  if (b) {
+    memcpy(b, value, length);
+    memset(b + length, 0, n - length);
   }
+  return b != NULL;
 }
-  
-#pragma mark Sending
 
-inline OSCResult OSCSetValue(OSCRef osc, CFStringRef name, CFTypeRef value) {
-  OSCResult result = kOSCResultNotAllocatedError;
-  if (osc && name && value) {
-    if (osc->cache) {
-      CFMutableArrayRef array = (CFMutableArrayRef)CFDictionaryGetValue(osc->cache, name);
-      if (!array) {
-        array = CFArrayCreateMutable(osc->allocator, 0, &kCFTypeArrayCallBacks);
-        CFDictionarySetValue(osc->cache, name, array);
-        CFRelease(array); // Retained by dictionary, we can use it normally
-      }
-      CFArraySetValueAtIndex(array, 0, value);
-      //      CFArrayAppendValue(array, value);
-//      CFShow(osc->cache);
+inline bool OSCWriterAppendString(OSCWriterRef writer, CFStringRef value) {
+  bool result = false;
+  const char *pointer = CFStringGetCStringPtr(value, kCFStringEncodingUTF8);
+  if (pointer) {
+    result = OSCWriterAppendCString(writer, pointer, strlen(pointer));
+  } else {
+    CFIndex offset = writer->length;
+    CFIndex maximumLength = CFStringGetMaximumSizeForEncoding(CFStringGetLength(value), kCFStringEncodingUTF8);
+    UInt8 *b = __OSCWriterReserve(writer, maximumLength + 4);
+    if (b) {
+      CFIndex usedLength = 0;
+      CFStringGetBytes(value, CFRangeMake(0, CFStringGetLength(value)), kCFStringEncodingUTF8, 0, 0, b, maximumLength, &usedLength);
+      CFIndex n = __OSCGet32BitAlignedLength(usedLength + 1);
+      memset(b + usedLength, 0, n - usedLength);
+      writer->length = offset + n;
+      result = true;
     }
   }
   return result;
 }
 
-// Force Float32 number if not of float type
-inline OSCResult OSCSetNumberAsFloat32(OSCRef osc, CFStringRef name, CFNumberRef value) {
-  OSCResult result = kOSCResultNotAllocatedError;
-  if (osc && name && value) {
-    if (CFGetTypeID(value) == CFNumberGetTypeID()) {
-      if (CFNumberIsFloatType(value)) {
-        result = OSCSetValue(osc, name, value);
-      } else {
-        Float32 value_ = (Float32)0.0;
-        CFNumberGetValue(value, kCFNumberFloat32Type, &value_);
-        CFNumberRef number = CFNumberCreate(osc->allocator, kCFNumberFloat32Type, &value_);
-        result = OSCSetValue(osc, name, number);
-        CFRelease(number);
-      }
-    }
-  }
-  return result;
+inline bool OSCWriterAppendSInt32(OSCWriterRef writer, SInt32 value) {
+  uint32_t swapped = CFSwapInt32HostToBig(value);
+  return OSCWriterAppendBytes(writer, &swapped, sizeof(uint32_t));
 }
 
-inline OSCResult OSCSendValue(OSCRef osc, CFStringRef name, CFTypeRef value) {
-  OSCResult result = kOSCResultNotAllocatedError;
-  if (osc && name && value) {
-    CFTypeID valueId = CFGetTypeID(value);
-    if (valueId == CFNumberGetTypeID()) {
-      if (CFNumberIsFloatType(value)) {
-        Float32 float32Value = (Float32)0.0;
-        CFNumberGetValue(value, kCFNumberFloat32Type, &float32Value);
-        result = OSCSendFloat32(osc, name, float32Value);
-      } else {
-        SInt32 sint32Value = 0;
-        CFNumberGetValue(value, kCFNumberSInt32Type, &sint32Value);
-        result = OSCSendSInt32(osc, name, sint32Value);
-      }
-    }
-//    else if (valueId == CFArrayGetTypeID()) {
-//      
-//    }
-  }
-  return result;
+inline bool OSCWriterAppendFloat32(OSCWriterRef writer, Float32 value) {
+  CFSwappedFloat32 swapped = CFConvertFloat32HostToSwapped(value);
+  return OSCWriterAppendBytes(writer, &swapped, sizeof(CFSwappedFloat32));
 }
 
-ssize_t sendallto(int s, const void *buf, size_t len,
-               int flags, const struct sockaddr *to,
-               socklen_t tolen) {
-  int total = 0;        // how many bytes we've sent
-  int bytesleft = len; // how many we have left to send
-  int n;
-  
-  while(total < len) {
-    n = sendto(s, buf+total, bytesleft, flags, to, tolen);
-    if (n == -1) { break; }
-    total += n;
-    bytesleft -= n;
+inline bool OSCWriterAppendTimeTag(OSCWriterRef writer, OSCTimeTag timeTag) {
+  uint64_t swapped = CFSwapInt64HostToBig(timeTag);
+  return OSCWriterAppendBytes(writer, &swapped, sizeof(uint64_t));
+}
+
+// Reserve element size slot if inside of a bundle. Returns offset of the
+// slot, -1 for top level packets or -2 if the slot couldn't be reserved.
+inline CFIndex __OSCWriterBeginElement(OSCWriterRef writer) {
+  CFIndex offset = -1;
+  if (writer->depth > 0) {
+    offset = writer->length;
+    if (!__OSCWriterReserve(writer, 4))
+      offset = -2;
   }
-  
-  len = total; // return number actually sent here
-  
-  return n==-1?-1:0; // return -1 on failure, 0 on success
-} 
+  return offset;
+}
 
-inline OSCResult OSCSendRawBuffer(OSCRef osc, const void *buffer, CFIndex length) {
-  OSCResult result = kOSCResultNotAllocatedError;
-  if (osc && osc->sockfd && osc->p) {
-    if ((result = (OSCResult)sendallto(osc->sockfd, buffer, length, 0, osc->p->ai_addr, osc->p->ai_addrlen)) == -1) {
-//      if ((result = (OSCResult)sendto(osc->sockfd, buffer, length, 0, osc->p->ai_addr, osc->p->ai_addrlen)) == -1) {
-      // TODO: Error
-    }
-  } else {
-    printf("failed to send buffer osc=%p", osc);
-    if (osc)
-      printf(", osc->sosckfd=%i, osc->p=%p", osc->sockfd, osc->p);
-    printf("\n");
+// Fill in the size of element started at offset.
+inline void __OSCWriterEndElement(OSCWriterRef writer, CFIndex offset) {
+  if (offset >= 0) {
+    uint32_t size = CFSwapInt32HostToBig((uint32_t)(writer->length - offset - 4));
+    memcpy(writer->bytes + offset, &size, sizeof(uint32_t));
   }
-  return result;
 }
 
-inline OSCResult OSCSendRawBufferWithData(OSCRef osc, CFDataRef data) {
-  OSCResult result = kOSCResultNotAllocatedError;
-  if (osc)
-    if (data)
-      result = OSCSendRawBuffer(osc, CFDataGetBytePtr(data), CFDataGetLength(data));
+// Start bundle, nested in the current one if there is an open bundle.
+inline bool OSCWriterBeginBundle(OSCWriterRef writer, OSCTimeTag timeTag) {
+  bool result = false;
+  if (writer && writer->depth < OSC_MAXIMUM_BUNDLE_DEPTH) {
+    CFIndex length = writer->length;
+    CFIndex offset = __OSCWriterBeginElement(writer);
+    if (offset != -2 && OSCWriterAppendBytes(writer, "#bundle\0", 8) && OSCWriterAppendTimeTag(writer, timeTag)) {
+      writer->bundles[writer->depth++] = offset;
+      result = true;
+    } else {
+      writer->length = length;
+    }
+  }
   return result;
 }
 
-inline OSCResult OSCSendTrue(OSCRef osc, CFStringRef name) {
-  OSCResult result = kOSCResultNotAllocatedError;
-  if (osc && name) {
-    char buffer[OSC_STATIC_TRUE_PACKET_LENGTH];
-    int i = 0;
-    __OSCBufferAppendAddressWithString(buffer, name, &i);
-    __OSCBufferAppend(buffer, ",T\0\0", 4, i);
-    __OSCBufferSend(osc, buffer, i, result);
+inline bool OSCWriterEndBundle(OSCWriterRef writer) {
+  bool result = false;
+  if (writer && writer->depth > 0) {
+    __OSCWriterEndElement(writer, writer->bundles[--writer->depth]);
+    result = true;
   }
   return result;
 }
 
-inline OSCResult OSCSendFalse(OSCRef osc, CFStringRef name) {
-  OSCResult result = kOSCResultNotAllocatedError;
-  if (osc && name) {
-    char buffer[OSC_STATIC_FALSE_PACKET_LENGTH];
-    int i = 0;
-    __OSCBufferAppendAddressWithString(buffer, name, &i);
-    __OSCBufferAppend(buffer, ",F\0\0", 4, i);
-    __OSCBufferSend(osc, buffer, i, result);
+// Append type tags and arguments for CF value.
+inline bool __OSCWriterAppendArguments(OSCWriterRef writer, CFTypeRef value) {
+  bool result = false;
+  CFTypeID valueType = CFGetTypeID(value);
+  if (valueType == CFNumberGetTypeID()) {
+    if (CFNumberIsFloatType(value)) {
+      Float32 value_ = 0;
+      CFNumberGetValue(value, kCFNumberFloat32Type, &value_);
+      result = OSCWriterAppendBytes(writer, ",f\0\0", 4) && OSCWriterAppendFloat32(writer, value_);
+    } else {
+      SInt32 value_ = 0;
+      CFNumberGetValue(value, kCFNumberSInt32Type, &value_);
+      result = OSCWriterAppendBytes(writer, ",i\0\0", 4) && OSCWriterAppendSInt32(writer, value_);
+    }
+  } else if (valueType == CFBooleanGetTypeID()) {
+    result = OSCWriterAppendBytes(writer, CFBooleanGetValue(value) ? ",T\0\0" : ",F\0\0", 4);
+  } else if (valueType == CFStringGetTypeID()) {
+    result = OSCWriterAppendBytes(writer, ",s\0\0", 4) && OSCWriterAppendString(writer, value);
+  } else if (valueType == CFDataGetTypeID()) {
+    CFIndex length = CFDataGetLength(value);
+    UInt8 *b;
+    if (OSCWriterAppendBytes(writer, ",b\0\0", 4) && OSCWriterAppendSInt32(writer, (SInt32)length) && (b = __OSCWriterReserve(writer, (length + 3) / 4 * 4))) {
+      memcpy(b, CFDataGetBytePtr(value), length);
+      memset(b + length, 0, (length + 3) / 4 * 4 - length);
+      result = true;
+    }
   }
   return result;
 }
 
-inline OSCResult OSCSendBool(OSCRef osc, CFStringRef name, bool value) {
-  OSCResult result = kOSCResultNotAllocatedError;
-  if (osc && name)
-    result = value ? OSCSendTrue(osc, name) : OSCSendFalse(osc, name);
+// Append message, as an element of the open bundle if there is one. Nothing
+// is appended if the value type is not supported.
+inline bool OSCWriterAppendMessage(OSCWriterRef writer, CFStringRef name, CFTypeRef value) {
+  bool result = false;
+  if (writer && name && value) {
+    CFIndex length = writer->length;
+    CFIndex offset = __OSCWriterBeginElement(writer);
+    if (offset != -2 && OSCWriterAppendString(writer, name) && __OSCWriterAppendArguments(writer, value)) {
+      __OSCWriterEndElement(writer, offset);
+      result = true;
+    } else {
+      writer->length = length;
+    }
+  }
   return result;
 }
 
-inline OSCResult OSCSendSInt32(OSCRef osc, CFStringRef name, SInt32 value) {
-  OSCResult result = kOSCResultNotAllocatedError;
-  if (osc && name) {
-    char buffer[OSC_STATIC_SINT32_PACKET_LENGTH];
-    SInt32 swappedValue = CFSwapInt32HostToBig(value);
-    int i = 0;
-    __OSCBufferAppendAddressWithString(buffer, name, &i);
-    __OSCBufferAppend(buffer, ",i\0\0", 4, i);
-    __OSCBufferAppend(buffer, &swappedValue, 4, i);
-    __OSCBufferSend(osc, buffer, i, result);
+inline bool OSCWriterAppendMessageWithAddress(OSCWriterRef writer, const OSCAddress *address, CFTypeRef value) {
+  bool result = false;
+  if (writer && address && value) {
+    CFIndex length = writer->length;
+    CFIndex offset = __OSCWriterBeginElement(writer);
+    if (offset != -2 && OSCWriterAppendBytes(writer, address->buffer, address->length) && __OSCWriterAppendArguments(writer, value)) {
+      __OSCWriterEndElement(writer, offset);
+      result = true;
+    } else {
+      writer->length = length;
+    }
   }
   return result;
 }
 
-inline OSCResult OSCSendFloat32(OSCRef osc, CFStringRef name, Float32 value) {
-  OSCResult result = kOSCResultNotAllocatedError;
-  if (osc) {
-    char buffer[OSC_STATIC_FLOAT32_PACKET_LENGTH];
-    CFSwappedFloat32 swappedValue = CFConvertFloat32HostToSwapped(value);
-    int i = 0;
-    __OSCBufferAppendAddressWithString(buffer, name, &i);
-    __OSCBufferAppend(buffer, ",f\0\0", 4, i);
-    __OSCBufferAppend(buffer, &swappedValue, 4, i);
-    __OSCBufferSend(osc, buffer, i, result);
-    
-//    __OSCBufferPrint(buffer, i);
-    
-    printf("> %f\n", value);
+// Unboxed counterpart of OSCWriterAppendMessageWithAddress.
+inline bool OSCWriterAppendValueWithAddress(OSCWriterRef writer, const OSCAddress *address, const OSCValue *value) {
+  bool result = false;
+  if (writer && address && value) {
+    CFIndex length = writer->length;
+    CFIndex offset = __OSCWriterBeginElement(writer);
+    if (offset != -2 && OSCWriterAppendBytes(writer, address->buffer, address->length)) {
+      switch (value->type) {
+        case 'f': result = OSCWriterAppendBytes(writer, ",f\0\0", 4) && OSCWriterAppendFloat32(writer, value->value.f); break;
+        case 'i': result = OSCWriterAppendBytes(writer, ",i\0\0", 4) && OSCWriterAppendSInt32(writer, value->value.i); break;
+        case 'T': result = OSCWriterAppendBytes(writer, ",T\0\0", 4); break;
+        case 'F': result = OSCWriterAppendBytes(writer, ",F\0\0", 4); break;
+        case 's':
+        case 'b': result = value->value.object && __OSCWriterAppendArguments(writer, value->value.object); break;
+      }
+    }
+    if (result)
+      __OSCWriterEndElement(writer, offset);
+    else
+      writer->length = length;
   }
   return result;
 }
 
-inline OSCResult OSCSendFloats32(OSCRef osc, CFStringRef name, const Float32 *values, CFIndex n) {
-  OSCResult result = kOSCResultNotAllocatedError;
-  if (osc && name && values && n > 0) {
-    char buffer[OSC_STATIC_FLOATS32_PACKET_LENGTH];
-    char type[OSC_STATIC_FLOATS32_PACKET_HEADER_LENGTH];
-    memset(type, 0, OSC_STATIC_FLOATS32_PACKET_HEADER_LENGTH);
-    type[0] = ',';
-    memset(type + 1, 'f', n);
-    int i = 0;
-    __OSCBufferAppendAddressWithString(buffer, name, &i);
-    __OSCBufferAppend(buffer, type, __OSCGet32BitAlignedLength(1 + n), i);
-    for (int i = 0; i < n; i++) {
-      CFSwappedFloat32 swappedValue = CFConvertFloat32HostToSwapped(values[i]);
-      __OSCBufferAppend(buffer, &swappedValue, 4, i);
+#pragma mark Values
+
+// Unbox CFNumber and CFBoolean, CFString and CFData are referenced, not
+// retained. Returns false for unsupported types.
+inline bool __OSCValueMakeWithCFType(OSCValue *value, CFTypeRef object) {
+  CFTypeID objectType = CFGetTypeID(object);
+  value->type = 0;
+  value->value.object = object;
+  if (objectType == CFNumberGetTypeID()) {
+    if (CFNumberIsFloatType(object)) {
+      value->type = 'f';
+      CFNumberGetValue(object, kCFNumberFloat32Type, &value->value.f);
+    } else {
+      value->type = 'i';
+      CFNumberGetValue(object, kCFNumberSInt32Type, &value->value.i);
     }
-    __OSCBufferSend(osc, buffer, i, result);
+  } else if (objectType == CFBooleanGetTypeID()) {
+    value->type = CFBooleanGetValue(object) ? 'T' : 'F';
+  } else if (objectType == CFStringGetTypeID()) {
+    value->type = 's';
+  } else if (objectType == CFDataGetTypeID()) {
+    value->type = 'b';
   }
-  return result;
+  return value->type != 0;
 }
 
-inline OSCResult OSCSendCString(OSCRef osc, CFStringRef name, const UInt8 *value) {
-  OSCResult result = kOSCResultNotAllocatedError;
-  if (osc && name && value) {
-    char buffer[OSC_STATIC_STRING_PACKET_LENGTH];
-    unsigned long length = strlen((const char *)value);
-    int i = 0;
-    __OSCBufferAppendAddressWithString(buffer, name, &i);
-    __OSCBufferAppend(buffer, ",s\0\0", 4, i);
-    __OSCBufferAppend(buffer, value, length, i);
-    __OSCBufferSend(osc, buffer, i, result);
+inline void __OSCValueRelease(OSCValue *value) {
+  if ((value->type == 's' || value->type == 'b') && value->value.object)
+    CFRelease(value->value.object);
+  value->type = 0;
+}
+
+#pragma mark Latest value cache
+
+inline bool __OSCCacheInit(CFAllocatorRef allocator, __OSCCache *cache, CFIndex capacity) {
+  CFIndex length = 64;
+  while (length < capacity * 2)
+    length *= 2;
+  memset(cache, 0, sizeof(__OSCCache));
+  cache->dirtyHead = -1;
+  cache->dirtyTail = -1;
+  if ((cache->slots = CFAllocatorAllocate(allocator, sizeof(__OSCCacheSlot) * length, 0))) {
+    cache->capacity = length;
+    for (CFIndex i = 0; i < length; i++)
+      cache->slots[i].handle = kOSCAddressHandleInvalid;
   }
-  return result;
+  return cache->slots != NULL;
 }
 
-inline OSCResult OSCSendString(OSCRef osc, CFStringRef name, CFStringRef value) {
-  OSCResult result = kOSCResultNotAllocatedError;
-  if (osc && name && value) {
-    __OSCUTF8String utf8Value = __OSCUTF8StringMake(osc->allocator, value);
-    result = OSCSendCString(osc, name, (const UInt8 *)__OSCUTF8StringGetBuffer(utf8Value));
-    __OSCUTF8StringDestroy(utf8Value);
+inline void __OSCCacheDestroy(CFAllocatorRef allocator, __OSCCache *cache) {
+  if (cache->slots) {
+    for (CFIndex i = 0; i < cache->capacity; i++)
+      if (cache->slots[i].handle != kOSCAddressHandleInvalid) {
+        __OSCValueRelease(&cache->slots[i].value);
+        __OSCValueRelease(&cache->slots[i].sent);
+      }
+    CFAllocatorDeallocate(allocator, cache->slots);
   }
-  return result;
+  if (cache->order)
+    CFAllocatorDeallocate(allocator, cache->order);
+  memset(cache, 0, sizeof(__OSCCache));
+  cache->dirtyHead = -1;
+  cache->dirtyTail = -1;
 }
 
-OSCResult OSCSendNumbersAsFloats32(OSCRef osc, CFStringRef name, const CFNumberRef *values, CFIndex n) {
-  OSCResult result = kOSCResultNotAllocatedError;
-  if (osc && name && values && n > 0) {
-    Float32 *values_ = CFAllocatorAllocate(osc->allocator, n, 0);
-    if (values_) {
-      for (CFIndex i = 0; i < n; i++)
-        CFNumberGetValue(values[i], kCFNumberFloat32Type, &values_[i]);
-      result = OSCSendFloats32(osc, name, values_, n);
-      CFAllocatorDeallocate(osc->allocator, values_);
+// Linear probing from the address hash. Registered addresses are compared by
+// pointer, addresses encoded on the stack by their bytes.
+inline __OSCCacheSlot *__OSCCacheFind(OSCRef osc, __OSCCache *cache, const OSCAddress *address) {
+  __OSCCacheSlot *slot = NULL;
+  if (cache->slots && address) {
+    CFIndex mask = cache->capacity - 1;
+    for (CFIndex i = address->hash & mask; cache->slots[i].handle != kOSCAddressHandleInvalid; i = (i + 1) & mask) {
+      if (cache->slots[i].hash == address->hash) {
+        const OSCAddress *candidate = OSCAddressesGetAddress(osc, cache->slots[i].handle);
+        if (candidate == address || (candidate->length == address->length && memcmp(candidate->buffer, address->buffer, address->length) == 0)) {
+          slot = &cache->slots[i];
+          break;
+        }
+      }
     }
   }
-  return result;
+  return slot;
 }
 
-OSCResult OSCSendNumberAsSInt32(OSCRef osc, CFStringRef name, CFNumberRef value) {
-  OSCResult result = kOSCResultNotAllocatedError;
+// Insert handle which is not in the cache yet. Table is kept at most half
+// full, when it grows the dirty list is relinked in the same order.
+inline __OSCCacheSlot *__OSCCacheInsert(OSCRef osc, __OSCCache *cache, OSCAddressHandle handle) {
+  __OSCCacheSlot *slot = NULL;
+  const OSCAddress *address = OSCAddressesGetAddress(osc, handle);
+  if (address && cache->slots) {
+    if ((cache->count + 1) * 2 > cache->capacity) {
+      __OSCCache grown;
+      if (!__OSCCacheInit(osc->allocator, &grown, cache->capacity))
+        return NULL;
+      CFIndex mask = grown.capacity - 1;
+      CFIndex *moved = CFAllocatorAllocate(osc->allocator, sizeof(CFIndex) * cache->capacity, 0);
+      if (!moved) {
+        CFAllocatorDeallocate(osc->allocator, grown.slots);
+        return NULL;
+      }
+      for (CFIndex i = 0; i < cache->capacity; i++) {
+        if (cache->slots[i].handle != kOSCAddressHandleInvalid) {
+          CFIndex j = cache->slots[i].hash & mask;
+          while (grown.slots[j].handle != kOSCAddressHandleInvalid)
+            j = (j + 1) & mask;
+          grown.slots[j] = cache->slots[i];
+          moved[i] = j;
+        }
+      }
+      for (CFIndex i = cache->dirtyHead; i >= 0; i = cache->slots[i].next) {
+        CFIndex j = moved[i];
+        grown.slots[j].next = -1;
+        if (grown.dirtyTail >= 0)
+          grown.slots[grown.dirtyTail].next = j;
+        else
+          grown.dirtyHead = j;
+        grown.dirtyTail = j;
+      }
+      grown.count = cache->count;
+      grown.dirtyCount = cache->dirtyCount;
+      grown.order = cache->order;
+      grown.orderCapacity = cache->orderCapacity;
+      grown.keepAliveTime = cache->keepAliveTime;
+      grown.schedule = cache->schedule;
+      CFAllocatorDeallocate(osc->allocator, moved);
+      CFAllocatorDeallocate(osc->allocator, cache->slots);
+      *cache = grown;
+    }
+    CFIndex mask = cache->capacity - 1;
+    CFIndex i = address->hash & mask;
+    while (cache->slots[i].handle != kOSCAddressHandleInvalid)
+      i = (i + 1) & mask;
+    slot = &cache->slots[i];
+    slot->handle = handle;
+    slot->hash = address->hash;
+    slot->next = -1;
+    slot->dirty = false;
+    slot->value.type = 0;
+    slot->filter = -1;
+    slot->filterGeneration = 0;
+    slot->sent.type = 0;
+    slot->sentTime = 0;
+    slot->rateClass = -1;
+    slot->rateClassGeneration = 0;
+    cache->count++;
+  }
+  return slot;
+}
+
+// Replace slot value, s and b values are retained. Slot is appended to the
+// dirty list unless it's already there or the value is suppressed by its
+// filter. Dirty slot is kept dirty, the filter is checked again when sending.
+// Returns true if the value replaced one which hasn't been sent yet.
+inline bool __OSCCacheSetValue(OSCRef osc, __OSCCache *cache, __OSCCacheSlot *slot, const OSCValue *value) {
+  bool coalesced = slot->dirty;
+  if (value->type == 's' || value->type == 'b')
+    CFRetain(value->value.object);
+  __OSCValueRelease(&slot->value);
+  slot->value = *value;
+  if (!slot->dirty) {
+    if (osc->filters.count > 0 && __OSCFilterSuppresses(__OSCCacheGetFilter(osc, slot), &slot->sent, value))
+      __atomic_fetch_add(&osc->metrics.filteredCount, 1, __ATOMIC_RELAXED);
+    else
+      __OSCCacheMarkDirty(cache, slot);
+  }
+  return coalesced;
+}
+
+inline void __OSCCacheMarkDirty(__OSCCache *cache, __OSCCacheSlot *slot) {
+  if (!slot->dirty) {
+    CFIndex i = slot - cache->slots;
+    slot->dirty = true;
+    slot->next = -1;
+    cache->dirtyCount++;
+    if (cache->dirtyTail >= 0)
+      cache->slots[cache->dirtyTail].next = i;
+    else
+      cache->dirtyHead = i;
+    cache->dirtyTail = i;
+  }
+}
+
+// Filter rule of the slot, resolved again after rules have changed.
+inline const OSCFilter *__OSCCacheGetFilter(OSCRef osc, __OSCCacheSlot *slot) {
+  if (slot->filterGeneration != osc->filters.generation) {
+    slot->filter = __OSCFiltersResolve(osc, OSCAddressesGetAddress(osc, slot->handle));
+    slot->filterGeneration = osc->filters.generation;
+  }
+  return slot->filter >= 0 ? &osc->filters.rules[slot->filter].filter : NULL;
+}
+
+// True if value doesn't have to be sent because it's within the deadband of
+// the last sent value.
+inline bool __OSCFilterSuppresses(const OSCFilter *filter, const OSCValue *sent, const OSCValue *value) {
+  bool result = false;
+  if (filter && sent->type == value->type) {
+    switch (value->type) {
+      case 'f':
+      case 'i': {
+        Float64 a = value->type == 'f' ? value->value.f : value->value.i;
+        Float64 b = sent->type == 'f' ? sent->value.f : sent->value.i;
+        Float64 delta = fabs(a - b);
+        result = delta <= filter->absoluteEpsilon || delta <= filter->relativeEpsilon * fabs(b);
+        break;
+      }
+      case 'T':
+      case 'F':
+        result = true;
+        break;
+      case 's':
+      case 'b':
+        result = CFEqual(value->value.object, sent->value.object);
+        break;
+    }
+  }
+  return result;
+}
+
+// Rate class of the slot, resolved again after classes have changed.
+inline const __OSCRateClass *__OSCCacheGetRateClass(OSCRef osc, __OSCCacheSlot *slot) {
+  if (slot->rateClassGeneration != osc->rateClasses.generation) {
+    slot->rateClass = __OSCRateClassesResolve(osc, OSCAddressesGetAddress(osc, slot->handle));
+    slot->rateClassGeneration = osc->rateClasses.generation;
+  }
+  return slot->rateClass >= 0 ? &osc->rateClasses.classes[slot->rateClass] : NULL;
+}
+
+// Mark filtered values which haven't been sent for their keep alive
+// interval as changed. Runs once the earliest keep alive is due, not on
+// every tick.
+inline void __OSCCacheKeepAlive(OSCRef osc, __OSCCache *cache, CFAbsoluteTime now) {
+  if (cache->keepAliveTime > 0 && now >= cache->keepAliveTime) {
+    cache->keepAliveTime = 0;
+    for (CFIndex i = 0; i < cache->capacity; i++) {
+      __OSCCacheSlot *slot = &cache->slots[i];
+      if (slot->handle != kOSCAddressHandleInvalid && slot->sent.type) {
+        const OSCFilter *filter = __OSCCacheGetFilter(osc, slot);
+        if (filter && filter->keepAlive > 0) {
+          CFAbsoluteTime time = slot->sentTime + filter->keepAlive;
+          if (time <= now)
+            __OSCCacheMarkDirty(cache, slot);
+          else if (cache->keepAliveTime == 0 || time < cache->keepAliveTime)
+            cache->keepAliveTime = time;
+        }
+      }
+    }
+  }
+}
+
+// Check dirty value of a filtered slot once more before it's sent. Returns
+// true for value within deadband of the last sent value, unless its keep
+// alive is due.
+inline bool __OSCCacheIsFiltered(OSCRef osc, __OSCCacheSlot *slot, CFAbsoluteTime now) {
+  bool result = false;
+  const OSCFilter *filter = __OSCCacheGetFilter(osc, slot);
+  if (filter) {
+    bool keepAlive = filter->keepAlive > 0 && slot->sent.type && now - slot->sentTime >= filter->keepAlive;
+    if (!keepAlive && __OSCFilterSuppresses(filter, &slot->sent, &slot->value)) {
+      __atomic_fetch_add(&osc->metrics.filteredCount, 1, __ATOMIC_RELAXED);
+      result = true;
+    }
+  }
+  return result;
+}
+
+// Remember value of a filtered slot as the last sent one.
+inline void __OSCCacheSetSent(OSCRef osc, __OSCCache *cache, __OSCCacheSlot *slot, CFAbsoluteTime now) {
+  const OSCFilter *filter = __OSCCacheGetFilter(osc, slot);
+  if (filter) {
+    if (slot->value.type == 's' || slot->value.type == 'b')
+      CFRetain(slot->value.value.object);
+    __OSCValueRelease(&slot->sent);
+    slot->sent = slot->value;
+    slot->sentTime = now;
+    if (filter->keepAlive > 0 && (cache->keepAliveTime == 0 || now + filter->keepAlive < cache->keepAliveTime))
+      cache->keepAliveTime = now + filter->keepAlive;
+  }
+}
+
+// Slot waiting for its rate class or send budget stays in the dirty list.
+inline void __OSCCacheKeepDirty(__OSCCache *cache, CFIndex i, CFIndex *head, CFIndex *tail) {
+  cache->slots[i].dirty = true;
+  cache->slots[i].next = -1;
+  if (*tail >= 0)
+    cache->slots[*tail].next = i;
+  else
+    *head = i;
+  *tail = i;
+}
+
+inline int __OSCCacheOrderCompare(const void *a, const void *b) {
+  const __OSCCacheOrder *a_ = a, *b_ = b;
+  if (a_->priority != b_->priority)
+    return a_->priority > b_->priority ? -1 : 1;
+  if (a_->prefixHash != b_->prefixHash)
+    return a_->prefixHash < b_->prefixHash ? -1 : 1;
+  return a_->position < b_->position ? -1 : (a_->position > b_->position);
+}
+
+// Send bundle of ordered values first...last and remember them as sent.
+inline void __OSCCacheSendBundle(OSCRef osc, __OSCCache *cache, OSCWriterRef writer, bool now, CFIndex first, CFIndex last, CFAbsoluteTime time) {
+  OSCWriterEndBundle(writer);
+  __OSCMetricsAdd(osc->metrics.bundlesCount, 1);
+  if (osc->filters.count > 0)
+    for (CFIndex e = first; e <= last; e++)
+      if (cache->order[e].slot >= 0)
+        __OSCCacheSetSent(osc, cache, &cache->slots[cache->order[e].slot], time);
+  if (now) {
+    if (__OSCCanSend(osc)) {
+      if (osc->capture) {
+        struct iovec iov = { (void *)OSCWriterGetBytePtr(writer), OSCWriterGetLength(writer) };
+        __OSCCaptureAppend(osc, &iov, 1);
+      }
+      __OSCSendRawBufferNow(osc, OSCWriterGetBytePtr(writer), OSCWriterGetLength(writer));
+    }
+  } else
+    OSCSendRawBufferWithWriter(osc, writer);
+}
+
+// Send all changed values and clear the dirty list. Messages are packed into
+// bundles of at most maximumDatagramSize bytes, with prefix packing policy
+// messages are grouped by container and a group which doesn't fit the rest
+// of the current bundle starts a new one. Only a group larger than a whole
+// bundle is split. Values of rate classes which aren't due yet stay in the
+// dirty list, higher priority classes are packed first and values past the
+// send budget wait for the next pass. Value which can't be encoded is
+// dropped and counted. Returns number of sent bundles, or -1 if values
+// couldn't be ordered and all of them have been left dirty.
+inline CFIndex __OSCCacheSendDirty(OSCRef osc, __OSCCache *cache, OSCWriterRef writer, bool now) {
+  CFIndex count = 0;
+  
+  // Socket is backed up - keep coalescing values in the cache
+  if (osc->queue.policy == kOSCOverflowPolicyCoalesce && osc->queue.count > 0 && __OSCSendQueueDrain(osc) > 0)
+    return count;
+  
+  CFAbsoluteTime time = osc->filters.count > 0 || osc->rateClasses.count > 0 ? CFAbsoluteTimeGetCurrent() : 0;
+  if (osc->filters.count > 0)
+    __OSCCacheKeepAlive(osc, cache, time);
+  
+  // Values can't be ordered - keep them dirty for the next pass
+  if (cache->dirtyCount > cache->orderCapacity) {
+    __OSCCacheOrder *order = CFAllocatorReallocate(osc->allocator, cache->order, sizeof(__OSCCacheOrder) * cache->dirtyCount, 0);
+    if (!order)
+      return -1;
+    cache->order = order;
+    cache->orderCapacity = cache->dirtyCount;
+  }
+  __OSCRateClassesBeginPass(osc, cache->schedule, time);
+  
+  if (cache->dirtyHead >= 0) {
+    CFIndex head = -1, tail = -1, kept = 0;
+    CFIndex n = 0;
+    for (CFIndex i = cache->dirtyHead, next; i >= 0; i = next) {
+      __OSCCacheSlot *slot = &cache->slots[i];
+      const __OSCRateClass *rateClass = osc->rateClasses.count > 0 ? __OSCCacheGetRateClass(osc, slot) : NULL;
+      next = slot->next;
+      if (rateClass && !rateClass->due[cache->schedule]) {
+        __OSCCacheKeepDirty(cache, i, &head, &tail);
+        kept++;
+        continue;
+      }
+      slot->dirty = false;
+      if (osc->filters.count > 0 && __OSCCacheIsFiltered(osc, slot, time))
+        continue;
+      if (rateClass)
+        osc->rateClasses.classes[slot->rateClass].sent[cache->schedule] = true;
+      cache->order[n].priority = rateClass ? rateClass->priority : 0;
+      cache->order[n].prefixHash = 0;
+      if (osc->packingPolicy == kOSCPackingPolicyPrefix) {
+        const OSCAddress *address = OSCAddressesGetAddress(osc, slot->handle);
+        CFIndex slash = 0;
+        for (CFIndex j = 0; j < address->length && address->buffer[j]; j++)
+          if (address->buffer[j] == '/')
+            slash = j;
+        cache->order[n].prefixHash = __OSCHash(address->buffer, slash);
+      }
+      cache->order[n].position = n;
+      cache->order[n].slot = i;
+      n++;
+    }
+    if (osc->packingPolicy == kOSCPackingPolicyPrefix || osc->rateClasses.count > 0)
+      qsort(cache->order, n, sizeof(__OSCCacheOrder), __OSCCacheOrderCompare);
+    
+    OSCTimeTag timeTag = osc->latency > 0 ? OSCTimeTagMakeWithTimeIntervalSinceNow(osc->latency) : kOSCTimeTagImmediately;
+    UInt64 start = __OSCMetricsGetTime(osc);
+    CFIndex budget = osc->sendBudget;
+    CFIndex sent = 0, first = 0, e = 0, dropped = 0;
+    OSCWriterReset(writer);
+    OSCWriterBeginBundle(writer, timeTag);
+    CFIndex header = OSCWriterGetLength(writer);
+    CFIndex groupOffset = header;
+    for (; e < n; e++) {
+      if (e == 0 || cache->order[e].prefixHash != cache->order[e - 1].prefixHash || cache->order[e].priority != cache->order[e - 1].priority)
+        groupOffset = OSCWriterGetLength(writer);
+      if (cache->order[e].slot < 0)
+        continue;
+      CFIndex offset = OSCWriterGetLength(writer);
+      __OSCCacheSlot *slot = &cache->slots[cache->order[e].slot];
+      const OSCAddress *address = OSCAddressesGetAddress(osc, slot->handle);
+      
+      // Can't be encoded - drop it rather than retry it on every pass
+      if (!OSCWriterAppendValueWithAddress(writer, address, &slot->value)) {
+        __OSCMetricsAdd(osc->metrics.droppedCount, 1);
+        __OSCDiagnostic(osc, kOSCResultNotAllocatedError, 0, "can't encode value of %s", (const char *)address->buffer);
+        cache->order[e].slot = -1;
+        dropped++;
+        continue;
+      }
+      
+      // Over budget - the rest waits for the next pass, at least one value
+      // is always sent so large values can't get stuck.
+      if (budget > 0 && sent + OSCWriterGetLength(writer) > budget && (sent > 0 || offset > header)) {
+        writer->length = offset;
+        break;
+      }
+      if (OSCWriterGetLength(writer) > osc->maximumDatagramSize && offset > header) {
+        
+        // Doesn't fit - move the whole group to the next bundle if there is
+        // something else before it, otherwise split the group here.
+        bool group = osc->packingPolicy == kOSCPackingPolicyPrefix && groupOffset > header;
+        writer->length = group ? groupOffset : offset;
+        if (group)
+          while (e > 0 && cache->order[e].prefixHash == cache->order[e - 1].prefixHash && cache->order[e].priority == cache->order[e - 1].priority)
+            e--;
+        if (start)
+          __OSCMetricsRecordTime(osc->metrics.encodeTimes, start);
+        sent += OSCWriterGetLength(writer);
+        __OSCCacheSendBundle(osc, cache, writer, now, first, e - 1, time);
+        start = __OSCMetricsGetTime(osc);
+        count++;
+        first = e;
+        OSCWriterReset(writer);
+        OSCWriterBeginBundle(writer, timeTag);
+        e--;
+      }
+    }
+    if (OSCWriterGetLength(writer) > header) {
+      if (start)
+        __OSCMetricsRecordTime(osc->metrics.encodeTimes, start);
+      __OSCCacheSendBundle(osc, cache, writer, now, first, e - 1, time);
+      count++;
+    }
+    for (CFIndex k = e; k < n; k++) {
+      if (cache->order[k].slot < 0) {
+        dropped--;
+        continue;
+      }
+      __OSCCacheKeepDirty(cache, cache->order[k].slot, &head, &tail);
+      kept++;
+    }
+    __OSCMetricsAdd(osc->metrics.messagesCount, e - dropped);
+    cache->dirtyHead = head;
+    cache->dirtyTail = tail;
+    cache->dirtyCount = kept;
+  }
+  __OSCRateClassesEndPass(osc, cache->schedule, time);
+  return count;
+}
+
+// Message with n arguments of the same type - f and i for 32 bit, d and h
+// for 64 bit values. Message is reserved with its exact size up front and
+// values are byte swapped straight into it.
+inline bool OSCWriterAppendArrayWithAddress(OSCWriterRef writer, const OSCAddress *address, char type, const void *values, CFIndex n) {
+  bool result = false;
+  if (writer && address && (values || n == 0) && n >= 0 && (type == 'f' || type == 'i' || type == 'd' || type == 'h')) {
+    CFIndex size = type == 'd' || type == 'h' ? 8 : 4;
+    CFIndex length = writer->length;
+    CFIndex offset = __OSCWriterBeginElement(writer);
+    UInt8 *bytes;
+    if (offset != -2 && (bytes = __OSCWriterReserve(writer, address->length + __OSCGet32BitAlignedLength(n + 2) + n * size))) {
+      memcpy(bytes, address->buffer, address->length);
+      bytes += address->length;
+      bytes += __OSCEncodeTypeTags(bytes, type, n);
+      if (size == 8)
+        __OSCEncodeSwapped64(bytes, values, n);
+      else
+        __OSCEncodeSwapped32(bytes, values, n);
+      __OSCWriterEndElement(writer, offset);
+      result = true;
+    } else {
+      writer->length = length;
+    }
+  }
+  return result;
+}
+
+#pragma mark Array encoders
+
+// Big endian copy of n 32 bit values, source doesn't have to be aligned.
+// Shuffles 8 values at a time with AVX2, 4 with SSSE3 or NEON.
+inline void __OSCEncodeSwapped32(UInt8 *destination, const void *source, CFIndex n) {
+  const UInt8 *source_ = source;
+  CFIndex i = 0;
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  memcpy(destination, source_, n * 4);
+  i = n;
+#else
+#if defined(__AVX2__)
+  const __m256i mask256 = _mm256_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12, 3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+  for (; i + 8 <= n; i += 8)
+    _mm256_storeu_si256((__m256i *)(destination + i * 4), _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i *)(source_ + i * 4)), mask256));
+#endif
+#if defined(__SSSE3__)
+  const __m128i mask = _mm_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+  for (; i + 4 <= n; i += 4)
+    _mm_storeu_si128((__m128i *)(destination + i * 4), _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(source_ + i * 4)), mask));
+#elif defined(__ARM_NEON)
+  for (; i + 4 <= n; i += 4)
+    vst1q_u8(destination + i * 4, vrev32q_u8(vld1q_u8(source_ + i * 4)));
+#endif
+#endif
+  for (; i < n; i++) {
+    UInt32 value;
+    memcpy(&value, source_ + i * 4, 4);
+    value = CFSwapInt32HostToBig(value);
+    memcpy(destination + i * 4, &value, 4);
+  }
+}
+
+// Big endian copy of n 64 bit values.
+inline void __OSCEncodeSwapped64(UInt8 *destination, const void *source, CFIndex n) {
+  const UInt8 *source_ = source;
+  CFIndex i = 0;
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  memcpy(destination, source_, n * 8);
+  i = n;
+#else
+#if defined(__AVX2__)
+  const __m256i mask256 = _mm256_setr_epi8(7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8);
+  for (; i + 4 <= n; i += 4)
+    _mm256_storeu_si256((__m256i *)(destination + i * 8), _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i *)(source_ + i * 8)), mask256));
+#endif
+#if defined(__SSSE3__)
+  const __m128i mask = _mm_setr_epi8(7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8);
+  for (; i + 2 <= n; i += 2)
+    _mm_storeu_si128((__m128i *)(destination + i * 8), _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(source_ + i * 8)), mask));
+#elif defined(__ARM_NEON)
+  for (; i + 2 <= n; i += 2)
+    vst1q_u8(destination + i * 8, vrev64q_u8(vld1q_u8(source_ + i * 8)));
+#endif
+#endif
+  for (; i < n; i++) {
+    UInt64 value;
+    memcpy(&value, source_ + i * 8, 8);
+    value = CFSwapInt64HostToBig(value);
+    memcpy(destination + i * 8, &value, 8);
+  }
+}
+
+// Type tag string of n same type arguments, including zero padding. Returns
+// written length.
+inline CFIndex __OSCEncodeTypeTags(UInt8 *destination, char type, CFIndex n) {
+  CFIndex length = __OSCGet32BitAlignedLength(n + 2);
+  destination[0] = ',';
+  memset(destination + 1, type, n);
+  memset(destination + 1 + n, 0, length - n - 1);
+  return length;
+}
+
+#pragma mark Argument lists
+
+// Encode message with arguments described by type tags (without leading
+// ',') into buffer in a single pass. Values are consumed in order by tags
+// which take a value. Returns kOSCResultTooLongError if the message doesn't
+// fit capacity and kOSCResultMalformedPacketError for unknown type tags,
+// missing strings or unbalanced array brackets.
+inline OSCResult OSCEncodeMessage(void *buffer, CFIndex capacity, const OSCAddress *address, const char *typeTags, const OSCArgumentValue *values, CFIndex *length) {
+  OSCResult result = kOSCResultNotAllocatedError;
+  if (buffer && address && typeTags && length) {
+    UInt8 *bytes = buffer;
+    const OSCArgumentValue *value = values;
+    CFIndex n = strlen(typeTags);
+    CFIndex i = address->length + __OSCGet32BitAlignedLength(n + 2);
+    CFIndex depth = 0;
+    CFIndex stringLength = 0;
+    result = kOSCResultSuccess;
+    if (i <= capacity) {
+      memcpy(bytes, address->buffer, address->length);
+      bytes[address->length] = ',';
+      memcpy(bytes + address->length + 1, typeTags, n);
+      memset(bytes + address->length + 1 + n, 0, i - address->length - n - 1);
+    } else {
+      result = kOSCResultTooLongError;
+    }
+    for (CFIndex j = 0; j < n && result == kOSCResultSuccess; j++) {
+      CFIndex size = 0;
+      char type = typeTags[j];
+      switch (type) {
+        case 'i': case 'f': case 'c': case 'r': case 'm':
+          size = 4;
+          break;
+        case 'h': case 'd': case 't':
+          size = 8;
+          break;
+        case 's': case 'S':
+          size = value && value->s ? __OSCGet32BitAlignedLength((stringLength = strlen(value->s)) + 1) : -1;
+          break;
+        case 'b':
+          size = value && value->b.length >= 0 && value->b.length <= INT32_MAX && (value->b.bytes || value->b.length == 0) ? 4 + (value->b.length + 3) / 4 * 4 : -1;
+          break;
+        case 'T': case 'F': case 'N': case 'I':
+          break;
+        case '[':
+          depth++;
+          break;
+        case ']':
+          size = depth-- > 0 ? 0 : -1;
+          break;
+        default:
+          size = -1;
+          break;
+      }
+      if (size > 0 && !value)
+        size = -1;
+      if (size < 0) {
+        result = kOSCResultMalformedPacketError;
+      } else if (i + size > capacity) {
+        result = kOSCResultTooLongError;
+      } else if (size > 0) {
+        UInt8 *b = bytes + i;
+        switch (type) {
+          case 'i': case 'f': case 'r':
+            __OSCEncodeSwapped32(b, &value->i, 1);
+            break;
+          case 'c': {
+            SInt32 c = (UInt8)value->c;
+            __OSCEncodeSwapped32(b, &c, 1);
+            break;
+          }
+          case 'm':
+            memcpy(b, value->m, 4);
+            break;
+          case 'h': case 'd': case 't':
+            __OSCEncodeSwapped64(b, &value->h, 1);
+            break;
+          case 's': case 'S':
+            memset(b + size - 4, 0, 4);
+            memcpy(b, value->s, stringLength);
+            break;
+          case 'b': {
+            SInt32 blobLength = (SInt32)value->b.length;
+            __OSCEncodeSwapped32(b, &blobLength, 1);
+            if (size > 4)
+              memset(b + size - 4, 0, 4);
+            if (blobLength > 0)
+              memcpy(b + 4, value->b.bytes, blobLength);
+            break;
+          }
+        }
+        value++;
+        i += size;
+      }
+    }
+    if (result == kOSCResultSuccess && depth != 0)
+      result = kOSCResultMalformedPacketError;
+    if (result == kOSCResultSuccess)
+      *length = i;
+  }
+  return result;
+}
+
+#pragma mark OSC API
+
+// Send values which have changed since the last execution, encoded straight
+// into the reused writer.
+inline void __OSCRunLoopTimerCallBack(CFRunLoopTimerRef timer, void *info) {
+  OSCRef osc = info;
+  if (osc) {
+    pthread_mutex_lock(&osc->sendLock);
+    if (osc->writer)
+      __OSCCacheSendDirty(osc, &osc->cache, osc->writer, false);
+    OSCFlush(osc);
+    
+    // With rate classes wake up when the next class is due
+    if (timer && osc->rateClasses.count > 0)
+      CFRunLoopTimerSetNextFireDate(timer, __OSCRateClassesGetNextTime(osc, CFAbsoluteTimeGetCurrent()));
+    pthread_mutex_unlock(&osc->sendLock);
+  }
+}
+
+inline OSCRef OSCCreateWithUserInfo(CFAllocatorRef allocator, void *userInfo) {
+  OSCRef osc = CFAllocatorAllocate(allocator, sizeof(OSC), 0);
+  if (osc) {
+    osc->allocator = allocator ? CFRetain(allocator) : NULL;
+    osc->retainCount = 1;
+    osc->userInfo = userInfo;
+    osc->runLoopTimer = NULL;
+    osc->sockfd = 0;
+    osc->p = NULL;
+    osc->servinfo = NULL;
+    memset(osc->addresses, 0, sizeof(osc->addresses));
+    osc->addressesCount = 0;
+    osc->addressHandles = CFDictionaryCreateMutable(osc->allocator, 0, &kCFTypeDictionaryKeyCallBacks, &kCFTypeDictionaryValueCallBacks);
+    osc->methods = NULL;
+    osc->methodsTable = NULL;
+    osc->methodsTableCapacity = 0;
+    osc->methodsCount = 0;
+    osc->messageCallBack = NULL;
+    osc->messageCallBackInfo = NULL;
+    osc->scheduler = NULL;
+    osc->latency = 0;
+    osc->sender = NULL;
+    osc->pushersCount = 0;
+    osc->receiveServer = NULL;
+    osc->maximumDatagramSize = OSC_DEFAULT_DATAGRAM_SIZE;
+    osc->packingPolicy = kOSCPackingPolicySequential;
+    memset(&osc->filters, 0, sizeof(__OSCFilters));
+    memset(&osc->rateClasses, 0, sizeof(__OSCRateClasses));
+    osc->runLoopTimerInterval = 0;
+    osc->sendBudget = 0;
+    osc->writer = OSCWriterCreate(osc->allocator, 0);
+    memset(&osc->batch, 0, sizeof(__OSCBatch));
+    memset(&osc->queue, 0, sizeof(__OSCSendQueue));
+    __OSCDestinationsInit(&osc->destinations);
+    memset(&osc->stream, 0, sizeof(__OSCStream));
+    osc->stream.frameLength = -1;
+    osc->capture = NULL;
+    osc->transport = kOSCTransportSocket;
+    osc->uring = NULL;
+    __OSCResolverInit(&osc->resolver);
+    memset(&osc->peerInfo, 0, sizeof(osc->peerInfo));
+    osc->connectedDatagrams = false;
+    osc->peerConnected = false;
+    memset(&osc->metrics, 0, sizeof(OSCMetrics));
+    osc->metricsTiming = false;
+    osc->diagnosticCallBack = NULL;
+    osc->diagnosticCallBackInfo = NULL;
+    __OSCCacheInit(osc->allocator, &osc->cache, 0);
+    pthread_mutexattr_t attributes;
+    pthread_mutexattr_init(&attributes);
+    pthread_mutexattr_settype(&attributes, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&osc->sendLock, &attributes);
+    pthread_mutexattr_destroy(&attributes);
+  }
+  return osc;
+}
+
+inline OSCRef OSCRetain(OSCRef osc) {
+  if (osc)
+    osc->retainCount++;
+  return osc;
+}
+
+inline OSCRef OSCRelease(OSCRef osc) {
+  if (osc) {
+    if (--osc->retainCount == 0) {
+      CFAllocatorRef allocator = osc->allocator;
+      
+      OSCDeactivateRunLoopTimer(osc);
+      OSCStopReceiveServer(osc);
+      OSCDeactivateScheduler(osc);
+      OSCStopSenderThread(osc);
+      __OSCResolverDestroy(osc);
+      
+      OSCFlush(osc);
+      OSCStopCapture(osc);
+      __OSCBatchDestroy(osc);
+      __OSCSendQueueDestroy(osc);
+      __OSCStreamDestroy(osc);
+      __OSCDestinationsDestroy(osc);
+      __OSCUringSenderDestroy(osc);
+      
+      if (osc->writer)
+        OSCWriterRelease(osc->writer);
+      
+      __OSCCacheDestroy(allocator, &osc->cache);
+      if (osc->filters.rules)
+        CFAllocatorDeallocate(allocator, osc->filters.rules);
+      if (osc->rateClasses.classes)
+        CFAllocatorDeallocate(allocator, osc->rateClasses.classes);
+      
+      for (CFIndex i = 0; i < osc->addressesCount; i++)
+        CFRelease(osc->addresses[i / OSC_ADDRESSES_LENGTH][i % OSC_ADDRESSES_LENGTH].name);
+      for (CFIndex i = 0; i < OSC_ADDRESSES_CHUNKS_LENGTH && osc->addresses[i]; i++)
+        CFAllocatorDeallocate(allocator, osc->addresses[i]);
+      
+      if (osc->addressHandles)
+        CFRelease(osc->addressHandles);
+      
+      if (osc->methods)
+        __OSCMethodNodeDestroy(allocator, osc->methods);
+      
+      if (osc->methodsTable)
+        CFAllocatorDeallocate(allocator, osc->methodsTable);
+      
+      if (osc->servinfo)
+        freeaddrinfo(osc->servinfo);
+      
+      if (osc->sockfd)
+        close(osc->sockfd);
+      
+      pthread_mutex_destroy(&osc->sendLock);
+      CFAllocatorDeallocate(allocator, osc);
+      osc = NULL;
+      
+      if (allocator)
+        CFRelease(allocator);
+    }
+  }
+  return osc;
+}
+
+// Address passed to send calls, NULL once the socket is connected.
+inline const struct sockaddr *__OSCGetPeerAddress(OSCRef osc) {
+  return osc->peerConnected ? NULL : osc->p->ai_addr;
+}
+
+inline socklen_t __OSCGetPeerAddressLength(OSCRef osc) {
+  return osc->peerConnected ? 0 : osc->p->ai_addrlen;
+}
+
+// connect() datagram socket to the peer, or dissolve the association.
+inline void __OSCPeerSetConnected(OSCRef osc, bool connected) {
+  if (connected) {
+    osc->peerConnected = connect(osc->sockfd, osc->p->ai_addr, osc->p->ai_addrlen) == 0;
+    if (!osc->peerConnected)
+      __OSCDiagnostic(osc, -1, errno, "can't connect datagram socket, %s", strerror(errno));
+  } else if (osc->peerConnected) {
+    struct sockaddr unspecified;
+    memset(&unspecified, 0, sizeof(unspecified));
+    unspecified.sa_family = AF_UNSPEC;
+    connect(osc->sockfd, &unspecified, sizeof(unspecified));
+    osc->peerConnected = false;
+  }
+}
+
+// Send datagrams to address. Socket is reused if it has the same family.
+// Batched packets are flushed to the previous peer first.
+inline OSCResult __OSCConnectAddress(OSCRef osc, const __OSCDestination *address) {
+  OSCResult result = kOSCResultSuccess;
+  if (osc->batch.count > 0)
+    __OSCBatchFlush(osc);
+  __OSCUringDrain(osc);
+  if (osc->sockfd && (osc->stream.framing != kOSCFramingNone || !osc->p || osc->p->ai_family != address->address.ss_family))
+    __OSCDisconnectSocket(osc);
+  if (!osc->sockfd) {
+    int sockfd = socket(address->address.ss_family, SOCK_DGRAM, 0);
+    if (sockfd == -1) {
+      result = -1;
+      __OSCDiagnostic(osc, result, errno, "can't create socket, %s", strerror(errno));
+      return result;
+    }
+    osc->sockfd = sockfd;
+  }
+  if (osc->servinfo) {
+    freeaddrinfo(osc->servinfo);
+    osc->servinfo = NULL;
+  }
+  memcpy(&osc->peerAddress, &address->address, address->length);
+  memset(&osc->peerInfo, 0, sizeof(osc->peerInfo));
+  osc->peerInfo.ai_family = address->address.ss_family;
+  osc->peerInfo.ai_socktype = SOCK_DGRAM;
+  osc->peerInfo.ai_protocol = IPPROTO_UDP;
+  osc->peerInfo.ai_addrlen = address->length;
+  osc->peerInfo.ai_addr = (struct sockaddr *)&osc->peerAddress;
+  osc->p = &osc->peerInfo;
+  if (osc->connectedDatagrams || osc->peerConnected || osc->uring) {
+    osc->peerConnected = false;
+    __OSCPeerSetConnected(osc, osc->connectedDatagrams || osc->uring);
+  }
+  __OSCUringSetSocket(osc);
+  return result;
+}
+
+// Close connection socket. Queued packets are dropped.
+inline void __OSCDisconnectSocket(OSCRef osc) {
+  __OSCUringDrain(osc);
+  __OSCMetricsAdd(osc->metrics.droppedCount, osc->queue.count);
+  osc->queue.head = 0;
+  osc->queue.count = 0;
+  if (osc->stream.framing != kOSCFramingNone) {
+    __OSCStreamDestroy(osc);
+    osc->stream.framing = kOSCFramingNone;
+  }
+  if (osc->servinfo)
+    freeaddrinfo(osc->servinfo);
+  if (osc->sockfd)
+    close(osc->sockfd);
+  osc->servinfo = NULL;
+  osc->sockfd = 0;
+  osc->p = NULL;
+  osc->peerConnected = false;
+  __OSCUringSetSocket(osc);
+}
+
+// Resolve host, reusing cached address, and send datagrams to it. Blocks
+// on cache miss, see OSCConnectAsync. Returns NULL on failure.
+inline struct addrinfo *OSCConnect(OSCRef osc, CFStringRef host, UInt16 port) {
+  struct addrinfo *result = NULL;
+  char hostBuffer[OSC_RESOLVER_HOST_LENGTH];
+  if (osc && host && CFStringGetCString(host, hostBuffer, sizeof(hostBuffer), kCFStringEncodingUTF8)) {
+    __OSCDestination address;
+    __OSCResolverSetTarget(osc, hostBuffer, port, false);
+    if (__OSCResolverResolve(osc, hostBuffer, port, &address) == kOSCResultSuccess) {
+      pthread_mutex_lock(&osc->sendLock);
+      if (__OSCConnectAddress(osc, &address) == kOSCResultSuccess)
+        result = osc->p;
+      pthread_mutex_unlock(&osc->sendLock);
+    }
+  }
+  return result;
+}
+
+// Connect without waiting for DNS. With cached address it connects right
+// away, otherwise the host is resolved on the resolver thread and returns
+// kOSCResultQueued. Packets sent before the address is resolved are
+// dropped. The host is resolved again whenever its cache entry expires and
+// the connection follows address changes.
+inline OSCResult OSCConnectAsync(OSCRef osc, CFStringRef host, UInt16 port) {
+  OSCResult result = kOSCResultNotAllocatedError;
+  char hostBuffer[OSC_RESOLVER_HOST_LENGTH];
+  if (osc && host && CFStringGetCString(host, hostBuffer, sizeof(hostBuffer), kCFStringEncodingUTF8)) {
+    __OSCDestination address;
+    pthread_mutex_lock(&osc->sendLock);
+    if (__OSCResolverFind(&osc->resolver, hostBuffer, port, &address)) {
+      __OSCResolverSetTarget(osc, hostBuffer, port, false);
+      result = __OSCConnectAddress(osc, &address);
+    } else {
+      __OSCDisconnectSocket(osc);
+      __OSCResolverSetTarget(osc, hostBuffer, port, true);
+      result = __OSCResolverStart(osc) ? kOSCResultQueued : kOSCResultNotAllocatedError;
+    }
+    pthread_mutex_unlock(&osc->sendLock);
+  }
+  return result;
+}
+
+// Drop cached address of the connection target, eg. after network change,
+// and connect to it again without waiting for DNS.
+inline OSCResult OSCReconnect(OSCRef osc) {
+  OSCResult result = kOSCResultNotAllocatedError;
+  if (osc) {
+    __OSCResolver *resolver = &osc->resolver;
+    char host[OSC_RESOLVER_HOST_LENGTH];
+    pthread_mutex_lock(&resolver->lock);
+    memcpy(host, resolver->target.host, sizeof(host));
+    UInt16 port = resolver->target.port;
+    pthread_mutex_unlock(&resolver->lock);
+    result = kOSCResultInvalidAddressError;
+    if (host[0]) {
+      pthread_mutex_lock(&osc->sendLock);
+      OSCFlush(osc);
+      __OSCDisconnectSocket(osc);
+      OSCFlushResolverCache(osc);
+      __OSCResolverSetTarget(osc, host, port, true);
+      result = __OSCResolverStart(osc) ? kOSCResultQueued : kOSCResultNotAllocatedError;
+      pthread_mutex_unlock(&osc->sendLock);
+    }
+  }
+  return result;
+}
+
+// Send pending packets and close connection socket. Destinations stay.
+inline void OSCDisconnect(OSCRef osc) {
+  if (osc) {
+    pthread_mutex_lock(&osc->sendLock);
+    OSCFlush(osc);
+    __OSCResolverSetTarget(osc, "", 0, false);
+    __OSCDisconnectSocket(osc);
+    pthread_mutex_unlock(&osc->sendLock);
+  }
+}
+
+// connect() datagram socket to its peer, so sends don't carry the address
+// and kernel doesn't look up route for every packet. Once the peer has
+// reported port unreachable, next send fails with ECONNREFUSED. With
+// io_uring transport the socket stays connected.
+inline OSCResult OSCSetConnectedDatagrams(OSCRef osc, bool connected) {
+  OSCResult result = kOSCResultNotAllocatedError;
+  if (osc) {
+    pthread_mutex_lock(&osc->sendLock);
+    osc->connectedDatagrams = connected;
+    connected = connected || osc->uring;
+    result = kOSCResultSuccess;
+    if (osc->sockfd && osc->p && osc->stream.framing == kOSCFramingNone) {
+      __OSCUringDrain(osc);
+      __OSCPeerSetConnected(osc, connected);
+      __OSCUringSetSocket(osc);
+      if (osc->peerConnected != connected)
+        result = -1;
+    }
+    pthread_mutex_unlock(&osc->sendLock);
+  }
+  return result;
+}
+
+inline bool OSCGetConnectedDatagrams(OSCRef osc) {
+  return osc ? osc->connectedDatagrams : false;
+}
+
+#pragma mark Stream transport
+
+// Grow buffer to fit required more bytes after length.
+inline UInt8 *__OSCStreamReserve(OSCRef osc, UInt8 **buffer, CFIndex *capacity, CFIndex length, CFIndex required) {
+  if (length + required > *capacity) {
+    CFIndex capacity_ = *capacity ? *capacity : 4096;
+    while (capacity_ < length + required)
+      capacity_ *= 2;
+    UInt8 *buffer_ = CFAllocatorReallocate(osc->allocator, *buffer, capacity_, 0);
+    if (!buffer_)
+      return NULL;
+    *buffer = buffer_;
+    *capacity = capacity_;
+  }
+  return *buffer + length;
+}
+
+// Write all iovecs, continuing after partial writes. Modifies iov.
+inline OSCResult __OSCStreamWriteAll(int fd, struct iovec *iov, int count) {
+  OSCResult result = kOSCResultSuccess;
+  while (count > 0) {
+    ssize_t n = writev(fd, iov, count);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      result = -1;
+      break;
+    }
+    while (count > 0 && (size_t)n >= iov->iov_len) {
+      n -= iov->iov_len;
+      iov++;
+      count--;
+    }
+    if (count > 0) {
+      iov->iov_base = (UInt8 *)iov->iov_base + n;
+      iov->iov_len -= n;
+    }
+  }
+  return result;
+}
+
+// Frame packet gathered from iov. With batching enabled small packets are
+// coalesced in the output buffer and written with one writev when it's full
+// or on OSCFlush. Length prefixed packets larger than
+// OSC_STREAM_COALESCE_LENGTH, or any packet with batching disabled, are
+// written right away together with the buffered output, straight from the
+// caller's buffers. SLIP has to escape, so packets are always framed into
+// the output buffer.
+inline OSCResult __OSCStreamSend(OSCRef osc, const struct iovec *iov, int count) {
+  OSCResult result = kOSCResultNotAllocatedError;
+  __OSCStream *stream = &osc->stream;
+  bool buffered = osc->batch.capacity > 0;
+  CFIndex length = 0;
+  for (int i = 0; i < count; i++)
+    length += iov[i].iov_len;
+  if (stream->framing == kOSCFramingSLIP || (buffered && length <= OSC_STREAM_COALESCE_LENGTH)) {
+    UInt8 *bytes = __OSCStreamReserve(osc, &stream->output, &stream->outputCapacity, stream->outputLength, stream->framing == kOSCFramingSLIP ? length * 2 + 2 : length + 4);
+    if (bytes) {
+      UInt8 *start = bytes;
+      if (stream->framing == kOSCFramingSLIP) {
+        *bytes++ = OSC_SLIP_END;
+        for (int i = 0; i < count; i++) {
+          const UInt8 *source = iov[i].iov_base;
+          for (size_t j = 0; j < iov[i].iov_len; j++) {
+            if (source[j] == OSC_SLIP_END) {
+              *bytes++ = OSC_SLIP_ESC;
+              *bytes++ = OSC_SLIP_ESC_END;
+            } else if (source[j] == OSC_SLIP_ESC) {
+              *bytes++ = OSC_SLIP_ESC;
+              *bytes++ = OSC_SLIP_ESC_ESC;
+            } else {
+              *bytes++ = source[j];
+            }
+          }
+        }
+        *bytes++ = OSC_SLIP_END;
+      } else {
+        uint32_t size = CFSwapInt32HostToBig((uint32_t)length);
+        memcpy(bytes, &size, 4);
+        bytes += 4;
+        for (int i = 0; i < count; i++) {
+          memcpy(bytes, iov[i].iov_base, iov[i].iov_len);
+          bytes += iov[i].iov_len;
+        }
+      }
+      stream->outputLength += bytes - start;
+      __OSCMetricsAdd(osc->metrics.packetsCount, 1);
+      result = kOSCResultSuccess;
+      if (!buffered || stream->outputLength >= OSC_STREAM_BUFFER_LENGTH)
+        result = __OSCStreamFlush(osc);
+    }
+  } else if (count <= OSC_STREAM_IOVECS_LENGTH) {
+    struct iovec iov_[OSC_STREAM_IOVECS_LENGTH + 2];
+    uint32_t size = CFSwapInt32HostToBig((uint32_t)length);
+    int n = 0;
+    if (stream->outputLength > 0)
+      iov_[n++] = (struct iovec) { stream->output, stream->outputLength };
+    iov_[n++] = (struct iovec) { &size, 4 };
+    memcpy(iov_ + n, iov, sizeof(struct iovec) * count);
+    UInt64 start = __OSCMetricsGetTime(osc);
+    result = __OSCStreamWriteAll(osc->sockfd, iov_, n + count);
+    __OSCMetricsRecordSend(osc, result == kOSCResultSuccess, 1, stream->outputLength + 4 + length, start);
+    stream->outputLength = 0;
+  }
+  return result;
+}
+
+inline OSCResult __OSCStreamFlush(OSCRef osc) {
+  OSCResult result = kOSCResultSuccess;
+  __OSCStream *stream = &osc->stream;
+  if (stream->outputLength > 0) {
+    struct iovec iov = { stream->output, stream->outputLength };
+    UInt64 start = __OSCMetricsGetTime(osc);
+    result = __OSCStreamWriteAll(osc->sockfd, &iov, 1);
+    __OSCMetricsRecordSend(osc, result == kOSCResultSuccess, 0, stream->outputLength, start); // Packets counted when framed
+    stream->outputLength = 0;
+  }
+  return result;
+}
+
+inline void __OSCStreamDestroy(OSCRef osc) {
+  if (osc->stream.output)
+    CFAllocatorDeallocate(osc->allocator, osc->stream.output);
+  if (osc->stream.input)
+    CFAllocatorDeallocate(osc->allocator, osc->stream.input);
+  OSCFraming framing = osc->stream.framing;
+  OSCFraming receiveFraming = osc->stream.receiveFraming;
+  memset(&osc->stream, 0, sizeof(__OSCStream));
+  osc->stream.framing = framing;
+  osc->stream.receiveFraming = receiveFraming;
+  osc->stream.frameLength = -1;
+}
+
+// Connect with TCP. All OSCSend* functions, run loop timer and sender thread
+// send framed packets over the connection. Host is resolved and connected
+// without holding the send lock, senders keep going meanwhile and the
+// connection is swapped in once it's established. Returns NULL on failure.
+inline struct addrinfo *OSCConnectStream(OSCRef osc, CFStringRef host, UInt16 port, OSCFraming framing) {
+  struct addrinfo *result = NULL;
+  if (osc && host && framing != kOSCFramingNone) {
+    char hostBuffer[256];
+    char portBuffer[16];
+    CFStringGetCString(host, hostBuffer, sizeof(hostBuffer), kCFStringEncodingUTF8);
+    snprintf(portBuffer, sizeof(portBuffer), "%i", port);
+    
+    struct addrinfo hints, *servinfo = NULL, *p = NULL;
+    int sockfd = 0;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    int rv = getaddrinfo(hostBuffer, portBuffer, &hints, &servinfo);
+    if (rv == 0) {
+      for (p = servinfo; p != NULL; p = p->ai_next) {
+        if ((sockfd = socket(p->ai_family, p->ai_socktype, p->ai_protocol)) == -1) {
+          sockfd = 0;
+          continue;
+        }
+        if (connect(sockfd, p->ai_addr, p->ai_addrlen) == 0)
+          break;
+        close(sockfd);
+        sockfd = 0;
+      }
+      if (p) {
+        int one = 1;
+        setsockopt(sockfd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)); // We coalesce ourselves
+      } else {
+        freeaddrinfo(servinfo);
+        servinfo = NULL;
+      }
+    }
+    
+    pthread_mutex_lock(&osc->sendLock);
+    __OSCResolverSetTarget(osc, "", 0, false);
+    __OSCDisconnectSocket(osc);
+    osc->rv = rv;
+    if (p) {
+      osc->servinfo = servinfo;
+      osc->p = p;
+      osc->sockfd = sockfd;
+      __OSCStreamDestroy(osc);
+      osc->stream.framing = framing;
+      osc->stream.receiveFraming = framing;
+      result = p;
+    }
+    pthread_mutex_unlock(&osc->sendLock);
+  }
+  return result;
+}
+
+// Framing used by OSCReceiveStreamBytes when bytes come from a connection
+// not made with OSCConnectStream, eg. accepted by the caller. Sent packets
+// are only framed on OSCConnectStream connection, datagrams stay as they are.
+inline void OSCSetStreamFraming(OSCRef osc, OSCFraming framing) {
+  if (osc) {
+    pthread_mutex_lock(&osc->sendLock);
+    osc->stream.receiveFraming = framing;
+    osc->stream.inputLength = 0;
+    osc->stream.prefixLength = 0;
+    osc->stream.frameLength = -1;
+    osc->stream.escape = false;
+    osc->stream.discard = false;
+    pthread_mutex_unlock(&osc->sendLock);
+  }
+}
+
+inline OSCFraming OSCGetStreamFraming(OSCRef osc) {
+  return osc ? osc->stream.receiveFraming : kOSCFramingNone;
+}
+
+// Packets sent over stream connection are not limited to a datagram.
+inline CFIndex __OSCStreamGetMaximumPacketLength(OSCRef osc) {
+  return osc->stream.framing != kOSCFramingNone ? OSC_STREAM_MAXIMUM_PACKET_LENGTH : OSC_MAXIMUM_DATAGRAM_SIZE;
+}
+
+inline OSCResult __OSCStreamReceiveFrame(OSCRef osc, const UInt8 *bytes, CFIndex length) {
+  return length > 0 ? OSCReceiveRawBuffer(osc, bytes, length) : kOSCResultSuccess;
+}
+
+// Feed received stream bytes, in chunks of any size. Frames can be split
+// anywhere, deframing resumes where the previous chunk ended. Returns the
+// first error, following frames are still processed.
+inline OSCResult OSCReceiveStreamBytes(OSCRef osc, const void *bytes, CFIndex length) {
+  OSCResult result = kOSCResultNotAllocatedError;
+  if (osc && (bytes || length == 0) && osc->stream.receiveFraming != kOSCFramingNone) {
+    __OSCStream *stream = &osc->stream;
+    const UInt8 *b = bytes;
+    result = kOSCResultSuccess;
+    while (length > 0) {
+      OSCResult frameResult = kOSCResultSuccess;
+      if (stream->receiveFraming == kOSCFramingLengthPrefix) {
+        if (stream->frameLength < 0) {
+          CFIndex n = 4 - stream->prefixLength < length ? 4 - stream->prefixLength : length;
+          memcpy(stream->prefix + stream->prefixLength, b, n);
+          stream->prefixLength += n;
+          b += n;
+          length -= n;
+          if (stream->prefixLength == 4) {
+            stream->prefixLength = 0;
+            stream->frameLength = __OSCReadSInt32(stream->prefix);
+            if (stream->frameLength < 0 || stream->frameLength > OSC_STREAM_MAXIMUM_PACKET_LENGTH) {
+              stream->frameLength = -1; // Can't resync length prefixed stream
+              result = kOSCResultMalformedPacketError;
+              break;
+            }
+          }
+        } else if (stream->inputLength == 0 && length >= stream->frameLength) {
+          frameResult = __OSCStreamReceiveFrame(osc, b, stream->frameLength);
+          b += stream->frameLength;
+          length -= stream->frameLength;
+          stream->frameLength = -1;
+        } else {
+          CFIndex n = stream->frameLength - stream->inputLength < length ? stream->frameLength - stream->inputLength : length;
+          UInt8 *input = __OSCStreamReserve(osc, &stream->input, &stream->inputCapacity, stream->inputLength, n);
+          if (!input) {
+            result = kOSCResultNotAllocatedError;
+            break;
+          }
+          memcpy(input, b, n);
+          stream->inputLength += n;
+          b += n;
+          length -= n;
+          if (stream->inputLength == stream->frameLength) {
+            frameResult = __OSCStreamReceiveFrame(osc, stream->input, stream->inputLength);
+            stream->inputLength = 0;
+            stream->frameLength = -1;
+          }
+        }
+      } else {
+        
+        // Run of bytes up to the next END or ESC
+        CFIndex n = 0;
+        while (n < length && b[n] != OSC_SLIP_END && b[n] != OSC_SLIP_ESC)
+          n++;
+        if (stream->escape) {
+          stream->escape = false;
+          n = 1;
+          UInt8 *input = __OSCStreamReserve(osc, &stream->input, &stream->inputCapacity, stream->inputLength, 1);
+          if (input) {
+            *input = b[0] == OSC_SLIP_ESC_END ? OSC_SLIP_END : b[0] == OSC_SLIP_ESC_ESC ? OSC_SLIP_ESC : b[0];
+            stream->inputLength++;
+          }
+        } else if (n < length && b[n] == OSC_SLIP_END && stream->inputLength == 0) {
+          if (!stream->discard)
+            frameResult = __OSCStreamReceiveFrame(osc, b, n); // Unescaped frame, decoded in place
+          stream->discard = false;
+          n++;
+        } else if (n > 0) {
+          UInt8 *input = __OSCStreamReserve(osc, &stream->input, &stream->inputCapacity, stream->inputLength, n);
+          if (input) {
+            memcpy(input, b, n);
+            stream->inputLength += n;
+          }
+        } else if (b[0] == OSC_SLIP_ESC) {
+          stream->escape = true;
+          n = 1;
+        } else {
+          if (!stream->discard)
+            frameResult = __OSCStreamReceiveFrame(osc, stream->input, stream->inputLength);
+          stream->discard = false;
+          stream->inputLength = 0;
+          n = 1;
+        }
+        if (stream->inputLength > OSC_STREAM_MAXIMUM_PACKET_LENGTH) {
+          stream->inputLength = 0;
+          stream->discard = true;
+          frameResult = kOSCResultMalformedPacketError;
+        }
+        b += n;
+        length -= n;
+      }
+      if (result == kOSCResultSuccess)
+        result = frameResult;
+    }
+  }
+  return result;
+}
+
+// Read what's available on the stream connection and decode complete
+// packets. Blocks if nothing is available on a blocking socket. Returns
+// number of bytes read, 0 when the connection has been closed, -1 on error.
+inline CFIndex OSCReceiveStream(OSCRef osc) {
+  CFIndex result = -1;
+  if (osc && osc->sockfd && osc->stream.framing != kOSCFramingNone) {
+    UInt8 buffer[16384];
+    do {
+      result = recv(osc->sockfd, buffer, sizeof(buffer), 0);
+    } while (result < 0 && errno == EINTR);
+    if (result > 0)
+      OSCReceiveStreamBytes(osc, buffer, result);
+  }
+  return result;
+}
+
+#pragma mark Addresses
+
+// Addresses with a value set.
+CFArrayRef OSCCreateAddressArray(OSCRef osc) {
+  CFArrayRef array = NULL;
+  if (osc) {
+    CFIndex n = 0;
+    CFTypeRef *keys = CFAllocatorAllocate(osc->allocator, sizeof(CFTypeRef) * (osc->cache.count + 1), 0);
+    if (keys) {
+      for (CFIndex i = 0; i < osc->cache.capacity; i++)
+        if (osc->cache.slots[i].handle != kOSCAddressHandleInvalid)
+          keys[n++] = OSCAddressesGetAddress(osc, osc->cache.slots[i].handle)->name;
+      array = CFArrayCreate(osc->allocator, keys, n, &kCFTypeArrayCallBacks);
+      CFAllocatorDeallocate(osc->allocator, keys);
+    }
+  }
+  return array;
+}
+
+// Register address for sending and return its handle. Address is encoded
+// once, OSCSend*WithHandle functions only copy the encoded bytes. Appending
+// the same address again returns the existing handle.
+OSCAddressHandle OSCAddressesAppendWithString(OSCRef osc, CFStringRef name) {
+  OSCAddressHandle handle = kOSCAddressHandleInvalid;
+  if (osc && name) {
+    if ((handle = OSCAddressesGetHandleWithString(osc, name)) == kOSCAddressHandleInvalid) {
+      CFIndex chunk = osc->addressesCount / OSC_ADDRESSES_LENGTH;
+      if (chunk < OSC_ADDRESSES_CHUNKS_LENGTH) {
+        if (!osc->addresses[chunk])
+          osc->addresses[chunk] = CFAllocatorAllocate(osc->allocator, sizeof(OSCAddress) * OSC_ADDRESSES_LENGTH, 0);
+        if (osc->addresses[chunk]) {
+          OSCAddress *address = &osc->addresses[chunk][osc->addressesCount % OSC_ADDRESSES_LENGTH];
+          if (__OSCAddressInitWithString(address, name)) {
+            address->name = CFRetain(name);
+            handle = osc->addressesCount;
+            __atomic_store_n(&osc->addressesCount, handle + 1, __ATOMIC_RELEASE); // Published to pushing threads
+            CFNumberRef number = CFNumberCreate(osc->allocator, kCFNumberCFIndexType, &handle);
+            CFDictionarySetValue(osc->addressHandles, name, number);
+            CFRelease(number);
+          }
+        }
+      }
+    }
+  }
+  return handle;
+}
+
+OSCAddressHandle OSCAddressesGetHandleWithString(OSCRef osc, CFStringRef name) {
+  OSCAddressHandle handle = kOSCAddressHandleInvalid;
+  if (osc && name) {
+    CFNumberRef number = CFDictionaryGetValue(osc->addressHandles, name);
+    if (number)
+      CFNumberGetValue(number, kCFNumberCFIndexType, &handle);
+  }
+  return handle;
+}
+
+inline const OSCAddress *OSCAddressesGetAddress(OSCRef osc, OSCAddressHandle handle) {
+  const OSCAddress *address = NULL;
+  if (osc && handle >= 0 && handle < __atomic_load_n(&osc->addressesCount, __ATOMIC_ACQUIRE))
+    address = &osc->addresses[handle / OSC_ADDRESSES_LENGTH][handle % OSC_ADDRESSES_LENGTH];
+  return address;
+}
+
+inline CFIndex OSCAddressesGetCount(OSCRef osc) {
+  return osc ? __atomic_load_n(&osc->addressesCount, __ATOMIC_ACQUIRE) : 0;
+}
+
+#pragma mark Run Loop Timer
+
+inline void OSCActivateRunLoopTimer(OSCRef osc, CFTimeInterval timeInterval) {
+  if (osc) {
+    if (osc->runLoopTimer)
+      OSCDeactivateRunLoopTimer(osc);
+    CFRunLoopTimerContext context = { 0, osc, NULL, NULL, NULL };
+    osc->runLoopTimerInterval = timeInterval;
+    osc->runLoopTimer = CFRunLoopTimerCreate(osc->allocator, CFAbsoluteTimeGetCurrent(), timeInterval, 0, 0, __OSCRunLoopTimerCallBack, &context);
+    CFRunLoopAddTimer(CFRunLoopGetCurrent(), osc->runLoopTimer, kCFRunLoopCommonModes);
+  }
+}
+
+inline void OSCDeactivateRunLoopTimer(OSCRef osc) {
+  if (osc) {
+    if (osc->runLoopTimer) {
+      CFRunLoopTimerInvalidate(osc->runLoopTimer);
+      CFRelease(osc->runLoopTimer);
+      osc->runLoopTimer = NULL;
+    }
+  }
+}
+  
+// Stamp bundles sent by the run loop timer latency seconds ahead, receivers
+// with a scheduler release them on time instead of on arrival.
+inline void OSCSetLatency(OSCRef osc, CFTimeInterval latency) {
+  if (osc)
+    osc->latency = latency > 0 ? latency : 0;
+}
+
+inline CFTimeInterval OSCGetLatency(OSCRef osc) {
+  return osc ? osc->latency : 0;
+}
+
+// Bundles sent by the run loop timer and the sender thread are split to
+// fit size, a single message larger than size is still sent on its own.
+// Send queue slots grow with size, so queued bundles aren't dropped.
+inline void OSCSetMaximumDatagramSize(OSCRef osc, CFIndex size) {
+  if (osc) {
+    pthread_mutex_lock(&osc->sendLock);
+    osc->maximumDatagramSize = size < OSC_MINIMUM_DATAGRAM_SIZE ? OSC_MINIMUM_DATAGRAM_SIZE : size > OSC_MAXIMUM_DATAGRAM_SIZE ? OSC_MAXIMUM_DATAGRAM_SIZE : size;
+    if (__OSCSendQueueGetSlotLength(osc) > osc->queue.slotLength && __OSCSendQueueSetSlotLength(osc, __OSCSendQueueGetSlotLength(osc)) != kOSCResultSuccess)
+      __OSCDiagnostic(osc, kOSCResultNotAllocatedError, 0, "can't resize send queue to %li bytes", (long)osc->maximumDatagramSize);
+    pthread_mutex_unlock(&osc->sendLock);
+  }
+}
+
+inline CFIndex OSCGetMaximumDatagramSize(OSCRef osc) {
+  return osc ? osc->maximumDatagramSize : 0;
+}
+
+inline void OSCSetPackingPolicy(OSCRef osc, OSCPackingPolicy policy) {
+  if (osc) {
+    pthread_mutex_lock(&osc->sendLock);
+    osc->packingPolicy = policy;
+    pthread_mutex_unlock(&osc->sendLock);
+  }
+}
+
+inline OSCPackingPolicy OSCGetPackingPolicy(OSCRef osc) {
+  return osc ? osc->packingPolicy : kOSCPackingPolicySequential;
+}
+
+// Index of the rule with the longest prefix of address, -1 if none matches.
+inline CFIndex __OSCFiltersResolve(OSCRef osc, const OSCAddress *address) {
+  CFIndex result = -1;
+  if (address) {
+    for (CFIndex i = 0; i < osc->filters.count; i++) {
+      const __OSCFilterRule *rule = &osc->filters.rules[i];
+      if (rule->prefixLength <= address->length && memcmp(rule->prefix, address->buffer, rule->prefixLength) == 0)
+        if (result < 0 || rule->prefixLength > osc->filters.rules[result].prefixLength)
+          result = i;
+    }
+  }
+  return result;
+}
+
+// Prefix is matched byte by byte, "/sensors/" covers all addresses in the
+// container, full address covers the address only.
+inline OSCResult OSCSetFilter(OSCRef osc, CFStringRef prefix, const OSCFilter *filter) {
+  OSCResult result = kOSCResultNotAllocatedError;
+  if (osc && prefix) {
+    char buffer[OSC_STATIC_ADDRESS_LENGTH];
+    pthread_mutex_lock(&osc->sendLock);
+    if (CFStringGetCString(prefix, buffer, OSC_STATIC_ADDRESS_LENGTH, kCFStringEncodingUTF8) && buffer[0] == '/') {
+      CFIndex length = strlen(buffer);
+      CFIndex i = 0;
+      while (i < osc->filters.count && strcmp(osc->filters.rules[i].prefix, buffer) != 0)
+        i++;
+      if (!filter) {
+        if (i < osc->filters.count)
+          osc->filters.rules[i] = osc->filters.rules[--osc->filters.count];
+        result = kOSCResultSuccess;
+      } else {
+        if (i == osc->filters.count && osc->filters.count == osc->filters.capacity) {
+          CFIndex capacity = osc->filters.capacity ? osc->filters.capacity * 2 : 8;
+          __OSCFilterRule *rules = CFAllocatorReallocate(osc->allocator, osc->filters.rules, sizeof(__OSCFilterRule) * capacity, 0);
+          if (rules) {
+            osc->filters.rules = rules;
+            osc->filters.capacity = capacity;
+          }
+        }
+        if (i < osc->filters.capacity) {
+          memcpy(osc->filters.rules[i].prefix, buffer, length + 1);
+          osc->filters.rules[i].prefixLength = length;
+          osc->filters.rules[i].filter = *filter;
+          if (i == osc->filters.count)
+            osc->filters.count++;
+          result = kOSCResultSuccess;
+        }
+      }
+      osc->filters.generation++;
+    } else {
+      result = kOSCResultInvalidAddressError;
+    }
+    pthread_mutex_unlock(&osc->sendLock);
+  }
+  return result;
+}
+
+inline void OSCRemoveAllFilters(OSCRef osc) {
+  if (osc) {
+    pthread_mutex_lock(&osc->sendLock);
+    osc->filters.count = 0;
+    osc->filters.generation++;
+    pthread_mutex_unlock(&osc->sendLock);
+  }
+}
+
+// Index of the class with the longest prefix of address, -1 if none matches.
+inline CFIndex __OSCRateClassesResolve(OSCRef osc, const OSCAddress *address) {
+  CFIndex result = -1;
+  if (address) {
+    for (CFIndex i = 0; i < osc->rateClasses.count; i++) {
+      const __OSCRateClass *rateClass = &osc->rateClasses.classes[i];
+      if (rateClass->prefixLength <= address->length && memcmp(rateClass->prefix, address->buffer, rateClass->prefixLength) == 0)
+        if (result < 0 || rateClass->prefixLength > osc->rateClasses.classes[result].prefixLength)
+          result = i;
+    }
+  }
+  return result;
+}
+
+inline void __OSCRateClassesBeginPass(OSCRef osc, CFIndex schedule, CFAbsoluteTime time) {
+  for (CFIndex i = 0; i < osc->rateClasses.count; i++) {
+    osc->rateClasses.classes[i].due[schedule] = time >= osc->rateClasses.classes[i].nextTime[schedule];
+    osc->rateClasses.classes[i].sent[schedule] = false;
+  }
+}
+
+// Classes sent in this pass are due again one interval later, missed
+// intervals are skipped rather than sent in a burst. Class without values
+// in the pass stays due, its next value goes out right away.
+inline void __OSCRateClassesEndPass(OSCRef osc, CFIndex schedule, CFAbsoluteTime time) {
+  for (CFIndex i = 0; i < osc->rateClasses.count; i++) {
+    __OSCRateClass *rateClass = &osc->rateClasses.classes[i];
+    if (rateClass->due[schedule] && rateClass->sent[schedule]) {
+      rateClass->nextTime[schedule] += rateClass->interval;
+      if (rateClass->nextTime[schedule] <= time)
+        rateClass->nextTime[schedule] = time + rateClass->interval;
+    }
+    rateClass->due[schedule] = false;
+  }
+}
+
+// Earliest time a class of the run loop timer cache is due, at most one run
+// loop timer interval away. Classes with 0 interval are sent on every tick,
+// classes already due wait for the next value on a regular tick.
+inline CFAbsoluteTime __OSCRateClassesGetNextTime(OSCRef osc, CFAbsoluteTime time) {
+  CFAbsoluteTime result = time + (osc->runLoopTimerInterval > 0 ? osc->runLoopTimerInterval : 1);
+  for (CFIndex i = 0; i < osc->rateClasses.count; i++)
+    if (osc->rateClasses.classes[i].interval > 0 && osc->rateClasses.classes[i].nextTime[0] > time && osc->rateClasses.classes[i].nextTime[0] < result)
+      result = osc->rateClasses.classes[i].nextTime[0];
+  return result;
+}
+
+// Prefix is matched the same way as with OSCSetFilter. Priority decides
+// which values are packed first when the send budget is tight.
+inline OSCResult OSCSetRateClass(OSCRef osc, CFStringRef prefix, CFTimeInterval interval, SInt32 priority) {
+  OSCResult result = kOSCResultNotAllocatedError;
+  if (osc && prefix && interval >= 0) {
+    char buffer[OSC_STATIC_ADDRESS_LENGTH];
+    pthread_mutex_lock(&osc->sendLock);
+    if (CFStringGetCString(prefix, buffer, OSC_STATIC_ADDRESS_LENGTH, kCFStringEncodingUTF8) && buffer[0] == '/') {
+      CFIndex length = strlen(buffer);
+      CFIndex i = 0;
+      while (i < osc->rateClasses.count && strcmp(osc->rateClasses.classes[i].prefix, buffer) != 0)
+        i++;
+      if (i == osc->rateClasses.count && osc->rateClasses.count == osc->rateClasses.capacity) {
+        CFIndex capacity = osc->rateClasses.capacity ? osc->rateClasses.capacity * 2 : 8;
+        __OSCRateClass *classes = CFAllocatorReallocate(osc->allocator, osc->rateClasses.classes, sizeof(__OSCRateClass) * capacity, 0);
+        if (classes) {
+          osc->rateClasses.classes = classes;
+          osc->rateClasses.capacity = capacity;
+        }
+      }
+      if (i < osc->rateClasses.capacity) {
+        __OSCRateClass *rateClass = &osc->rateClasses.classes[i];
+        memcpy(rateClass->prefix, buffer, length + 1);
+        rateClass->prefixLength = length;
+        rateClass->interval = interval;
+        rateClass->priority = priority;
+        memset(rateClass->nextTime, 0, sizeof(rateClass->nextTime));
+        memset(rateClass->due, 0, sizeof(rateClass->due));
+        memset(rateClass->sent, 0, sizeof(rateClass->sent));
+        if (i == osc->rateClasses.count)
+          osc->rateClasses.count++;
+        osc->rateClasses.generation++;
+        result = kOSCResultSuccess;
+      }
+    } else {
+      result = kOSCResultInvalidAddressError;
+    }
+    pthread_mutex_unlock(&osc->sendLock);
+  }
+  return result;
+}
+
+inline OSCResult OSCRemoveRateClass(OSCRef osc, CFStringRef prefix) {
+  OSCResult result = kOSCResultNotAllocatedError;
+  if (osc && prefix) {
+    char buffer[OSC_STATIC_ADDRESS_LENGTH];
+    result = kOSCResultInvalidAddressError;
+    pthread_mutex_lock(&osc->sendLock);
+    if (CFStringGetCString(prefix, buffer, OSC_STATIC_ADDRESS_LENGTH, kCFStringEncodingUTF8)) {
+      for (CFIndex i = 0; i < osc->rateClasses.count; i++) {
+        if (strcmp(osc->rateClasses.classes[i].prefix, buffer) == 0) {
+          osc->rateClasses.classes[i] = osc->rateClasses.classes[--osc->rateClasses.count];
+          osc->rateClasses.generation++;
+          result = kOSCResultSuccess;
+          break;
+        }
+      }
+    }
+    pthread_mutex_unlock(&osc->sendLock);
+  }
+  return result;
+}
+
+inline void OSCRemoveAllRateClasses(OSCRef osc) {
+  if (osc) {
+    pthread_mutex_lock(&osc->sendLock);
+    osc->rateClasses.count = 0;
+    osc->rateClasses.generation++;
+    pthread_mutex_unlock(&osc->sendLock);
+  }
+}
+
+inline void OSCSetSendBudget(OSCRef osc, CFIndex bytes) {
+  if (osc)
+    osc->sendBudget = bytes > 0 ? bytes : 0;
+}
+
+inline CFIndex OSCGetSendBudget(OSCRef osc) {
+  return osc ? osc->sendBudget : 0;
+}
+
+#pragma mark Sending
+
+// Address is encoded on the stack and looked up in the cache by its hash,
+// it's registered only the first time a value is set.
+inline OSCResult __OSCSetValueWithString(OSCRef osc, CFStringRef name, const OSCValue *value) {
+  OSCResult result = kOSCResultInvalidAddressError;
+  OSCAddress address;
+  if (__OSCAddressInitWithString(&address, name)) {
+    pthread_mutex_lock(&osc->sendLock);
+    __OSCCacheSlot *slot = __OSCCacheFind(osc, &osc->cache, &address);
+    if (!slot)
+      slot = __OSCCacheInsert(osc, &osc->cache, OSCAddressesAppendWithString(osc, name));
+    if (slot) {
+      if (__OSCCacheSetValue(osc, &osc->cache, slot, value))
+        __atomic_fetch_add(&osc->metrics.coalescedCount, 1, __ATOMIC_RELAXED);
+      result = kOSCResultSuccess;
+    } else {
+      result = kOSCResultNotAllocatedError;
+    }
+    pthread_mutex_unlock(&osc->sendLock);
+  }
+  return result;
+}
+
+inline OSCResult OSCSetValue(OSCRef osc, CFStringRef name, CFTypeRef value) {
+  OSCResult result = kOSCResultNotAllocatedError;
+  OSCValue value_;
+  if (osc && name && value && __OSCValueMakeWithCFType(&value_, value))
+    result = __OSCSetValueWithString(osc, name, &value_);
+  return result;
+}
+
+inline OSCResult OSCSetValueWithHandle(OSCRef osc, OSCAddressHandle handle, const OSCValue *value) {
+  OSCResult result = kOSCResultNotAllocatedError;
+  if (osc && value) {
+    const OSCAddress *address = OSCAddressesGetAddress(osc, handle);
+    if (address) {
+      pthread_mutex_lock(&osc->sendLock);
+      __OSCCacheSlot *slot = __OSCCacheFind(osc, &osc->cache, address);
+      if (!slot)
+        slot = __OSCCacheInsert(osc, &osc->cache, handle);
+      if (slot) {
+        if (__OSCCacheSetValue(osc, &osc->cache, slot, value))
+          __atomic_fetch_add(&osc->metrics.coalescedCount, 1, __ATOMIC_RELAXED);
+        result = kOSCResultSuccess;
+      }
+      pthread_mutex_unlock(&osc->sendLock);
+    } else {
+      result = kOSCResultInvalidHandleError;
+    }
+  }
+  return result;
+}
+
+inline OSCResult OSCSetFloat32WithHandle(OSCRef osc, OSCAddressHandle handle, Float32 value) {
+  OSCValue value_ = { 'f', { .f = value } };
+  return OSCSetValueWithHandle(osc, handle, &value_);
+}
+
+inline OSCResult OSCSetSInt32WithHandle(OSCRef osc, OSCAddressHandle handle, SInt32 value) {
+  OSCValue value_ = { 'i', { .i = value } };
+  return OSCSetValueWithHandle(osc, handle, &value_);
+}
+
+inline OSCResult OSCSetBoolWithHandle(OSCRef osc, OSCAddressHandle handle, bool value) {
+  OSCValue value_ = { value ? 'T' : 'F', { .i = 0 } };
+  return OSCSetValueWithHandle(osc, handle, &value_);
+}
+
+// Force Float32 number if not of float type
+inline OSCResult OSCSetNumberAsFloat32(OSCRef osc, CFStringRef name, CFNumberRef value) {
+  OSCResult result = kOSCResultNotAllocatedError;
+  if (osc && name && value) {
+    if (CFGetTypeID(value) == CFNumberGetTypeID()) {
+      OSCValue value_ = { 'f', { .f = (Float32)0.0 } };
+      CFNumberGetValue(value, kCFNumberFloat32Type, &value_.value.f);
+      result = __OSCSetValueWithString(osc, name, &value_);
+    }
+  }
+  return result;
+}
+
+inline OSCResult OSCSendValue(OSCRef osc, CFStringRef name, CFTypeRef value) {
+  OSCResult result = kOSCResultNotAllocatedError;
+  if (osc && name && value) {
+    CFTypeID valueId = CFGetTypeID(value);
+    if (valueId == CFNumberGetTypeID()) {
+      if (CFNumberIsFloatType(value)) {
+        Float32 float32Value = (Float32)0.0;
+        CFNumberGetValue(value, kCFNumberFloat32Type, &float32Value);
+        result = OSCSendFloat32(osc, name, float32Value);
+      } else {
+        SInt32 sint32Value = 0;
+        CFNumberGetValue(value, kCFNumberSInt32Type, &sint32Value);
+        result = OSCSendSInt32(osc, name, sint32Value);
+      }
+    } else if (valueId == CFBooleanGetTypeID()) {
+      result = OSCSendBoolean(osc, name, value);
+    } else if (valueId == CFStringGetTypeID()) {
+      result = OSCSendString(osc, name, value);
+    } else if (valueId == CFDataGetTypeID()) {
+      result = OSCSendData(osc, name, value);
+    }
+//    else if (valueId == CFArrayGetTypeID()) {
+//      
+//    }
+  }
+  return result;
+}
+
+// Returns number of bytes sent or -1 with errno set. Retried only when
+// interrupted, with MSG_DONTWAIT it fails with EAGAIN instead of blocking.
+ssize_t sendallto(int s, const void *buf, size_t len,
+               int flags, const struct sockaddr *to,
+               socklen_t tolen) {
+  size_t total = 0;
+  ssize_t n = 0;
+  while (total < len || len == 0) {
+    n = sendto(s, (const UInt8 *)buf + total, len - total, flags, to, tolen);
+    if (n == -1) {
+      if (errno == EINTR)
+        continue;
+      break;
+    }
+    total += n;
+    if (len == 0)
+      break;
+  }
+  return n == -1 ? -1 : (ssize_t)total;
+}
+
+inline OSCResult __OSCSendRawBufferNow(OSCRef osc, const void *buffer, CFIndex length) {
+  if (osc->stream.framing != kOSCFramingNone) {
+    struct iovec iov = { (void *)buffer, length };
+    return __OSCStreamSend(osc, &iov, 1);
+  }
+  OSCResult result = kOSCResultSuccess;
+  if (__OSCUringCanSend(osc)) {
+    struct iovec iov = { (void *)buffer, length };
+    result = __OSCUringSend(osc, &iov, 1, true);
+  } else if (osc->sockfd && osc->p && osc->queue.nonBlocking) {
+    struct iovec iov = { (void *)buffer, length };
+    result = __OSCSendQueueSend(osc, &iov, 1);
+  } else if (osc->sockfd && osc->p) {
+    UInt64 start = __OSCMetricsGetTime(osc);
+    ssize_t sent = sendallto(osc->sockfd, buffer, length, 0, __OSCGetPeerAddress(osc), __OSCGetPeerAddressLength(osc));
+    __OSCMetricsRecordSend(osc, sent != -1, 1, sent, start);
+    if (sent == -1)
+      result = -1;
+  }
+  if (__atomic_load_n(&osc->destinations.count, __ATOMIC_ACQUIRE) > 0) {
+    struct iovec iov = { (void *)buffer, length };
+    if (__OSCDestinationsSend(osc, &iov, 1, 1) != kOSCResultSuccess)
+      result = -1;
+  }
+  return result;
+}
+
+// Gather packet from iov and send it with a single sendmsg, nothing is
+// copied in user space. Pending batch is flushed first to keep the order.
+// Buffers can be reused as soon as this returns.
+inline OSCResult __OSCSendIOVectorNow(OSCRef osc, const struct iovec *iov, int count) {
+  OSCResult result = kOSCResultNotAllocatedError;
+  pthread_mutex_lock(&osc->sendLock);
+  if (osc->capture && __OSCCanSend(osc))
+    __OSCCaptureAppend(osc, iov, count);
+  if (osc->sockfd && osc->p && osc->stream.framing != kOSCFramingNone) {
+    result = __OSCStreamSend(osc, iov, count);
+  } else if (__OSCCanSend(osc)) {
+    if (osc->batch.count > 0)
+      __OSCBatchFlush(osc);
+    result = kOSCResultSuccess;
+    if (__OSCUringCanSend(osc)) {
+      result = __OSCUringSend(osc, iov, count, true);
+    } else if (osc->sockfd && osc->p && osc->queue.nonBlocking) {
+      result = __OSCSendQueueSend(osc, iov, count);
+    } else if (osc->sockfd && osc->p) {
+      struct msghdr message;
+      memset(&message, 0, sizeof(message));
+      message.msg_name = (void *)__OSCGetPeerAddress(osc);
+      message.msg_namelen = __OSCGetPeerAddressLength(osc);
+      message.msg_iov = (struct iovec *)iov;
+      message.msg_iovlen = count;
+      UInt64 start = __OSCMetricsGetTime(osc);
+      ssize_t sent = sendmsg(osc->sockfd, &message, 0);
+      __OSCMetricsRecordSend(osc, sent != -1, 1, sent, start);
+      if (sent == -1)
+        result = -1;
+    }
+    if (__atomic_load_n(&osc->destinations.count, __ATOMIC_ACQUIRE) > 0)
+      if (__OSCDestinationsSend(osc, (struct iovec *)iov, 1, count) != kOSCResultSuccess)
+        result = -1;
+  }
+  pthread_mutex_unlock(&osc->sendLock);
+  return result;
+}
+
+// Send packet or, if batching is enabled, copy it to the batch which is
+// flushed when full, on OSCFlush or on run loop timer tick.
+inline OSCResult OSCSendRawBuffer(OSCRef osc, const void *buffer, CFIndex length) {
+  OSCResult result = kOSCResultNotAllocatedError;
+  if (osc) {
+    pthread_mutex_lock(&osc->sendLock);
+    if (osc->capture && __OSCCanSend(osc)) {
+      struct iovec iov = { (void *)buffer, length };
+      __OSCCaptureAppend(osc, &iov, 1);
+    }
+    if (osc->sockfd && osc->p && osc->stream.framing != kOSCFramingNone) {
+      struct iovec iov = { (void *)buffer, length };
+      result = __OSCStreamSend(osc, &iov, 1);
+    } else if (__OSCCanSend(osc)) {
+      __OSCBatch *batch = &osc->batch;
+      if (batch->capacity > 0 && length <= OSC_BATCH_BUFFER_LENGTH) {
+        CFIndex i = (batch->head + batch->count) % batch->capacity;
+        memcpy(batch->buffers + i * OSC_BATCH_BUFFER_LENGTH, buffer, length);
+        batch->lengths[i] = length;
+        result = kOSCResultSuccess;
+        if (++batch->count == batch->capacity)
+          result = __OSCBatchFlush(osc);
+      } else {
+        if (batch->count > 0)
+          __OSCBatchFlush(osc);
+        result = __OSCSendRawBufferNow(osc, buffer, length);
+      }
+    } else {
+      __OSCDiagnostic(osc, result, 0, "can't send packet, not connected");
+    }
+    pthread_mutex_unlock(&osc->sendLock);
+  }
+  return result;
+}
+
+inline OSCResult OSCSendRawBufferWithData(OSCRef osc, CFDataRef data) {
+  OSCResult result = kOSCResultNotAllocatedError;
+  if (osc)
+    if (data)
+      result = OSCSendRawBuffer(osc, CFDataGetBytePtr(data), CFDataGetLength(data));
+  return result;
+}
+
+inline OSCResult __OSCSendTrueWithAddress(OSCRef osc, const OSCAddress *address) {
+  char buffer[OSC_STATIC_TRUE_PACKET_LENGTH];
+  OSCResult result;
+  int i = 0;
+  __OSCBufferAppendAddress(buffer, (*address), i);
+  __OSCBufferAppend(buffer, ",T\0\0", 4, i);
+  __OSCBufferSend(osc, buffer, i, result);
+  return result;
+}
+
+inline OSCResult __OSCSendFalseWithAddress(OSCRef osc, const OSCAddress *address) {
+  char buffer[OSC_STATIC_FALSE_PACKET_LENGTH];
+  OSCResult result;
+  int i = 0;
+  __OSCBufferAppendAddress(buffer, (*address), i);
+  __OSCBufferAppend(buffer, ",F\0\0", 4, i);
+  __OSCBufferSend(osc, buffer, i, result);
+  return result;
+}
+
+inline OSCResult __OSCSendSInt32WithAddress(OSCRef osc, const OSCAddress *address, SInt32 value) {
+  char buffer[OSC_STATIC_SINT32_PACKET_LENGTH];
+  SInt32 swappedValue = CFSwapInt32HostToBig(value);
+  OSCResult result;
+  int i = 0;
+  __OSCBufferAppendAddress(buffer, (*address), i);
+  __OSCBufferAppend(buffer, ",i\0\0", 4, i);
+  __OSCBufferAppend(buffer, &swappedValue, 4, i);
+  __OSCBufferSend(osc, buffer, i, result);
+  return result;
+}
+
+inline OSCResult __OSCSendFloat32WithAddress(OSCRef osc, const OSCAddress *address, Float32 value) {
+  char buffer[OSC_STATIC_FLOAT32_PACKET_LENGTH];
+  CFSwappedFloat32 swappedValue = CFConvertFloat32HostToSwapped(value);
+  OSCResult result;
+  int i = 0;
+  __OSCBufferAppendAddress(buffer, (*address), i);
+  __OSCBufferAppend(buffer, ",f\0\0", 4, i);
+  __OSCBufferAppend(buffer, &swappedValue, 4, i);
+  __OSCBufferSend(osc, buffer, i, result);
+  return result;
+}
+
+inline OSCResult __OSCSendFloats32WithAddress(OSCRef osc, const OSCAddress *address, const Float32 *values, CFIndex n) {
+  return __OSCSendArrayWithAddress(osc, address, 'f', values, n);
+}
+
+// Encoded into the reused writer, arrays of any length which fit a datagram
+// are sent without allocating.
+inline OSCResult __OSCSendArrayWithAddress(OSCRef osc, const OSCAddress *address, char type, const void *values, CFIndex n) {
+  OSCResult result = kOSCResultTooLongError;
+  CFIndex size = type == 'd' || type == 'h' ? 8 : 4;
+  CFIndex maximum = __OSCStreamGetMaximumPacketLength(osc);
+  if (n <= (maximum - address->length) / (size + 1)) {
+    UInt64 start = __OSCMetricsGetTime(osc);
+    pthread_mutex_lock(&osc->sendLock);
+    OSCWriterReset(osc->writer);
+    if (!OSCWriterAppendArrayWithAddress(osc->writer, address, type, values, n)) {
+      result = kOSCResultNotAllocatedError;
+    } else if (OSCWriterGetLength(osc->writer) <= maximum) {
+      if (start)
+        __OSCMetricsRecordTime(osc->metrics.encodeTimes, start);
+      __OSCMetricsAdd(osc->metrics.messagesCount, 1);
+      result = OSCSendRawBufferWithWriter(osc, osc->writer);
+    }
+    pthread_mutex_unlock(&osc->sendLock);
+  }
+  return result;
+}
+
+inline OSCResult __OSCSendArray(OSCRef osc, CFStringRef name, char type, const void *values, CFIndex n) {
+  OSCResult result = kOSCResultNotAllocatedError;
+  if (osc && name && values && n > 0) {
+    OSCAddress address;
+    result = __OSCAddressInitWithString(&address, name) ? __OSCSendArrayWithAddress(osc, &address, type, values, n) : kOSCResultInvalidAddressError;
+  }
+  return result;
+}
+
+inline OSCResult __OSCSendArrayWithHandle(OSCRef osc, OSCAddressHandle handle, char type, const void *values, CFIndex n) {
+  OSCResult result = kOSCResultNotAllocatedError;
+  if (osc && values && n > 0) {
+    const OSCAddress *address = OSCAddressesGetAddress(osc, handle);
+    result = address ? __OSCSendArrayWithAddress(osc, address, type, values, n) : kOSCResultInvalidHandleError;
+  }
+  return result;
+}
+
+// Encoded into the reused writer, which is reserved for the largest packet
+// up front. Stream packets are limited to OSC_STREAM_BUFFER_LENGTH here,
+// larger blobs should go through OSCSendBlob.
+inline OSCResult __OSCSendArgumentsWithAddress(OSCRef osc, const OSCAddress *address, const char *typeTags, const OSCArgumentValue *values) {
+  OSCResult result = kOSCResultNotAllocatedError;
+  CFIndex maximum = __OSCStreamGetMaximumPacketLength(osc);
+  CFIndex length = 0;
+  UInt8 *bytes;
+  if (maximum > OSC_STREAM_BUFFER_LENGTH)
+    maximum = OSC_STREAM_BUFFER_LENGTH;
+  UInt64 start = __OSCMetricsGetTime(osc);
+  pthread_mutex_lock(&osc->sendLock);
+  OSCWriterReset(osc->writer);
+  if ((bytes = __OSCWriterReserve(osc->writer, maximum))) {
+    result = OSCEncodeMessage(bytes, maximum, address, typeTags, values, &length);
+    osc->writer->length = result == kOSCResultSuccess ? length : 0;
+    if (result == kOSCResultSuccess) {
+      if (start)
+        __OSCMetricsRecordTime(osc->metrics.encodeTimes, start);
+      __OSCMetricsAdd(osc->metrics.messagesCount, 1);
+      result = OSCSendRawBufferWithWriter(osc, osc->writer);
+    }
+  }
+  pthread_mutex_unlock(&osc->sendLock);
+  return result;
+}
+
+// Only address, type tag and size are encoded, blob bytes are passed to the
+// kernel straight from the caller's buffer.
+inline OSCResult __OSCSendBlobWithAddress(OSCRef osc, const OSCAddress *address, const void *bytes, CFIndex length) {
+  OSCResult result = kOSCResultTooLongError;
+  CFIndex padding = (4 - (length & 3)) & 3;
+  if (length >= 0 && address->length + 8 + length + padding <= __OSCStreamGetMaximumPacketLength(osc)) {
+    static const UInt8 zeros[4] = { 0, 0, 0, 0 };
+    UInt8 header[OSC_STATIC_ADDRESS_LENGTH + 8];
+    uint32_t size = CFSwapInt32HostToBig((uint32_t)length);
+    memcpy(header, address->buffer, address->length);
+    memcpy(header + address->length, ",b\0\0", 4);
+    memcpy(header + address->length + 4, &size, 4);
+    struct iovec iov[3] = {
+      { header, address->length + 8 },
+      { (void *)bytes, length },
+      { (void *)zeros, padding }
+    };
+    __OSCMetricsAdd(osc->metrics.messagesCount, 1);
+    result = __OSCSendIOVectorNow(osc, iov, padding > 0 ? 3 : 2);
+  }
+  return result;
+}
+
+inline OSCResult __OSCSendCStringWithAddress(OSCRef osc, const OSCAddress *address, const UInt8 *value) {
+  OSCResult result = kOSCResultTooLongError;
+  unsigned long length = strlen((const char *)value);
+  if (length < OSC_STATIC_STRING_LENGTH) {
+    char buffer[OSC_STATIC_STRING_PACKET_LENGTH];
+    int i = 0;
+    __OSCBufferAppendAddress(buffer, (*address), i);
+    __OSCBufferAppend(buffer, ",s\0\0", 4, i);
+    __OSCBufferAppend(buffer, value, length + 1, i);
+    __OSCBufferSend(osc, buffer, i, result);
+  }
+  return result;
+}
+
+inline OSCResult OSCSendTrue(OSCRef osc, CFStringRef name) {
+  OSCResult result = kOSCResultNotAllocatedError;
+  if (osc && name) {
+    OSCAddress address;
+    result = __OSCAddressInitWithString(&address, name) ? __OSCSendTrueWithAddress(osc, &address) : kOSCResultInvalidAddressError;
+  }
+  return result;
+}
+
+inline OSCResult OSCSendFalse(OSCRef osc, CFStringRef name) {
+  OSCResult result = kOSCResultNotAllocatedError;
+  if (osc && name) {
+    OSCAddress address;
+    result = __OSCAddressInitWithString(&address, name) ? __OSCSendFalseWithAddress(osc, &address) : kOSCResultInvalidAddressError;
+  }
+  return result;
+}
+
+inline OSCResult OSCSendBool(OSCRef osc, CFStringRef name, bool value) {
+  OSCResult result = kOSCResultNotAllocatedError;
+  if (osc && name)
+    result = value ? OSCSendTrue(osc, name) : OSCSendFalse(osc, name);
+  return result;
+}
+
+inline OSCResult OSCSendBoolean(OSCRef osc, CFStringRef name, CFBooleanRef value) {
+  OSCResult result = kOSCResultNotAllocatedError;
+  if (osc && name && value)
+    result = OSCSendBool(osc, name, CFBooleanGetValue(value));
+  return result;
+}
+
+inline OSCResult OSCSendSInt32(OSCRef osc, CFStringRef name, SInt32 value) {
+  OSCResult result = kOSCResultNotAllocatedError;
+  if (osc && name) {
+    OSCAddress address;
+    result = __OSCAddressInitWithString(&address, name) ? __OSCSendSInt32WithAddress(osc, &address, value) : kOSCResultInvalidAddressError;
+  }
+  return result;
+}
+
+inline OSCResult OSCSendFloat32(OSCRef osc, CFStringRef name, Float32 value) {
+  OSCResult result = kOSCResultNotAllocatedError;
+  if (osc && name) {
+    OSCAddress address;
+    result = __OSCAddressInitWithString(&address, name) ? __OSCSendFloat32WithAddress(osc, &address, value) : kOSCResultInvalidAddressError;
+  }
+  return result;
+}
+
+inline OSCResult OSCSendFloats32(OSCRef osc, CFStringRef name, const Float32 *values, CFIndex n) {
+  return __OSCSendArray(osc, name, 'f', values, n);
+}
+
+inline OSCResult OSCSendFloats64(OSCRef osc, CFStringRef name, const Float64 *values, CFIndex n) {
+  return __OSCSendArray(osc, name, 'd', values, n);
+}
+
+inline OSCResult OSCSendSInts32(OSCRef osc, CFStringRef name, const SInt32 *values, CFIndex n) {
+  return __OSCSendArray(osc, name, 'i', values, n);
+}
+
+inline OSCResult OSCSendSInts64(OSCRef osc, CFStringRef name, const SInt64 *values, CFIndex n) {
+  return __OSCSendArray(osc, name, 'h', values, n);
+}
+
+inline OSCResult OSCSendCString(OSCRef osc, CFStringRef name, const UInt8 *value) {
+  OSCResult result = kOSCResultNotAllocatedError;
+  if (osc && name && value) {
+    OSCAddress address;
+    result = __OSCAddressInitWithString(&address, name) ? __OSCSendCStringWithAddress(osc, &address, value) : kOSCResultInvalidAddressError;
+  }
+  return result;
+}
+
+inline OSCResult OSCSendBlob(OSCRef osc, CFStringRef name, const void *bytes, CFIndex length) {
+  OSCResult result = kOSCResultNotAllocatedError;
+  if (osc && name && (bytes || length == 0)) {
+    OSCAddress address;
+    result = __OSCAddressInitWithString(&address, name) ? __OSCSendBlobWithAddress(osc, &address, bytes, length) : kOSCResultInvalidAddressError;
+  }
+  return result;
+}
+
+// Data is retained for the duration of the send, its bytes are not copied.
+inline OSCResult OSCSendData(OSCRef osc, CFStringRef name, CFDataRef value) {
+  OSCResult result = kOSCResultNotAllocatedError;
+  if (osc && name && value) {
+    CFRetain(value);
+    result = OSCSendBlob(osc, name, CFDataGetBytePtr(value), CFDataGetLength(value));
+    CFRelease(value);
+  }
+  return result;
+}
+
+// Mixed arguments in one message, see OSCEncodeMessage.
+inline OSCResult OSCSendArguments(OSCRef osc, CFStringRef name, const char *typeTags, const OSCArgumentValue *values) {
+  OSCResult result = kOSCResultNotAllocatedError;
+  if (osc && name && typeTags) {
+    OSCAddress address;
+    result = __OSCAddressInitWithString(&address, name) ? __OSCSendArgumentsWithAddress(osc, &address, typeTags, values) : kOSCResultInvalidAddressError;
+  }
+  return result;
+}
+
+inline OSCResult OSCSendString(OSCRef osc, CFStringRef name, CFStringRef value) {
+  OSCResult result = kOSCResultNotAllocatedError;
+  if (osc && name && value) {
+    __OSCUTF8String utf8Value;
+    __OSCUTF8StringInit(&utf8Value, osc->allocator, value);
+    result = OSCSendCString(osc, name, (const UInt8 *)__OSCUTF8StringGetBuffer(&utf8Value));
+    __OSCUTF8StringDestroy(&utf8Value);
+  }
+  return result;
+}
+
+OSCResult OSCSendNumbersAsFloats32(OSCRef osc, CFStringRef name, const CFNumberRef *values, CFIndex n) {
+  OSCResult result = kOSCResultNotAllocatedError;
+  if (osc && name && values && n > 0) {
+    Float32 stack[OSC_STACK_VALUES_LENGTH];
+    Float32 *values_ = n <= OSC_STACK_VALUES_LENGTH ? stack : CFAllocatorAllocate(osc->allocator, n * sizeof(Float32), 0);
+    if (values_) {
+      for (CFIndex i = 0; i < n; i++)
+        CFNumberGetValue(values[i], kCFNumberFloat32Type, &values_[i]);
+      result = OSCSendFloats32(osc, name, values_, n);
+      if (values_ != stack)
+        CFAllocatorDeallocate(osc->allocator, values_);
+    }
+  }
+  return result;
+}
+
+OSCResult OSCSendNumberAsSInt32(OSCRef osc, CFStringRef name, CFNumberRef value) {
+  OSCResult result = kOSCResultNotAllocatedError;
   if (osc && name && value) {
     SInt32 value_ = 0;
     CFNumberGetValue(value, kCFNumberSInt32Type, &value_);
@@ -594,13 +2677,3128 @@ OSCResult OSCSendNumberAsSInt32(OSCRef osc, CFStringRef name, CFNumberRef value)
   return result;
 }
 
-OSCResult OSCSendNumberAsFloat32(OSCRef osc, CFStringRef name, CFNumberRef value) {
+OSCResult OSCSendNumberAsFloat32(OSCRef osc, CFStringRef name, CFNumberRef value) {
+  OSCResult result = kOSCResultNotAllocatedError;
+  if (osc && name && value) {
+    Float32 value_ = 0;
+    CFNumberGetValue(value, kCFNumberFloat32Type, &value_);
+    result = OSCSendFloat32(osc, name, value_);
+  }
+  return result;
+}
+
+inline OSCResult OSCSendRawBufferWithWriter(OSCRef osc, OSCWriterRef writer) {
+  OSCResult result = kOSCResultNotAllocatedError;
+  if (osc)
+    if (writer)
+      result = OSCSendRawBuffer(osc, OSCWriterGetBytePtr(writer), OSCWriterGetLength(writer));
+  return result;
+}
+
+#pragma mark Batching
+
+inline void __OSCBatchDestroy(OSCRef osc) {
+  __OSCBatch *batch = &osc->batch;
+  if (batch->buffers)
+    CFAllocatorDeallocate(osc->allocator, batch->buffers);
+  if (batch->lengths)
+    CFAllocatorDeallocate(osc->allocator, batch->lengths);
+#if defined(__linux__)
+  if (batch->messages)
+    CFAllocatorDeallocate(osc->allocator, batch->messages);
+  if (batch->iovecs)
+    CFAllocatorDeallocate(osc->allocator, batch->iovecs);
+#endif
+  memset(batch, 0, sizeof(__OSCBatch));
+}
+
+// Send all batched packets. On Linux it's a single sendmmsg call, plus one
+// for destinations of each address family, unless the kernel accepts only
+// part of the batch, elsewhere it falls back to sendto per packet. Packet which fails to send is dropped so the batch can't get
+// stuck.
+inline OSCResult __OSCBatchFlush(OSCRef osc) {
+  OSCResult result = kOSCResultSuccess;
+  __OSCBatch *batch = &osc->batch;
+#if defined(__linux__)
+  for (CFIndex j = 0; j < batch->count; j++) {
+    CFIndex i = (batch->head + j) % batch->capacity;
+    batch->iovecs[j].iov_base = batch->buffers + i * OSC_BATCH_BUFFER_LENGTH;
+    batch->iovecs[j].iov_len = batch->lengths[i];
+  }
+  if (__atomic_load_n(&osc->destinations.count, __ATOMIC_ACQUIRE) > 0)
+    result = __OSCDestinationsSend(osc, batch->iovecs, batch->count, 1);
+  for (CFIndex j = 0; j < batch->count && osc->sockfd && osc->p; j++) {
+    memset(&batch->messages[j], 0, sizeof(struct mmsghdr));
+    batch->messages[j].msg_hdr.msg_name = (void *)__OSCGetPeerAddress(osc);
+    batch->messages[j].msg_hdr.msg_namelen = __OSCGetPeerAddressLength(osc);
+    batch->messages[j].msg_hdr.msg_iov = &batch->iovecs[j];
+    batch->messages[j].msg_hdr.msg_iovlen = 1;
+  }
+  CFIndex sent = osc->sockfd && osc->p ? 0 : batch->count;
+  
+  // With io_uring the whole batch is queued and submitted at once
+  if (sent == 0 && __OSCUringCanSend(osc)) {
+    for (; sent < batch->count; sent++)
+      if (__OSCUringSend(osc, &batch->iovecs[sent], 1, false) != kOSCResultSuccess)
+        result = (OSCResult)-1;
+    if (__OSCUringFlush(osc) != kOSCResultSuccess)
+      result = (OSCResult)-1;
+  }
+  int flags = osc->queue.nonBlocking ? MSG_DONTWAIT : 0;
+  while (sent < batch->count) {
+    
+    // Keep the order behind packets which would block
+    if (osc->queue.nonBlocking && osc->queue.count > 0 && __OSCSendQueueDrain(osc) > 0) {
+      for (; sent < batch->count; sent++)
+        result = __OSCSendQueueEnqueue(osc, &batch->iovecs[sent], 1);
+      break;
+    }
+    UInt64 start = __OSCMetricsGetTime(osc);
+    int n = sendmmsg(osc->sockfd, batch->messages + sent, (unsigned int)(batch->count - sent), flags);
+    CFIndex bytes = 0;
+    for (int j = 0; j < n; j++)
+      bytes += batch->messages[sent + j].msg_len;
+    __OSCMetricsRecordSend(osc, n > 0, n, bytes, start);
+    if (n > 0) {
+      sent += n;
+    } else if (osc->queue.nonBlocking && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      for (; sent < batch->count; sent++)
+        result = __OSCSendQueueEnqueue(osc, &batch->iovecs[sent], 1);
+    } else {
+      sent++;
+      result = (OSCResult)-1;
+    }
+  }
+#else
+  for (CFIndex j = 0; j < batch->count; j++) {
+    CFIndex i = (batch->head + j) % batch->capacity;
+    if (__OSCSendRawBufferNow(osc, batch->buffers + i * OSC_BATCH_BUFFER_LENGTH, batch->lengths[i]) == -1)
+      result = (OSCResult)-1;
+  }
+#endif
+  batch->head = 0;
+  batch->count = 0;
+  return result;
+}
+
+// Enable batching with capacity packets per send call, 0 disables batching.
+// Pending packets are flushed before the batch is resized.
+inline OSCResult OSCSetBatchCapacity(OSCRef osc, CFIndex capacity) {
+  OSCResult result = kOSCResultNotAllocatedError;
+  if (osc && capacity >= 0) {
+    pthread_mutex_lock(&osc->sendLock);
+    if (osc->batch.count > 0)
+      __OSCBatchFlush(osc);
+    __OSCBatchDestroy(osc);
+    result = kOSCResultSuccess;
+    if (capacity > 0) {
+      __OSCBatch *batch = &osc->batch;
+      batch->buffers = CFAllocatorAllocate(osc->allocator, capacity * OSC_BATCH_BUFFER_LENGTH, 0);
+      batch->lengths = CFAllocatorAllocate(osc->allocator, capacity * sizeof(CFIndex), 0);
+#if defined(__linux__)
+      batch->messages = CFAllocatorAllocate(osc->allocator, capacity * sizeof(struct mmsghdr), 0);
+      batch->iovecs = CFAllocatorAllocate(osc->allocator, capacity * sizeof(struct iovec), 0);
+      if (batch->messages && batch->iovecs && batch->buffers && batch->lengths)
+#else
+      if (batch->buffers && batch->lengths)
+#endif
+        batch->capacity = capacity;
+      else {
+        __OSCBatchDestroy(osc);
+        result = kOSCResultNotAllocatedError;
+      }
+    }
+    pthread_mutex_unlock(&osc->sendLock);
+  }
+  return result;
+}
+
+inline CFIndex OSCGetBatchCapacity(OSCRef osc) {
+  return osc ? osc->batch.capacity : 0;
+}
+
+inline OSCResult OSCFlush(OSCRef osc) {
+  OSCResult result = kOSCResultNotAllocatedError;
+  if (osc) {
+    pthread_mutex_lock(&osc->sendLock);
+    result = kOSCResultSuccess;
+    if (osc->queue.count > 0 && osc->sockfd && osc->p && __OSCSendQueueDrain(osc) > 0)
+      result = kOSCResultQueued;
+    if (osc->batch.count > 0 && __OSCCanSend(osc))
+      result = __OSCBatchFlush(osc);
+    if (osc->stream.outputLength > 0 && osc->sockfd)
+      result = __OSCStreamFlush(osc);
+    if (osc->uring && __OSCUringFlush(osc) != kOSCResultSuccess)
+      result = -1;
+    pthread_mutex_unlock(&osc->sendLock);
+  }
+  return result;
+}
+
+// Number of packets sent and number of send syscalls used. Their ratio is
+// the average number of packets per syscall.
+inline void OSCGetSendStatistics(OSCRef osc, UInt64 *packetsCount, UInt64 *callsCount) {
+  if (packetsCount)
+    *packetsCount = osc ? __atomic_load_n(&osc->metrics.packetsCount, __ATOMIC_RELAXED) : 0;
+  if (callsCount)
+    *callsCount = osc ? __atomic_load_n(&osc->metrics.sendCallsCount, __ATOMIC_RELAXED) : 0;
+}
+
+#pragma mark Send queue
+
+inline void __OSCSendQueueDestroy(OSCRef osc) {
+  __OSCSendQueue *queue = &osc->queue;
+  if (queue->buffers)
+    CFAllocatorDeallocate(osc->allocator, queue->buffers);
+  if (queue->lengths)
+    CFAllocatorDeallocate(osc->allocator, queue->lengths);
+  if (queue->hashes)
+    CFAllocatorDeallocate(osc->allocator, queue->hashes);
+  queue->buffers = NULL;
+  queue->lengths = NULL;
+  queue->hashes = NULL;
+  queue->capacity = 0;
+  queue->head = 0;
+  queue->count = 0;
+}
+
+// Slots hold a whole bundle of the run loop timer or sender thread.
+inline CFIndex __OSCSendQueueGetSlotLength(OSCRef osc) {
+  return osc->maximumDatagramSize > OSC_BATCH_BUFFER_LENGTH ? osc->maximumDatagramSize : OSC_BATCH_BUFFER_LENGTH;
+}
+
+// Move queued packets, in order, to slots of a new length. Old slots are
+// kept if new ones can't be allocated.
+inline OSCResult __OSCSendQueueSetSlotLength(OSCRef osc, CFIndex slotLength) {
+  OSCResult result = kOSCResultSuccess;
+  __OSCSendQueue *queue = &osc->queue;
+  if (queue->capacity > 0 && slotLength != queue->slotLength) {
+    UInt8 *buffers = CFAllocatorAllocate(osc->allocator, queue->capacity * slotLength, 0);
+    if (buffers) {
+      CFIndex n = 0;
+      for (CFIndex i = 0; i < queue->count; i++) {
+        CFIndex j = (queue->head + i) % queue->capacity;
+        if (queue->lengths[j] <= slotLength) {
+          memcpy(buffers + n * slotLength, queue->buffers + j * queue->slotLength, queue->lengths[j]);
+          queue->lengths[n] = queue->lengths[j];
+          queue->hashes[n] = queue->hashes[j];
+          n++;
+        } else {
+          __OSCMetricsAdd(osc->metrics.droppedCount, 1);
+        }
+      }
+      CFAllocatorDeallocate(osc->allocator, queue->buffers);
+      queue->buffers = buffers;
+      queue->head = 0;
+      queue->count = n;
+    } else {
+      result = kOSCResultNotAllocatedError;
+    }
+  }
+  if (result == kOSCResultSuccess)
+    queue->slotLength = slotLength;
+  return result;
+}
+
+// Send queued packets until the socket would block again. Packet which
+// fails with other error is dropped. Returns number of packets left.
+inline CFIndex __OSCSendQueueDrain(OSCRef osc) {
+  __OSCSendQueue *queue = &osc->queue;
+  int flags = queue->nonBlocking ? MSG_DONTWAIT : 0;
+  while (queue->count > 0 && osc->sockfd && osc->p) {
+    UInt8 *buffer = queue->buffers + queue->head * queue->slotLength;
+    CFIndex length = queue->lengths[queue->head];
+    UInt64 start = __OSCMetricsGetTime(osc);
+    ssize_t sent = sendallto(osc->sockfd, buffer, length, flags, __OSCGetPeerAddress(osc), __OSCGetPeerAddressLength(osc));
+    __OSCMetricsRecordSend(osc, sent != -1, 1, sent, start);
+    if (sent == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+      break;
+    queue->head = (queue->head + 1) % queue->capacity;
+    queue->count--;
+  }
+  return queue->count;
+}
+
+// Copy packet gathered from iov to the queue applying overflow policy.
+inline OSCResult __OSCSendQueueEnqueue(OSCRef osc, const struct iovec *iov, int count) {
+  OSCResult result = kOSCResultDroppedError;
+  __OSCSendQueue *queue = &osc->queue;
+  CFIndex length = 0;
+  for (int i = 0; i < count; i++)
+    length += iov[i].iov_len;
+  if (queue->capacity > 0 && length <= queue->slotLength) {
+    
+    // Message address hash, address is 0 terminated and padded. Encoders
+    // always put the whole address in the first iovec.
+    const UInt8 *packet = count > 0 ? iov[0].iov_base : NULL;
+    UInt32 hash = 0;
+    CFIndex addressLength = 0;
+    if (queue->policy == kOSCOverflowPolicyCoalesce && count > 0 && iov[0].iov_len > 0 && packet[0] == '/') {
+      while (addressLength < (CFIndex)iov[0].iov_len && packet[addressLength])
+        addressLength++;
+      if (addressLength < (CFIndex)iov[0].iov_len)
+        hash = __OSCHash(packet, addressLength) | 1;
+    }
+    
+    CFIndex slot = -1;
+    for (CFIndex i = 0; hash && i < queue->count && slot < 0; i++) {
+      CFIndex j = (queue->head + i) % queue->capacity;
+      if (queue->hashes[j] == hash && queue->lengths[j] > addressLength && !memcmp(queue->buffers + j * queue->slotLength, packet, addressLength + 1)) {
+        slot = j;
+        __atomic_fetch_add(&osc->metrics.coalescedCount, 1, __ATOMIC_RELAXED);
+      }
+    }
+    if (slot < 0 && queue->count == queue->capacity && queue->policy != kOSCOverflowPolicyDropNewest) {
+      queue->head = (queue->head + 1) % queue->capacity;
+      queue->count--;
+      __OSCMetricsAdd(osc->metrics.droppedCount, 1);
+    }
+    if (slot < 0 && queue->count < queue->capacity) {
+      slot = (queue->head + queue->count++) % queue->capacity;
+      __OSCMetricsAdd(osc->metrics.queuedCount, 1);
+    }
+    if (slot >= 0) {
+      UInt8 *buffer = queue->buffers + slot * queue->slotLength;
+      for (int i = 0; i < count; i++) {
+        memcpy(buffer, iov[i].iov_base, iov[i].iov_len);
+        buffer += iov[i].iov_len;
+      }
+      queue->lengths[slot] = length;
+      queue->hashes[slot] = hash;
+      result = kOSCResultQueued;
+    }
+  }
+  if (result == kOSCResultDroppedError)
+    __OSCMetricsAdd(osc->metrics.droppedCount, 1);
+  return result;
+}
+
+// Send to connected host without blocking. Queued packets go first, a
+// packet which would block is queued.
+inline OSCResult __OSCSendQueueSend(OSCRef osc, const struct iovec *iov, int count) {
+  OSCResult result = kOSCResultSuccess;
+  if (osc->queue.count > 0)
+    __OSCSendQueueDrain(osc);
+  if (osc->queue.count > 0) {
+    result = __OSCSendQueueEnqueue(osc, iov, count);
+  } else {
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_name = (void *)__OSCGetPeerAddress(osc);
+    message.msg_namelen = __OSCGetPeerAddressLength(osc);
+    message.msg_iov = (struct iovec *)iov;
+    message.msg_iovlen = count;
+    UInt64 start = __OSCMetricsGetTime(osc);
+    ssize_t sent;
+    do {
+      sent = sendmsg(osc->sockfd, &message, MSG_DONTWAIT);
+    } while (sent == -1 && errno == EINTR);
+    __OSCMetricsRecordSend(osc, sent != -1, 1, sent, start);
+    if (sent == -1)
+      result = errno == EAGAIN || errno == EWOULDBLOCK ? __OSCSendQueueEnqueue(osc, iov, count) : -1;
+  }
+  return result;
+}
+
+// In non-blocking mode send calls never wait for socket buffer space. A
+// packet which doesn't fit is queued and the call returns kOSCResultQueued,
+// or kOSCResultDroppedError if it was dropped by overflow policy. Stream
+// connections always block.
+inline OSCResult OSCSetNonBlocking(OSCRef osc, bool nonBlocking) {
+  OSCResult result = kOSCResultNotAllocatedError;
+  if (osc && osc->stream.framing == kOSCFramingNone) {
+    pthread_mutex_lock(&osc->sendLock);
+    osc->queue.nonBlocking = nonBlocking;
+    if (!nonBlocking && osc->queue.count > 0)
+      __OSCSendQueueDrain(osc);
+    pthread_mutex_unlock(&osc->sendLock);
+    result = kOSCResultSuccess;
+  }
+  return result;
+}
+
+inline bool OSCGetNonBlocking(OSCRef osc) {
+  return osc ? osc->queue.nonBlocking : false;
+}
+
+// Queue for capacity packets of up to the larger of maximum datagram size
+// and OSC_BATCH_BUFFER_LENGTH bytes. Queued packets are dropped. With 0
+// capacity packets which would block are dropped.
+inline OSCResult OSCSetSendQueue(OSCRef osc, CFIndex capacity, OSCOverflowPolicy policy) {
+  OSCResult result = kOSCResultNotAllocatedError;
+  if (osc && capacity >= 0) {
+    __OSCSendQueue *queue = &osc->queue;
+    pthread_mutex_lock(&osc->sendLock);
+    __OSCMetricsAdd(osc->metrics.droppedCount, queue->count);
+    __OSCSendQueueDestroy(osc);
+    queue->policy = policy;
+    queue->slotLength = __OSCSendQueueGetSlotLength(osc);
+    result = kOSCResultSuccess;
+    if (capacity > 0) {
+      queue->buffers = CFAllocatorAllocate(osc->allocator, capacity * queue->slotLength, 0);
+      queue->lengths = CFAllocatorAllocate(osc->allocator, capacity * sizeof(CFIndex), 0);
+      queue->hashes = CFAllocatorAllocate(osc->allocator, capacity * sizeof(UInt32), 0);
+      if (queue->buffers && queue->lengths && queue->hashes) {
+        queue->capacity = capacity;
+      } else {
+        __OSCSendQueueDestroy(osc);
+        result = kOSCResultNotAllocatedError;
+      }
+    }
+    pthread_mutex_unlock(&osc->sendLock);
+  }
+  return result;
+}
+
+inline CFIndex OSCGetSendQueueCount(OSCRef osc) {
+  return osc ? osc->queue.count : 0;
+}
+
+#pragma mark Destinations
+
+// Called with the send lock held, resolved target is applied first.
+inline bool __OSCCanSend(OSCRef osc) {
+  if (__atomic_load_n(&osc->resolver.ready, __ATOMIC_ACQUIRE))
+    __OSCResolverApply(osc);
+  return (osc->sockfd && osc->p) || __atomic_load_n(&osc->destinations.count, __ATOMIC_ACQUIRE) > 0;
+}
+
+inline void __OSCDestinationsInit(__OSCDestinations *destinations) {
+  memset(destinations, 0, sizeof(__OSCDestinations));
+  pthread_mutex_init(&destinations->lock, NULL);
+}
+
+inline void __OSCDestinationsDestroy(OSCRef osc) {
+  __OSCDestinations *destinations = &osc->destinations;
+  if (destinations->items)
+    CFAllocatorDeallocate(osc->allocator, destinations->items);
+#if defined(__linux__)
+  if (destinations->messages)
+    CFAllocatorDeallocate(osc->allocator, destinations->messages);
+#endif
+  for (int i = 0; i < 2; i++)
+    if (destinations->sockfds[i])
+      close(destinations->sockfds[i]);
+  pthread_mutex_destroy(&destinations->lock);
+}
+
+// Socket shared by all destinations of the address family, created with
+// broadcast enabled and current multicast options.
+inline int __OSCDestinationsGetSocket(OSCRef osc, int family) {
+  __OSCDestinations *destinations = &osc->destinations;
+  int *sockfd = &destinations->sockfds[family == AF_INET6];
+  if (*sockfd == 0) {
+    int sockfd_ = socket(family, SOCK_DGRAM, 0);
+    if (sockfd_ > 0) {
+      int one = 1;
+      int loopback = destinations->multicastLoopback;
+      int hops = destinations->multicastHops;
+      if (family == AF_INET) {
+        unsigned char loopback_ = loopback, hops_ = hops;
+        setsockopt(sockfd_, SOL_SOCKET, SO_BROADCAST, &one, sizeof(one));
+        setsockopt(sockfd_, IPPROTO_IP, IP_MULTICAST_LOOP, &loopback_, sizeof(loopback_));
+        if (hops > 0)
+          setsockopt(sockfd_, IPPROTO_IP, IP_MULTICAST_TTL, &hops_, sizeof(hops_));
+      } else {
+        setsockopt(sockfd_, IPPROTO_IPV6, IPV6_MULTICAST_LOOP, &loopback, sizeof(loopback));
+        if (hops > 0)
+          setsockopt(sockfd_, IPPROTO_IPV6, IPV6_MULTICAST_HOPS, &hops, sizeof(hops));
+      }
+      *sockfd = sockfd_;
+    }
+  }
+  return *sockfd > 0 ? *sockfd : -1;
+}
+
+// Resolve host through the resolver cache.
+inline OSCResult __OSCDestinationsResolve(OSCRef osc, CFStringRef host, UInt16 port, __OSCDestination *destination) {
+  OSCResult result = kOSCResultInvalidAddressError;
+  char hostBuffer[OSC_RESOLVER_HOST_LENGTH];
+  if (CFStringGetCString(host, hostBuffer, sizeof(hostBuffer), kCFStringEncodingUTF8))
+    result = __OSCResolverResolve(osc, hostBuffer, port, destination);
+  return result;
+}
+
+// Send packetsCount packets, each gathered from iovecsPerPacket consecutive
+// iovecs, to all destinations. On Linux it's one sendmmsg per address family
+// for all packets and destinations, unless the kernel accepts only part of
+// them.
+inline OSCResult __OSCDestinationsSend(OSCRef osc, struct iovec *iov, CFIndex packetsCount, int iovecsPerPacket) {
+  OSCResult result = kOSCResultSuccess;
+  __OSCDestinations *destinations = &osc->destinations;
+  pthread_mutex_lock(&destinations->lock);
+#if defined(__linux__)
+  CFIndex required = destinations->count * packetsCount;
+  if (required > destinations->messagesCapacity) {
+    struct mmsghdr *messages = CFAllocatorReallocate(osc->allocator, destinations->messages, required * sizeof(struct mmsghdr), 0);
+    if (messages) {
+      destinations->messages = messages;
+      destinations->messagesCapacity = required;
+    } else {
+      required = 0;
+      result = kOSCResultNotAllocatedError;
+    }
+  }
+  for (int family = 0; family < 2 && required > 0; family++) {
+    CFIndex n = 0;
+    for (CFIndex i = 0; i < destinations->count; i++) {
+      __OSCDestination *destination = &destinations->items[i];
+      if ((destination->address.ss_family == AF_INET6) != family)
+        continue;
+      for (CFIndex j = 0; j < packetsCount; j++) {
+        struct mmsghdr *message = &destinations->messages[n++];
+        memset(message, 0, sizeof(struct mmsghdr));
+        message->msg_hdr.msg_name = &destination->address;
+        message->msg_hdr.msg_namelen = destination->length;
+        message->msg_hdr.msg_iov = iov + j * iovecsPerPacket;
+        message->msg_hdr.msg_iovlen = iovecsPerPacket;
+      }
+    }
+    int sockfd = n > 0 ? __OSCDestinationsGetSocket(osc, family ? AF_INET6 : AF_INET) : -1;
+    for (CFIndex sent = 0; sent < n && sockfd != -1; ) {
+      UInt64 start = __OSCMetricsGetTime(osc);
+      int m = sendmmsg(sockfd, destinations->messages + sent, (unsigned int)(n - sent), osc->queue.nonBlocking ? MSG_DONTWAIT : 0);
+      CFIndex bytes = 0;
+      for (int j = 0; j < m; j++)
+        bytes += destinations->messages[sent + j].msg_len;
+      __OSCMetricsRecordSend(osc, m > 0, m, bytes, start);
+      if (m > 0) {
+        sent += m;
+      } else {
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+          __OSCMetricsAdd(osc->metrics.droppedCount, 1);
+        sent++; // Drop datagram the kernel refused, eg. unreachable destination
+        result = (OSCResult)-1;
+      }
+    }
+  }
+#else
+  for (CFIndex i = 0; i < destinations->count; i++) {
+    __OSCDestination *destination = &destinations->items[i];
+    int sockfd = __OSCDestinationsGetSocket(osc, destination->address.ss_family);
+    for (CFIndex j = 0; j < packetsCount && sockfd != -1; j++) {
+      struct msghdr message;
+      memset(&message, 0, sizeof(message));
+      message.msg_name = &destination->address;
+      message.msg_namelen = destination->length;
+      message.msg_iov = iov + j * iovecsPerPacket;
+      message.msg_iovlen = iovecsPerPacket;
+      UInt64 start = __OSCMetricsGetTime(osc);
+      ssize_t sent = sendmsg(sockfd, &message, osc->queue.nonBlocking ? MSG_DONTWAIT : 0);
+      __OSCMetricsRecordSend(osc, sent != -1, 1, sent, start);
+      if (sent == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        __OSCMetricsAdd(osc->metrics.droppedCount, 1);
+      if (sent == -1)
+        result = (OSCResult)-1;
+    }
+  }
+#endif
+  pthread_mutex_unlock(&destinations->lock);
+  return result;
+}
+
+// Add datagram destination, host can be unicast, multicast group or
+// broadcast address. Adding existing destination has no effect.
+// Add resolved destination unless it's already there. Safe to call from
+// any thread.
+inline OSCResult __OSCDestinationsAdd(OSCRef osc, const __OSCDestination *destination) {
+  OSCResult result = kOSCResultSuccess;
+  __OSCDestinations *destinations = &osc->destinations;
+  pthread_mutex_lock(&destinations->lock);
+  CFIndex i = 0;
+  while (i < destinations->count && (destinations->items[i].length != destination->length || memcmp(&destinations->items[i].address, &destination->address, destination->length)))
+    i++;
+  if (i == destinations->count) {
+    if (destinations->count == destinations->capacity) {
+      CFIndex capacity = destinations->capacity ? destinations->capacity * 2 : 8;
+      __OSCDestination *items = CFAllocatorReallocate(osc->allocator, destinations->items, capacity * sizeof(__OSCDestination), 0);
+      if (items) {
+        destinations->items = items;
+        destinations->capacity = capacity;
+      }
+    }
+    if (destinations->count < destinations->capacity && __OSCDestinationsGetSocket(osc, destination->address.ss_family) != -1) {
+      destinations->items[destinations->count] = *destination;
+      __atomic_store_n(&destinations->count, destinations->count + 1, __ATOMIC_RELEASE);
+    } else {
+      result = kOSCResultNotAllocatedError;
+    }
+  }
+  pthread_mutex_unlock(&destinations->lock);
+  return result;
+}
+
+inline OSCResult OSCAddDestination(OSCRef osc, CFStringRef host, UInt16 port) {
+  OSCResult result = kOSCResultNotAllocatedError;
+  if (osc && host) {
+    __OSCDestination destination;
+    result = __OSCDestinationsResolve(osc, host, port, &destination);
+    if (result == kOSCResultSuccess)
+      result = __OSCDestinationsAdd(osc, &destination);
+  }
+  return result;
+}
+
+// Add destination without waiting for DNS. Cached address is added right
+// away, otherwise it's added by the resolver thread and returns
+// kOSCResultQueued. Unresolvable hosts are reported to diagnostic callback.
+inline OSCResult OSCAddDestinationAsync(OSCRef osc, CFStringRef host, UInt16 port) {
+  OSCResult result = kOSCResultNotAllocatedError;
+  char hostBuffer[OSC_RESOLVER_HOST_LENGTH];
+  if (osc && host && CFStringGetCString(host, hostBuffer, sizeof(hostBuffer), kCFStringEncodingUTF8)) {
+    __OSCResolver *resolver = &osc->resolver;
+    __OSCDestination destination;
+    if (__OSCResolverFind(resolver, hostBuffer, port, &destination)) {
+      result = __OSCDestinationsAdd(osc, &destination);
+    } else {
+      pthread_mutex_lock(&resolver->lock);
+      if (resolver->pendingCount == resolver->pendingCapacity) {
+        CFIndex capacity = resolver->pendingCapacity ? resolver->pendingCapacity * 2 : 8;
+        __OSCResolverEntry *pending = CFAllocatorReallocate(osc->allocator, resolver->pending, capacity * sizeof(__OSCResolverEntry), 0);
+        if (pending) {
+          resolver->pending = pending;
+          resolver->pendingCapacity = capacity;
+        }
+      }
+      if (resolver->pendingCount < resolver->pendingCapacity) {
+        __OSCResolverEntry *entry = &resolver->pending[resolver->pendingCount++];
+        memset(entry, 0, sizeof(__OSCResolverEntry));
+        memcpy(entry->host, hostBuffer, sizeof(entry->host));
+        entry->port = port;
+        result = kOSCResultQueued;
+      }
+      pthread_mutex_unlock(&resolver->lock);
+      if (result == kOSCResultQueued && !__OSCResolverStart(osc))
+        result = kOSCResultNotAllocatedError;
+    }
+  }
+  return result;
+}
+
+inline OSCResult OSCRemoveDestination(OSCRef osc, CFStringRef host, UInt16 port) {
+  OSCResult result = kOSCResultNotAllocatedError;
+  if (osc && host) {
+    __OSCDestination destination;
+    result = __OSCDestinationsResolve(osc, host, port, &destination);
+    if (result == kOSCResultSuccess) {
+      __OSCDestinations *destinations = &osc->destinations;
+      result = kOSCResultInvalidAddressError;
+      pthread_mutex_lock(&destinations->lock);
+      for (CFIndex i = 0; i < destinations->count; i++) {
+        if (destinations->items[i].length == destination.length && !memcmp(&destinations->items[i].address, &destination.address, destination.length)) {
+          memmove(destinations->items + i, destinations->items + i + 1, (destinations->count - i - 1) * sizeof(__OSCDestination));
+          __atomic_store_n(&destinations->count, destinations->count - 1, __ATOMIC_RELEASE);
+          result = kOSCResultSuccess;
+          break;
+        }
+      }
+      pthread_mutex_unlock(&destinations->lock);
+    }
+  }
+  return result;
+}
+
+inline void OSCRemoveAllDestinations(OSCRef osc) {
+  if (osc) {
+    pthread_mutex_lock(&osc->destinations.lock);
+    __atomic_store_n(&osc->destinations.count, 0, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&osc->destinations.lock);
+  }
+}
+
+inline CFIndex OSCGetDestinationsCount(OSCRef osc) {
+  return osc ? __atomic_load_n(&osc->destinations.count, __ATOMIC_ACQUIRE) : 0;
+}
+
+// Multicast TTL (IPv4) and hop limit (IPv6) of destination sockets.
+inline OSCResult OSCSetMulticastHops(OSCRef osc, int hops) {
+  OSCResult result = kOSCResultNotAllocatedError;
+  if (osc && hops > 0 && hops < 256) {
+    __OSCDestinations *destinations = &osc->destinations;
+    unsigned char hops_ = hops;
+    pthread_mutex_lock(&destinations->lock);
+    destinations->multicastHops = hops;
+    if (destinations->sockfds[0])
+      setsockopt(destinations->sockfds[0], IPPROTO_IP, IP_MULTICAST_TTL, &hops_, sizeof(hops_));
+    if (destinations->sockfds[1])
+      setsockopt(destinations->sockfds[1], IPPROTO_IPV6, IPV6_MULTICAST_HOPS, &hops, sizeof(hops));
+    pthread_mutex_unlock(&destinations->lock);
+    result = kOSCResultSuccess;
+  }
+  return result;
+}
+
+// Whether multicast packets are looped back to this host, off by default.
+inline OSCResult OSCSetMulticastLoopback(OSCRef osc, bool loopback) {
+  OSCResult result = kOSCResultNotAllocatedError;
+  if (osc) {
+    __OSCDestinations *destinations = &osc->destinations;
+    unsigned char loopback4 = loopback;
+    int loopback6 = loopback;
+    pthread_mutex_lock(&destinations->lock);
+    destinations->multicastLoopback = loopback;
+    if (destinations->sockfds[0])
+      setsockopt(destinations->sockfds[0], IPPROTO_IP, IP_MULTICAST_LOOP, &loopback4, sizeof(loopback4));
+    if (destinations->sockfds[1])
+      setsockopt(destinations->sockfds[1], IPPROTO_IPV6, IPV6_MULTICAST_LOOP, &loopback6, sizeof(loopback6));
+    pthread_mutex_unlock(&destinations->lock);
+    result = kOSCResultSuccess;
+  }
+  return result;
+}
+
+#pragma mark Resolver
+
+inline void __OSCResolverInit(__OSCResolver *resolver) {
+  memset(resolver, 0, sizeof(__OSCResolver));
+  pthread_mutex_init(&resolver->lock, NULL);
+  pthread_cond_init(&resolver->condition, NULL);
+  resolver->ttl = OSC_RESOLVER_TTL;
+}
+
+inline void __OSCResolverDestroy(OSCRef osc) {
+  __OSCResolver *resolver = &osc->resolver;
+  if (resolver->started) {
+    pthread_mutex_lock(&resolver->lock);
+    resolver->stopping = true;
+    pthread_cond_signal(&resolver->condition);
+    pthread_mutex_unlock(&resolver->lock);
+    pthread_join(resolver->thread, NULL);
+    resolver->started = false;
+  }
+  resolver->ready = false;
+  if (resolver->entries)
+    CFAllocatorDeallocate(osc->allocator, resolver->entries);
+  if (resolver->pending)
+    CFAllocatorDeallocate(osc->allocator, resolver->pending);
+  pthread_cond_destroy(&resolver->condition);
+  pthread_mutex_destroy(&resolver->lock);
+}
+
+// Blocking getaddrinfo, first IPv4 or IPv6 address of host.
+inline OSCResult __OSCResolverLookup(const char *host, UInt16 port, __OSCDestination *address) {
+  OSCResult result = kOSCResultInvalidAddressError;
+  char portBuffer[16];
+  struct addrinfo hints, *info = NULL;
+  snprintf(portBuffer, sizeof(portBuffer), "%i", port);
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_DGRAM;
+  hints.ai_flags = AI_NUMERICSERV;
+  if (getaddrinfo(host, portBuffer, &hints, &info) == 0) {
+    for (struct addrinfo *p = info; p && result != kOSCResultSuccess; p = p->ai_next) {
+      if (p->ai_addrlen <= sizeof(address->address) && (p->ai_family == AF_INET || p->ai_family == AF_INET6)) {
+        memset(address, 0, sizeof(__OSCDestination));
+        memcpy(&address->address, p->ai_addr, p->ai_addrlen);
+        address->length = p->ai_addrlen;
+        result = kOSCResultSuccess;
+      }
+    }
+    freeaddrinfo(info);
+  }
+  return result;
+}
+
+// Cached address of host which hasn't expired yet.
+inline bool __OSCResolverFind(__OSCResolver *resolver, const char *host, UInt16 port, __OSCDestination *address) {
+  bool result = false;
+  CFAbsoluteTime now = CFAbsoluteTimeGetCurrent();
+  pthread_mutex_lock(&resolver->lock);
+  for (CFIndex i = 0; i < resolver->count && !result; i++) {
+    __OSCResolverEntry *entry = &resolver->entries[i];
+    if (entry->port == port && entry->expires > now && !strcmp(entry->host, host)) {
+      *address = entry->address;
+      result = true;
+    }
+  }
+  pthread_mutex_unlock(&resolver->lock);
+  return result;
+}
+
+// Cache resolved address for ttl seconds, called with lock held.
+inline void __OSCResolverStore(OSCRef osc, const char *host, UInt16 port, const __OSCDestination *address) {
+  __OSCResolver *resolver = &osc->resolver;
+  if (resolver->ttl > 0) {
+    CFIndex i = 0;
+    while (i < resolver->count && (resolver->entries[i].port != port || strcmp(resolver->entries[i].host, host)))
+      i++;
+    if (i == resolver->count && resolver->count == resolver->capacity) {
+      CFIndex capacity = resolver->capacity ? resolver->capacity * 2 : 8;
+      __OSCResolverEntry *entries = CFAllocatorReallocate(osc->allocator, resolver->entries, capacity * sizeof(__OSCResolverEntry), 0);
+      if (entries) {
+        resolver->entries = entries;
+        resolver->capacity = capacity;
+      }
+    }
+    if (i < resolver->capacity) {
+      __OSCResolverEntry *entry = &resolver->entries[i];
+      if (i == resolver->count) {
+        resolver->count++;
+        memset(entry, 0, sizeof(__OSCResolverEntry));
+        strncpy(entry->host, host, sizeof(entry->host) - 1);
+        entry->port = port;
+      }
+      entry->address = *address;
+      entry->expires = CFAbsoluteTimeGetCurrent() + resolver->ttl;
+    }
+  }
+}
+
+// Cached address or blocking lookup stored in the cache.
+inline OSCResult __OSCResolverResolve(OSCRef osc, const char *host, UInt16 port, __OSCDestination *address) {
+  OSCResult result = kOSCResultSuccess;
+  if (!__OSCResolverFind(&osc->resolver, host, port, address)) {
+    result = __OSCResolverLookup(host, port, address);
+    if (result == kOSCResultSuccess) {
+      pthread_mutex_lock(&osc->resolver.lock);
+      __OSCResolverStore(osc, host, port, address);
+      pthread_mutex_unlock(&osc->resolver.lock);
+    } else {
+      __OSCDiagnostic(osc, result, 0, "can't resolve %s:%i", host, port);
+    }
+  }
+  return result;
+}
+
+// Remember connection target. Pending target is resolved by the resolver
+// thread, empty host clears it.
+inline void __OSCResolverSetTarget(OSCRef osc, const char *host, UInt16 port, bool pending) {
+  __OSCResolver *resolver = &osc->resolver;
+  pthread_mutex_lock(&resolver->lock);
+  memset(&resolver->target, 0, sizeof(__OSCResolverEntry));
+  strncpy(resolver->target.host, host, sizeof(resolver->target.host) - 1);
+  resolver->target.port = port;
+  resolver->target.expires = CFAbsoluteTimeGetCurrent() + resolver->ttl;
+  resolver->targetPending = pending && host[0];
+  __atomic_store_n(&resolver->ready, false, __ATOMIC_RELEASE);
+  pthread_cond_signal(&resolver->condition);
+  pthread_mutex_unlock(&resolver->lock);
+}
+
+inline bool __OSCResolverStart(OSCRef osc) {
+  __OSCResolver *resolver = &osc->resolver;
+  pthread_mutex_lock(&resolver->lock);
+  if (!resolver->started) {
+    resolver->stopping = false;
+    resolver->started = pthread_create(&resolver->thread, NULL, __OSCResolverThreadMain, osc) == 0;
+  }
+  pthread_cond_signal(&resolver->condition);
+  pthread_mutex_unlock(&resolver->lock);
+  return resolver->started;
+}
+
+// Sleep until there's work or the target expires, called with lock held.
+// Target which failed to resolve is retried even without caching.
+inline void __OSCResolverWait(__OSCResolver *resolver) {
+  if (resolver->target.host[0] && (resolver->ttl > 0 || resolver->target.address.length == 0)) {
+    CFTimeInterval delay = resolver->target.expires - CFAbsoluteTimeGetCurrent();
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    if (delay > 0) {
+      deadline.tv_sec += (time_t)delay;
+      deadline.tv_nsec += (long)((delay - (time_t)delay) * 1e9);
+      if (deadline.tv_nsec >= 1000000000) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+      }
+    }
+    pthread_cond_timedwait(&resolver->condition, &resolver->lock, &deadline);
+  } else {
+    pthread_cond_wait(&resolver->condition, &resolver->lock);
+  }
+}
+
+// Resolves pending target and destinations, and the target again when it
+// expires. New target address is handed over to the sending thread only if
+// it changed.
+inline void *__OSCResolverThreadMain(void *info) {
+  OSCRef osc = info;
+  __OSCResolver *resolver = &osc->resolver;
+  pthread_mutex_lock(&resolver->lock);
+  while (!resolver->stopping) {
+    bool refresh = resolver->target.host[0] && !resolver->targetPending &&
+                   (resolver->ttl > 0 || resolver->target.address.length == 0) &&
+                   resolver->target.expires <= CFAbsoluteTimeGetCurrent();
+    if (resolver->targetPending || refresh) {
+      __OSCResolverEntry target = resolver->target;
+      __OSCDestination address;
+      resolver->targetPending = false;
+      pthread_mutex_unlock(&resolver->lock);
+      OSCResult result = __OSCResolverLookup(target.host, target.port, &address);
+      if (result != kOSCResultSuccess && !refresh)
+        __OSCDiagnostic(osc, result, 0, "can't resolve %s:%i", target.host, target.port);
+      pthread_mutex_lock(&resolver->lock);
+      
+      // Skip the result if target has been changed meanwhile.
+      if (!resolver->targetPending && resolver->target.port == target.port && !strcmp(resolver->target.host, target.host)) {
+        if (result == kOSCResultSuccess) {
+          __OSCResolverStore(osc, target.host, target.port, &address);
+          if (!refresh || address.length != target.address.length || memcmp(&address.address, &target.address.address, address.length)) {
+            resolver->resolved = address;
+            __atomic_store_n(&resolver->ready, true, __ATOMIC_RELEASE);
+          }
+          resolver->target.address = address;
+          resolver->target.expires = CFAbsoluteTimeGetCurrent() + resolver->ttl;
+        } else {
+          resolver->target.address.length = 0;
+          resolver->target.expires = CFAbsoluteTimeGetCurrent() + OSC_RESOLVER_RETRY_INTERVAL;
+        }
+      }
+    } else if (resolver->pendingCount > 0) {
+      __OSCResolverEntry entry = resolver->pending[0];
+      memmove(resolver->pending, resolver->pending + 1, --resolver->pendingCount * sizeof(__OSCResolverEntry));
+      pthread_mutex_unlock(&resolver->lock);
+      OSCResult result = __OSCResolverLookup(entry.host, entry.port, &entry.address);
+      if (result == kOSCResultSuccess)
+        __OSCDestinationsAdd(osc, &entry.address);
+      else
+        __OSCDiagnostic(osc, result, 0, "can't resolve %s:%i", entry.host, entry.port);
+      pthread_mutex_lock(&resolver->lock);
+      if (result == kOSCResultSuccess)
+        __OSCResolverStore(osc, entry.host, entry.port, &entry.address);
+    } else {
+      __OSCResolverWait(resolver);
+    }
+  }
+  pthread_mutex_unlock(&resolver->lock);
+  return NULL;
+}
+
+// Connect to target address resolved by the resolver thread. Socket and
+// peer are replaced under the send lock, so no other thread is sending
+// through them meanwhile.
+inline void __OSCResolverApply(OSCRef osc) {
+  __OSCResolver *resolver = &osc->resolver;
+  __OSCDestination address;
+  bool ready;
+  pthread_mutex_lock(&osc->sendLock);
+  pthread_mutex_lock(&resolver->lock);
+  ready = resolver->ready;
+  address = resolver->resolved;
+  __atomic_store_n(&resolver->ready, false, __ATOMIC_RELEASE);
+  pthread_mutex_unlock(&resolver->lock);
+  if (ready)
+    __OSCConnectAddress(osc, &address);
+  pthread_mutex_unlock(&osc->sendLock);
+}
+
+// Seconds resolved hosts are reused, OSC_RESOLVER_TTL by default. With 0
+// every connect and destination resolves its host again.
+inline void OSCSetResolverTTL(OSCRef osc, CFTimeInterval ttl) {
+  if (osc) {
+    __OSCResolver *resolver = &osc->resolver;
+    pthread_mutex_lock(&resolver->lock);
+    resolver->ttl = ttl > 0 ? ttl : 0;
+    if (resolver->ttl == 0)
+      resolver->count = 0;
+    pthread_cond_signal(&resolver->condition);
+    pthread_mutex_unlock(&resolver->lock);
+  }
+}
+
+inline void OSCFlushResolverCache(OSCRef osc) {
+  if (osc) {
+    pthread_mutex_lock(&osc->resolver.lock);
+    osc->resolver.count = 0;
+    pthread_mutex_unlock(&osc->resolver.lock);
+  }
+}
+
+#pragma mark Pool allocator
+
+// Every block starts with a 16 byte header holding its usable size, so the
+// returned memory keeps malloc alignment.
+#define __OSC_POOL_HEADER_LENGTH 16
+
+static __thread __OSCPoolCache *__OSCPoolThreadCache = NULL;
+static pthread_key_t __OSCPoolKey;
+static pthread_once_t __OSCPoolOnce = PTHREAD_ONCE_INIT;
+static CFAllocatorRef __OSCPoolAllocator = NULL;
+
+// Size class fitting size, -1 if it's larger than the largest class.
+inline CFIndex __OSCPoolGetClass(CFIndex size) {
+  CFIndex result = 0;
+  while (result < OSC_POOL_CLASSES_LENGTH && ((CFIndex)1 << (result + OSC_POOL_MINIMUM_SHIFT)) < size)
+    result++;
+  return result < OSC_POOL_CLASSES_LENGTH ? result : -1;
+}
+
+inline __OSCPoolCache *__OSCPoolGetCache(void) {
+  if (__OSCPoolThreadCache == NULL) {
+    __OSCPoolThreadCache = calloc(1, sizeof(__OSCPoolCache));
+    if (__OSCPoolThreadCache)
+      pthread_setspecific(__OSCPoolKey, __OSCPoolThreadCache); // Freed on thread exit
+  }
+  return __OSCPoolThreadCache;
+}
+
+inline void __OSCPoolCacheDestroy(void *info) {
+  __OSCPoolCache *cache = info;
+  for (CFIndex i = 0; i < OSC_POOL_CLASSES_LENGTH; i++) {
+    while (cache->heads[i]) {
+      __OSCPoolBlock *block = cache->heads[i];
+      cache->heads[i] = block->next;
+      free((UInt8 *)block - __OSC_POOL_HEADER_LENGTH);
+    }
+  }
+  if (cache == __OSCPoolThreadCache)
+    __OSCPoolThreadCache = NULL;
+  free(cache);
+}
+
+inline void *__OSCPoolAllocate(CFIndex size, CFOptionFlags hint, void *info) {
+  (void)hint; (void)info;
+  UInt8 *result = NULL;
+  CFIndex class = __OSCPoolGetClass(size);
+  if (class >= 0) {
+    __OSCPoolCache *cache = __OSCPoolGetCache();
+    if (cache && cache->heads[class]) {
+      __OSCPoolBlock *block = cache->heads[class];
+      cache->heads[class] = block->next;
+      cache->counts[class]--;
+      return block;
+    }
+    size = (CFIndex)1 << (class + OSC_POOL_MINIMUM_SHIFT);
+  }
+  if ((result = malloc(__OSC_POOL_HEADER_LENGTH + size))) {
+    *(CFIndex *)result = size;
+    result += __OSC_POOL_HEADER_LENGTH;
+  }
+  return result;
+}
+
+inline void *__OSCPoolReallocate(void *pointer, CFIndex size, CFOptionFlags hint, void *info) {
+  if (pointer == NULL)
+    return __OSCPoolAllocate(size, hint, info);
+  void *result = pointer;
+  CFIndex capacity = *(CFIndex *)((UInt8 *)pointer - __OSC_POOL_HEADER_LENGTH);
+  if (size > capacity && (result = __OSCPoolAllocate(size, hint, info))) {
+    memcpy(result, pointer, capacity);
+    __OSCPoolDeallocate(pointer, info);
+  }
+  return result;
+}
+
+// Small blocks go to this thread's cache unless it's full.
+inline void __OSCPoolDeallocate(void *pointer, void *info) {
+  (void)info;
+  CFIndex size = *(CFIndex *)((UInt8 *)pointer - __OSC_POOL_HEADER_LENGTH);
+  CFIndex class = __OSCPoolGetClass(size);
+  __OSCPoolCache *cache = class >= 0 && ((CFIndex)1 << (class + OSC_POOL_MINIMUM_SHIFT)) == size ? __OSCPoolGetCache() : NULL;
+  if (cache && cache->counts[class] < OSC_POOL_CACHE_LENGTH) {
+    __OSCPoolBlock *block = pointer;
+    block->next = cache->heads[class];
+    cache->heads[class] = block;
+    cache->counts[class]++;
+  } else {
+    free((UInt8 *)pointer - __OSC_POOL_HEADER_LENGTH);
+  }
+}
+
+inline CFIndex __OSCPoolPreferredSize(CFIndex size, CFOptionFlags hint, void *info) {
+  (void)hint; (void)info;
+  CFIndex class = __OSCPoolGetClass(size);
+  return class >= 0 ? (CFIndex)1 << (class + OSC_POOL_MINIMUM_SHIFT) : size;
+}
+
+inline void __OSCPoolInit(void) {
+  CFAllocatorContext context;
+  memset(&context, 0, sizeof(context));
+  context.allocate = __OSCPoolAllocate;
+  context.reallocate = __OSCPoolReallocate;
+  context.deallocate = __OSCPoolDeallocate;
+  context.preferredSize = __OSCPoolPreferredSize;
+  pthread_key_create(&__OSCPoolKey, __OSCPoolCacheDestroy);
+  __OSCPoolAllocator = CFAllocatorCreate(kCFAllocatorDefault, &context);
+}
+
+// Process wide allocator with thread local free lists of small blocks.
+// Once warmed up, steady allocate/deallocate traffic of an OSCRef created
+// with it doesn't reach malloc. Blocks larger than the largest size class
+// are passed to malloc.
+inline CFAllocatorRef OSCGetPoolAllocator(void) {
+  pthread_once(&__OSCPoolOnce, __OSCPoolInit);
+  return __OSCPoolAllocator;
+}
+
+#pragma mark Capture
+
+inline UInt64 __OSCCaptureGetTime(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return (UInt64)t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+// Make room for length more bytes, growing the file and remapping it in
+// OSC_CAPTURE_CHUNK_LENGTH steps.
+inline bool __OSCCaptureReserve(__OSCCapture *capture, CFIndex length) {
+  bool result = true;
+  if (capture->length + length > capture->capacity) {
+    CFIndex capacity = capture->capacity + OSC_CAPTURE_CHUNK_LENGTH;
+    while (capture->length + length > capacity)
+      capacity += OSC_CAPTURE_CHUNK_LENGTH;
+    result = false;
+    if (ftruncate(capture->fd, capacity) == 0) {
+      void *bytes = mmap(NULL, capacity, PROT_READ | PROT_WRITE, MAP_SHARED, capture->fd, 0);
+      if (bytes != MAP_FAILED) {
+        if (capture->bytes)
+          munmap(capture->bytes, capture->capacity);
+        capture->bytes = bytes;
+        capture->capacity = capacity;
+        result = true;
+      }
+    }
+  }
+  return result;
+}
+
+// Append packet gathered from iov as a single record.
+inline void __OSCCaptureAppend(OSCRef osc, const struct iovec *iov, int count) {
+  __OSCCapture *capture = osc->capture;
+  CFIndex length = 0;
+  for (int i = 0; i < count; i++)
+    length += iov[i].iov_len;
+  CFIndex paddedLength = (length + 3) & ~(CFIndex)3;
+  pthread_mutex_lock(&capture->lock);
+  if (__OSCCaptureReserve(capture, sizeof(__OSCCaptureRecord) + paddedLength)) {
+    UInt8 *bytes = capture->bytes + capture->length;
+    __OSCCaptureRecord record = {
+      CFSwapInt64HostToBig(__OSCCaptureGetTime()),
+      CFSwapInt32HostToBig(capture->destinationId),
+      CFSwapInt32HostToBig((UInt32)length)
+    };
+    memcpy(bytes, &record, sizeof(record));
+    bytes += sizeof(record);
+    for (int i = 0; i < count; i++) {
+      memcpy(bytes, iov[i].iov_base, iov[i].iov_len);
+      bytes += iov[i].iov_len;
+    }
+    memset(bytes, 0, paddedLength - length);
+    capture->length += sizeof(record) + paddedLength;
+  } else {
+    __OSCDiagnostic(osc, -1, errno, "can't grow capture file, %s", strerror(errno));
+  }
+  pthread_mutex_unlock(&capture->lock);
+}
+
+// Log every sent packet to file at path, tagged with destinationId. Packets
+// are recorded as they are handed over for sending, before batching, send
+// queue and destinations fan-out. Capture must not be started or stopped
+// while another thread is sending.
+inline OSCResult OSCStartCapture(OSCRef osc, const char *path, UInt32 destinationId) {
+  OSCResult result = kOSCResultNotAllocatedError;
+  if (osc && path && !osc->capture) {
+    __OSCCapture *capture = CFAllocatorAllocate(osc->allocator, sizeof(__OSCCapture), 0);
+    if (capture) {
+      memset(capture, 0, sizeof(__OSCCapture));
+      capture->destinationId = destinationId;
+      pthread_mutex_init(&capture->lock, NULL);
+      capture->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+      if (capture->fd != -1 && __OSCCaptureReserve(capture, sizeof(__OSCCaptureHeader))) {
+        __OSCCaptureHeader header = {
+          { 'C', 'o', 'r', 'e', 'O', 'S', 'C', 0 },
+          CFSwapInt32HostToBig(OSC_CAPTURE_VERSION),
+          CFSwapInt32HostToBig(sizeof(__OSCCaptureRecord))
+        };
+        memcpy(capture->bytes, &header, sizeof(header));
+        capture->length = sizeof(header);
+        pthread_mutex_lock(&osc->sendLock);
+        osc->capture = capture;
+        pthread_mutex_unlock(&osc->sendLock);
+        result = kOSCResultSuccess;
+      } else {
+        result = -1;
+        __OSCDiagnostic(osc, result, errno, "can't create capture file %s, %s", path, strerror(errno));
+        if (capture->fd != -1)
+          close(capture->fd);
+        pthread_mutex_destroy(&capture->lock);
+        CFAllocatorDeallocate(osc->allocator, capture);
+      }
+    }
+  }
+  return result;
+}
+
+// Unmap capture file and truncate it to the length of recorded packets.
+inline OSCResult OSCStopCapture(OSCRef osc) {
+  OSCResult result = kOSCResultNotAllocatedError;
+  __OSCCapture *capture = NULL;
+  if (osc) {
+    pthread_mutex_lock(&osc->sendLock);
+    capture = osc->capture;
+    osc->capture = NULL;
+    pthread_mutex_unlock(&osc->sendLock);
+  }
+  if (capture) {
+    result = kOSCResultSuccess;
+    munmap(capture->bytes, capture->capacity);
+    if (ftruncate(capture->fd, capture->length) == -1 || close(capture->fd) == -1)
+      result = -1;
+    pthread_mutex_destroy(&capture->lock);
+    CFAllocatorDeallocate(osc->allocator, capture);
+  }
+  return result;
+}
+
+inline bool OSCIsCapturing(OSCRef osc) {
+  return osc && osc->capture;
+}
+
+// Send packets of capture file at path again. With speed > 0 packets keep
+// their original spacing divided by speed, eg. 1 for original timing or 10
+// for 10x faster. With speed 0 packets are sent as fast as possible.
+// Packets are batched, if batching is off it's enabled for the replay.
+// destinationId selects recorded packets, kOSCCaptureAllDestinations
+// replays all. A record of 0 length ends the log, which is what the
+// unused tail of a file not stopped cleanly looks like.
+inline OSCResult OSCReplayCapture(OSCRef osc, const char *path, double speed, UInt32 destinationId, UInt64 *packetsCount) {
+  OSCResult result = kOSCResultNotAllocatedError;
+  UInt64 count = 0;
+  if (osc && path && speed >= 0) {
+    int fd = open(path, O_RDONLY);
+    struct stat info;
+    UInt8 *bytes = MAP_FAILED;
+    if (fd != -1 && fstat(fd, &info) == 0 && info.st_size >= (off_t)sizeof(__OSCCaptureHeader))
+      bytes = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (bytes != MAP_FAILED) {
+      CFIndex size = info.st_size;
+      __OSCCaptureHeader header;
+      memcpy(&header, bytes, sizeof(header));
+      CFIndex recordHeaderLength = CFSwapInt32BigToHost(header.recordHeaderLength);
+      result = kOSCResultMalformedPacketError;
+      if (memcmp(header.magic, "CoreOSC", 8) == 0 && CFSwapInt32BigToHost(header.version) == OSC_CAPTURE_VERSION && recordHeaderLength >= (CFIndex)sizeof(__OSCCaptureRecord) && recordHeaderLength % 4 == 0) {
+        CFIndex batchCapacity = OSCGetBatchCapacity(osc);
+        if (batchCapacity == 0)
+          OSCSetBatchCapacity(osc, OSC_REPLAY_BATCH_CAPACITY);
+        result = kOSCResultSuccess;
+        UInt64 start = __OSCCaptureGetTime();
+        UInt64 first = 0;
+        CFIndex offset = sizeof(header);
+        while (offset + recordHeaderLength <= size) {
+          __OSCCaptureRecord record;
+          memcpy(&record, bytes + offset, sizeof(record));
+          CFIndex length = CFSwapInt32BigToHost(record.length);
+          if (length == 0)
+            break;
+          if (offset + recordHeaderLength + ((length + 3) & ~(CFIndex)3) > size) {
+            result = kOSCResultMalformedPacketError;
+            break;
+          }
+          UInt64 time = CFSwapInt64BigToHost(record.time);
+          if (count == 0)
+            first = time;
+          if (destinationId == kOSCCaptureAllDestinations || destinationId == CFSwapInt32BigToHost(record.destinationId)) {
+            if (speed > 0 && time > first) {
+              UInt64 due = start + (UInt64)((time - first) / speed);
+              UInt64 now = __OSCCaptureGetTime();
+              if (due > now) {
+                OSCFlush(osc);
+                now = __OSCCaptureGetTime();
+                if (due > now) {
+                  struct timespec delay = { (time_t)((due - now) / 1000000000), (long)((due - now) % 1000000000) };
+                  nanosleep(&delay, NULL);
+                }
+              }
+            }
+            OSCResult sent = OSCSendRawBuffer(osc, bytes + offset + recordHeaderLength, length);
+            if (sent < 0)
+              result = sent;
+            count++;
+          }
+          offset += recordHeaderLength + ((length + 3) & ~(CFIndex)3);
+        }
+        OSCFlush(osc);
+        if (batchCapacity == 0)
+          OSCSetBatchCapacity(osc, 0);
+      }
+      munmap(bytes, size);
+    } else {
+      result = -1;
+      __OSCDiagnostic(osc, result, errno, "can't open capture file %s, %s", path, strerror(errno));
+    }
+    if (fd != -1)
+      close(fd);
+  }
+  if (packetsCount)
+    *packetsCount = count;
+  return result;
+}
+
+#pragma mark io_uring transport
+
+#if defined(OSC_IO_URING)
+
+// Create ring with entries submission entries and map it, cqEntries 0 uses
+// the kernel default of twice the entries.
+inline bool __OSCUringInit(__OSCUring *ring, unsigned entries, unsigned cqEntries, unsigned flags) {
+  struct io_uring_params params;
+  memset(ring, 0, sizeof(__OSCUring));
+  memset(&params, 0, sizeof(params));
+  params.flags = flags | (cqEntries ? IORING_SETUP_CQSIZE : 0);
+  params.cq_entries = cqEntries;
+  params.sq_thread_idle = OSC_URING_IDLE_MS;
+  ring->fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+  if (ring->fd == -1) {
+    ring->fd = 0;
+    return false;
+  }
+  
+  // Both rings share one mapping since 5.4, older kernels are not supported
+  if (!(params.features & IORING_FEAT_SINGLE_MMAP)) {
+    __OSCUringDestroy(ring);
+    errno = ENOSYS;
+    return false;
+  }
+  ring->flags = params.flags;
+  ring->entries = params.sq_entries;
+  ring->ringLength = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  if (ring->ringLength < params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe))
+    ring->ringLength = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  ring->sqesLength = params.sq_entries * sizeof(struct io_uring_sqe);
+  ring->ring = mmap(NULL, ring->ringLength, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+  ring->sqes = mmap(NULL, ring->sqesLength, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+  if (ring->ring == MAP_FAILED || ring->sqes == MAP_FAILED) {
+    __OSCUringDestroy(ring);
+    return false;
+  }
+  UInt8 *bytes = ring->ring;
+  ring->sqHead = (unsigned *)(bytes + params.sq_off.head);
+  ring->sqTail = (unsigned *)(bytes + params.sq_off.tail);
+  ring->sqMask = (unsigned *)(bytes + params.sq_off.ring_mask);
+  ring->sqFlags = (unsigned *)(bytes + params.sq_off.flags);
+  ring->sqArray = (unsigned *)(bytes + params.sq_off.array);
+  ring->cqHead = (unsigned *)(bytes + params.cq_off.head);
+  ring->cqTail = (unsigned *)(bytes + params.cq_off.tail);
+  ring->cqMask = (unsigned *)(bytes + params.cq_off.ring_mask);
+  ring->cqes = (struct io_uring_cqe *)(bytes + params.cq_off.cqes);
+  return true;
+}
+
+inline void __OSCUringDestroy(__OSCUring *ring) {
+  if (ring->sqes && ring->sqes != MAP_FAILED)
+    munmap(ring->sqes, ring->sqesLength);
+  if (ring->ring && ring->ring != MAP_FAILED)
+    munmap(ring->ring, ring->ringLength);
+  if (ring->fd > 0)
+    close(ring->fd);
+  memset(ring, 0, sizeof(__OSCUring));
+}
+
+// Next submission entry, zeroed, or NULL if the queue is full. It's handed
+// to the kernel by __OSCUringQueue once it's filled in.
+inline struct io_uring_sqe *__OSCUringGetSQE(__OSCUring *ring) {
+  struct io_uring_sqe *sqe = NULL;
+  unsigned tail = *ring->sqTail;
+  if (tail - __atomic_load_n(ring->sqHead, __ATOMIC_ACQUIRE) < ring->entries) {
+    sqe = &ring->sqes[tail & *ring->sqMask];
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+  }
+  return sqe;
+}
+
+inline void __OSCUringQueue(__OSCUring *ring) {
+  unsigned tail = *ring->sqTail;
+  ring->sqArray[tail & *ring->sqMask] = tail & *ring->sqMask;
+  __atomic_store_n(ring->sqTail, tail + 1, __ATOMIC_RELEASE);
+}
+
+// Submit queued entries and wait for at least wait completions, at most
+// timeout us if it's positive. Kernel thread of polled ring picks entries
+// up by itself, the syscall is needed only to wake it up after it went
+// idle or to wait. Fails with ETIME on timeout.
+inline int __OSCUringSubmit(__OSCUring *ring, unsigned wait, CFIndex timeout) {
+  struct __kernel_timespec timespec = { timeout / 1000000, (timeout % 1000000) * 1000 };
+  struct io_uring_getevents_arg argument;
+  memset(&argument, 0, sizeof(argument));
+  argument.ts = (UInt64)(uintptr_t)&timespec;
+  int n = 0;
+  do {
+    unsigned queued = *ring->sqTail - __atomic_load_n(ring->sqHead, __ATOMIC_ACQUIRE);
+    unsigned submit = queued;
+    unsigned flags = wait ? IORING_ENTER_GETEVENTS : 0;
+    if (wait && timeout > 0)
+      flags |= IORING_ENTER_EXT_ARG;
+    if (ring->flags & IORING_SETUP_SQPOLL) {
+      submit = 0;
+      __atomic_thread_fence(__ATOMIC_SEQ_CST);
+      if (queued > 0 && (__atomic_load_n(ring->sqFlags, __ATOMIC_RELAXED) & IORING_SQ_NEED_WAKEUP))
+        flags |= IORING_ENTER_SQ_WAKEUP;
+    }
+    if (submit == 0 && flags == 0)
+      return 0;
+    if (ring->callsCount)
+      __atomic_fetch_add(ring->callsCount, 1, __ATOMIC_RELAXED);
+    n = (int)syscall(__NR_io_uring_enter, ring->fd, submit, wait, flags,
+                     flags & IORING_ENTER_EXT_ARG ? &argument : NULL,
+                     flags & IORING_ENTER_EXT_ARG ? sizeof(argument) : 0);
+  } while (n == -1 && errno == EINTR);
+  return n;
+}
+
+#endif
+
+// Set up ring, registered send buffer and send slots. Fails on kernels
+// without io_uring or with io_uring disabled, eg. by seccomp or
+// kernel.io_uring_disabled. Polled transport falls back to plain ring if
+// the kernel thread can't be started.
+inline bool __OSCUringSenderCreate(OSCRef osc, OSCTransport transport) {
+  bool result = false;
+#if defined(OSC_IO_URING)
+  __OSCUringSender *sender = CFAllocatorAllocate(osc->allocator, sizeof(__OSCUringSender), 0);
+  UInt8 *buffers = CFAllocatorAllocate(osc->allocator, OSC_URING_ENTRIES * OSC_BATCH_BUFFER_LENGTH, 0);
+  if (sender && buffers) {
+    memset(sender, 0, sizeof(__OSCUringSender));
+    sender->buffers = buffers;
+    sender->registeredfd = -1;
+    bool initialized = transport == kOSCTransportIOUringPolled && __OSCUringInit(&sender->ring, OSC_URING_ENTRIES, 0, IORING_SETUP_SQPOLL);
+    if (!initialized)
+      initialized = __OSCUringInit(&sender->ring, OSC_URING_ENTRIES, 0, 0);
+    struct iovec iov = { buffers, OSC_URING_ENTRIES * OSC_BATCH_BUFFER_LENGTH };
+    if (initialized && syscall(__NR_io_uring_register, sender->ring.fd, IORING_REGISTER_BUFFERS, &iov, 1) == 0) {
+      for (CFIndex i = 0; i < OSC_URING_ENTRIES; i++)
+        sender->slots[i] = (UInt16)(OSC_URING_ENTRIES - 1 - i);
+      sender->slotsCount = OSC_URING_ENTRIES;
+      sender->ring.callsCount = &osc->metrics.sendCallsCount;
+      osc->uring = sender;
+      osc->transport = sender->ring.flags & IORING_SETUP_SQPOLL ? kOSCTransportIOUringPolled : kOSCTransportIOUring;
+      result = true;
+    } else if (initialized) {
+      __OSCUringDestroy(&sender->ring);
+    }
+  }
+  if (!result) {
+    if (sender)
+      CFAllocatorDeallocate(osc->allocator, sender);
+    if (buffers)
+      CFAllocatorDeallocate(osc->allocator, buffers);
+  }
+#endif
+  return result;
+}
+
+inline void __OSCUringSenderDestroy(OSCRef osc) {
+#if defined(OSC_IO_URING)
+  if (osc->uring) {
+    __OSCUringDrain(osc);
+    __OSCUringDestroy(&osc->uring->ring);
+    CFAllocatorDeallocate(osc->allocator, osc->uring->buffers);
+    CFAllocatorDeallocate(osc->allocator, osc->uring);
+    osc->uring = NULL;
+    osc->transport = kOSCTransportSocket;
+  }
+#endif
+}
+
+// Connected datagram socket registered with the ring. Streams and
+// sockets which failed to connect go through the socket path.
+inline bool __OSCUringCanSend(OSCRef osc) {
+#if defined(OSC_IO_URING)
+  return osc->uring && osc->sockfd && osc->p && osc->peerConnected && osc->uring->registeredfd == osc->sockfd;
+#else
+  return false;
+#endif
+}
+
+// Give slots of completed writes back and count them, never blocks.
+inline CFIndex __OSCUringReap(OSCRef osc) {
+  CFIndex count = 0;
+#if defined(OSC_IO_URING)
+  __OSCUringSender *sender = osc->uring;
+  if (sender) {
+    __OSCUring *ring = &sender->ring;
+    CFIndex bytes = 0;
+    CFIndex errors = 0;
+    unsigned head = *ring->cqHead;
+    unsigned tail = __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE);
+    for (; head != tail; head++, count++) {
+      struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cqMask];
+      sender->slots[sender->slotsCount++] = (UInt16)cqe->user_data;
+      if (cqe->res >= 0) {
+        bytes += cqe->res;
+      } else {
+        int errnum = -cqe->res;
+        errors++;
+        __OSCMetricsAdd(osc->metrics.sendErrors[errnum < OSC_METRICS_ERRNO_LENGTH ? errnum : 0], 1);
+        __OSCDiagnostic(osc, -1, errnum, "send failed, %s", strerror(errnum));
+      }
+    }
+    __atomic_store_n(ring->cqHead, head, __ATOMIC_RELEASE);
+    if (count > 0) {
+      __OSCMetricsAdd(osc->metrics.packetsCount, count - errors);
+      __OSCMetricsAdd(osc->metrics.bytesCount, bytes);
+      __OSCMetricsAdd(osc->metrics.sendErrorsCount, errors);
+    }
+  }
+#endif
+  return count;
+}
+
+// Submit queued writes and wait for all of them, before the socket changes
+// or slots are released.
+inline void __OSCUringDrain(OSCRef osc) {
+#if defined(OSC_IO_URING)
+  if (osc->uring) {
+    __OSCUringReap(osc);
+    while (osc->uring->slotsCount < OSC_URING_ENTRIES && __OSCUringSubmit(&osc->uring->ring, 1, 0) != -1)
+      __OSCUringReap(osc);
+  }
+#endif
+}
+
+// Register connected datagram socket as fixed file 0, or clear the entry
+// once the socket is closed, so a new socket which reuses the descriptor
+// number is registered again.
+inline void __OSCUringSetSocket(OSCRef osc) {
+#if defined(OSC_IO_URING)
+  __OSCUringSender *sender = osc->uring;
+  int fd = osc->sockfd && osc->p && osc->peerConnected && osc->stream.framing == kOSCFramingNone ? osc->sockfd : -1;
+  if (sender && fd != sender->registeredfd) {
+    __OSCUringDrain(osc);
+    struct io_uring_files_update update;
+    memset(&update, 0, sizeof(update));
+    update.fds = (UInt64)(uintptr_t)&fd;
+    if (syscall(__NR_io_uring_register, sender->ring.fd, IORING_REGISTER_FILES_UPDATE, &update, 1) == 1 ||
+        (fd != -1 && syscall(__NR_io_uring_register, sender->ring.fd, IORING_REGISTER_FILES, &fd, 1) == 0)) {
+      sender->registeredfd = fd;
+    } else {
+      sender->registeredfd = -1;
+      __OSCDiagnostic(osc, -1, errno, "can't register socket with io_uring, using socket, %s", strerror(errno));
+    }
+  }
+#endif
+}
+
+// Copy packet gathered from iov to a free slot and queue its write, which
+// is submitted right away unless submit is false, eg. for all but the last
+// packet of a batch. Completions are reaped on later sends and flushes,
+// nothing waits for them unless all slots are in flight. Packets longer
+// than a slot are sent with sendmsg once the queue is drained, to keep the
+// order.
+inline OSCResult __OSCUringSend(OSCRef osc, const struct iovec *iov, int count, bool submit) {
+  OSCResult result = kOSCResultNotAllocatedError;
+#if defined(OSC_IO_URING)
+  __OSCUringSender *sender = osc->uring;
+  CFIndex length = 0;
+  for (int i = 0; i < count; i++)
+    length += iov[i].iov_len;
+  if (length > OSC_BATCH_BUFFER_LENGTH) {
+    __OSCUringDrain(osc);
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = (struct iovec *)iov;
+    message.msg_iovlen = count;
+    UInt64 start = __OSCMetricsGetTime(osc);
+    ssize_t sent = sendmsg(osc->sockfd, &message, 0);
+    __OSCMetricsRecordSend(osc, sent != -1, 1, sent, start);
+    return sent == -1 ? -1 : kOSCResultSuccess;
+  }
+  __OSCUringReap(osc);
+  while (sender->slotsCount == 0 && __OSCUringSubmit(&sender->ring, 1, 0) != -1)
+    __OSCUringReap(osc);
+  struct io_uring_sqe *sqe = sender->slotsCount > 0 ? __OSCUringGetSQE(&sender->ring) : NULL;
+  if (sqe) {
+    UInt16 slot = sender->slots[--sender->slotsCount];
+    UInt8 *buffer = sender->buffers + slot * OSC_BATCH_BUFFER_LENGTH;
+    CFIndex offset = 0;
+    for (int i = 0; i < count; i++) {
+      memcpy(buffer + offset, iov[i].iov_base, iov[i].iov_len);
+      offset += iov[i].iov_len;
+    }
+    sqe->opcode = IORING_OP_WRITE_FIXED;
+    sqe->flags = IOSQE_FIXED_FILE;
+    sqe->fd = 0;
+    sqe->addr = (UInt64)(uintptr_t)buffer;
+    sqe->len = (UInt32)length;
+    sqe->buf_index = 0;
+    sqe->user_data = slot;
+    __OSCUringQueue(&sender->ring);
+    result = kOSCResultSuccess;
+    if (submit && __OSCUringSubmit(&sender->ring, 0, 0) == -1)
+      result = -1;
+  } else {
+    result = -1;
+  }
+  if (result == -1)
+    __OSCDiagnostic(osc, result, errno, "can't submit send, %s", strerror(errno));
+#endif
+  return result;
+}
+
+// Submit queued writes without waiting and reap completed ones.
+inline OSCResult __OSCUringFlush(OSCRef osc) {
+  OSCResult result = kOSCResultSuccess;
+#if defined(OSC_IO_URING)
+  if (osc->uring) {
+    if (__OSCUringSubmit(&osc->uring->ring, 0, 0) == -1)
+      result = -1;
+    __OSCUringReap(osc);
+  }
+#endif
+  return result;
+}
+
+// Create with io_uring transport. Sends are queued to the kernel without
+// blocking and receive server workers keep multishot receives armed. Falls
+// back to kOSCTransportSocket if io_uring is not available, see
+// OSCGetTransport.
+inline OSCRef OSCCreateWithTransport(CFAllocatorRef allocator, void *userInfo, OSCTransport transport) {
+  OSCRef osc = OSCCreateWithUserInfo(allocator, userInfo);
+  if (osc && transport != kOSCTransportSocket)
+    __OSCUringSenderCreate(osc, transport);
+  return osc;
+}
+
+// Transport in use, which can differ from the requested one after fallback.
+inline OSCTransport OSCGetTransport(OSCRef osc) {
+  return osc ? osc->transport : kOSCTransportSocket;
+}
+
+#pragma mark Metrics
+
+// Monotonic time in ns if timing is enabled, 0 otherwise.
+inline UInt64 __OSCMetricsGetTime(OSCRef osc) {
+  UInt64 result = 0;
+  if (osc->metricsTiming) {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    result = (UInt64)time.tv_sec * 1000000000 + time.tv_nsec;
+  }
+  return result;
+}
+
+inline void __OSCMetricsRecordTime(UInt64 *histogram, UInt64 start) {
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  UInt64 duration = (UInt64)time.tv_sec * 1000000000 + time.tv_nsec - start;
+  int i = 63 - __builtin_clzll(duration | 1);
+  if (i >= OSC_METRICS_HISTOGRAM_LENGTH)
+    i = OSC_METRICS_HISTOGRAM_LENGTH - 1;
+  __OSCMetricsAdd(histogram[i], 1);
+}
+
+// Record send syscall, errno is read on failure. Start is 0 if timing is
+// disabled.
+inline void __OSCMetricsRecordSend(OSCRef osc, bool success, CFIndex packets, CFIndex bytes, UInt64 start) {
+  OSCMetrics *metrics = &osc->metrics;
+  if (start)
+    __OSCMetricsRecordTime(metrics->sendTimes, start);
+  __OSCMetricsAdd(metrics->sendCallsCount, 1);
+  if (success) {
+    __OSCMetricsAdd(metrics->packetsCount, packets);
+    __OSCMetricsAdd(metrics->bytesCount, bytes);
+  } else {
+    int errnum = errno;
+    __OSCMetricsAdd(metrics->sendErrorsCount, 1);
+    __OSCMetricsAdd(metrics->sendErrors[errnum > 0 && errnum < OSC_METRICS_ERRNO_LENGTH ? errnum : 0], 1);
+    if (osc->diagnosticCallBack && errnum != EAGAIN && errnum != EWOULDBLOCK)
+      __OSCDiagnostic(osc, -1, errnum, "send failed, %s", strerror(errnum));
+  }
+}
+
+inline void __OSCDiagnostic(OSCRef osc, OSCResult result, int errnum, const char *format, ...) {
+  if (osc->diagnosticCallBack) {
+    char message[256];
+    va_list arguments;
+    va_start(arguments, format);
+    vsnprintf(message, sizeof(message), format, arguments);
+    va_end(arguments);
+    osc->diagnosticCallBack(osc, result, errnum, message, osc->diagnosticCallBackInfo);
+  }
+}
+
+// Copy all counters, cheap enough to be called on every frame from any
+// thread.
+inline void OSCGetMetrics(OSCRef osc, OSCMetrics *metrics) {
+  if (metrics) {
+    UInt64 *source = osc ? (UInt64 *)&osc->metrics : NULL;
+    UInt64 *destination = (UInt64 *)metrics;
+    for (size_t i = 0; i < sizeof(OSCMetrics) / sizeof(UInt64); i++)
+      destination[i] = source ? __atomic_load_n(&source[i], __ATOMIC_RELAXED) : 0;
+  }
+}
+
+// Should be called on the sending thread or while nothing is being sent.
+inline void OSCResetMetrics(OSCRef osc) {
+  if (osc) {
+    UInt64 *counters = (UInt64 *)&osc->metrics;
+    for (size_t i = 0; i < sizeof(OSCMetrics) / sizeof(UInt64); i++)
+      __atomic_store_n(&counters[i], 0, __ATOMIC_RELAXED);
+  }
+}
+
+// Encode and send time histograms, off by default. Each measurement is a
+// clock_gettime call, counters don't depend on it.
+inline void OSCSetMetricsTiming(OSCRef osc, bool enabled) {
+  if (osc)
+    osc->metricsTiming = enabled;
+}
+
+inline void OSCSetDiagnosticCallBack(OSCRef osc, OSCDiagnosticCallBack callBack, void *info) {
+  if (osc) {
+    osc->diagnosticCallBack = callBack;
+    osc->diagnosticCallBackInfo = info;
+  }
+}
+
+#pragma mark Pre-encoded addresses
+
+inline OSCResult OSCSendTrueWithHandle(OSCRef osc, OSCAddressHandle handle) {
+  OSCResult result = kOSCResultNotAllocatedError;
+  if (osc) {
+    const OSCAddress *address = OSCAddressesGetAddress(osc, handle);
+    result = address ? __OSCSendTrueWithAddress(osc, address) : kOSCResultInvalidHandleError;
+  }
+  return result;
+}
+
+inline OSCResult OSCSendFalseWithHandle(OSCRef osc, OSCAddressHandle handle) {
+  OSCResult result = kOSCResultNotAllocatedError;
+  if (osc) {
+    const OSCAddress *address = OSCAddressesGetAddress(osc, handle);
+    result = address ? __OSCSendFalseWithAddress(osc, address) : kOSCResultInvalidHandleError;
+  }
+  return result;
+}
+
+inline OSCResult OSCSendBoolWithHandle(OSCRef osc, OSCAddressHandle handle, bool value) {
+  return value ? OSCSendTrueWithHandle(osc, handle) : OSCSendFalseWithHandle(osc, handle);
+}
+
+inline OSCResult OSCSendFloat32WithHandle(OSCRef osc, OSCAddressHandle handle, Float32 value) {
+  OSCResult result = kOSCResultNotAllocatedError;
+  if (osc) {
+    const OSCAddress *address = OSCAddressesGetAddress(osc, handle);
+    result = address ? __OSCSendFloat32WithAddress(osc, address, value) : kOSCResultInvalidHandleError;
+  }
+  return result;
+}
+
+inline OSCResult OSCSendFloats32WithHandle(OSCRef osc, OSCAddressHandle handle, const Float32 *values, CFIndex n) {
+  return __OSCSendArrayWithHandle(osc, handle, 'f', values, n);
+}
+
+inline OSCResult OSCSendBlobWithHandle(OSCRef osc, OSCAddressHandle handle, const void *bytes, CFIndex length) {
+  OSCResult result = kOSCResultNotAllocatedError;
+  if (osc && (bytes || length == 0)) {
+    const OSCAddress *address = OSCAddressesGetAddress(osc, handle);
+    result = address ? __OSCSendBlobWithAddress(osc, address, bytes, length) : kOSCResultInvalidHandleError;
+  }
+  return result;
+}
+
+inline OSCResult OSCSendDataWithHandle(OSCRef osc, OSCAddressHandle handle, CFDataRef value) {
+  OSCResult result = kOSCResultNotAllocatedError;
+  if (osc && value) {
+    CFRetain(value);
+    result = OSCSendBlobWithHandle(osc, handle, CFDataGetBytePtr(value), CFDataGetLength(value));
+    CFRelease(value);
+  }
+  return result;
+}
+
+inline OSCResult OSCSendArgumentsWithHandle(OSCRef osc, OSCAddressHandle handle, const char *typeTags, const OSCArgumentValue *values) {
+  OSCResult result = kOSCResultNotAllocatedError;
+  if (osc && typeTags) {
+    const OSCAddress *address = OSCAddressesGetAddress(osc, handle);
+    result = address ? __OSCSendArgumentsWithAddress(osc, address, typeTags, values) : kOSCResultInvalidHandleError;
+  }
+  return result;
+}
+
+inline OSCResult OSCSendFloats64WithHandle(OSCRef osc, OSCAddressHandle handle, const Float64 *values, CFIndex n) {
+  return __OSCSendArrayWithHandle(osc, handle, 'd', values, n);
+}
+
+inline OSCResult OSCSendSInts32WithHandle(OSCRef osc, OSCAddressHandle handle, const SInt32 *values, CFIndex n) {
+  return __OSCSendArrayWithHandle(osc, handle, 'i', values, n);
+}
+
+inline OSCResult OSCSendSInts64WithHandle(OSCRef osc, OSCAddressHandle handle, const SInt64 *values, CFIndex n) {
+  return __OSCSendArrayWithHandle(osc, handle, 'h', values, n);
+}
+
+inline OSCResult OSCSendSInt32WithHandle(OSCRef osc, OSCAddressHandle handle, SInt32 value) {
+  OSCResult result = kOSCResultNotAllocatedError;
+  if (osc) {
+    const OSCAddress *address = OSCAddressesGetAddress(osc, handle);
+    result = address ? __OSCSendSInt32WithAddress(osc, address, value) : kOSCResultInvalidHandleError;
+  }
+  return result;
+}
+
+inline OSCResult OSCSendCStringWithHandle(OSCRef osc, OSCAddressHandle handle, const UInt8 *value) {
+  OSCResult result = kOSCResultNotAllocatedError;
+  if (osc && value) {
+    const OSCAddress *address = OSCAddressesGetAddress(osc, handle);
+    result = address ? __OSCSendCStringWithAddress(osc, address, value) : kOSCResultInvalidHandleError;
+  }
+  return result;
+}
+
+#pragma mark Receiving - packet views
+
+// Length of zero terminated, 32bit padded string starting at bytes or -1 if
+// there is no terminator within length bytes.
+inline CFIndex __OSCGetPaddedStringLength(const UInt8 *bytes, CFIndex length) {
+  const UInt8 *terminator = memchr(bytes, 0, length);
+  CFIndex n = -1;
+  if (terminator) {
+    n = __OSCGet32BitAlignedLength(terminator - bytes + 1);
+    if (n > length)
+      n = -1;
+  }
+  return n;
+}
+
+inline SInt32 __OSCReadSInt32(const UInt8 *bytes) {
+  uint32_t value;
+  memcpy(&value, bytes, sizeof(uint32_t));
+  return (SInt32)CFSwapInt32BigToHost(value);
+}
+
+inline UInt64 __OSCReadUInt64(const UInt8 *bytes) {
+  uint64_t value;
+  memcpy(&value, bytes, sizeof(uint64_t));
+  return CFSwapInt64BigToHost(value);
+}
+
+// Parse packet in place. Returned view has kOSCPacketTypeInvalid type if
+// the bytes are not a valid OSC message or bundle.
+inline OSCPacketView OSCPacketViewMake(const void *bytes, CFIndex length) {
+  OSCPacketView packet;
+  memset(&packet, 0, sizeof(packet));
+  const UInt8 *b = bytes;
+  if (b && length >= 4 && length % 4 == 0) {
+    if (b[0] == '/') {
+      CFIndex n = __OSCGetPaddedStringLength(b, length);
+      if (n > 0) {
+        packet.message.address = (const char *)b;
+        packet.message.addressLength = strlen((const char *)b);
+        if (n < length && b[n] == ',') {
+          CFIndex m = __OSCGetPaddedStringLength(b + n, length - n);
+          if (m > 0) {
+            packet.message.typeTags = (const char *)b + n + 1;
+            packet.message.typeTagsLength = strlen(packet.message.typeTags);
+            n += m;
+          } else {
+            n = -1;
+          }
+        } else {
+          packet.message.typeTags = "";
+          packet.message.typeTagsLength = 0;
+        }
+        if (n > 0) {
+          packet.message.arguments = b + n;
+          packet.message.argumentsLength = length - n;
+          packet.type = kOSCPacketTypeMessage;
+        }
+      }
+    } else if (length >= 16 && memcmp(b, "#bundle\0", 8) == 0) {
+      packet.bundle.timeTag = __OSCReadUInt64(b + 8);
+      packet.bundle.elements = b + 16;
+      packet.bundle.elementsLength = length - 16;
+      packet.type = kOSCPacketTypeBundle;
+    }
+  }
+  if (packet.type != kOSCPacketTypeInvalid) {
+    packet.bytes = b;
+    packet.length = length;
+  }
+  return packet;
+}
+
+inline OSCArgumentIterator OSCArgumentIteratorMake(const OSCMessageView *message) {
+  OSCArgumentIterator iterator = { message, 0, 0, false };
+  return iterator;
+}
+
+// Decode next argument. Returns false at the end of arguments or if the
+// message is malformed (iterator->malformed is set in that case).
+inline bool OSCArgumentIteratorNext(OSCArgumentIterator *iterator, OSCArgument *argument) {
+  bool result = false;
+  if (iterator && argument && !iterator->malformed && iterator->typeTagIndex < iterator->message->typeTagsLength) {
+    const UInt8 *b = iterator->message->arguments + iterator->offset;
+    CFIndex left = iterator->message->argumentsLength - iterator->offset;
+    CFIndex n = -1;
+    argument->type = iterator->message->typeTags[iterator->typeTagIndex];
+    switch (argument->type) {
+      case 'i':
+        if (left >= 4) {
+          argument->value.i = __OSCReadSInt32(b);
+          n = 4;
+        }
+        break;
+      case 'f':
+        if (left >= 4) {
+          CFSwappedFloat32 swapped;
+          memcpy(&swapped, b, sizeof(CFSwappedFloat32));
+          argument->value.f = CFConvertFloat32SwappedToHost(swapped);
+          n = 4;
+        }
+        break;
+      case 'c':
+        if (left >= 4) {
+          argument->value.c = (char)__OSCReadSInt32(b);
+          n = 4;
+        }
+        break;
+      case 'r':
+        if (left >= 4) {
+          argument->value.r = (UInt32)__OSCReadSInt32(b);
+          n = 4;
+        }
+        break;
+      case 'm':
+        if (left >= 4) {
+          memcpy(argument->value.m, b, 4);
+          n = 4;
+        }
+        break;
+      case 'h':
+        if (left >= 8) {
+          argument->value.h = (SInt64)__OSCReadUInt64(b);
+          n = 8;
+        }
+        break;
+      case 't':
+        if (left >= 8) {
+          argument->value.t = __OSCReadUInt64(b);
+          n = 8;
+        }
+        break;
+      case 'd':
+        if (left >= 8) {
+          UInt64 value = __OSCReadUInt64(b);
+          memcpy(&argument->value.d, &value, sizeof(Float64));
+          n = 8;
+        }
+        break;
+      case 's':
+      case 'S':
+        if ((n = __OSCGetPaddedStringLength(b, left)) > 0) {
+          argument->value.s.pointer = (const char *)b;
+          argument->value.s.length = strlen((const char *)b);
+        }
+        break;
+      case 'b':
+        if (left >= 4) {
+          
+          // Size is checked before rounding, so hostile sizes can't overflow
+          CFIndex size = __OSCReadSInt32(b);
+          if (size >= 0 && size <= left - 4 && (size + 3) / 4 * 4 <= left - 4) {
+            argument->value.b.pointer = b + 4;
+            argument->value.b.length = size;
+            n = 4 + (size + 3) / 4 * 4;
+          }
+        }
+        break;
+      case 'T':
+      case 'F':
+      case 'N':
+      case 'I':
+      case '[':
+      case ']':
+        n = 0;
+        break;
+    }
+    if (n >= 0) {
+      iterator->offset += n;
+      iterator->typeTagIndex++;
+      result = true;
+    } else {
+      iterator->malformed = true;
+    }
+  }
+  return result;
+}
+
+inline OSCBundleIterator OSCBundleIteratorMake(const OSCBundleView *bundle) {
+  OSCBundleIterator iterator = { bundle, 0, false };
+  return iterator;
+}
+
+// Parse next bundle element, which is a message or a nested bundle.
+inline bool OSCBundleIteratorNext(OSCBundleIterator *iterator, OSCPacketView *element) {
+  bool result = false;
+  if (iterator && element && !iterator->malformed) {
+    CFIndex left = iterator->bundle->elementsLength - iterator->offset;
+    if (left >= 4) {
+      const UInt8 *b = iterator->bundle->elements + iterator->offset;
+      SInt32 size = __OSCReadSInt32(b);
+      if (size > 0 && size <= left - 4) {
+        *element = OSCPacketViewMake(b + 4, size);
+        if (element->type != kOSCPacketTypeInvalid) {
+          iterator->offset += 4 + size;
+          result = true;
+        }
+      }
+      if (!result)
+        iterator->malformed = true;
+    } else if (left != 0) {
+      iterator->malformed = true;
+    }
+  }
+  return result;
+}
+
+#pragma mark Receiving
+
+inline void OSCSetMessageCallBack(OSCRef osc, OSCMessageCallBack callBack, void *info) {
+  if (osc) {
+    osc->messageCallBack = callBack;
+    osc->messageCallBackInfo = info;
+  }
+}
+
+// Deliver packet to methods and message callback. Bundles with future time
+// tags go to the scheduler if it's active and schedule is true.
+inline OSCResult __OSCReceivePacketView(OSCRef osc, const OSCPacketView *packet, OSCTimeTag timeTag, CFIndex depth, bool schedule) {
+  OSCResult result = kOSCResultSuccess;
+  if (packet->type == kOSCPacketTypeMessage) {
+    if (osc->methods)
+      OSCDispatchMessage(osc, &packet->message, timeTag);
+    if (osc->messageCallBack)
+      osc->messageCallBack(osc, &packet->message, timeTag, osc->messageCallBackInfo);
+  } else if (packet->type == kOSCPacketTypeBundle) {
+    
+    // Bundles in ticks the wheel already released or due by the clock are
+    // delivered now
+    OSCTimeTag now = 0;
+    if (schedule && osc->scheduler && packet->bundle.timeTag != kOSCTimeTagImmediately && (packet->bundle.timeTag >> OSC_SCHEDULER_TICK_SHIFT) >= osc->scheduler->tick)
+      now = OSCTimeTagMakeWithAbsoluteTime(CFAbsoluteTimeGetCurrent());
+    if (now && packet->bundle.timeTag > now) {
+      result = __OSCSchedulerScheduleBundle(osc, packet, now);
+    } else if (depth < OSC_MAXIMUM_BUNDLE_DEPTH) {
+      OSCBundleIterator iterator = OSCBundleIteratorMake(&packet->bundle);
+      OSCPacketView element;
+      while (result == kOSCResultSuccess && OSCBundleIteratorNext(&iterator, &element))
+        result = __OSCReceivePacketView(osc, &element, packet->bundle.timeTag, depth + 1, schedule);
+      if (result == kOSCResultSuccess && iterator.malformed)
+        result = kOSCResultMalformedPacketError;
+    } else {
+      result = kOSCResultBundleTooDeepError;
+    }
+  } else {
+    result = kOSCResultMalformedPacketError;
+  }
+  return result;
+}
+
+// Decode received datagram in place and deliver all messages to the message
+// callback. Messages outside of bundles get kOSCTimeTagImmediately.
+inline OSCResult OSCReceiveRawBuffer(OSCRef osc, const void *buffer, CFIndex length) {
   OSCResult result = kOSCResultNotAllocatedError;
-  if (osc && name && value) {
-    Float32 value_ = 0;
-    CFNumberGetValue(value, kCFNumberFloat32Type, &value_);
-    result = OSCSendFloat32(osc, name, value_);
+  if (osc && buffer) {
+    OSCPacketView packet = OSCPacketViewMake(buffer, length);
+    result = __OSCReceivePacketView(osc, &packet, kOSCTimeTagImmediately, 0, true);
+  }
+  return result;
+}
+
+inline OSCResult OSCReceiveRawBufferWithData(OSCRef osc, CFDataRef data) {
+  OSCResult result = kOSCResultNotAllocatedError;
+  if (osc)
+    if (data)
+      result = OSCReceiveRawBuffer(osc, CFDataGetBytePtr(data), CFDataGetLength(data));
+  return result;
+}
+
+#pragma mark Sender thread
+
+// Single consumer side of the queue, called from the sender thread only.
+inline bool __OSCSenderDequeue(__OSCSender *sender, CFIndex *handle, OSCValue *value) {
+  bool result = false;
+  CFIndex position = sender->dequeuePosition;
+  __OSCSenderCell *cell = &sender->cells[position & sender->mask];
+  if (__atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE) == position + 1) {
+    *handle = cell->handle;
+    *value = cell->value;
+    sender->dequeuePosition = position + 1;
+    __atomic_store_n(&cell->sequence, position + sender->mask + 1, __ATOMIC_RELEASE);
+    result = true;
+  }
+  return result;
+}
+
+// Keep the latest value per handle. Value comes retained from the queue,
+// the cache retains its own reference.
+inline void __OSCSenderCoalesce(OSCRef osc, CFIndex handle, OSCValue *value) {
+  __OSCCache *cache = &osc->sender->cache;
+  __OSCCacheSlot *slot = __OSCCacheFind(osc, cache, OSCAddressesGetAddress(osc, handle));
+  if (!slot)
+    slot = __OSCCacheInsert(osc, cache, handle);
+  if (slot && __OSCCacheSetValue(osc, cache, slot, value))
+    __atomic_fetch_add(&osc->metrics.coalescedCount, 1, __ATOMIC_RELAXED);
+  __OSCValueRelease(value);
+}
+
+// Send all pending values, bypassing the batch which belongs to the thread
+// running OSCRef.
+inline void __OSCSenderSend(OSCRef osc) {
+  __OSCCacheSendDirty(osc, &osc->sender->cache, osc->sender->writer, true);
+}
+
+// Drain the queue every time interval. Values pushed before the thread has
+// been stopped are still sent on the last pass. Each pass holds the send
+// lock, the socket and cache rules are shared with the thread running OSCRef.
+inline void *__OSCSenderThreadMain(void *info) {
+  OSCRef osc = info;
+  __OSCSender *sender = osc->sender;
+  struct timespec interval = { (time_t)sender->timeInterval, (long)((sender->timeInterval - (time_t)sender->timeInterval) * 1e9) };
+  bool running;
+  do {
+    running = __atomic_load_n(&sender->running, __ATOMIC_ACQUIRE);
+    CFIndex handle;
+    OSCValue value;
+    pthread_mutex_lock(&osc->sendLock);
+    while (__OSCSenderDequeue(sender, &handle, &value))
+      __OSCSenderCoalesce(osc, handle, &value);
+    __OSCSenderSend(osc);
+    pthread_mutex_unlock(&osc->sendLock);
+    if (running)
+      nanosleep(&interval, NULL);
+  } while (running);
+  return NULL;
+}
+
+// Start dedicated thread sending values pushed with OSCPush* functions from
+// any thread. Capacity is rounded up to power of 2, 0 means
+// OSC_SENDER_QUEUE_LENGTH. Addresses have to be registered before values
+// for their handles are pushed.
+inline OSCResult OSCStartSenderThread(OSCRef osc, CFIndex capacity, CFTimeInterval timeInterval) {
+  OSCResult result = kOSCResultNotAllocatedError;
+  if (osc && !osc->sender) {
+    CFIndex length = 2;
+    while (length < (capacity > 0 ? capacity : OSC_SENDER_QUEUE_LENGTH))
+      length *= 2;
+    __OSCSender *sender = CFAllocatorAllocate(osc->allocator, sizeof(__OSCSender), 0);
+    if (sender) {
+      memset(sender, 0, sizeof(__OSCSender));
+      sender->cells = CFAllocatorAllocate(osc->allocator, sizeof(__OSCSenderCell) * length, 0);
+      sender->writer = OSCWriterCreate(osc->allocator, 0);
+      if (sender->cells && sender->writer && __OSCCacheInit(osc->allocator, &sender->cache, 0)) {
+        for (CFIndex i = 0; i < length; i++)
+          sender->cells[i].sequence = i;
+        sender->mask = length - 1;
+        sender->cache.schedule = 1;
+        sender->timeInterval = timeInterval > 0 ? timeInterval : 0.001;
+        sender->running = true;
+        __atomic_store_n(&osc->sender, sender, __ATOMIC_SEQ_CST);
+        if (pthread_create(&sender->thread, NULL, __OSCSenderThreadMain, osc) == 0) {
+          result = kOSCResultSuccess;
+        } else {
+          __atomic_store_n(&osc->sender, NULL, __ATOMIC_SEQ_CST);
+          while (__atomic_load_n(&osc->pushersCount, __ATOMIC_SEQ_CST) > 0)
+            sched_yield();
+        }
+      }
+      if (result != kOSCResultSuccess) {
+        if (sender->cells)
+          CFAllocatorDeallocate(osc->allocator, sender->cells);
+        if (sender->writer)
+          OSCWriterRelease(sender->writer);
+        __OSCCacheDestroy(osc->allocator, &sender->cache);
+        CFAllocatorDeallocate(osc->allocator, sender);
+      }
+    }
+  }
+  return result;
+}
+
+// Stop the sender thread. Values already pushed are sent before it exits.
+// Pushing threads don't see the sender once it's stopped, the queue is
+// freed after calls already in progress have returned.
+inline void OSCStopSenderThread(OSCRef osc) {
+  if (osc && osc->sender) {
+    __OSCSender *sender = osc->sender;
+    __atomic_store_n(&sender->running, false, __ATOMIC_RELEASE);
+    pthread_join(sender->thread, NULL);
+    __atomic_store_n(&osc->sender, NULL, __ATOMIC_SEQ_CST);
+    while (__atomic_load_n(&osc->pushersCount, __ATOMIC_SEQ_CST) > 0)
+      sched_yield();
+    CFIndex handle;
+    OSCValue value;
+    while (__OSCSenderDequeue(sender, &handle, &value)) // Pushed after last pass
+      __OSCValueRelease(&value);
+    CFAllocatorDeallocate(osc->allocator, sender->cells);
+    __OSCCacheDestroy(osc->allocator, &sender->cache);
+    OSCWriterRelease(sender->writer);
+    CFAllocatorDeallocate(osc->allocator, sender);
+  }
+}
+
+// Lock-free, can be called from any thread. Values of s and b type are
+// retained until sent.
+inline OSCResult OSCPushValue(OSCRef osc, OSCAddressHandle handle, const OSCValue *value) {
+  OSCResult result = kOSCResultNotAllocatedError;
+  __OSCSender *sender = NULL;
+  if (osc && value) {
+    __atomic_fetch_add(&osc->pushersCount, 1, __ATOMIC_SEQ_CST);
+    sender = __atomic_load_n(&osc->sender, __ATOMIC_SEQ_CST);
+  }
+  if (sender) {
+    if (handle >= 0 && handle < __atomic_load_n(&osc->addressesCount, __ATOMIC_ACQUIRE)) {
+      CFIndex position = __atomic_load_n(&sender->enqueuePosition, __ATOMIC_RELAXED);
+      __OSCSenderCell *cell = NULL;
+      while (!cell) {
+        __OSCSenderCell *candidate = &sender->cells[position & sender->mask];
+        CFIndex sequence = __atomic_load_n(&candidate->sequence, __ATOMIC_ACQUIRE);
+        if (sequence == position) {
+          if (__atomic_compare_exchange_n(&sender->enqueuePosition, &position, position + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            cell = candidate;
+        } else if (sequence < position) {
+          break;
+        } else {
+          position = __atomic_load_n(&sender->enqueuePosition, __ATOMIC_RELAXED);
+        }
+      }
+      if (cell) {
+        cell->handle = handle;
+        cell->value = *value;
+        if (value->type == 's' || value->type == 'b')
+          CFRetain(value->value.object);
+        __atomic_store_n(&cell->sequence, position + 1, __ATOMIC_RELEASE);
+        result = kOSCResultSuccess;
+      } else {
+        __atomic_fetch_add(&osc->metrics.queueFullCount, 1, __ATOMIC_RELAXED);
+        result = kOSCResultQueueFullError;
+      }
+    } else {
+      result = kOSCResultInvalidHandleError;
+    }
+  }
+  if (osc && value)
+    __atomic_fetch_sub(&osc->pushersCount, 1, __ATOMIC_RELEASE);
+  return result;
+}
+
+inline OSCResult OSCPushFloat32(OSCRef osc, OSCAddressHandle handle, Float32 value) {
+  OSCValue value_ = { 'f', { .f = value } };
+  return OSCPushValue(osc, handle, &value_);
+}
+
+inline OSCResult OSCPushSInt32(OSCRef osc, OSCAddressHandle handle, SInt32 value) {
+  OSCValue value_ = { 'i', { .i = value } };
+  return OSCPushValue(osc, handle, &value_);
+}
+
+inline OSCResult OSCPushBool(OSCRef osc, OSCAddressHandle handle, bool value) {
+  OSCValue value_ = { value ? 'T' : 'F', { .i = 0 } };
+  return OSCPushValue(osc, handle, &value_);
+}
+
+// CFNumber, CFBoolean, CFString and CFData are supported. Numbers are
+// unboxed here, on the producer thread.
+inline OSCResult OSCPushCFType(OSCRef osc, OSCAddressHandle handle, CFTypeRef value) {
+  OSCResult result = kOSCResultNotAllocatedError;
+  OSCValue value_;
+  if (osc && value && __OSCValueMakeWithCFType(&value_, value))
+    result = OSCPushValue(osc, handle, &value_);
+  return result;
+}
+
+#pragma mark Receive server
+
+// Receive up to batchLength datagrams, blocking for the first one at most
+// OSC_RECEIVE_TIMEOUT_US, and dispatch them on this thread. On Linux it's a
+// single recvmmsg call, elsewhere recvfrom per datagram. Returns number of
+// received datagrams or -1.
+inline CFIndex __OSCReceiveWorkerReceive(__OSCReceiveWorker *worker, CFIndex batchLength) {
+  OSCRef osc = worker->osc;
+  CFIndex count = 0;
+  CFIndex bytes = 0;
+  CFIndex errors = 0;
+#if defined(OSC_IO_URING)
+  if (worker->uring)
+    return __OSCReceiveWorkerReceiveRing(worker);
+#endif
+#if defined(__linux__)
+  for (CFIndex i = 0; i < batchLength; i++)
+    worker->messages[i].msg_hdr.msg_flags = 0;
+  int n = recvmmsg(worker->sockfd, worker->messages, (unsigned int)batchLength, MSG_WAITFORONE, NULL);
+  __atomic_fetch_add(&osc->metrics.receiveCallsCount, 1, __ATOMIC_RELAXED);
+  if (n == -1)
+    return -1;
+  for (int i = 0; i < n; i++) {
+    CFIndex length = worker->messages[i].msg_len;
+    bytes += length;
+    if (worker->messages[i].msg_hdr.msg_flags & MSG_TRUNC) {
+      errors++;
+      continue;
+    }
+    OSCPacketView packet = OSCPacketViewMake(worker->buffers + i * OSC_RECEIVE_BUFFER_LENGTH, length);
+    if (__OSCReceivePacketView(osc, &packet, kOSCTimeTagImmediately, 0, false) != kOSCResultSuccess)
+      errors++;
+  }
+  count = n;
+#else
+  while (count < batchLength) {
+    ssize_t length = recvfrom(worker->sockfd, worker->buffers, OSC_RECEIVE_BUFFER_LENGTH, count > 0 ? MSG_DONTWAIT : 0, NULL, NULL);
+    __atomic_fetch_add(&osc->metrics.receiveCallsCount, 1, __ATOMIC_RELAXED);
+    if (length == -1) {
+      if (count == 0)
+        return -1;
+      break;
+    }
+    bytes += length;
+    count++;
+    OSCPacketView packet = OSCPacketViewMake(worker->buffers, length);
+    if (__OSCReceivePacketView(osc, &packet, kOSCTimeTagImmediately, 0, false) != kOSCResultSuccess)
+      errors++;
+  }
+#endif
+  __atomic_fetch_add(&osc->metrics.receivedPacketsCount, count, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&osc->metrics.receivedBytesCount, bytes, __ATOMIC_RELAXED);
+  if (errors > 0)
+    __atomic_fetch_add(&osc->metrics.receiveErrorsCount, errors, __ATOMIC_RELAXED);
+  return count;
+}
+
+#if defined(OSC_IO_URING)
+
+// Set up worker's ring with the socket as fixed file 0 and a ring of
+// provided buffers over the worker's slab. Fails if io_uring or provided
+// buffer rings are not available.
+inline bool __OSCReceiveWorkerInitRing(__OSCReceiveWorker *worker, CFIndex batchLength) {
+  worker->buffersCount = 1;
+  while ((CFIndex)worker->buffersCount * 2 <= batchLength && worker->buffersCount < 32768)
+    worker->buffersCount *= 2;
+  if (!__OSCUringInit(&worker->ring, 4, worker->buffersCount * 2, 0))
+    return false;
+  worker->ring.callsCount = &worker->osc->metrics.receiveCallsCount;
+  worker->bufferRingLength = worker->buffersCount * sizeof(struct io_uring_buf);
+  worker->bufferRing = mmap(NULL, worker->bufferRingLength, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (worker->bufferRing == MAP_FAILED)
+    worker->bufferRing = NULL;
+  struct io_uring_buf_reg registration;
+  memset(&registration, 0, sizeof(registration));
+  registration.ring_addr = (UInt64)(uintptr_t)worker->bufferRing;
+  registration.ring_entries = worker->buffersCount;
+  if (!worker->bufferRing ||
+      syscall(__NR_io_uring_register, worker->ring.fd, IORING_REGISTER_PBUF_RING, &registration, 1) == -1 ||
+      syscall(__NR_io_uring_register, worker->ring.fd, IORING_REGISTER_FILES, &worker->sockfd, 1) == -1) {
+    __OSCReceiveWorkerDestroyRing(worker);
+    return false;
+  }
+  worker->bufferRingTail = 0;
+  for (unsigned i = 0; i < worker->buffersCount; i++)
+    __OSCReceiveWorkerRecycle(worker, i);
+  __atomic_store_n(&worker->bufferRing->tail, worker->bufferRingTail, __ATOMIC_RELEASE);
+  worker->uring = true;
+  worker->armed = false;
+  return true;
+}
+
+// Cancel pending receive and wait until it ends, so the kernel doesn't
+// write to buffers after the server frees them.
+inline void __OSCReceiveWorkerDestroyRing(__OSCReceiveWorker *worker) {
+  int errnum = errno;
+  __OSCUring *ring = &worker->ring;
+  if (worker->armed) {
+    struct io_uring_sqe *sqe = __OSCUringGetSQE(ring);
+    if (sqe) {
+      sqe->opcode = IORING_OP_ASYNC_CANCEL;
+      sqe->cancel_flags = IORING_ASYNC_CANCEL_ANY;
+      sqe->user_data = 1;
+      __OSCUringQueue(ring);
+    }
+    while (worker->armed && __OSCUringSubmit(ring, 1, OSC_RECEIVE_TIMEOUT_US) != -1) {
+      unsigned head = *ring->cqHead;
+      unsigned tail = __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE);
+      for (; head != tail; head++) {
+        struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cqMask];
+        if (cqe->user_data == 0 && !(cqe->flags & IORING_CQE_F_MORE))
+          worker->armed = false;
+      }
+      __atomic_store_n(ring->cqHead, head, __ATOMIC_RELEASE);
+    }
+  }
+  __OSCUringDestroy(ring);
+  if (worker->bufferRing)
+    munmap(worker->bufferRing, worker->bufferRingLength);
+  worker->bufferRing = NULL;
+  worker->uring = false;
+  worker->armed = false;
+  errno = errnum;
+}
+
+// Put buffer back to the provided buffer ring, the kernel sees it after
+// the next tail store.
+inline void __OSCReceiveWorkerRecycle(__OSCReceiveWorker *worker, unsigned index) {
+  struct io_uring_buf *buffer = &worker->bufferRing->bufs[worker->bufferRingTail & (worker->buffersCount - 1)];
+  buffer->addr = (UInt64)(uintptr_t)(worker->buffers + index * OSC_RECEIVE_BUFFER_LENGTH);
+  buffer->len = OSC_RECEIVE_BUFFER_LENGTH;
+  buffer->bid = (UInt16)index;
+  worker->bufferRingTail++;
+}
+
+// Wait for completions of the multishot receive, at most
+// OSC_RECEIVE_TIMEOUT_US, dispatch datagrams from their buffers and put
+// the buffers back. One receive stays armed over any number of datagrams,
+// it's armed again only after the kernel ends it, eg. when it runs out of
+// buffers. Returns number of received datagrams or -1.
+inline CFIndex __OSCReceiveWorkerReceiveRing(__OSCReceiveWorker *worker) {
+  OSCRef osc = worker->osc;
+  __OSCUring *ring = &worker->ring;
+  CFIndex count = 0;
+  CFIndex bytes = 0;
+  CFIndex errors = 0;
+  if (!worker->armed) {
+    struct io_uring_sqe *sqe = __OSCUringGetSQE(ring);
+    if (sqe) {
+      sqe->opcode = IORING_OP_RECV;
+      sqe->flags = IOSQE_FIXED_FILE | IOSQE_BUFFER_SELECT;
+      sqe->fd = 0;
+      sqe->ioprio = IORING_RECV_MULTISHOT;
+      sqe->buf_group = 0;
+      sqe->user_data = 0;
+      __OSCUringQueue(ring);
+      worker->armed = true;
+    }
+  }
+  if (__OSCUringSubmit(ring, 1, OSC_RECEIVE_TIMEOUT_US) == -1) {
+    if (errno == ETIME)
+      errno = EAGAIN;
+    return -1;
+  }
+  unsigned head = *ring->cqHead;
+  unsigned tail = __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE);
+  for (; head != tail; head++) {
+    struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cqMask];
+    
+    // Receive has ended, eg. out of buffers, it's armed again on the next call
+    if (!(cqe->flags & IORING_CQE_F_MORE))
+      worker->armed = false;
+    if (cqe->flags & IORING_CQE_F_BUFFER) {
+      unsigned index = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+      if (cqe->res >= 0) {
+        count++;
+        bytes += cqe->res;
+        OSCPacketView packet = OSCPacketViewMake(worker->buffers + index * OSC_RECEIVE_BUFFER_LENGTH, cqe->res);
+        if (__OSCReceivePacketView(osc, &packet, kOSCTimeTagImmediately, 0, false) != kOSCResultSuccess)
+          errors++;
+      }
+      __OSCReceiveWorkerRecycle(worker, index);
+    } else if (cqe->res < 0 && cqe->res != -ENOBUFS) {
+      errors++;
+      __OSCDiagnostic(osc, -1, -cqe->res, "receive failed, %s", strerror(-cqe->res));
+    }
+  }
+  __atomic_store_n(ring->cqHead, head, __ATOMIC_RELEASE);
+  __atomic_store_n(&worker->bufferRing->tail, worker->bufferRingTail, __ATOMIC_RELEASE);
+  __atomic_fetch_add(&osc->metrics.receivedPacketsCount, count, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&osc->metrics.receivedBytesCount, bytes, __ATOMIC_RELAXED);
+  if (errors > 0)
+    __atomic_fetch_add(&osc->metrics.receiveErrorsCount, errors, __ATOMIC_RELAXED);
+  return count;
+}
+
+#endif
+
+inline void *__OSCReceiveWorkerMain(void *info) {
+  __OSCReceiveWorker *worker = info;
+  __OSCReceiveServer *server = worker->osc->receiveServer;
+#if defined(__linux__)
+  if (worker->cpu >= 0) {
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(worker->cpu, &cpus);
+    pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+  }
+  
+  // Message headers are set up after pinning, so they are first touched
+  // by the CPU which uses them.
+  memset(worker->messages, 0, server->batchLength * sizeof(struct mmsghdr));
+  for (CFIndex i = 0; i < server->batchLength; i++) {
+    worker->iovecs[i].iov_base = worker->buffers + i * OSC_RECEIVE_BUFFER_LENGTH;
+    worker->iovecs[i].iov_len = OSC_RECEIVE_BUFFER_LENGTH;
+    worker->messages[i].msg_hdr.msg_iov = &worker->iovecs[i];
+    worker->messages[i].msg_hdr.msg_iovlen = 1;
+  }
+#endif
+#if defined(OSC_IO_URING)
+  if (worker->osc->transport != kOSCTransportSocket && !__OSCReceiveWorkerInitRing(worker, server->batchLength))
+    __OSCDiagnostic(worker->osc, -1, errno, "io_uring receive unavailable, using recvmmsg, %s", strerror(errno));
+#endif
+  while (__atomic_load_n(&server->running, __ATOMIC_ACQUIRE))
+    if (__OSCReceiveWorkerReceive(worker, server->batchLength) == -1 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+      __OSCDiagnostic(worker->osc, -1, errno, "receive failed, %s", strerror(errno));
+#if defined(OSC_IO_URING)
+  if (worker->uring)
+    __OSCReceiveWorkerDestroyRing(worker);
+#endif
+  return NULL;
+}
+
+// Close sockets and free buffers of workers which are not running.
+inline void __OSCReceiveServerDestroy(OSCRef osc, __OSCReceiveServer *server) {
+  for (CFIndex i = 0; i < server->workersCount; i++) {
+    __OSCReceiveWorker *worker = &server->workers[i];
+    if (worker->sockfd > 0)
+      close(worker->sockfd);
+    if (worker->buffers)
+      CFAllocatorDeallocate(osc->allocator, worker->buffers);
+#if defined(__linux__)
+    if (worker->messages)
+      CFAllocatorDeallocate(osc->allocator, worker->messages);
+    if (worker->iovecs)
+      CFAllocatorDeallocate(osc->allocator, worker->iovecs);
+#endif
+  }
+  if (server->workers)
+    CFAllocatorDeallocate(osc->allocator, server->workers);
+  CFAllocatorDeallocate(osc->allocator, server);
+}
+
+// Listen on host and port with workersCount threads, each with its own
+// SO_REUSEPORT socket, receiving up to batchLength datagrams per call into
+// preallocated buffers. Received packets are decoded and delivered on the
+// receiving thread, so methods and message callback are called concurrently
+// from all workers. Bundles are delivered on arrival, the scheduler is not
+// used. workersCount 0 starts one worker per online CPU, batchLength 0 uses
+// OSC_RECEIVE_BATCH_LENGTH. If cpus is not NULL, worker i is pinned to CPU
+// cpus[i] (Linux only), negative entries are not pinned. Port 0 binds an
+// ephemeral port shared by all workers, see OSCGetReceiveServerPort.
+inline OSCResult OSCStartReceiveServer(OSCRef osc, CFStringRef host, UInt16 port, CFIndex workersCount, CFIndex batchLength, const int *cpus) {
+  OSCResult result = kOSCResultNotAllocatedError;
+  if (osc && host && !osc->receiveServer && workersCount >= 0 && batchLength >= 0) {
+    if (workersCount == 0)
+      workersCount = sysconf(_SC_NPROCESSORS_ONLN) > 0 ? sysconf(_SC_NPROCESSORS_ONLN) : 1;
+    if (batchLength == 0)
+      batchLength = OSC_RECEIVE_BATCH_LENGTH;
+    
+    char hostBuffer[256];
+    char portBuffer[16];
+    CFStringGetCString(host, hostBuffer, sizeof(hostBuffer), kCFStringEncodingUTF8);
+    sprintf(portBuffer, "%i", port);
+    struct addrinfo hints;
+    struct addrinfo *info = NULL;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_DGRAM;
+    hints.ai_flags = AI_PASSIVE;
+    int rv = getaddrinfo(hostBuffer, portBuffer, &hints, &info);
+    if (rv != 0) {
+      __OSCDiagnostic(osc, kOSCResultInvalidAddressError, 0, "can't resolve %s:%s, %s", hostBuffer, portBuffer, gai_strerror(rv));
+      return kOSCResultInvalidAddressError;
+    }
+    
+    __OSCReceiveServer *server = CFAllocatorAllocate(osc->allocator, sizeof(__OSCReceiveServer), 0);
+    if (server) {
+      memset(server, 0, sizeof(__OSCReceiveServer));
+      server->batchLength = batchLength;
+      server->workers = CFAllocatorAllocate(osc->allocator, workersCount * sizeof(__OSCReceiveWorker), 0);
+      if (server->workers) {
+        memset(server->workers, 0, workersCount * sizeof(__OSCReceiveWorker));
+        server->workersCount = workersCount;
+        result = kOSCResultSuccess;
+      }
+      
+      // All sockets are bound before any worker starts. With port 0 the
+      // first socket picks the port and the rest bind to the same one.
+      struct sockaddr_storage address;
+      socklen_t addressLength = (socklen_t)info->ai_addrlen;
+      memcpy(&address, info->ai_addr, info->ai_addrlen);
+      for (CFIndex i = 0; result == kOSCResultSuccess && i < workersCount; i++) {
+        __OSCReceiveWorker *worker = &server->workers[i];
+        int one = 1;
+        struct timeval timeout = { 0, OSC_RECEIVE_TIMEOUT_US };
+        worker->osc = osc;
+        worker->cpu = cpus && cpus[i] >= 0 ? cpus[i] : -1;
+        worker->sockfd = socket(info->ai_family, info->ai_socktype, info->ai_protocol);
+        if (worker->sockfd == -1 ||
+            setsockopt(worker->sockfd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) == -1 ||
+            setsockopt(worker->sockfd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) == -1 ||
+            bind(worker->sockfd, (struct sockaddr *)&address, addressLength) == -1 ||
+            (i == 0 && getsockname(worker->sockfd, (struct sockaddr *)&address, &addressLength) == -1)) {
+          result = -1;
+          __OSCDiagnostic(osc, result, errno, "can't listen on %s:%s, %s", hostBuffer, portBuffer, strerror(errno));
+          break;
+        }
+        worker->buffers = CFAllocatorAllocate(osc->allocator, batchLength * OSC_RECEIVE_BUFFER_LENGTH, 0);
+#if defined(__linux__)
+        worker->messages = CFAllocatorAllocate(osc->allocator, batchLength * sizeof(struct mmsghdr), 0);
+        worker->iovecs = CFAllocatorAllocate(osc->allocator, batchLength * sizeof(struct iovec), 0);
+        if (!worker->buffers || !worker->messages || !worker->iovecs)
+#else
+        if (!worker->buffers)
+#endif
+          result = kOSCResultNotAllocatedError;
+      }
+      server->port = ntohs(address.ss_family == AF_INET6 ? ((struct sockaddr_in6 *)&address)->sin6_port : ((struct sockaddr_in *)&address)->sin_port);
+      
+      if (result == kOSCResultSuccess) {
+        server->running = true;
+        osc->receiveServer = server;
+        CFIndex started = 0;
+        while (started < workersCount && pthread_create(&server->workers[started].thread, NULL, __OSCReceiveWorkerMain, &server->workers[started]) == 0)
+          started++;
+        if (started < workersCount) {
+          result = -1;
+          __OSCDiagnostic(osc, result, errno, "can't start receive worker, %s", strerror(errno));
+          __atomic_store_n(&server->running, false, __ATOMIC_RELEASE);
+          for (CFIndex i = 0; i < started; i++)
+            pthread_join(server->workers[i].thread, NULL);
+          osc->receiveServer = NULL;
+        }
+      }
+      if (result != kOSCResultSuccess)
+        __OSCReceiveServerDestroy(osc, server);
+    }
+    freeaddrinfo(info);
+  }
+  return result;
+}
+
+// Stop and join all workers. Each exits after its current batch, within
+// OSC_RECEIVE_TIMEOUT_US if idle.
+inline void OSCStopReceiveServer(OSCRef osc) {
+  if (osc && osc->receiveServer) {
+    __OSCReceiveServer *server = osc->receiveServer;
+    __atomic_store_n(&server->running, false, __ATOMIC_RELEASE);
+    for (CFIndex i = 0; i < server->workersCount; i++)
+      pthread_join(server->workers[i].thread, NULL);
+    osc->receiveServer = NULL;
+    __OSCReceiveServerDestroy(osc, server);
+  }
+}
+
+// Port the receive server is bound to, 0 if not started.
+inline UInt16 OSCGetReceiveServerPort(OSCRef osc) {
+  return osc && osc->receiveServer ? osc->receiveServer->port : 0;
+}
+
+#pragma mark Scheduler
+
+// Put bundle to its wheel slot, or to the overflow list if it's due after
+// the current wheel turn.
+inline void __OSCSchedulerInsert(OSCRef osc, __OSCScheduledBundle *bundle) {
+  __OSCScheduler *scheduler = osc->scheduler;
+  UInt64 tick = bundle->timeTag >> OSC_SCHEDULER_TICK_SHIFT;
+  bundle->next = NULL;
+  if (tick < scheduler->tick + OSC_SCHEDULER_SLOTS_LENGTH) {
+    CFIndex slot = (tick < scheduler->tick ? scheduler->tick : tick) % OSC_SCHEDULER_SLOTS_LENGTH;
+    if (scheduler->tails[slot])
+      scheduler->tails[slot]->next = bundle;
+    else
+      scheduler->heads[slot] = bundle;
+    scheduler->tails[slot] = bundle;
+    scheduler->occupied[slot / 64] |= 1ULL << (slot % 64);
+  } else {
+    bundle->next = scheduler->overflow;
+    scheduler->overflow = bundle;
+    scheduler->overflowCount++;
+  }
+}
+
+// Copy bundle out of the receive buffer and schedule it. Run loop timer is
+// only moved if the bundle is due before the armed tick.
+inline OSCResult __OSCSchedulerScheduleBundle(OSCRef osc, const OSCPacketView *packet, OSCTimeTag now) {
+  OSCResult result = kOSCResultNotAllocatedError;
+  __OSCScheduler *scheduler = osc->scheduler;
+  __OSCScheduledBundle *bundle = CFAllocatorAllocate(osc->allocator, sizeof(__OSCScheduledBundle) + packet->length, 0);
+  if (bundle) {
+    bundle->timeTag = packet->bundle.timeTag;
+    bundle->length = packet->length;
+    memcpy(bundle + 1, packet->bytes, packet->length);
+    
+    // Empty wheel can be moved to now, there's nothing to release on the way
+    if (scheduler->count == 0 && scheduler->tick <= now >> OSC_SCHEDULER_TICK_SHIFT)
+      scheduler->tick = (now >> OSC_SCHEDULER_TICK_SHIFT) + 1;
+    __OSCSchedulerInsert(osc, bundle);
+    scheduler->count++;
+    UInt64 tick = bundle->timeTag >> OSC_SCHEDULER_TICK_SHIFT;
+    if (tick < scheduler->tick)
+      tick = scheduler->tick;
+    if (tick < scheduler->armedTick)
+      __OSCSchedulerArmRunLoopTimer(osc, tick);
+    result = kOSCResultSuccess;
+  }
+  return result;
+}
+
+// Release all bundles due at or before now, in time order with arrival
+// order kept for bundles within the same tick. Returns number of released
+// bundles.
+inline CFIndex OSCDispatchScheduledBundles(OSCRef osc, OSCTimeTag now) {
+  CFIndex count = 0;
+  if (osc && osc->scheduler) {
+    __OSCScheduler *scheduler = osc->scheduler;
+    UInt64 nowTick = now >> OSC_SCHEDULER_TICK_SHIFT;
+    while (scheduler->count > 0 && scheduler->tick <= nowTick) {
+      
+      // Only overflow bundles left and we're more than a turn behind - skip
+      // empty slots up to the next turn.
+      if (scheduler->count == scheduler->overflowCount && nowTick - scheduler->tick >= OSC_SCHEDULER_SLOTS_LENGTH)
+        scheduler->tick += OSC_SCHEDULER_SLOTS_LENGTH - scheduler->tick % OSC_SCHEDULER_SLOTS_LENGTH;
+      
+      // New turn, bring overflow bundles due in this turn to the wheel
+      if (scheduler->tick % OSC_SCHEDULER_SLOTS_LENGTH == 0) {
+        __OSCScheduledBundle *overflow = scheduler->overflow;
+        scheduler->overflow = NULL;
+        scheduler->overflowCount = 0;
+        while (overflow) {
+          __OSCScheduledBundle *next = overflow->next;
+          __OSCSchedulerInsert(osc, overflow);
+          overflow = next;
+        }
+      }
+      
+      CFIndex slot = scheduler->tick % OSC_SCHEDULER_SLOTS_LENGTH;
+      __OSCScheduledBundle *bundle = scheduler->heads[slot];
+      scheduler->heads[slot] = NULL;
+      scheduler->tails[slot] = NULL;
+      scheduler->occupied[slot / 64] &= ~(1ULL << (slot % 64));
+      scheduler->tick++;
+      while (bundle) {
+        __OSCScheduledBundle *next = bundle->next;
+        OSCPacketView packet = OSCPacketViewMake(bundle + 1, bundle->length);
+        scheduler->count--;
+        __OSCReceivePacketView(osc, &packet, packet.bundle.timeTag, 0, true);
+        CFAllocatorDeallocate(osc->allocator, bundle);
+        bundle = next;
+        count++;
+      }
+    }
+    if (scheduler->count == 0 && scheduler->tick <= nowTick)
+      scheduler->tick = nowTick + 1;
+    __OSCSchedulerUpdateRunLoopTimer(osc);
+  }
+  return count;
+}
+
+inline CFIndex OSCGetScheduledBundlesCount(OSCRef osc) {
+  return osc && osc->scheduler ? osc->scheduler->count : 0;
+}
+
+// Earliest tick with pending bundles, UINT64_MAX if there are none. Occupied
+// slots bitmap is searched from the current slot, wrapped slots belong to the
+// next turn. With only overflow bundles left it's the start of the next turn,
+// where they're brought to the wheel.
+inline UInt64 __OSCSchedulerGetEarliestTick(OSCRef osc) {
+  __OSCScheduler *scheduler = osc->scheduler;
+  UInt64 result = UINT64_MAX;
+  if (scheduler->count > 0) {
+    CFIndex start = scheduler->tick % OSC_SCHEDULER_SLOTS_LENGTH;
+    UInt64 turn = scheduler->tick - start;
+    for (CFIndex i = 0; i <= OSC_SCHEDULER_SLOTS_LENGTH / 64 && result == UINT64_MAX; i++) {
+      CFIndex word = (start / 64 + i) % (OSC_SCHEDULER_SLOTS_LENGTH / 64);
+      UInt64 bits = scheduler->occupied[word];
+      if (i == 0)
+        bits &= ~0ULL << (start % 64);
+      else if (i == OSC_SCHEDULER_SLOTS_LENGTH / 64)
+        bits &= (1ULL << (start % 64)) - 1;
+      if (bits) {
+        CFIndex slot = word * 64 + __builtin_ctzll(bits);
+        result = turn + slot + (slot < start ? OSC_SCHEDULER_SLOTS_LENGTH : 0);
+      }
+    }
+    if (result == UINT64_MAX)
+      result = turn + OSC_SCHEDULER_SLOTS_LENGTH;
+  }
+  return result;
+}
+
+// Fire run loop timer at tick, or in an hour if idle.
+inline void __OSCSchedulerArmRunLoopTimer(OSCRef osc, UInt64 tick) {
+  __OSCScheduler *scheduler = osc->scheduler;
+  scheduler->armedTick = tick;
+  if (scheduler->runLoopTimer)
+    CFRunLoopTimerSetNextFireDate(scheduler->runLoopTimer, tick == UINT64_MAX ? CFAbsoluteTimeGetCurrent() + 3600.0 : OSCTimeTagGetAbsoluteTime(tick << OSC_SCHEDULER_TICK_SHIFT));
+}
+
+// Fire run loop timer at the earliest pending bundle.
+inline void __OSCSchedulerUpdateRunLoopTimer(OSCRef osc) {
+  UInt64 tick = __OSCSchedulerGetEarliestTick(osc);
+  if (tick != osc->scheduler->armedTick)
+    __OSCSchedulerArmRunLoopTimer(osc, tick);
+}
+
+inline void __OSCSchedulerRunLoopTimerCallBack(CFRunLoopTimerRef timer, void *info) {
+  (void)timer;
+  OSCDispatchScheduledBundles(info, OSCTimeTagMakeWithAbsoluteTime(CFAbsoluteTimeGetCurrent()));
+}
+
+// Hold received bundles with future time tags and release them on time from
+// the current run loop. OSCDispatchScheduledBundles can be used instead to
+// release them manually.
+inline void OSCActivateScheduler(OSCRef osc) {
+  if (osc && !osc->scheduler) {
+    osc->scheduler = CFAllocatorAllocate(osc->allocator, sizeof(__OSCScheduler), 0);
+    if (osc->scheduler) {
+      memset(osc->scheduler, 0, sizeof(__OSCScheduler));
+      osc->scheduler->tick = (OSCTimeTagMakeWithAbsoluteTime(CFAbsoluteTimeGetCurrent()) >> OSC_SCHEDULER_TICK_SHIFT) + 1;
+      osc->scheduler->armedTick = UINT64_MAX;
+      CFRunLoopTimerContext context = { 0, osc, NULL, NULL, NULL };
+      osc->scheduler->runLoopTimer = CFRunLoopTimerCreate(osc->allocator, CFAbsoluteTimeGetCurrent() + 3600.0, 3600.0, 0, 0, __OSCSchedulerRunLoopTimerCallBack, &context);
+      CFRunLoopAddTimer(CFRunLoopGetCurrent(), osc->scheduler->runLoopTimer, kCFRunLoopCommonModes);
+    }
+  }
+}
+
+// Stop scheduling, pending bundles are dropped.
+inline void OSCDeactivateScheduler(OSCRef osc) {
+  if (osc && osc->scheduler) {
+    __OSCScheduler *scheduler = osc->scheduler;
+    if (scheduler->runLoopTimer) {
+      CFRunLoopTimerInvalidate(scheduler->runLoopTimer);
+      CFRelease(scheduler->runLoopTimer);
+    }
+    for (CFIndex i = 0; i <= OSC_SCHEDULER_SLOTS_LENGTH; i++) {
+      __OSCScheduledBundle *bundle = i < OSC_SCHEDULER_SLOTS_LENGTH ? scheduler->heads[i] : scheduler->overflow;
+      while (bundle) {
+        __OSCScheduledBundle *next = bundle->next;
+        CFAllocatorDeallocate(osc->allocator, bundle);
+        bundle = next;
+      }
+    }
+    CFAllocatorDeallocate(osc->allocator, scheduler);
+    osc->scheduler = NULL;
+  }
+}
+
+#pragma mark Methods
+
+// FNV-1a
+inline UInt32 __OSCHash(const void *bytes, CFIndex length) {
+  const UInt8 *b = bytes;
+  UInt32 hash = 2166136261u;
+  for (CFIndex i = 0; i < length; i++) {
+    hash ^= b[i];
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+inline bool OSCPatternIsLiteral(const char *pattern, CFIndex patternLength) {
+  for (CFIndex i = 0; i < patternLength; i++)
+    switch (pattern[i]) {
+      case '*': case '?': case '[': case '{':
+        return false;
+    }
+  return true;
+}
+
+// Match single address segment against OSC pattern with *, ?, [a-z], [!a-z]
+// and {foo,bar} wildcards.
+inline bool OSCPatternMatch(const char *pattern, CFIndex patternLength, const char *string, CFIndex stringLength) {
+  const char *p = pattern, *pe = pattern + patternLength;
+  const char *s = string, *se = string + stringLength;
+  while (p < pe) {
+    switch (*p) {
+      case '*':
+        while (p < pe && *p == '*')
+          p++;
+        if (p == pe)
+          return true;
+        for (; s <= se; s++)
+          if (OSCPatternMatch(p, pe - p, s, se - s))
+            return true;
+        return false;
+        
+      case '?':
+        if (s == se)
+          return false;
+        p++;
+        s++;
+        break;
+        
+      case '[': {
+        const char *end = memchr(p + 1, ']', pe - p - 1);
+        if (!end || s == se)
+          return false;
+        const char *c = p + 1;
+        bool negate = c < end && *c == '!';
+        bool matched = false;
+        if (negate)
+          c++;
+        for (; c < end; c++) {
+          if (c + 2 < end && c[1] == '-') {
+            if ((unsigned char)*s >= (unsigned char)c[0] && (unsigned char)*s <= (unsigned char)c[2])
+              matched = true;
+            c += 2;
+          } else if (*s == *c) {
+            matched = true;
+          }
+        }
+        if (matched == negate)
+          return false;
+        p = end + 1;
+        s++;
+        break;
+      }
+        
+      case '{': {
+        const char *end = memchr(p + 1, '}', pe - p - 1);
+        if (!end)
+          return false;
+        const char *alternative = p + 1;
+        while (alternative <= end) {
+          const char *comma = memchr(alternative, ',', end - alternative);
+          const char *alternativeEnd = comma ? comma : end;
+          CFIndex n = alternativeEnd - alternative;
+          if (n <= se - s && memcmp(alternative, s, n) == 0)
+            if (OSCPatternMatch(end + 1, pe - end - 1, s + n, se - s - n))
+              return true;
+          alternative = alternativeEnd + 1;
+        }
+        return false;
+      }
+        
+      default:
+        if (s == se || *s != *p)
+          return false;
+        p++;
+        s++;
+    }
+  }
+  return s == se;
+}
+
+inline int __OSCMethodNodeCompareName(const __OSCMethodNode *node, const char *name, CFIndex nameLength) {
+  int result = memcmp(node->name, name, node->nameLength < nameLength ? node->nameLength : nameLength);
+  if (result == 0)
+    result = (node->nameLength > nameLength) - (node->nameLength < nameLength);
+  return result;
+}
+
+// Binary search for child with the name. Returns index of the child or
+// insertion point encoded as -(index + 1).
+inline CFIndex __OSCMethodNodeFindChild(const __OSCMethodNode *node, const char *name, CFIndex nameLength) {
+  CFIndex low = 0, high = node->childrenCount - 1;
+  while (low <= high) {
+    CFIndex middle = (low + high) / 2;
+    int result = __OSCMethodNodeCompareName(node->children[middle], name, nameLength);
+    if (result < 0)
+      low = middle + 1;
+    else if (result > 0)
+      high = middle - 1;
+    else
+      return middle;
+  }
+  return -(low + 1);
+}
+
+inline __OSCMethodNode *__OSCMethodNodeCreate(CFAllocatorRef allocator, const char *address, CFIndex addressLength, CFIndex nameOffset) {
+  __OSCMethodNode *node = CFAllocatorAllocate(allocator, sizeof(__OSCMethodNode) + addressLength + 1, 0);
+  if (node) {
+    memset(node, 0, sizeof(__OSCMethodNode));
+    char *copy = (char *)(node + 1);
+    memcpy(copy, address, addressLength);
+    copy[addressLength] = 0;
+    node->address = copy;
+    node->addressLength = addressLength;
+    node->name = copy + nameOffset;
+    node->nameLength = addressLength - nameOffset;
+    node->hash = __OSCHash(copy, addressLength);
+  }
+  return node;
+}
+
+inline void __OSCMethodNodeDestroy(CFAllocatorRef allocator, __OSCMethodNode *node) {
+  if (node) {
+    for (CFIndex i = 0; i < node->childrenCount; i++)
+      __OSCMethodNodeDestroy(allocator, node->children[i]);
+    if (node->children)
+      CFAllocatorDeallocate(allocator, node->children);
+    CFAllocatorDeallocate(allocator, node);
+  }
+}
+
+inline __OSCMethodNode *__OSCMethodsTableFind(OSCRef osc, const char *address, CFIndex addressLength, UInt32 hash) {
+  if (osc->methodsTable) {
+    CFIndex mask = osc->methodsTableCapacity - 1;
+    for (CFIndex i = hash & mask; osc->methodsTable[i]; i = (i + 1) & mask) {
+      __OSCMethodNode *node = osc->methodsTable[i];
+      if (node->hash == hash && node->addressLength == addressLength && memcmp(node->address, address, addressLength) == 0)
+        return node;
+    }
+  }
+  return NULL;
+}
+
+// Insert node into the table, growing it to keep load factor under 1/2.
+inline bool __OSCMethodsTableInsert(OSCRef osc, __OSCMethodNode *node) {
+  if ((osc->methodsCount + 1) * 2 > osc->methodsTableCapacity) {
+    CFIndex capacity = osc->methodsTableCapacity ? osc->methodsTableCapacity * 2 : 64;
+    __OSCMethodNode **table = CFAllocatorAllocate(osc->allocator, sizeof(__OSCMethodNode *) * capacity, 0);
+    if (!table)
+      return false;
+    memset(table, 0, sizeof(__OSCMethodNode *) * capacity);
+    for (CFIndex i = 0; i < osc->methodsTableCapacity; i++) {
+      __OSCMethodNode *existing = osc->methodsTable[i];
+      if (existing) {
+        CFIndex j = existing->hash & (capacity - 1);
+        while (table[j])
+          j = (j + 1) & (capacity - 1);
+        table[j] = existing;
+      }
+    }
+    if (osc->methodsTable)
+      CFAllocatorDeallocate(osc->allocator, osc->methodsTable);
+    osc->methodsTable = table;
+    osc->methodsTableCapacity = capacity;
+  }
+  CFIndex mask = osc->methodsTableCapacity - 1;
+  CFIndex i = node->hash & mask;
+  while (osc->methodsTable[i])
+    i = (i + 1) & mask;
+  osc->methodsTable[i] = node;
+  osc->methodsCount++;
+  return true;
+}
+
+inline void __OSCMethodsTableRemove(OSCRef osc, __OSCMethodNode *node) {
+  CFIndex mask = osc->methodsTableCapacity - 1;
+  CFIndex i = node->hash & mask;
+  while (osc->methodsTable[i] && osc->methodsTable[i] != node)
+    i = (i + 1) & mask;
+  if (osc->methodsTable[i]) {
+    osc->methodsTable[i] = NULL;
+    osc->methodsCount--;
+    // Reinsert the rest of the cluster so lookups don't stop at the hole
+    for (i = (i + 1) & mask; osc->methodsTable[i]; i = (i + 1) & mask) {
+      __OSCMethodNode *existing = osc->methodsTable[i];
+      osc->methodsTable[i] = NULL;
+      CFIndex j = existing->hash & mask;
+      while (osc->methodsTable[j])
+        j = (j + 1) & mask;
+      osc->methodsTable[j] = existing;
+    }
+  }
+}
+
+// Register method for literal address, replacing callback registered
+// previously for the same address.
+inline OSCResult OSCAddMethod(OSCRef osc, CFStringRef address, OSCMethodCallBack callBack, void *info) {
+  OSCResult result = kOSCResultNotAllocatedError;
+  if (osc && address && callBack) {
+    char buffer[OSC_STATIC_ADDRESS_LENGTH];
+    CFIndex length = 0;
+    result = kOSCResultInvalidAddressError;
+    if (CFStringGetCString(address, buffer, OSC_STATIC_ADDRESS_LENGTH, kCFStringEncodingUTF8))
+      length = strlen(buffer);
+    if (length > 1 && buffer[0] == '/' && buffer[length - 1] != '/' && OSCPatternIsLiteral(buffer, length) && !memchr(buffer, ',', length) && !memchr(buffer, '#', length)) {
+      if (!osc->methods)
+        osc->methods = __OSCMethodNodeCreate(osc->allocator, "", 0, 0);
+      __OSCMethodNode *node = osc->methods;
+      CFIndex start = 1;
+      result = kOSCResultSuccess;
+      while (node && start <= length) {
+        const char *slash = memchr(buffer + start, '/', length - start);
+        CFIndex end = slash ? slash - buffer : length;
+        if (end == start) {
+          result = kOSCResultInvalidAddressError;
+          break;
+        }
+        CFIndex i = __OSCMethodNodeFindChild(node, buffer + start, end - start);
+        if (i < 0) {
+          i = -(i + 1);
+          __OSCMethodNode *child = __OSCMethodNodeCreate(osc->allocator, buffer, end, start);
+          if (!child) {
+            result = kOSCResultNotAllocatedError;
+            break;
+          }
+          if (node->childrenCount == node->childrenCapacity) {
+            CFIndex capacity = node->childrenCapacity ? node->childrenCapacity * 2 : 4;
+            __OSCMethodNode **children = CFAllocatorAllocate(osc->allocator, sizeof(__OSCMethodNode *) * capacity, 0);
+            if (!children) {
+              CFAllocatorDeallocate(osc->allocator, child);
+              result = kOSCResultNotAllocatedError;
+              break;
+            }
+            if (node->children) {
+              memcpy(children, node->children, sizeof(__OSCMethodNode *) * node->childrenCount);
+              CFAllocatorDeallocate(osc->allocator, node->children);
+            }
+            node->children = children;
+            node->childrenCapacity = capacity;
+          }
+          memmove(node->children + i + 1, node->children + i, sizeof(__OSCMethodNode *) * (node->childrenCount - i));
+          node->children[i] = child;
+          node->childrenCount++;
+        }
+        node = node->children[i];
+        start = end + 1;
+      }
+      if (result == kOSCResultSuccess && !node->callBack && !__OSCMethodsTableInsert(osc, node))
+        result = kOSCResultNotAllocatedError;
+      if (result == kOSCResultSuccess) {
+        node->callBack = callBack;
+        node->info = info;
+      }
+    }
+  }
+  return result;
+}
+
+inline OSCResult OSCRemoveMethod(OSCRef osc, CFStringRef address) {
+  OSCResult result = kOSCResultNotAllocatedError;
+  if (osc && address) {
+    char buffer[OSC_STATIC_ADDRESS_LENGTH];
+    result = kOSCResultInvalidAddressError;
+    if (CFStringGetCString(address, buffer, OSC_STATIC_ADDRESS_LENGTH, kCFStringEncodingUTF8)) {
+      CFIndex length = strlen(buffer);
+      __OSCMethodNode *node = __OSCMethodsTableFind(osc, buffer, length, __OSCHash(buffer, length));
+      if (node) {
+        __OSCMethodsTableRemove(osc, node);
+        node->callBack = NULL;
+        node->info = NULL;
+        result = kOSCResultSuccess;
+      }
+    }
   }
   return result;
 }
 
+// Walk the trie matching pattern segments starting at offset, invoke all
+// matched methods and return their count.
+inline CFIndex __OSCMethodNodeDispatch(OSCRef osc, const __OSCMethodNode *node, const OSCMessageView *message, CFIndex offset, OSCTimeTag timeTag) {
+  CFIndex count = 0;
+  const char *pattern = message->address + offset;
+  const char *slash = memchr(pattern, '/', message->addressLength - offset);
+  CFIndex patternLength = slash ? slash - pattern : message->addressLength - offset;
+  if (OSCPatternIsLiteral(pattern, patternLength)) {
+    CFIndex i = __OSCMethodNodeFindChild(node, pattern, patternLength);
+    if (i >= 0) {
+      const __OSCMethodNode *child = node->children[i];
+      if (slash)
+        count += __OSCMethodNodeDispatch(osc, child, message, offset + patternLength + 1, timeTag);
+      else if (child->callBack) {
+        child->callBack(osc, message, timeTag, child->info);
+        count++;
+      }
+    }
+  } else {
+    for (CFIndex i = 0; i < node->childrenCount; i++) {
+      const __OSCMethodNode *child = node->children[i];
+      if (OSCPatternMatch(pattern, patternLength, child->name, child->nameLength)) {
+        if (slash)
+          count += __OSCMethodNodeDispatch(osc, child, message, offset + patternLength + 1, timeTag);
+        else if (child->callBack) {
+          child->callBack(osc, message, timeTag, child->info);
+          count++;
+        }
+      }
+    }
+  }
+  return count;
+}
+
+// Invoke all methods matching message address pattern. Literal addresses
+// are resolved with a single hash table lookup.
+inline CFIndex OSCDispatchMessage(OSCRef osc, const OSCMessageView *message, OSCTimeTag timeTag) {
+  CFIndex count = 0;
+  if (osc && message && osc->methods && message->addressLength > 1 && message->address[0] == '/') {
+    if (OSCPatternIsLiteral(message->address, message->addressLength)) {
+      __OSCMethodNode *node = __OSCMethodsTableFind(osc, message->address, message->addressLength, __OSCHash(message->address, message->addressLength));
+      if (node) {
+        node->callBack(osc, message, timeTag, node->info);
+        count = 1;
+      }
+    } else {
+      count = __OSCMethodNodeDispatch(osc, osc->methods, message, 1, timeTag);
+    }
+  }
+  return count;
+}
@@ -10,16 +10,46 @@
 
 #if (TARGET_OS_IPHONE)
 #include <CFNetwork/CFNetwork.h>
-#else
+#elif defined(__APPLE__)
 #include <CoreServices/CoreServices.h>
 #endif
 
 #include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
 #include <netdb.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <time.h>
+#include <math.h>
+
+// io_uring transport needs Linux headers with multishot receive (6.0+),
+// the kernel is probed at runtime.
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#if defined(IORING_RECV_MULTISHOT) && defined(__NR_io_uring_setup)
+#define OSC_IO_URING 1
+#endif
+#endif
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
 
 #define kOSCHostAny CFSTR("0.0.0.0")
 
 #define OSC_ADDRESSES_LENGTH 1024
+#define OSC_ADDRESSES_CHUNKS_LENGTH 256
 
 #define OSC_STATIC_ADDRESS_LENGTH        128
 #define OSC_STATIC_STRING_LENGTH         256
@@ -33,8 +63,45 @@
 #define OSC_STATIC_FLOAT64_PACKET_LENGTH (OSC_STATIC_ADDRESS_LENGTH + 4 + 8)
 #define OSC_STATIC_STRING_PACKET_LENGTH  (OSC_STATIC_ADDRESS_LENGTH + 4 + OSC_STATIC_STRING_LENGTH)
 
-#define OSC_STATIC_FLOATS32_PACKET_HEADER_LENGTH 128
-#define OSC_STATIC_FLOATS32_PACKET_LENGTH        (OSC_STATIC_ADDRESS_LENGTH + OSC_STATIC_FLOATS32_PACKET_HEADER_LENGTH + OSC_STATIC_FLOATS32_PACKET_HEADER_LENGTH * 4)
+#define OSC_MAXIMUM_BUNDLE_DEPTH 16
+
+#define OSC_BATCH_BUFFER_LENGTH  2048 // Larger packets bypass the batch
+
+#define OSC_SCHEDULER_SLOTS_LENGTH 1024 // Timing wheel slots, ~1ms each
+#define OSC_SCHEDULER_TICK_SHIFT   22   // Time tag >> 22 is ~0.98ms tick
+
+#define OSC_SENDER_QUEUE_LENGTH    4096 // Default sender thread queue capacity
+
+#define OSC_RECEIVE_BATCH_LENGTH   64    // Default datagrams per recvmmsg call
+#define OSC_RECEIVE_BUFFER_LENGTH  65536 // Fits any datagram, untouched slab pages are never faulted in
+#define OSC_RECEIVE_TIMEOUT_US     100000 // Workers check for stop this often
+
+#define OSC_STREAM_BUFFER_LENGTH   65536 // Buffered stream output is written when it grows past this
+#define OSC_STREAM_COALESCE_LENGTH 2048  // Larger packets are written from the caller's buffer
+#define OSC_STREAM_MAXIMUM_PACKET_LENGTH (16 * 1024 * 1024)
+#define OSC_STREAM_IOVECS_LENGTH   8
+
+#define OSC_CAPTURE_CHUNK_LENGTH   (16 * 1024 * 1024) // Capture file grows by this many bytes
+#define OSC_CAPTURE_VERSION        1
+#define OSC_REPLAY_BATCH_CAPACITY  64 // Batch used by replay if batching is off
+
+#define OSC_RESOLVER_TTL           60.0 // Default seconds a resolved host is reused
+#define OSC_RESOLVER_RETRY_INTERVAL 1.0 // Seconds before failed connection target is resolved again
+#define OSC_RESOLVER_HOST_LENGTH   256
+
+#define OSC_URING_ENTRIES          256  // Send queue depth and registered send buffers of OSC_BATCH_BUFFER_LENGTH
+#define OSC_URING_IDLE_MS          50   // Polling kernel thread sleeps after this long without sends
+
+#define OSC_STACK_VALUES_LENGTH    64   // Larger temporary arrays are allocated
+
+#define OSC_POOL_CLASSES_LENGTH    8    // Size classes of 32, 64, ... 4096 bytes
+#define OSC_POOL_MINIMUM_SHIFT     5
+#define OSC_POOL_CACHE_LENGTH      256  // Free blocks kept per size class and thread
+
+#define OSC_DEFAULT_DATAGRAM_SIZE  1452  // Fits 1500 bytes MTU with IPv6 and UDP headers
+#define OSC_MINIMUM_DATAGRAM_SIZE  64
+#define OSC_MAXIMUM_DATAGRAM_SIZE  65507
+
 
 #define __OSCGet32BitAlignedLength(n) (((((n) - 1) >> 2) << 2) + 4)
 
@@ -43,22 +110,26 @@
 
 // Finish buffer by zeroing 32bit aligned, 0-3 bytes and send the buffer returning the result
 #define __OSCBufferSend(osc, buffer, i, result) memset(buffer + i, 0, __OSCGet32BitAlignedLength(i) - i); \
+                                                __OSCMetricsAdd(osc->metrics.messagesCount, 1); \
                                                 result = OSCSendRawBuffer(osc, buffer, __OSCGet32BitAlignedLength(i));
 
 #pragma mark Internal string helper for fast UTF8 buffer access
 
+// Strings which don't have a fast C string pointer are copied to storage,
+// only longer ones are copied to an allocated buffer.
 typedef struct {
   CFAllocatorRef allocator;
   CFStringRef string;
   const char *pointer;
   const char *buffer;
   CFIndex maximumSize;
+  char storage[OSC_STATIC_STRING_LENGTH];
 } __OSCUTF8String;
 
-__OSCUTF8String __OSCUTF8StringMake(CFAllocatorRef allocator, CFStringRef string);
-const char     *__OSCUTF8StringGetBuffer(__OSCUTF8String utf8String);
-CFIndex         __OSCUTF8StringGetMaximumSize(__OSCUTF8String utf8String);
-void            __OSCUTF8StringDestroy(__OSCUTF8String utf8String);
+void            __OSCUTF8StringInit(__OSCUTF8String *utf8String, CFAllocatorRef allocator, CFStringRef string);
+const char     *__OSCUTF8StringGetBuffer(const __OSCUTF8String *utf8String);
+CFIndex         __OSCUTF8StringGetMaximumSize(const __OSCUTF8String *utf8String);
+void            __OSCUTF8StringDestroy(__OSCUTF8String *utf8String);
 
 #pragma mark Bundle
 
@@ -90,14 +161,644 @@ void            __OSCUTF8StringDestroy(__OSCUTF8String utf8String);
 //  
 //};
 
+#pragma mark Addresses
+
+// Handle of pre-encoded address, index into OSCRef address table.
+typedef CFIndex OSCAddressHandle;
+
+#define kOSCAddressHandleInvalid ((OSCAddressHandle)-1)
+
+// Address encoded for the wire - zero terminated and zero padded to 32bit
+// boundary, ready to be copied in front of the type tags.
+typedef struct {
+  CFStringRef name;
+  UInt32 hash;                  // Hash of the address without padding
+  CFIndex length;               // Padded length
+  UInt8 buffer[OSC_STATIC_ADDRESS_LENGTH];
+} OSCAddress;
+
+#pragma mark Writer
+
+// Growable, reusable buffer packets are encoded into. Bundle elements are
+// written in place - element size is reserved first and filled in when the
+// element is finished, so nothing is encoded twice or copied around. After
+// OSCWriterReset the memory is reused, a writer which has grown to its
+// working size doesn't allocate anymore.
+typedef struct OSCWriter {
+  CFAllocatorRef allocator;
+  CFIndex retainCount;
+  UInt8 *bytes;
+  CFIndex length;
+  CFIndex capacity;
+  CFIndex bundles[OSC_MAXIMUM_BUNDLE_DEPTH]; // Offsets of open bundles' size slots, -1 for top level
+  CFIndex depth;
+} OSCWriter;
+
+typedef OSCWriter *OSCWriterRef;
+
+#pragma mark Batching
+
+// Ring of encoded packets waiting to be sent with a single sendmmsg.
+typedef struct {
+  CFIndex capacity;             // 0 if batching is disabled
+  CFIndex head;
+  CFIndex count;
+  UInt8 *buffers;               // capacity * OSC_BATCH_BUFFER_LENGTH bytes
+  CFIndex *lengths;
+#if defined(__linux__)
+  struct mmsghdr *messages;
+  struct iovec *iovecs;
+#endif
+} __OSCBatch;
+
+#pragma mark Send queue
+
+// What happens to a packet which would block when send queue is full.
+typedef enum OSCOverflowPolicy {
+  kOSCOverflowPolicyDropNewest = 0, // The packet is dropped
+  kOSCOverflowPolicyDropOldest = 1, // The oldest queued packet is dropped to make room
+  kOSCOverflowPolicyCoalesce   = 2  // Queued message with the same address is replaced, otherwise
+                                    // the oldest is dropped. Values set with OSCSet* stay in the
+                                    // cache, coalesced, until the queue drains.
+} OSCOverflowPolicy;
+
+// Packets which would block in non-blocking mode, sent in order before
+// any new packet.
+typedef struct {
+  bool nonBlocking;
+  OSCOverflowPolicy policy;
+  CFIndex capacity;
+  CFIndex head;
+  CFIndex count;
+  CFIndex slotLength;           // Longer packets which would block are dropped
+  UInt8 *buffers;               // capacity * slotLength bytes
+  CFIndex *lengths;
+  UInt32 *hashes;               // Address hashes, 0 for bundles
+} __OSCSendQueue;
+
+#pragma mark Destinations
+
+typedef struct {
+  struct sockaddr_storage address;
+  socklen_t length;
+} __OSCDestination;
+
+// Extra datagram destinations, each packet is encoded once and sent to the
+// connected host and all destinations. Destinations of each address family
+// share one socket so they are sent with a single sendmmsg. Multicast and
+// broadcast addresses are regular destinations replicated by the kernel.
+typedef struct {
+  __OSCDestination *items;
+  CFIndex count;
+  CFIndex capacity;
+  int sockfds[2];               // IPv4 and IPv6, 0 until first destination of the family is added
+  int multicastHops;            // 0 uses system default
+  bool multicastLoopback;
+  pthread_mutex_t lock;         // Destinations can be changed while sender thread is sending
+#if defined(__linux__)
+  struct mmsghdr *messages;
+  CFIndex messagesCapacity;
+#endif
+} __OSCDestinations;
+
+#pragma mark Resolver
+
+typedef struct {
+  char host[OSC_RESOLVER_HOST_LENGTH];
+  UInt16 port;
+  __OSCDestination address;     // 0 length if host can't be resolved
+  CFAbsoluteTime expires;
+} __OSCResolverEntry;
+
+// Cache of resolved hosts and a background thread, started on first use,
+// which resolves connection target of OSCConnectAsync and destinations of
+// OSCAddDestinationAsync, so the caller never waits for DNS. Resolved
+// target address is applied by the sending thread on its next send.
+typedef struct {
+  pthread_mutex_t lock;
+  pthread_cond_t condition;
+  pthread_t thread;
+  bool started;
+  bool stopping;
+  CFTimeInterval ttl;           // 0 disables caching
+  __OSCResolverEntry *entries;
+  CFIndex count;
+  CFIndex capacity;
+  
+  // Connection target, empty host if not connected with a host name. It's
+  // resolved again when it expires and followed if its address changes.
+  __OSCResolverEntry target;
+  bool targetPending;
+  __OSCDestination resolved;
+  bool ready;                   // resolved waits to be applied
+  
+  // Destinations waiting to be resolved.
+  __OSCResolverEntry *pending;
+  CFIndex pendingCount;
+  CFIndex pendingCapacity;
+} __OSCResolver;
+
+#pragma mark Stream transport
+
+// Packet framing on stream (TCP) connections, kOSCFramingNone for UDP.
+typedef enum OSCFraming {
+  kOSCFramingNone         = 0,
+  kOSCFramingLengthPrefix = 1, // OSC 1.0, big endian int32 size before each packet
+  kOSCFramingSLIP         = 2  // OSC 1.1, double END SLIP (RFC 1055)
+} OSCFraming;
+
+#define OSC_SLIP_END     0xc0
+#define OSC_SLIP_ESC     0xdb
+#define OSC_SLIP_ESC_END 0xdc
+#define OSC_SLIP_ESC_ESC 0xdd
+
+typedef struct {
+  OSCFraming framing;           // Of sent packets, only set on OSCConnectStream connection
+  OSCFraming receiveFraming;    // Of bytes fed to OSCReceiveStreamBytes
+  
+  // Framed packets waiting to be written, with batching enabled.
+  UInt8 *output;
+  CFIndex outputLength;
+  CFIndex outputCapacity;
+  
+  // Deframer state. Only a frame split between received chunks is copied
+  // to input, complete frames are decoded in place.
+  UInt8 *input;
+  CFIndex inputLength;
+  CFIndex inputCapacity;
+  UInt8 prefix[4];
+  CFIndex prefixLength;
+  CFIndex frameLength;          // -1 while reading length prefix
+  bool escape;                  // SLIP escape byte was the last one received
+  bool discard;                 // SLIP frame too long, skip to the next END
+} __OSCStream;
+
+#pragma mark Capture
+
+// Capture file is a 16 byte header followed by records, all big endian:
+//
+//   header: "CoreOSC\0", UInt32 version, UInt32 record header length (16)
+//   record: UInt64 monotonic time in ns, UInt32 destination id,
+//           UInt32 packet length, packet bytes padded to 4 bytes
+//
+// Records are appended through a shared memory mapping which grows in
+// OSC_CAPTURE_CHUNK_LENGTH steps. The file is truncated to its real length
+// when capture stops.
+#define kOSCCaptureAllDestinations UINT32_MAX
+
+typedef struct {
+  char magic[8];
+  UInt32 version;
+  UInt32 recordHeaderLength;
+} __OSCCaptureHeader;
+
+typedef struct {
+  UInt64 time;
+  UInt32 destinationId;
+  UInt32 length;
+} __OSCCaptureRecord;
+
+typedef struct {
+  int fd;
+  UInt8 *bytes;
+  CFIndex length;
+  CFIndex capacity;
+  UInt32 destinationId;
+  pthread_mutex_t lock;         // Sends from run loop timer and sender thread can race
+} __OSCCapture;
+
+#pragma mark io_uring transport
+
+typedef enum {
+  kOSCTransportSocket        = 0, // sendto, sendmmsg and recvmmsg
+  kOSCTransportIOUring       = 1, // io_uring, non-blocking submit per send or batch flush
+  kOSCTransportIOUringPolled = 2  // io_uring with kernel thread polling submissions, busy sender makes no syscalls
+} OSCTransport;
+
+#if defined(OSC_IO_URING)
+
+// Submission and completion rings mapped from the kernel, set up with raw
+// syscalls so there's no liburing dependency.
+typedef struct {
+  int fd;
+  unsigned flags;               // IORING_SETUP_* the ring was created with
+  unsigned entries;
+  unsigned *sqHead;
+  unsigned *sqTail;
+  unsigned *sqMask;
+  unsigned *sqFlags;
+  unsigned *sqArray;
+  struct io_uring_sqe *sqes;
+  unsigned *cqHead;
+  unsigned *cqTail;
+  unsigned *cqMask;
+  struct io_uring_cqe *cqes;
+  void *ring;
+  size_t ringLength;
+  size_t sqesLength;
+  UInt64 *callsCount;           // Metrics counter of io_uring_enter calls
+} __OSCUring;
+
+// Sends of the connected datagram socket. Packets are copied to free slots
+// of the registered buffer and written with the socket registered as fixed
+// file 0. Slots are given back when their completions are reaped.
+typedef struct __OSCUringSender {
+  __OSCUring ring;
+  UInt8 *buffers;               // OSC_URING_ENTRIES * OSC_BATCH_BUFFER_LENGTH
+  UInt16 slots[OSC_URING_ENTRIES];
+  CFIndex slotsCount;
+  int registeredfd;             // Socket registered as fixed file, -1 if none
+} __OSCUringSender;
+
+#endif
+
 #pragma mark Internal, diagnostics
 
 void    __OSCBufferPrint(char *buffer, int length);
 
 typedef enum OSCResult {
-  kOSCResultNotAllocatedError = -1001 // OSCRef object has not been allocated?
+  kOSCResultSuccess                = 0,
+  kOSCResultNotAllocatedError      = -1001, // OSCRef object has not been allocated?
+  kOSCResultMalformedPacketError   = -1002, // Received bytes are not a valid OSC packet
+  kOSCResultBundleTooDeepError     = -1003, // Bundles nested deeper than OSC_MAXIMUM_BUNDLE_DEPTH
+  kOSCResultInvalidAddressError    = -1004, // Address is empty, too long or has reserved characters
+  kOSCResultInvalidHandleError     = -1005, // Address handle has not been registered with OSCRef
+  kOSCResultTooLongError           = -1006, // Value doesn't fit static packet buffer
+  kOSCResultQueueFullError         = -1007, // Sender thread queue is full, value has been dropped
+  kOSCResultDroppedError           = -1008, // Socket buffer is full and overflow policy dropped the packet
+  kOSCResultQueued                 = 1      // Socket buffer is full, packet will be sent by OSCFlush or run loop timer
 } OSCResult;
 
+#define OSC_METRICS_ERRNO_LENGTH     136 // Send errors are counted by errno below this, others at 0
+#define OSC_METRICS_HISTOGRAM_LENGTH 32  // Bucket i counts durations of [2^i, 2^(i+1)) ns
+
+// Counters of a single OSCRef, read with OSCGetMetrics. All counters are
+// updated with relaxed atomic adds, messages can be encoded on any thread
+// and a snapshot taken on another thread never sees torn values.
+typedef struct {
+  UInt64 messagesCount;                            // Messages encoded by OSCSend* and run loop timer
+  UInt64 bundlesCount;                             // Bundles of changed values sent by run loop timer or sender thread
+  UInt64 packetsCount;                             // Datagrams or stream frames accepted by the kernel
+  UInt64 bytesCount;
+  UInt64 sendCallsCount;                           // Send syscalls
+  UInt64 sendErrorsCount;
+  UInt64 sendErrors[OSC_METRICS_ERRNO_LENGTH];     // Failed send calls by errno
+  UInt64 queuedCount;                              // Packets queued because socket buffer was full
+  UInt64 droppedCount;                             // Packets dropped because socket buffer was full
+  UInt64 coalescedCount;                           // Values replaced by newer ones before they were sent
+  UInt64 queueFullCount;                           // Values dropped because sender thread queue was full
+  UInt64 filteredCount;                            // Values not sent because of filter rules
+  UInt64 receivedPacketsCount;                     // Datagrams received by receive server
+  UInt64 receivedBytesCount;
+  UInt64 receiveCallsCount;                        // Receive syscalls of receive server
+  UInt64 receiveErrorsCount;                       // Truncated or malformed received datagrams
+  UInt64 encodeTimes[OSC_METRICS_HISTOGRAM_LENGTH]; // Array and bundle encoding, with OSCSetMetricsTiming
+  UInt64 sendTimes[OSC_METRICS_HISTOGRAM_LENGTH];   // Send syscalls, with OSCSetMetricsTiming
+} OSCMetrics;
+
+// Counter updated from any thread, see OSCMetrics.
+#define __OSCMetricsAdd(counter, n) __atomic_fetch_add(&(counter), (n), __ATOMIC_RELAXED)
+
+// Called with failures which used to be printed, result is the error
+// returned to the caller or -1 for failed syscall with errnum set.
+struct OSC;
+typedef void (*OSCDiagnosticCallBack)(struct OSC *osc, OSCResult result, int errnum, const char *message, void *info);
+
+#pragma mark Values
+
+// Unboxed value, type is the OSC type tag character - f, i, T, F or s and b
+// for CFString and CFData objects.
+typedef struct {
+  char type;
+  union {
+    Float32 f;
+    SInt32 i;
+    CFTypeRef object;
+  } value;
+} OSCValue;
+
+#pragma mark Latest value cache
+
+// Filter rule of the latest value cache. Numbers within absolute or relative
+// epsilon of the last sent value aren't sent, strings, blobs and booleans
+// aren't sent when equal to it. Zero epsilons suppress exact repeats only.
+// Suppressed values are still resent every keepAlive seconds, so receivers
+// which join late get the state; 0 disables keep alive.
+typedef struct {
+  Float64 absoluteEpsilon;
+  Float64 relativeEpsilon;      // Fraction of the last sent value
+  CFTimeInterval keepAlive;
+} OSCFilter;
+
+typedef struct {
+  char prefix[OSC_STATIC_ADDRESS_LENGTH]; // Zero terminated address prefix
+  CFIndex prefixLength;
+  OSCFilter filter;
+} __OSCFilterRule;
+
+// Rules are resolved to cache slots lazily, slots remember the generation
+// they have been resolved with.
+typedef struct {
+  __OSCFilterRule *rules;
+  CFIndex count;
+  CFIndex capacity;
+  UInt32 generation;
+} __OSCFilters;
+
+// Rate class of the latest value cache. Changed values of addresses under
+// the prefix are sent at most every interval seconds, higher priority
+// classes are packed first. Run loop timer and sender thread caches are
+// scheduled separately, so a pass of one doesn't hold back the other.
+#define OSC_RATE_CLASS_SCHEDULES 2
+
+typedef struct {
+  char prefix[OSC_STATIC_ADDRESS_LENGTH]; // Zero terminated address prefix
+  CFIndex prefixLength;
+  CFTimeInterval interval;
+  SInt32 priority;
+  CFAbsoluteTime nextTime[OSC_RATE_CLASS_SCHEDULES]; // When values of the class are sent next
+  bool due[OSC_RATE_CLASS_SCHEDULES];                // Can be sent in the current pass
+  bool sent[OSC_RATE_CLASS_SCHEDULES];               // Has values in the current pass
+} __OSCRateClass;
+
+typedef struct {
+  __OSCRateClass *classes;
+  CFIndex count;
+  CFIndex capacity;
+  UInt32 generation;
+} __OSCRateClasses;
+
+typedef struct {
+  OSCAddressHandle handle;      // kOSCAddressHandleInvalid for empty slot
+  UInt32 hash;                  // Hash of the encoded address
+  CFIndex next;                 // Next dirty slot, -1 for the last one
+  bool dirty;
+  OSCValue value;
+  CFIndex filter;               // Filter rule index, -1 for none
+  UInt32 filterGeneration;
+  OSCValue sent;                // Last sent value, kept only for filtered slots
+  CFAbsoluteTime sentTime;
+  CFIndex rateClass;            // Rate class index, -1 for none
+  UInt32 rateClassGeneration;
+} __OSCCacheSlot;
+
+// Latest value per address. Flat open addressing table keyed by pre-hashed
+// encoded addresses, values are kept unboxed. Changed slots are linked into
+// intrusive dirty list in order of first change, so sending costs
+// O(changed addresses), not O(all addresses).
+typedef struct {
+  SInt32 priority;              // Priority of the rate class, 0 without one
+  UInt32 prefixHash;            // Hash of the address up to the last '/'
+  CFIndex position;             // Position in the dirty list
+  CFIndex slot;
+} __OSCCacheOrder;
+
+typedef struct {
+  __OSCCacheSlot *slots;
+  CFIndex capacity;             // Power of 2
+  CFIndex count;
+  CFIndex dirtyHead;            // -1 if nothing has changed
+  CFIndex dirtyTail;
+  CFIndex dirtyCount;
+  __OSCCacheOrder *order;       // Scratch for splitting dirty values into bundles
+  CFIndex orderCapacity;
+  CFAbsoluteTime keepAliveTime; // Next keep alive scan, 0 if no slot needs one
+  CFIndex schedule;             // Rate class schedule, 0 for run loop timer, 1 for sender thread
+} __OSCCache;
+
+// How changed values are split into bundles which fit maximum datagram size.
+typedef enum OSCPackingPolicy {
+  kOSCPackingPolicySequential = 0, // In order of change, bundles are filled up
+  kOSCPackingPolicyPrefix     = 1  // Messages of the same container are kept in the same bundle when they fit
+} OSCPackingPolicy;
+
+#pragma mark Receiving - packet views
+
+// OSC time tag, 64bit NTP fixed point format, value 1 means "immediately".
+typedef UInt64 OSCTimeTag;
+
+#define kOSCTimeTagImmediately ((OSCTimeTag)1)
+
+// Seconds between NTP epoch (1900) and CFAbsoluteTime reference date (2001).
+#define kOSCTimeTagAbsoluteTimeOffset 3187296000.0
+
+typedef enum OSCPacketType {
+  kOSCPacketTypeInvalid = 0,
+  kOSCPacketTypeMessage = 1,
+  kOSCPacketTypeBundle  = 2
+} OSCPacketType;
+
+// Views don't own or copy anything, all pointers point into the received
+// buffer and are valid only as long as the buffer is.
+typedef struct {
+  const char  *address;         // Zero terminated
+  CFIndex      addressLength;   // Without zero terminator
+  const char  *typeTags;        // Zero terminated, without leading ','
+  CFIndex      typeTagsLength;
+  const UInt8 *arguments;
+  CFIndex      argumentsLength;
+} OSCMessageView;
+
+typedef struct {
+  OSCTimeTag   timeTag;
+  const UInt8 *elements;        // Size prefixed elements following the time tag
+  CFIndex      elementsLength;
+} OSCBundleView;
+
+typedef struct {
+  OSCPacketType  type;
+  const UInt8   *bytes;
+  CFIndex        length;
+  OSCMessageView message;       // Valid for kOSCPacketTypeMessage
+  OSCBundleView  bundle;        // Valid for kOSCPacketTypeBundle
+} OSCPacketView;
+
+// Single argument, type is the OSC type tag character. Strings (s and S) and
+// blobs point into the packet, T, F, N, I, [ and ] have no value.
+typedef struct {
+  char type;
+  union {
+    SInt32 i;
+    Float32 f;
+    SInt64 h;
+    Float64 d;
+    OSCTimeTag t;
+    char c;
+    UInt32 r;                   // RGBA, red in the most significant byte
+    UInt8 m[4];                 // MIDI port id, status byte, data1, data2
+    struct {
+      const char *pointer;      // Zero terminated
+      CFIndex length;           // Without zero terminator
+    } s;
+    struct {
+      const UInt8 *pointer;
+      CFIndex length;
+    } b;
+  } value;
+} OSCArgument;
+
+typedef struct {
+  const OSCMessageView *message;
+  CFIndex typeTagIndex;
+  CFIndex offset;
+  bool malformed;
+} OSCArgumentIterator;
+
+typedef struct {
+  const OSCBundleView *bundle;
+  CFIndex offset;
+  bool malformed;
+} OSCBundleIterator;
+
+#pragma mark Argument lists
+
+// Unboxed argument of OSCEncodeMessage, the field is selected by the type
+// tag. T, F, N, I, [ and ] don't take a value.
+typedef union {
+  SInt32 i;
+  Float32 f;
+  SInt64 h;
+  Float64 d;
+  OSCTimeTag t;
+  char c;
+  UInt32 r;                     // RGBA, red in the most significant byte
+  UInt8 m[4];                   // MIDI port id, status byte, data1, data2
+  const char *s;                // s and S, zero terminated UTF8
+  struct {
+    const void *bytes;
+    CFIndex length;
+  } b;
+} OSCArgumentValue;
+
+CFIndex             __OSCGetPaddedStringLength(const UInt8 *bytes, CFIndex length);
+SInt32              __OSCReadSInt32           (const UInt8 *bytes);
+UInt64              __OSCReadUInt64           (const UInt8 *bytes);
+
+OSCPacketView       OSCPacketViewMake         (const void *bytes, CFIndex length);
+
+OSCArgumentIterator OSCArgumentIteratorMake   (const OSCMessageView *message);
+bool                OSCArgumentIteratorNext   (OSCArgumentIterator *iterator, OSCArgument *argument);
+
+OSCBundleIterator   OSCBundleIteratorMake     (const OSCBundleView *bundle);
+bool                OSCBundleIteratorNext     (OSCBundleIterator *iterator, OSCPacketView *element);
+
+typedef void (*OSCMessageCallBack)(struct OSC *osc, const OSCMessageView *message, OSCTimeTag timeTag, void *info);
+
+#pragma mark Scheduler
+
+// Received bundle copy waiting for its time tag.
+typedef struct __OSCScheduledBundle {
+  struct __OSCScheduledBundle *next;
+  OSCTimeTag timeTag;
+  CFIndex length;               // Followed by length bytes of the bundle
+} __OSCScheduledBundle;
+
+// Timing wheel of future bundles. Bundles due within OSC_SCHEDULER_SLOTS_LENGTH
+// ticks go straight to their slot, later ones wait in the overflow list which
+// is redistributed once per wheel turn. Insert and release are O(1) amortized.
+// Occupied slots are kept in a bitmap, so the earliest pending tick is found
+// without walking the wheel.
+typedef struct {
+  UInt64 tick;                  // Next tick to be released
+  UInt64 armedTick;             // Tick run loop timer fires at, UINT64_MAX if idle
+  CFIndex count;
+  __OSCScheduledBundle *heads[OSC_SCHEDULER_SLOTS_LENGTH];
+  __OSCScheduledBundle *tails[OSC_SCHEDULER_SLOTS_LENGTH];
+  UInt64 occupied[OSC_SCHEDULER_SLOTS_LENGTH / 64];
+  __OSCScheduledBundle *overflow;
+  CFIndex overflowCount;
+  CFRunLoopTimerRef runLoopTimer;
+} __OSCScheduler;
+
+#pragma mark Sender thread
+
+typedef struct {
+  CFIndex sequence;
+  CFIndex handle;
+  OSCValue value;
+} __OSCSenderCell;
+
+// Bounded lock-free queue (Vyukov). Any number of producers claim cells with
+// compare-and-swap on enqueuePosition, the sender thread is the only consumer.
+// Updates are coalesced by handle, only the latest value of each address
+// pushed since the last tick is sent.
+typedef struct {
+  __OSCSenderCell *cells;
+  CFIndex mask;
+  char padding0[64];
+  CFIndex enqueuePosition;
+  char padding1[64];
+  CFIndex dequeuePosition;
+  
+  pthread_t thread;
+  bool running;
+  CFTimeInterval timeInterval;
+  struct OSCWriter *writer;
+  
+  __OSCCache cache;             // Owned by the sender thread
+} __OSCSender;
+
+#pragma mark Receive server
+
+// Receiving thread with its own SO_REUSEPORT socket, the kernel spreads
+// incoming flows over workers by hash of source and destination.
+typedef struct {
+  struct OSC *osc;
+  pthread_t thread;
+  int sockfd;
+  int cpu;                      // -1 if not pinned
+  UInt8 *buffers;               // batchLength * OSC_RECEIVE_BUFFER_LENGTH slab
+#if defined(__linux__)
+  struct mmsghdr *messages;
+  struct iovec *iovecs;
+#endif
+#if defined(OSC_IO_URING)
+  
+  // Multishot receive into provided buffers, used with io_uring transport
+  // if the ring could be set up.
+  bool uring;
+  bool armed;                   // Multishot receive is pending
+  __OSCUring ring;
+  struct io_uring_buf_ring *bufferRing;
+  size_t bufferRingLength;
+  UInt16 bufferRingTail;
+  unsigned buffersCount;        // Power of two, at most batchLength
+#endif
+} __OSCReceiveWorker;
+
+typedef struct {
+  bool running;
+  UInt16 port;
+  CFIndex batchLength;
+  CFIndex workersCount;
+  __OSCReceiveWorker *workers;
+} __OSCReceiveServer;
+
+#pragma mark Receiving - methods
+
+typedef OSCMessageCallBack OSCMethodCallBack;
+
+// Trie node, one per address segment. Children are kept sorted by name,
+// so literal pattern segments are resolved with binary search and only
+// segments with wildcards have to be matched against every child.
+typedef struct __OSCMethodNode {
+  struct __OSCMethodNode **children;
+  CFIndex childrenCount;
+  CFIndex childrenCapacity;
+  const char *name;             // Segment name, points into address
+  CFIndex nameLength;
+  const char *address;          // Full address, zero terminated
+  CFIndex addressLength;
+  UInt32 hash;                  // Hash of full address
+  OSCMethodCallBack callBack;   // NULL for intermediate nodes
+  void *info;
+} __OSCMethodNode;
+
+UInt32 __OSCHash                  (const void *bytes, CFIndex length);
+
+bool   OSCPatternMatch            (const char *pattern, CFIndex patternLength, const char *string, CFIndex stringLength);
+bool   OSCPatternIsLiteral        (const char *pattern, CFIndex patternLength);
+
 typedef struct OSC {
   CFAllocatorRef allocator;
   CFIndex retainCount;
@@ -108,11 +809,99 @@ typedef struct OSC {
   
   CFRunLoopTimerRef runLoopTimer;
   
-  // Hold keys (addresses) and array of values.
-  // Depending on the mode, new values are replaced or added to the array.
-  // Run loop timer on each execution will send the first value for all
-  // keys.
-  CFMutableDictionaryRef cache;
+  // Latest values set with OSCSet* functions. Run loop timer on each
+  // execution sends values which have changed since the last execution.
+  __OSCCache cache;
+  
+  // Changed values are sent in as many bundles as needed, each at most
+  // maximumDatagramSize bytes long to avoid IP fragmentation.
+  CFIndex maximumDatagramSize;
+  OSCPackingPolicy packingPolicy;
+  
+  // Deadband and keep alive rules of the latest value cache, the longest
+  // matching address prefix wins.
+  __OSCFilters filters;
+  
+  // Send rates and priorities of the latest value cache by address prefix.
+  // Run loop timer wakes up when the next class is due, addresses without
+  // a class are sent every runLoopTimerInterval. Each pass sends at most
+  // sendBudget bytes, 0 for unlimited.
+  __OSCRateClasses rateClasses;
+  CFTimeInterval runLoopTimerInterval;
+  CFIndex sendBudget;
+  
+  // Addresses registered for sending, pre-encoded. Kept in fixed size
+  // chunks of OSC_ADDRESSES_LENGTH, so addresses never move once appended.
+  OSCAddress *addresses[OSC_ADDRESSES_CHUNKS_LENGTH];
+  CFIndex addressesCount;
+  CFMutableDictionaryRef addressHandles; // Address name -> CFNumber handle
+  
+  // Receiving namespace. Trie over address segments for pattern dispatch
+  // and open addressing table of full addresses for literal addresses,
+  // which is the common case.
+  __OSCMethodNode *methods;
+  __OSCMethodNode **methodsTable;
+  CFIndex methodsTableCapacity;
+  CFIndex methodsCount;
+  
+  // Called for every received message, including messages inside bundles.
+  OSCMessageCallBack messageCallBack;
+  void *messageCallBackInfo;
+  
+  // Received bundles with future time tags, NULL if scheduling is off and
+  // bundles are delivered as soon as they arrive.
+  __OSCScheduler *scheduler;
+  
+  // Time tag of bundles sent by the run loop timer is now + latency, so
+  // receivers can absorb network jitter. 0 sends immediate bundles.
+  CFTimeInterval latency;
+  
+  // Dedicated sender thread, NULL if not started. Number of OSCPush* calls
+  // in progress, the sender is freed only once they have returned.
+  __OSCSender *sender;
+  CFIndex pushersCount;
+  
+  // Receiving threads started with OSCStartReceiveServer, NULL if not started.
+  __OSCReceiveServer *receiveServer;
+  
+  // Reused by the run loop timer to encode bundles.
+  OSCWriterRef writer;
+  
+  __OSCBatch batch;
+  __OSCSendQueue queue;
+  __OSCDestinations destinations;
+  
+  // Framing and buffers of stream connection made with OSCConnectStream.
+  __OSCStream stream;
+  
+  // Log of sent packets, NULL if not capturing.
+  __OSCCapture *capture;
+  
+  // Transport picked at creation, uring is NULL with socket transport.
+  // io_uring keeps the datagram socket connected.
+  OSCTransport transport;
+  struct __OSCUringSender *uring;
+  
+  __OSCResolver resolver;
+  
+  // Peer of datagram connection, p points to peerInfo. With connected
+  // datagrams the socket is connect()ed and sends carry no address.
+  struct addrinfo peerInfo;
+  struct sockaddr_storage peerAddress;
+  bool connectedDatagrams;
+  bool peerConnected;
+  
+  OSCMetrics metrics;
+  bool metricsTiming;
+  
+  OSCDiagnosticCallBack diagnosticCallBack;
+  void *diagnosticCallBackInfo;
+  
+  // Serializes sending from OSCSend* callers, the run loop timer and the
+  // sender thread. Held while the writer, batch, send queue, stream output,
+  // io_uring ring, socket and peer, filters and rate classes are used or
+  // changed. Recursive, send functions call each other.
+  pthread_mutex_t sendLock;
   
   int sockfd;
   struct addrinfo hints;
@@ -126,6 +915,8 @@ typedef OSC *OSCRef;
 
 void __OSCBufferAppendAddressWithString  (void *buffer, CFStringRef name, int *i);
 
+bool __OSCAddressInitWithString          (OSCAddress *address, CFStringRef name);
+
 #pragma mark Data related functions - packet construction
 
 void OSCDataAppendZeroBytesFor32Alignment (CFMutableDataRef data);
@@ -133,38 +924,301 @@ void OSCDataAppendSInt32                  (CFMutableDataRef data, SInt32 value);
 void OSCDataAppendNumberAsSInt32          (CFMutableDataRef data, CFNumberRef value);
 void OSCDataAppendNumberAsFloat32         (CFMutableDataRef data, CFNumberRef value);
 void OSCDataAppendImmediateTimeTag        (CFMutableDataRef data);
+void OSCDataAppendTimeTag                 (CFMutableDataRef data, OSCTimeTag timeTag);
 void OSCDataAppendData                    (CFMutableDataRef data, CFDataRef value);
 
 void OSCDataAppendString                  (CFAllocatorRef allocator, CFMutableDataRef data, CFStringRef value);
 void OSCDataAppendMessage                 (CFAllocatorRef allocator, CFMutableDataRef data, CFStringRef name, CFTypeRef value);
 void OSCDataAppendBundleWithDictionary    (CFAllocatorRef allocator, CFMutableDataRef data, CFDictionaryRef keyValuePairs);
+void OSCDataAppendBundleWithDictionaryAndTimeTag (CFAllocatorRef allocator, CFMutableDataRef data, CFDictionaryRef keyValuePairs, OSCTimeTag timeTag);
+
+#pragma mark Time tags
+
+OSCTimeTag     OSCTimeTagMakeWithAbsoluteTime          (CFAbsoluteTime time);
+OSCTimeTag     OSCTimeTagMakeWithTimeIntervalSinceNow  (CFTimeInterval timeInterval);
+CFAbsoluteTime OSCTimeTagGetAbsoluteTime               (OSCTimeTag timeTag);
+
+#pragma mark Writer
+
+UInt8       *__OSCWriterReserve            (OSCWriterRef writer, CFIndex length);
+CFIndex      __OSCWriterBeginElement       (OSCWriterRef writer);
+void         __OSCWriterEndElement         (OSCWriterRef writer, CFIndex offset);
+bool         __OSCWriterAppendArguments    (OSCWriterRef writer, CFTypeRef value);
+
+OSCWriterRef OSCWriterCreate               (CFAllocatorRef allocator, CFIndex capacity);
+OSCWriterRef OSCWriterRetain               (OSCWriterRef writer);
+OSCWriterRef OSCWriterRelease              (OSCWriterRef writer);
+
+void         OSCWriterReset                (OSCWriterRef writer);
+const UInt8 *OSCWriterGetBytePtr           (OSCWriterRef writer);
+CFIndex      OSCWriterGetLength            (OSCWriterRef writer);
+
+bool         OSCWriterAppendBytes          (OSCWriterRef writer, const void *bytes, CFIndex length);
+bool         OSCWriterAppendCString        (OSCWriterRef writer, const char *value, CFIndex length);
+bool         OSCWriterAppendString         (OSCWriterRef writer, CFStringRef value);
+bool         OSCWriterAppendSInt32         (OSCWriterRef writer, SInt32 value);
+bool         OSCWriterAppendFloat32        (OSCWriterRef writer, Float32 value);
+bool         OSCWriterAppendTimeTag        (OSCWriterRef writer, OSCTimeTag timeTag);
+
+bool         OSCWriterBeginBundle          (OSCWriterRef writer, OSCTimeTag timeTag);
+bool         OSCWriterEndBundle            (OSCWriterRef writer);
+bool         OSCWriterAppendMessage        (OSCWriterRef writer, CFStringRef name, CFTypeRef value);
+bool         OSCWriterAppendMessageWithAddress (OSCWriterRef writer, const OSCAddress *address, CFTypeRef value);
+bool         OSCWriterAppendValueWithAddress   (OSCWriterRef writer, const OSCAddress *address, const OSCValue *value);
+bool         OSCWriterAppendArrayWithAddress   (OSCWriterRef writer, const OSCAddress *address, char type, const void *values, CFIndex n);
+
+#pragma mark Array encoders
+
+void         __OSCEncodeSwapped32          (UInt8 *destination, const void *source, CFIndex n);
+void         __OSCEncodeSwapped64          (UInt8 *destination, const void *source, CFIndex n);
+CFIndex      __OSCEncodeTypeTags           (UInt8 *destination, char type, CFIndex n);
+
+#pragma mark Argument lists
+
+OSCResult    OSCEncodeMessage              (void *buffer, CFIndex capacity, const OSCAddress *address, const char *typeTags, const OSCArgumentValue *values, CFIndex *length);
+
+#pragma mark Values
+
+bool      __OSCValueMakeWithCFType       (OSCValue *value, CFTypeRef object);
+void      __OSCValueRelease              (OSCValue *value);
+
+#pragma mark Latest value cache
+
+bool            __OSCCacheInit           (CFAllocatorRef allocator, __OSCCache *cache, CFIndex capacity);
+void            __OSCCacheDestroy        (CFAllocatorRef allocator, __OSCCache *cache);
+__OSCCacheSlot *__OSCCacheFind           (OSCRef osc, __OSCCache *cache, const OSCAddress *address);
+__OSCCacheSlot *__OSCCacheInsert         (OSCRef osc, __OSCCache *cache, OSCAddressHandle handle);
+bool            __OSCCacheSetValue       (OSCRef osc, __OSCCache *cache, __OSCCacheSlot *slot, const OSCValue *value);
+void            __OSCCacheMarkDirty      (__OSCCache *cache, __OSCCacheSlot *slot);
+const OSCFilter *__OSCCacheGetFilter     (OSCRef osc, __OSCCacheSlot *slot);
+bool            __OSCFilterSuppresses    (const OSCFilter *filter, const OSCValue *sent, const OSCValue *value);
+void            __OSCCacheKeepAlive      (OSCRef osc, __OSCCache *cache, CFAbsoluteTime now);
+bool            __OSCCacheIsFiltered     (OSCRef osc, __OSCCacheSlot *slot, CFAbsoluteTime now);
+void            __OSCCacheSetSent        (OSCRef osc, __OSCCache *cache, __OSCCacheSlot *slot, CFAbsoluteTime now);
+void            __OSCCacheKeepDirty      (__OSCCache *cache, CFIndex i, CFIndex *head, CFIndex *tail);
+const __OSCRateClass *__OSCCacheGetRateClass (OSCRef osc, __OSCCacheSlot *slot);
+int             __OSCCacheOrderCompare   (const void *a, const void *b);
+void            __OSCCacheSendBundle     (OSCRef osc, __OSCCache *cache, OSCWriterRef writer, bool now, CFIndex first, CFIndex last, CFAbsoluteTime time);
+CFIndex         __OSCCacheSendDirty      (OSCRef osc, __OSCCache *cache, OSCWriterRef writer, bool now);
 
 #pragma mark OSC API
 
 void __OSCRunLoopTimerCallBack(CFRunLoopTimerRef timer, void *info);
 
 OSCRef    OSCCreateWithUserInfo          (CFAllocatorRef allocator, void *userInfo);
+OSCRef    OSCCreateWithTransport         (CFAllocatorRef allocator, void *userInfo, OSCTransport transport);
+OSCTransport OSCGetTransport             (OSCRef osc);
 OSCRef    OSCRetain                      (OSCRef osc);
 OSCRef    OSCRelease                     (OSCRef osc);
 
+const struct sockaddr *__OSCGetPeerAddress      (OSCRef osc);
+socklen_t        __OSCGetPeerAddressLength (OSCRef osc);
+void             __OSCPeerSetConnected   (OSCRef osc, bool connected);
+OSCResult        __OSCConnectAddress     (OSCRef osc, const __OSCDestination *address);
+void             __OSCDisconnectSocket   (OSCRef osc);
+
 struct addrinfo *OSCConnect              (OSCRef osc, CFStringRef host, UInt16 port);
+OSCResult        OSCConnectAsync         (OSCRef osc, CFStringRef host, UInt16 port);
+OSCResult        OSCReconnect            (OSCRef osc);
 void             OSCDisconnect           (OSCRef osc);
+OSCResult        OSCSetConnectedDatagrams(OSCRef osc, bool connected);
+bool             OSCGetConnectedDatagrams(OSCRef osc);
+
+#pragma mark Stream transport
+
+UInt8    *__OSCStreamReserve         (OSCRef osc, UInt8 **buffer, CFIndex *capacity, CFIndex length, CFIndex required);
+OSCResult __OSCStreamWriteAll        (int fd, struct iovec *iov, int count);
+OSCResult __OSCStreamSend            (OSCRef osc, const struct iovec *iov, int count);
+OSCResult __OSCStreamFlush           (OSCRef osc);
+void      __OSCStreamDestroy         (OSCRef osc);
+CFIndex   __OSCStreamGetMaximumPacketLength (OSCRef osc);
+OSCResult __OSCStreamReceiveFrame    (OSCRef osc, const UInt8 *bytes, CFIndex length);
+
+struct addrinfo *OSCConnectStream    (OSCRef osc, CFStringRef host, UInt16 port, OSCFraming framing);
+void      OSCSetStreamFraming        (OSCRef osc, OSCFraming framing);
+OSCFraming OSCGetStreamFraming       (OSCRef osc);
+OSCResult OSCReceiveStreamBytes      (OSCRef osc, const void *bytes, CFIndex length);
+CFIndex   OSCReceiveStream           (OSCRef osc);
 
 #pragma mark Addresses
 
 CFArrayRef OSCCreateAddressArray         (OSCRef osc);
 
+OSCAddressHandle  OSCAddressesAppendWithString    (OSCRef osc, CFStringRef name);
+OSCAddressHandle  OSCAddressesGetHandleWithString (OSCRef osc, CFStringRef name);
+const OSCAddress *OSCAddressesGetAddress          (OSCRef osc, OSCAddressHandle handle);
+CFIndex           OSCAddressesGetCount            (OSCRef osc);
+
 void      OSCActivateRunLoopTimer        (OSCRef osc, CFTimeInterval timeInterval);
 void      OSCDeactivateRunLoopTimer      (OSCRef osc);
 
+void           OSCSetLatency             (OSCRef osc, CFTimeInterval latency);
+CFTimeInterval OSCGetLatency             (OSCRef osc);
+
+void             OSCSetMaximumDatagramSize (OSCRef osc, CFIndex size);
+CFIndex          OSCGetMaximumDatagramSize (OSCRef osc);
+void             OSCSetPackingPolicy       (OSCRef osc, OSCPackingPolicy policy);
+OSCPackingPolicy OSCGetPackingPolicy       (OSCRef osc);
+
+// Filters apply to values set with OSCSet* and pushed with OSCPush*. NULL
+// filter removes the rule of the prefix.
+CFIndex   __OSCFiltersResolve    (OSCRef osc, const OSCAddress *address);
+OSCResult OSCSetFilter           (OSCRef osc, CFStringRef prefix, const OSCFilter *filter);
+void      OSCRemoveAllFilters    (OSCRef osc);
+
+// Rate classes apply to values set with OSCSet*. With the sender thread its
+// time interval is the finest rate.
+CFIndex        __OSCRateClassesResolve     (OSCRef osc, const OSCAddress *address);
+void           __OSCRateClassesBeginPass   (OSCRef osc, CFIndex schedule, CFAbsoluteTime time);
+void           __OSCRateClassesEndPass     (OSCRef osc, CFIndex schedule, CFAbsoluteTime time);
+CFAbsoluteTime __OSCRateClassesGetNextTime (OSCRef osc, CFAbsoluteTime time);
+OSCResult      OSCSetRateClass             (OSCRef osc, CFStringRef prefix, CFTimeInterval interval, SInt32 priority);
+OSCResult      OSCRemoveRateClass          (OSCRef osc, CFStringRef prefix);
+void           OSCRemoveAllRateClasses     (OSCRef osc);
+void           OSCSetSendBudget            (OSCRef osc, CFIndex bytes);
+CFIndex        OSCGetSendBudget            (OSCRef osc);
+
 #pragma mark Sending
 
 // Async, scheduled for send with run loop timer
+OSCResult __OSCSetValueWithString  (OSCRef osc, CFStringRef name, const OSCValue *value);
 OSCResult OSCSetValue              (OSCRef osc, CFStringRef name, CFTypeRef value);
 OSCResult OSCSetNumberAsFloat32    (OSCRef osc, CFStringRef name, CFNumberRef value);
+OSCResult OSCSetValueWithHandle    (OSCRef osc, OSCAddressHandle handle, const OSCValue *value);
+OSCResult OSCSetFloat32WithHandle  (OSCRef osc, OSCAddressHandle handle, Float32 value);
+OSCResult OSCSetSInt32WithHandle   (OSCRef osc, OSCAddressHandle handle, SInt32 value);
+OSCResult OSCSetBoolWithHandle     (OSCRef osc, OSCAddressHandle handle, bool value);
 
+OSCResult __OSCSendRawBufferNow    (OSCRef osc, const void *buffer, CFIndex length);
+OSCResult __OSCSendIOVectorNow     (OSCRef osc, const struct iovec *iov, int count);
 OSCResult OSCSendRawBuffer         (OSCRef osc, const void *buffer, CFIndex length);
 OSCResult OSCSendRawBufferWithData (OSCRef osc, CFDataRef data);
+OSCResult OSCSendRawBufferWithWriter (OSCRef osc, OSCWriterRef writer);
+
+#pragma mark Batching
+
+void      __OSCBatchDestroy        (OSCRef osc);
+OSCResult __OSCBatchFlush          (OSCRef osc);
+
+OSCResult OSCSetBatchCapacity      (OSCRef osc, CFIndex capacity);
+CFIndex   OSCGetBatchCapacity      (OSCRef osc);
+OSCResult OSCFlush                 (OSCRef osc);
+void      OSCGetSendStatistics     (OSCRef osc, UInt64 *packetsCount, UInt64 *callsCount);
+
+#pragma mark Send queue
+
+void      __OSCSendQueueDestroy    (OSCRef osc);
+CFIndex   __OSCSendQueueGetSlotLength (OSCRef osc);
+OSCResult __OSCSendQueueSetSlotLength (OSCRef osc, CFIndex slotLength);
+CFIndex   __OSCSendQueueDrain      (OSCRef osc);
+OSCResult __OSCSendQueueEnqueue    (OSCRef osc, const struct iovec *iov, int count);
+OSCResult __OSCSendQueueSend       (OSCRef osc, const struct iovec *iov, int count);
+
+OSCResult OSCSetNonBlocking        (OSCRef osc, bool nonBlocking);
+bool      OSCGetNonBlocking        (OSCRef osc);
+OSCResult OSCSetSendQueue          (OSCRef osc, CFIndex capacity, OSCOverflowPolicy policy);
+CFIndex   OSCGetSendQueueCount     (OSCRef osc);
+
+#pragma mark Metrics
+
+UInt64    __OSCMetricsGetTime      (OSCRef osc);
+void      __OSCMetricsRecordTime   (UInt64 *histogram, UInt64 start);
+void      __OSCMetricsRecordSend   (OSCRef osc, bool success, CFIndex packets, CFIndex bytes, UInt64 start);
+void      __OSCDiagnostic          (OSCRef osc, OSCResult result, int errnum, const char *format, ...);
+
+void      OSCGetMetrics            (OSCRef osc, OSCMetrics *metrics);
+void      OSCResetMetrics          (OSCRef osc);
+void      OSCSetMetricsTiming      (OSCRef osc, bool enabled);
+void      OSCSetDiagnosticCallBack (OSCRef osc, OSCDiagnosticCallBack callBack, void *info);
+
+#pragma mark Destinations
+
+bool      __OSCCanSend                     (OSCRef osc);
+void      __OSCDestinationsInit            (__OSCDestinations *destinations);
+void      __OSCDestinationsDestroy         (OSCRef osc);
+int       __OSCDestinationsGetSocket       (OSCRef osc, int family);
+OSCResult __OSCDestinationsResolve         (OSCRef osc, CFStringRef host, UInt16 port, __OSCDestination *destination);
+OSCResult __OSCDestinationsAdd             (OSCRef osc, const __OSCDestination *destination);
+OSCResult __OSCDestinationsSend            (OSCRef osc, struct iovec *iov, CFIndex packetsCount, int iovecsPerPacket);
+
+OSCResult OSCAddDestination                (OSCRef osc, CFStringRef host, UInt16 port);
+OSCResult OSCAddDestinationAsync           (OSCRef osc, CFStringRef host, UInt16 port);
+OSCResult OSCRemoveDestination             (OSCRef osc, CFStringRef host, UInt16 port);
+void      OSCRemoveAllDestinations         (OSCRef osc);
+CFIndex   OSCGetDestinationsCount          (OSCRef osc);
+OSCResult OSCSetMulticastHops              (OSCRef osc, int hops);
+OSCResult OSCSetMulticastLoopback          (OSCRef osc, bool loopback);
+
+#pragma mark Resolver
+
+void      __OSCResolverInit                (__OSCResolver *resolver);
+void      __OSCResolverDestroy             (OSCRef osc);
+OSCResult __OSCResolverLookup              (const char *host, UInt16 port, __OSCDestination *address);
+bool      __OSCResolverFind                (__OSCResolver *resolver, const char *host, UInt16 port, __OSCDestination *address);
+void      __OSCResolverStore               (OSCRef osc, const char *host, UInt16 port, const __OSCDestination *address);
+OSCResult __OSCResolverResolve             (OSCRef osc, const char *host, UInt16 port, __OSCDestination *address);
+void      __OSCResolverSetTarget           (OSCRef osc, const char *host, UInt16 port, bool pending);
+bool      __OSCResolverStart               (OSCRef osc);
+void      __OSCResolverWait                (__OSCResolver *resolver);
+void     *__OSCResolverThreadMain          (void *info);
+void      __OSCResolverApply               (OSCRef osc);
+
+void      OSCSetResolverTTL                (OSCRef osc, CFTimeInterval ttl);
+void      OSCFlushResolverCache            (OSCRef osc);
+
+#pragma mark Pool allocator
+
+// Free blocks of one thread, by size class. Blocks freed on another thread
+// than they were allocated on join that thread's cache.
+typedef struct __OSCPoolBlock {
+  struct __OSCPoolBlock *next;
+} __OSCPoolBlock;
+
+typedef struct {
+  __OSCPoolBlock *heads[OSC_POOL_CLASSES_LENGTH];
+  CFIndex counts[OSC_POOL_CLASSES_LENGTH];
+} __OSCPoolCache;
+
+CFIndex         __OSCPoolGetClass         (CFIndex size);
+__OSCPoolCache *__OSCPoolGetCache         (void);
+void            __OSCPoolCacheDestroy     (void *info);
+void           *__OSCPoolAllocate         (CFIndex size, CFOptionFlags hint, void *info);
+void           *__OSCPoolReallocate       (void *pointer, CFIndex size, CFOptionFlags hint, void *info);
+void            __OSCPoolDeallocate       (void *pointer, void *info);
+CFIndex         __OSCPoolPreferredSize    (CFIndex size, CFOptionFlags hint, void *info);
+void            __OSCPoolInit             (void);
+
+CFAllocatorRef  OSCGetPoolAllocator       (void);
+
+#pragma mark Capture
+
+UInt64    __OSCCaptureGetTime              (void);
+bool      __OSCCaptureReserve              (__OSCCapture *capture, CFIndex length);
+void      __OSCCaptureAppend               (OSCRef osc, const struct iovec *iov, int count);
+
+OSCResult OSCStartCapture                  (OSCRef osc, const char *path, UInt32 destinationId);
+OSCResult OSCStopCapture                   (OSCRef osc);
+bool      OSCIsCapturing                   (OSCRef osc);
+OSCResult OSCReplayCapture                 (OSCRef osc, const char *path, double speed, UInt32 destinationId, UInt64 *packetsCount);
+
+#pragma mark io_uring transport
+
+#if defined(OSC_IO_URING)
+bool      __OSCUringInit                   (__OSCUring *ring, unsigned entries, unsigned cqEntries, unsigned flags);
+void      __OSCUringDestroy                (__OSCUring *ring);
+struct io_uring_sqe *__OSCUringGetSQE      (__OSCUring *ring);
+void      __OSCUringQueue                  (__OSCUring *ring);
+int       __OSCUringSubmit                 (__OSCUring *ring, unsigned wait, CFIndex timeout);
+#endif
+
+bool      __OSCUringSenderCreate           (OSCRef osc, OSCTransport transport);
+void      __OSCUringSenderDestroy          (OSCRef osc);
+bool      __OSCUringCanSend                (OSCRef osc);
+CFIndex   __OSCUringReap                   (OSCRef osc);
+void      __OSCUringDrain                  (OSCRef osc);
+void      __OSCUringSetSocket              (OSCRef osc);
+OSCResult __OSCUringSend                   (OSCRef osc, const struct iovec *iov, int count, bool submit);
+OSCResult __OSCUringFlush                  (OSCRef osc);
 
 #pragma mark 
 
@@ -173,8 +1227,42 @@ OSCResult OSCSendFalse             (OSCRef osc, CFStringRef name);
 OSCResult OSCSendBool              (OSCRef osc, CFStringRef name, bool value);
 OSCResult OSCSendFloat32           (OSCRef osc, CFStringRef name, Float32 value);
 OSCResult OSCSendFloats32          (OSCRef osc, CFStringRef name, const Float32 *values, CFIndex n);
+OSCResult OSCSendFloats64          (OSCRef osc, CFStringRef name, const Float64 *values, CFIndex n);
 OSCResult OSCSendSInt32            (OSCRef osc, CFStringRef name, SInt32 value);
+OSCResult OSCSendSInts32           (OSCRef osc, CFStringRef name, const SInt32 *values, CFIndex n);
+OSCResult OSCSendSInts64           (OSCRef osc, CFStringRef name, const SInt64 *values, CFIndex n);
 OSCResult OSCSendCString           (OSCRef osc, CFStringRef name, const UInt8 *value);
+OSCResult OSCSendBlob              (OSCRef osc, CFStringRef name, const void *bytes, CFIndex length);
+OSCResult OSCSendData              (OSCRef osc, CFStringRef name, CFDataRef value);
+OSCResult OSCSendArguments         (OSCRef osc, CFStringRef name, const char *typeTags, const OSCArgumentValue *values);
+
+#pragma mark Pre-encoded addresses
+
+OSCResult __OSCSendTrueWithAddress     (OSCRef osc, const OSCAddress *address);
+OSCResult __OSCSendFalseWithAddress    (OSCRef osc, const OSCAddress *address);
+OSCResult __OSCSendFloat32WithAddress  (OSCRef osc, const OSCAddress *address, Float32 value);
+OSCResult __OSCSendFloats32WithAddress (OSCRef osc, const OSCAddress *address, const Float32 *values, CFIndex n);
+OSCResult __OSCSendArrayWithAddress    (OSCRef osc, const OSCAddress *address, char type, const void *values, CFIndex n);
+OSCResult __OSCSendArray               (OSCRef osc, CFStringRef name, char type, const void *values, CFIndex n);
+OSCResult __OSCSendArrayWithHandle     (OSCRef osc, OSCAddressHandle handle, char type, const void *values, CFIndex n);
+OSCResult __OSCSendSInt32WithAddress   (OSCRef osc, const OSCAddress *address, SInt32 value);
+OSCResult __OSCSendCStringWithAddress  (OSCRef osc, const OSCAddress *address, const UInt8 *value);
+OSCResult __OSCSendBlobWithAddress     (OSCRef osc, const OSCAddress *address, const void *bytes, CFIndex length);
+OSCResult __OSCSendArgumentsWithAddress (OSCRef osc, const OSCAddress *address, const char *typeTags, const OSCArgumentValue *values);
+
+OSCResult OSCSendTrueWithHandle     (OSCRef osc, OSCAddressHandle handle);
+OSCResult OSCSendFalseWithHandle    (OSCRef osc, OSCAddressHandle handle);
+OSCResult OSCSendBoolWithHandle     (OSCRef osc, OSCAddressHandle handle, bool value);
+OSCResult OSCSendFloat32WithHandle  (OSCRef osc, OSCAddressHandle handle, Float32 value);
+OSCResult OSCSendFloats32WithHandle (OSCRef osc, OSCAddressHandle handle, const Float32 *values, CFIndex n);
+OSCResult OSCSendFloats64WithHandle (OSCRef osc, OSCAddressHandle handle, const Float64 *values, CFIndex n);
+OSCResult OSCSendSInt32WithHandle   (OSCRef osc, OSCAddressHandle handle, SInt32 value);
+OSCResult OSCSendSInts32WithHandle  (OSCRef osc, OSCAddressHandle handle, const SInt32 *values, CFIndex n);
+OSCResult OSCSendSInts64WithHandle  (OSCRef osc, OSCAddressHandle handle, const SInt64 *values, CFIndex n);
+OSCResult OSCSendCStringWithHandle  (OSCRef osc, OSCAddressHandle handle, const UInt8 *value);
+OSCResult OSCSendBlobWithHandle     (OSCRef osc, OSCAddressHandle handle, const void *bytes, CFIndex length);
+OSCResult OSCSendDataWithHandle     (OSCRef osc, OSCAddressHandle handle, CFDataRef value);
+OSCResult OSCSendArgumentsWithHandle (OSCRef osc, OSCAddressHandle handle, const char *typeTags, const OSCArgumentValue *values);
 
 #pragma mark CFTypes
 
@@ -186,3 +1274,77 @@ OSCResult OSCSendNumberAsFloat32   (OSCRef osc, CFStringRef name, CFNumberRef va
 
 OSCResult OSCSendBoolean           (OSCRef osc, CFStringRef name, CFBooleanRef value);
 OSCResult OSCSendString            (OSCRef osc, CFStringRef name, CFStringRef value);
+
+#pragma mark Receiving
+
+OSCResult __OSCReceivePacketView      (OSCRef osc, const OSCPacketView *packet, OSCTimeTag timeTag, CFIndex depth, bool schedule);
+
+void      OSCSetMessageCallBack       (OSCRef osc, OSCMessageCallBack callBack, void *info);
+
+OSCResult OSCReceiveRawBuffer         (OSCRef osc, const void *buffer, CFIndex length);
+OSCResult OSCReceiveRawBufferWithData (OSCRef osc, CFDataRef data);
+
+#pragma mark Sender thread
+
+bool      __OSCSenderDequeue          (__OSCSender *sender, CFIndex *handle, OSCValue *value);
+void      __OSCSenderCoalesce         (OSCRef osc, CFIndex handle, OSCValue *value);
+void      __OSCSenderSend             (OSCRef osc);
+void     *__OSCSenderThreadMain       (void *info);
+
+OSCResult OSCStartSenderThread        (OSCRef osc, CFIndex capacity, CFTimeInterval timeInterval);
+void      OSCStopSenderThread         (OSCRef osc);
+
+OSCResult OSCPushValue                (OSCRef osc, OSCAddressHandle handle, const OSCValue *value);
+OSCResult OSCPushFloat32              (OSCRef osc, OSCAddressHandle handle, Float32 value);
+OSCResult OSCPushSInt32               (OSCRef osc, OSCAddressHandle handle, SInt32 value);
+OSCResult OSCPushBool                 (OSCRef osc, OSCAddressHandle handle, bool value);
+OSCResult OSCPushCFType               (OSCRef osc, OSCAddressHandle handle, CFTypeRef value);
+
+#pragma mark Receive server
+
+CFIndex   __OSCReceiveWorkerReceive   (__OSCReceiveWorker *worker, CFIndex batchLength);
+void     *__OSCReceiveWorkerMain      (void *info);
+void      __OSCReceiveServerDestroy   (OSCRef osc, __OSCReceiveServer *server);
+#if defined(OSC_IO_URING)
+bool      __OSCReceiveWorkerInitRing  (__OSCReceiveWorker *worker, CFIndex batchLength);
+void      __OSCReceiveWorkerDestroyRing (__OSCReceiveWorker *worker);
+void      __OSCReceiveWorkerRecycle   (__OSCReceiveWorker *worker, unsigned index);
+CFIndex   __OSCReceiveWorkerReceiveRing (__OSCReceiveWorker *worker);
+#endif
+
+OSCResult OSCStartReceiveServer       (OSCRef osc, CFStringRef host, UInt16 port, CFIndex workersCount, CFIndex batchLength, const int *cpus);
+void      OSCStopReceiveServer        (OSCRef osc);
+UInt16    OSCGetReceiveServerPort     (OSCRef osc);
+
+#pragma mark Scheduler
+
+void      __OSCSchedulerInsert        (OSCRef osc, __OSCScheduledBundle *bundle);
+UInt64    __OSCSchedulerGetEarliestTick (OSCRef osc);
+void      __OSCSchedulerArmRunLoopTimer (OSCRef osc, UInt64 tick);
+void      __OSCSchedulerUpdateRunLoopTimer (OSCRef osc);
+void      __OSCSchedulerRunLoopTimerCallBack (CFRunLoopTimerRef timer, void *info);
+OSCResult __OSCSchedulerScheduleBundle(OSCRef osc, const OSCPacketView *packet, OSCTimeTag now);
+
+void      OSCActivateScheduler        (OSCRef osc);
+void      OSCDeactivateScheduler      (OSCRef osc);
+CFIndex   OSCDispatchScheduledBundles (OSCRef osc, OSCTimeTag now);
+CFIndex   OSCGetScheduledBundlesCount (OSCRef osc);
+
+#pragma mark Methods
+
+int              __OSCMethodNodeCompareName(const __OSCMethodNode *node, const char *name, CFIndex nameLength);
+CFIndex          __OSCMethodNodeFindChild  (const __OSCMethodNode *node, const char *name, CFIndex nameLength);
+__OSCMethodNode *__OSCMethodNodeCreate     (CFAllocatorRef allocator, const char *address, CFIndex addressLength, CFIndex nameOffset);
+void             __OSCMethodNodeDestroy    (CFAllocatorRef allocator, __OSCMethodNode *node);
+CFIndex          __OSCMethodNodeDispatch   (OSCRef osc, const __OSCMethodNode *node, const OSCMessageView *message, CFIndex offset, OSCTimeTag timeTag);
+__OSCMethodNode *__OSCMethodsTableFind     (OSCRef osc, const char *address, CFIndex addressLength, UInt32 hash);
+bool             __OSCMethodsTableInsert   (OSCRef osc, __OSCMethodNode *node);
+void             __OSCMethodsTableRemove   (OSCRef osc, __OSCMethodNode *node);
+
+OSCResult OSCAddMethod                (OSCRef osc, CFStringRef address, OSCMethodCallBack callBack, void *info);
+OSCResult OSCRemoveMethod             (OSCRef osc, CFStringRef address);
+CFIndex   OSCDispatchMessage          (OSCRef osc, const OSCMessageView *message, OSCTimeTag timeTag);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,161 @@
+//
+// CoreOSC.hpp
+// CoreOSC Framework
+//
+// Header only C++17 typed message builder. Type tags and argument layout of
+// osc::message<Ts...> are computed at compile time, arguments are encoded
+// with straight-line code into a stack buffer of constant size and sent
+// with OSCSendRawBuffer, so batching, send queue and destinations apply.
+//
+//   using Position = osc::message<float, float, int32_t>;
+//   Position::send(osc, handle, x, y, layer);
+//
+// Supported argument types are float (f), double (d), int32_t (i), int64_t
+// (h) and std::string_view (s).
+//
+
+#ifndef CORE_OSC_HPP
+#define CORE_OSC_HPP
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+#include "CoreOSC.h"
+
+namespace osc {
+
+namespace detail {
+
+// Type tag, encoded size (upper bound for strings) and encoder of
+// argument type. Fixed size arguments can't fail and are always valid.
+template <typename T> struct argument;
+
+template <> struct argument<int32_t> {
+  static constexpr char tag = 'i';
+  static constexpr size_t size = 4;
+  static constexpr bool valid(int32_t) { return true; }
+  static UInt8 *encode(UInt8 *bytes, int32_t value) {
+    uint32_t swapped = CFSwapInt32HostToBig((uint32_t)value);
+    memcpy(bytes, &swapped, 4);
+    return bytes + 4;
+  }
+};
+
+template <> struct argument<int64_t> {
+  static constexpr char tag = 'h';
+  static constexpr size_t size = 8;
+  static constexpr bool valid(int64_t) { return true; }
+  static UInt8 *encode(UInt8 *bytes, int64_t value) {
+    uint64_t swapped = CFSwapInt64HostToBig((uint64_t)value);
+    memcpy(bytes, &swapped, 8);
+    return bytes + 8;
+  }
+};
+
+template <> struct argument<float> {
+  static constexpr char tag = 'f';
+  static constexpr size_t size = 4;
+  static constexpr bool valid(float) { return true; }
+  static UInt8 *encode(UInt8 *bytes, float value) {
+    CFSwappedFloat32 swapped = CFConvertFloat32HostToSwapped(value);
+    memcpy(bytes, &swapped, 4);
+    return bytes + 4;
+  }
+};
+
+template <> struct argument<double> {
+  static constexpr char tag = 'd';
+  static constexpr size_t size = 8;
+  static constexpr bool valid(double) { return true; }
+  static UInt8 *encode(UInt8 *bytes, double value) {
+    CFSwappedFloat64 swapped = CFConvertFloat64HostToSwapped(value);
+    memcpy(bytes, &swapped, 8);
+    return bytes + 8;
+  }
+};
+
+// String and its 0 terminator padded to 4 bytes. The last word is zeroed
+// first, so padding doesn't need a branch.
+template <> struct argument<std::string_view> {
+  static constexpr char tag = 's';
+  static constexpr size_t size = OSC_STATIC_STRING_LENGTH;
+  static constexpr bool valid(std::string_view value) { return value.size() < OSC_STATIC_STRING_LENGTH; }
+  static UInt8 *encode(UInt8 *bytes, std::string_view value) {
+    size_t length = value.size();
+    memset(bytes + (length & ~(size_t)3), 0, 4);
+    memcpy(bytes, value.data(), length);
+    return bytes + ((length + 4) & ~(size_t)3);
+  }
+};
+
+} // namespace detail
+
+template <typename... Ts>
+class message {
+public:
+
+  // Comma, type tags and 0 terminator padded to 4 bytes.
+  static constexpr size_t tagsLength = (sizeof...(Ts) + 2 + 3) & ~(size_t)3;
+  static constexpr size_t argumentsLength = (0 + ... + detail::argument<Ts>::size);
+  static constexpr size_t maximumLength = OSC_STATIC_ADDRESS_LENGTH + tagsLength + argumentsLength;
+
+  static constexpr std::array<char, tagsLength> tags = [] {
+    std::array<char, tagsLength> result {};
+    size_t i = 0;
+    result[i++] = ',';
+    ((result[i++] = detail::argument<Ts>::tag), ...);
+    return result;
+  }();
+
+  // Encode message to buffer of at least maximumLength bytes. Returns
+  // length of the message or 0 if a string is too long.
+  static size_t encode(UInt8 *buffer, const OSCAddress &address, Ts... values) {
+    if (!(true && ... && detail::argument<Ts>::valid(values)))
+      return 0;
+    UInt8 *bytes = buffer;
+    memcpy(bytes, address.buffer, address.length);
+    bytes += address.length;
+    memcpy(bytes, tags.data(), tagsLength);
+    bytes += tagsLength;
+    ((bytes = detail::argument<Ts>::encode(bytes, values)), ...);
+    return bytes - buffer;
+  }
+
+  static OSCResult send(OSCRef osc, const OSCAddress &address, Ts... values) {
+    OSCResult result = kOSCResultNotAllocatedError;
+    if (osc) {
+      UInt8 buffer[maximumLength];
+      size_t length = encode(buffer, address, values...);
+      result = kOSCResultTooLongError;
+      if (length > 0) {
+        __OSCMetricsAdd(osc->metrics.messagesCount, 1);
+        result = OSCSendRawBuffer(osc, buffer, length);
+      }
+    }
+    return result;
+  }
+
+  static OSCResult send(OSCRef osc, OSCAddressHandle handle, Ts... values) {
+    OSCResult result = kOSCResultNotAllocatedError;
+    if (osc) {
+      const OSCAddress *address = OSCAddressesGetAddress(osc, handle);
+      result = address ? send(osc, *address, values...) : kOSCResultInvalidHandleError;
+    }
+    return result;
+  }
+
+  static OSCResult send(OSCRef osc, CFStringRef name, Ts... values) {
+    OSCResult result = kOSCResultNotAllocatedError;
+    if (osc && name) {
+      OSCAddress address;
+      result = __OSCAddressInitWithString(&address, name) ? send(osc, address, values...) : kOSCResultInvalidAddressError;
+    }
+    return result;
+  }
+};
+
+} // namespace osc
+
+#endif
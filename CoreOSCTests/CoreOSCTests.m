@@ -8,6 +8,72 @@
 
 #import "CoreOSCTests.h"
 
+static void TestReceiveMessageCallBack(struct OSC *osc, const OSCMessageView *message, OSCTimeTag timeTag, void *info) {
+  CFIndex *count = info;
+  OSCArgumentIterator iterator = OSCArgumentIteratorMake(message);
+  OSCArgument argument;
+  while (OSCArgumentIteratorNext(&iterator, &argument))
+    (*count)++;
+}
+
+static void TestDiagnosticCallBack(struct OSC *osc, OSCResult result, int errnum, const char *message, void *info) {
+  (*(CFIndex *)info)++;
+}
+
+static void TestMethodCallBack(struct OSC *osc, const OSCMessageView *message, OSCTimeTag timeTag, void *info) {
+  (*(CFIndex *)info)++;
+}
+
+static void TestAtomicMessageCallBack(struct OSC *osc, const OSCMessageView *message, OSCTimeTag timeTag, void *info) {
+  __atomic_fetch_add((CFIndex *)info, 1, __ATOMIC_RELAXED);
+}
+
+// Loopback socket receiving what a test sends, on port picked by the kernel.
+static int TestSocketCreate(UInt16 *port) {
+  int sockfd = socket(AF_INET, SOCK_DGRAM, 0);
+  struct sockaddr_in address;
+  socklen_t length = sizeof(address);
+  memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  int size = 4 * 1024 * 1024;
+  struct timeval timeout = { 1, 0 };
+  setsockopt(sockfd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+  setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  bind(sockfd, (struct sockaddr *)&address, sizeof(address));
+  getsockname(sockfd, (struct sockaddr *)&address, &length);
+  *port = ntohs(address.sin_port);
+  return sockfd;
+}
+
+// Allocator which refuses blocks larger than the limit passed as info.
+static void *TestLimitedAllocate(CFIndex size, CFOptionFlags hint, void *info) {
+  return size <= *(CFIndex *)info ? malloc(size) : NULL;
+}
+
+static void *TestLimitedReallocate(void *pointer, CFIndex size, CFOptionFlags hint, void *info) {
+  return size <= *(CFIndex *)info ? realloc(pointer, size) : NULL;
+}
+
+static void TestLimitedDeallocate(void *pointer, void *info) {
+  free(pointer);
+}
+
+// Pushes values until stopped, racing with the sender thread and sends made
+// from the test.
+typedef struct {
+  OSCRef osc;
+  OSCAddressHandle handle;
+  bool stop;
+} TestPusher;
+
+static void *TestPusherMain(void *info) {
+  TestPusher *pusher = info;
+  for (SInt32 i = 0; !__atomic_load_n(&pusher->stop, __ATOMIC_ACQUIRE); i++)
+    OSCPushFloat32(pusher->osc, pusher->handle, i);
+  return NULL;
+}
+
 @implementation CoreOSCTests
 
 - (void) setUp {
@@ -30,10 +96,883 @@
 }
 
 - (void) testExample {
-  OSCRef osc = OSCCreate(allocator, CFSTR("127.0.0.1"), CFSTR("60000"));
-  CFIndex testFloatIndex = OSCAddressesAppendWithString(osc, CFSTR("/test/float"));
-  OSCSendFloat(osc, testFloatIndex, 3.14);
+  OSCRef osc = OSCCreateWithUserInfo(allocator, NULL);
+  OSCConnect(osc, CFSTR("127.0.0.1"), 60000);
+  OSCAddressHandle testFloatIndex = OSCAddressesAppendWithString(osc, CFSTR("/test/float"));
+  STAssertEquals(OSCAddressesAppendWithString(osc, CFSTR("/test/float")), testFloatIndex, @"Same address should return the same handle");
+  STAssertEquals(OSCAddressesGetAddress(osc, testFloatIndex)->length, (CFIndex)12, @"Address should be padded to 32bit boundary");
+  STAssertEquals(OSCSendFloat32WithHandle(osc, testFloatIndex, 3.14), kOSCResultSuccess, @"Float should be sent");
+  OSCRelease(osc);
+}
+
+- (void) testReceiveRawBuffer {
+  OSCRef osc = OSCCreateWithUserInfo(allocator, NULL);
+  CFIndex count = 0;
+  OSCSetMessageCallBack(osc, TestReceiveMessageCallBack, &count);
+  
+  CFMutableDataRef data = CFDataCreateMutable(allocator, 0);
+  OSCDataAppendMessage(allocator, data, CFSTR("/test/true"), kCFBooleanTrue);
+  STAssertEquals(OSCReceiveRawBufferWithData(osc, data), kOSCResultSuccess, @"Message should decode");
+  STAssertEquals(count, (CFIndex)1, @"Message should have one argument");
+  
+  OSCPacketView packet = OSCPacketViewMake(CFDataGetBytePtr(data), CFDataGetLength(data));
+  STAssertTrue(packet.type == kOSCPacketTypeMessage, @"Packet should be a message");
+  STAssertTrue(packet.message.address == (const char *)CFDataGetBytePtr(data), @"Address should point into the buffer");
+  
+  // Cut inside the type tags, which are left without terminator
+  const UInt8 tags[] = { '/', 't', 'e', 's', 't', 0, 0, 0, ',', 'i', 'i', 'i', 'i', 0, 0, 0 };
+  STAssertEquals(OSCReceiveRawBuffer(osc, tags, 12), kOSCResultMalformedPacketError, @"Truncated type tags should be rejected");
+  
+  // Arguments are checked when iterated. Cut inside blob payload and blob
+  // with hostile size.
+  UInt8 blob[] = { '/', 't', 'e', 's', 't', 0, 0, 0, ',', 'b', 0, 0, 0, 0, 0, 8, 1, 2, 3, 4, 5, 6, 7, 8 };
+  CFIndex lengths[] = { sizeof(blob), sizeof(blob) - 4, sizeof(blob) };
+  for (int i = 0; i < 3; i++) {
+    if (i == 2) {
+      blob[12] = 0x7f; blob[13] = 0xff; blob[14] = 0xff; blob[15] = 0xff;
+    }
+    OSCPacketView truncated = OSCPacketViewMake(blob, lengths[i]);
+    OSCArgumentIterator iterator = OSCArgumentIteratorMake(&truncated.message);
+    OSCArgument argument;
+    STAssertEquals(OSCArgumentIteratorNext(&iterator, &argument), (bool)(i == 0), @"Only complete blob should decode");
+    STAssertEquals(iterator.malformed, (bool)(i != 0), @"Truncated blob should be malformed");
+  }
+  
+  CFRelease(data);
+  OSCRelease(osc);
+}
+
+- (void) testDispatchMessage {
+  OSCRef osc = OSCCreateWithUserInfo(allocator, NULL);
+  CFIndex gain1 = 0, gain2 = 0;
+  STAssertEquals(OSCAddMethod(osc, CFSTR("/mixer/1/gain"), TestMethodCallBack, &gain1), kOSCResultSuccess, @"Method should be added");
+  STAssertEquals(OSCAddMethod(osc, CFSTR("/mixer/2/gain"), TestMethodCallBack, &gain2), kOSCResultSuccess, @"Method should be added");
+  STAssertEquals(OSCAddMethod(osc, CFSTR("/mixer/*/gain"), TestMethodCallBack, NULL), kOSCResultInvalidAddressError, @"Patterns can't be registered");
+  
+  CFMutableDataRef data = CFDataCreateMutable(allocator, 0);
+  OSCDataAppendMessage(allocator, data, CFSTR("/mixer/{1,2}/g?in"), kCFBooleanTrue);
+  OSCReceiveRawBufferWithData(osc, data);
+  STAssertEquals(gain1 + gain2, (CFIndex)2, @"Pattern should match both methods");
+  
+  CFDataSetLength(data, 0);
+  OSCDataAppendMessage(allocator, data, CFSTR("/mixer/2/gain"), kCFBooleanTrue);
+  OSCReceiveRawBufferWithData(osc, data);
+  STAssertEquals(gain2, (CFIndex)2, @"Literal address should match one method");
+  
+  CFRelease(data);
+  OSCRelease(osc);
+}
+
+- (void) testScheduledBundles {
+  OSCRef osc = OSCCreateWithUserInfo(allocator, NULL);
+  CFIndex count = 0;
+  OSCSetMessageCallBack(osc, TestMethodCallBack, &count);
+  OSCActivateScheduler(osc);
+  
+  OSCTimeTag timeTag = OSCTimeTagMakeWithTimeIntervalSinceNow(10);
+  CFMutableDictionaryRef keyValuePairs = CFDictionaryCreateMutable(allocator, 0, &kCFTypeDictionaryKeyCallBacks, &kCFTypeDictionaryValueCallBacks);
+  CFDictionarySetValue(keyValuePairs, CFSTR("/a"), kCFBooleanTrue);
+  CFMutableDataRef data = CFDataCreateMutable(allocator, 0);
+  OSCDataAppendBundleWithDictionaryAndTimeTag(allocator, data, keyValuePairs, timeTag);
+  OSCReceiveRawBufferWithData(osc, data);
+  STAssertEquals(count, (CFIndex)0, @"Future bundle should be held");
+  STAssertEquals(OSCGetScheduledBundlesCount(osc), (CFIndex)1, @"Future bundle should be scheduled");
+  
+  STAssertEquals(OSCDispatchScheduledBundles(osc, timeTag), (CFIndex)1, @"Due bundle should be released");
+  STAssertEquals(count, (CFIndex)1, @"Released bundle should be delivered");
+  
+  CFRelease(data);
+  CFRelease(keyValuePairs);
+  OSCRelease(osc);
+}
+
+- (void) testSchedulerTimer {
+  OSCRef osc = OSCCreateWithUserInfo(allocator, NULL);
+  CFIndex count = 0;
+  OSCSetMessageCallBack(osc, TestMethodCallBack, &count);
+  OSCActivateScheduler(osc);
+  CFMutableDictionaryRef keyValuePairs = CFDictionaryCreateMutable(allocator, 0, &kCFTypeDictionaryKeyCallBacks, &kCFTypeDictionaryValueCallBacks);
+  CFDictionarySetValue(keyValuePairs, CFSTR("/a"), kCFBooleanTrue);
+  CFMutableDataRef data = CFDataCreateMutable(allocator, 0);
+  
+  // Bundle which became due while the wheel was idle is delivered on arrival
+  usleep(20000);
+  OSCDataAppendBundleWithDictionaryAndTimeTag(allocator, data, keyValuePairs, OSCTimeTagMakeWithTimeIntervalSinceNow(-0.005));
+  OSCReceiveRawBufferWithData(osc, data);
+  STAssertEquals(count, (CFIndex)1, @"Past due bundle should be delivered");
+  STAssertEquals(OSCGetScheduledBundlesCount(osc), (CFIndex)0, @"Past due bundle should not be scheduled");
+  
+  // Timer is moved by an earlier bundle only, and to the next one on release
+  CFTimeInterval intervals[3] = { 0.5, 0.25, 0.75 };
+  for (CFIndex i = 0; i < 3; i++) {
+    CFDataSetLength(data, 0);
+    OSCDataAppendBundleWithDictionaryAndTimeTag(allocator, data, keyValuePairs, OSCTimeTagMakeWithTimeIntervalSinceNow(intervals[i]));
+    OSCReceiveRawBufferWithData(osc, data);
+    CFTimeInterval interval = CFRunLoopTimerGetNextFireDate(osc->scheduler->runLoopTimer) - CFAbsoluteTimeGetCurrent();
+    STAssertTrue(interval > (i ? 0.24 : 0.49) && interval <= (i ? 0.25 : 0.5), @"Timer should fire at the earliest bundle");
+  }
+  STAssertEquals(OSCDispatchScheduledBundles(osc, OSCTimeTagMakeWithTimeIntervalSinceNow(0.3)), (CFIndex)1, @"Due bundle should be released");
+  CFTimeInterval interval = CFRunLoopTimerGetNextFireDate(osc->scheduler->runLoopTimer) - CFAbsoluteTimeGetCurrent();
+  STAssertTrue(interval > 0.49 && interval <= 0.5, @"Timer should move to the next bundle");
+  STAssertEquals(OSCDispatchScheduledBundles(osc, OSCTimeTagMakeWithTimeIntervalSinceNow(1)), (CFIndex)2, @"Due bundles should be released");
+  STAssertEquals(count, (CFIndex)4, @"Released bundles should be delivered");
+  
+  CFRelease(data);
+  CFRelease(keyValuePairs);
+  OSCRelease(osc);
+}
+
+- (void) testSenderThread {
+  OSCRef osc = OSCCreateWithUserInfo(allocator, NULL);
+  OSCConnect(osc, CFSTR("127.0.0.1"), 60000);
+  OSCAddressHandle handle = OSCAddressesAppendWithString(osc, CFSTR("/fader/1"));
+  STAssertTrue(OSCPushFloat32(osc, handle, 0.5) == kOSCResultNotAllocatedError, @"Sender thread should be started first");
+  
+  STAssertTrue(OSCStartSenderThread(osc, 16, 0.001) == kOSCResultSuccess, @"Sender thread should start");
+  STAssertTrue(OSCPushFloat32(osc, handle + 1, 0.5) == kOSCResultInvalidHandleError, @"Unregistered handle should be rejected");
+  for (CFIndex i = 0; i < 16; i++)
+    STAssertTrue(OSCPushFloat32(osc, handle, i) != kOSCResultInvalidHandleError, @"Value should be pushed or dropped");
+  OSCStopSenderThread(osc);
+  
+  OSCRelease(osc);
+}
+
+- (void) testSenderThreadWithSends {
+  UInt16 port = 0;
+  int sockfd = TestSocketCreate(&port);
+  OSCRef osc = OSCCreateWithUserInfo(allocator, NULL);
+  OSCConnect(osc, CFSTR("127.0.0.1"), port);
+  TestPusher pusher = { osc, OSCAddressesAppendWithString(osc, CFSTR("/fader/1")), false };
+  STAssertTrue(OSCStartSenderThread(osc, 64, 0.0001) == kOSCResultSuccess, @"Sender thread should start");
+  pthread_t thread;
+  pthread_create(&thread, NULL, TestPusherMain, &pusher);
+  
+  // Sends, batch and filter changes race with the sender thread
+  OSCFilter filter = { 0.5, 0, 0 };
+  for (SInt32 i = 0; i < 200; i++) {
+    OSCSetBatchCapacity(osc, i % 4);
+    OSCSetFilter(osc, CFSTR("/fader/"), i % 2 ? &filter : NULL);
+    STAssertEquals(OSCSendSInt32(osc, CFSTR("/test/int"), i), kOSCResultSuccess, @"Message should be sent");
+  }
+  OSCFlush(osc);
+  
+  // Sender is stopped while values are still being pushed
+  OSCStopSenderThread(osc);
+  STAssertTrue(OSCPushFloat32(osc, pusher.handle, 0) == kOSCResultNotAllocatedError, @"Stopped sender should reject values");
+  __atomic_store_n(&pusher.stop, true, __ATOMIC_RELEASE);
+  pthread_join(thread, NULL);
+  
+  // Every datagram is intact and all sent messages arrived
+  UInt8 buffer[2048];
+  CFIndex count = 0;
+  ssize_t length;
+  while ((length = recv(sockfd, buffer, sizeof(buffer), MSG_DONTWAIT)) > 0) {
+    OSCPacketView packet = OSCPacketViewMake(buffer, length);
+    STAssertTrue(packet.type != kOSCPacketTypeInvalid, @"Datagram should be a valid packet");
+    if (packet.type == kOSCPacketTypeMessage && strcmp(packet.message.address, "/test/int") == 0)
+      count++;
+  }
+  STAssertEquals(count, (CFIndex)200, @"All sent messages should arrive");
+  
+  OSCRelease(osc);
+  close(sockfd);
+}
+
+- (void) testSetValue {
+  OSCRef osc = OSCCreateWithUserInfo(allocator, NULL);
+  STAssertTrue(OSCSetValue(osc, CFSTR("/a"), kCFBooleanTrue) == kOSCResultSuccess, @"Value should be set");
+  STAssertTrue(OSCSetValue(osc, CFSTR("/b"), CFSTR("b")) == kOSCResultSuccess, @"Value should be set");
+  STAssertTrue(OSCSetValue(osc, CFSTR("/a"), kCFBooleanFalse) == kOSCResultSuccess, @"Value should be replaced");
+  STAssertTrue(OSCSetFloat32WithHandle(osc, OSCAddressesGetHandleWithString(osc, CFSTR("/b")), 1) == kOSCResultSuccess, @"Value should be set by handle");
+  
+  CFArrayRef addresses = OSCCreateAddressArray(osc);
+  STAssertEquals(CFArrayGetCount(addresses), (CFIndex)2, @"Each address should be cached once");
+  CFRelease(addresses);
+  
+  OSCRelease(osc);
+}
+
+- (void) testCacheSendDirty {
+  UInt16 port;
+  int sockfd = TestSocketCreate(&port);
+  CFIndex limit = 1024 * 1024;
+  CFAllocatorContext context = { 0, &limit, NULL, NULL, NULL, TestLimitedAllocate, TestLimitedReallocate, TestLimitedDeallocate, NULL };
+  CFAllocatorRef limited = CFAllocatorCreate(NULL, &context);
+  OSCRef osc = OSCCreateWithUserInfo(limited, NULL);
+  OSCConnect(osc, CFSTR("127.0.0.1"), port);
+  OSCSetMaximumDatagramSize(osc, 128);
+  for (int i = 0; i < 50; i++) {
+    CFStringRef address = CFStringCreateWithFormat(NULL, NULL, CFSTR("/test/value/%d"), i);
+    OSCSetFloat32WithHandle(osc, OSCAddressesAppendWithString(osc, address), i);
+    CFRelease(address);
+  }
+  
+  // Values which can't be ordered stay dirty
+  limit = 0;
+  STAssertEquals(__OSCCacheSendDirty(osc, &osc->cache, osc->writer, false), (CFIndex)-1, @"Failed allocation should be reported");
+  STAssertEquals(osc->cache.dirtyCount, (CFIndex)50, @"Values should stay dirty");
+  limit = 1024 * 1024;
+  STAssertTrue(__OSCCacheSendDirty(osc, &osc->cache, osc->writer, false) > 1, @"Values should be split into several bundles");
+  STAssertEquals(osc->cache.dirtyCount, (CFIndex)0, @"All values should be sent");
+  
+  OSCRef receiver = OSCCreateWithUserInfo(allocator, NULL);
+  CFIndex count = 0;
+  OSCSetMessageCallBack(receiver, TestReceiveMessageCallBack, &count);
+  UInt8 buffer[2048];
+  ssize_t length;
+  while ((length = recv(sockfd, buffer, sizeof(buffer), MSG_DONTWAIT)) > 0) {
+    STAssertTrue(length <= 128, @"Bundle should fit maximum datagram size");
+    STAssertEquals(OSCReceiveRawBuffer(receiver, buffer, length), kOSCResultSuccess, @"Bundle should decode");
+  }
+  STAssertEquals(count, (CFIndex)50, @"No value should be lost");
+  
+  // Value which can't be encoded is dropped and counted, the rest is sent
+  static UInt8 large[4096];
+  CFDataRef data = CFDataCreate(NULL, large, sizeof(large));
+  OSCSetValue(osc, CFSTR("/test/blob"), data);
+  OSCSetFloat32WithHandle(osc, OSCAddressesGetHandleWithString(osc, CFSTR("/test/value/0")), 100);
+  OSCMetrics before, after;
+  OSCGetMetrics(osc, &before);
+  limit = 1024;
+  STAssertEquals(__OSCCacheSendDirty(osc, &osc->cache, osc->writer, false), (CFIndex)1, @"Encoded value should be sent");
+  limit = 1024 * 1024;
+  OSCGetMetrics(osc, &after);
+  STAssertEquals(after.droppedCount - before.droppedCount, (UInt64)1, @"Value which can't be encoded should be dropped");
+  STAssertEquals(after.messagesCount - before.messagesCount, (UInt64)1, @"Dropped value shouldn't be counted as message");
+  STAssertEquals(osc->cache.dirtyCount, (CFIndex)0, @"Dropped value shouldn't stay dirty");
+  count = 0;
+  while ((length = recv(sockfd, buffer, sizeof(buffer), MSG_DONTWAIT)) > 0)
+    OSCReceiveRawBuffer(receiver, buffer, length);
+  STAssertEquals(count, (CFIndex)1, @"Value after the dropped one should be sent");
+  CFRelease(data);
+  
+  OSCRelease(receiver);
+  OSCRelease(osc);
+  CFRelease(limited);
+  close(sockfd);
+}
+
+- (void) testStreamFraming {
+  OSCRef osc = OSCCreateWithUserInfo(allocator, NULL);
+  CFIndex count = 0;
+  OSCSetMessageCallBack(osc, TestReceiveMessageCallBack, &count);
+  
+  CFMutableDataRef data = CFDataCreateMutable(allocator, 0);
+  OSCDataAppendMessage(allocator, data, CFSTR("/test/true"), kCFBooleanTrue);
+  const UInt8 *bytes = CFDataGetBytePtr(data);
+  CFIndex length = CFDataGetLength(data);
+  
+  // Length prefixed, split inside the prefix and inside the packet
+  OSCSetStreamFraming(osc, kOSCFramingLengthPrefix);
+  UInt8 prefix[4] = { 0, 0, 0, (UInt8)length };
+  OSCReceiveStreamBytes(osc, prefix, 2);
+  OSCReceiveStreamBytes(osc, prefix + 2, 2);
+  OSCReceiveStreamBytes(osc, bytes, 5);
+  STAssertEquals(count, (CFIndex)0, @"Incomplete frame shouldn't be decoded");
+  STAssertEquals(OSCReceiveStreamBytes(osc, bytes + 5, length - 5), kOSCResultSuccess, @"Frame should decode");
+  STAssertEquals(count, (CFIndex)1, @"Frame should be decoded once complete");
+  
+  // SLIP, one byte at a time
+  OSCSetStreamFraming(osc, kOSCFramingSLIP);
+  UInt8 end = OSC_SLIP_END;
+  OSCReceiveStreamBytes(osc, &end, 1);
+  for (CFIndex i = 0; i < length; i++)
+    OSCReceiveStreamBytes(osc, bytes + i, 1);
+  OSCReceiveStreamBytes(osc, &end, 1);
+  STAssertEquals(count, (CFIndex)2, @"SLIP frame should be decoded");
+  
+  // Receive framing doesn't frame datagrams sent over UDP
+  UInt16 port;
+  int sockfd = TestSocketCreate(&port);
+  OSCConnect(osc, CFSTR("127.0.0.1"), port);
+  STAssertEquals(OSCGetStreamFraming(osc), kOSCFramingSLIP, @"Receive framing should stay set");
+  STAssertEquals(OSCSendTrue(osc, CFSTR("/test/true")), kOSCResultSuccess, @"Datagram should be sent");
+  UInt8 buffer[64];
+  STAssertEquals((CFIndex)recv(sockfd, buffer, sizeof(buffer), 0), length, @"Datagram shouldn't be framed");
+  STAssertTrue(memcmp(buffer, bytes, length) == 0, @"Datagram should be the plain packet");
+  close(sockfd);
+  
+  // Stream connection sends length prefixed packets, failed connection
+  // leaves no socket behind
+  int listener = socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in address;
+  socklen_t addressLength = sizeof(address);
+  memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  bind(listener, (struct sockaddr *)&address, sizeof(address));
+  getsockname(listener, (struct sockaddr *)&address, &addressLength);
+  listen(listener, 1);
+  STAssertTrue(OSCConnectStream(osc, CFSTR("127.0.0.1"), ntohs(address.sin_port), kOSCFramingLengthPrefix) != NULL, @"Stream should connect");
+  sockfd = accept(listener, NULL, NULL);
+  STAssertEquals(OSCSendTrue(osc, CFSTR("/test/true")), kOSCResultSuccess, @"Packet should be sent");
+  CFIndex received = 0;
+  ssize_t n;
+  while (received < 4 + length && (n = recv(sockfd, buffer + received, sizeof(buffer) - received, 0)) > 0)
+    received += n;
+  STAssertEquals(received, 4 + length, @"Packet should be length prefixed");
+  STAssertTrue(memcmp(buffer, prefix, 4) == 0 && memcmp(buffer + 4, bytes, length) == 0, @"Frame should be prefix and packet");
+  close(sockfd);
+  close(listener);
+  STAssertTrue(OSCConnectStream(osc, CFSTR("127.0.0.1"), ntohs(address.sin_port), kOSCFramingLengthPrefix) == NULL, @"Closed port shouldn't connect");
+  STAssertEquals(osc->sockfd, 0, @"Failed connection shouldn't leave a socket");
+  STAssertTrue(OSCSendTrue(osc, CFSTR("/test/true")) != kOSCResultSuccess, @"Nothing should be sent without connection");
+  
+  CFRelease(data);
+  OSCRelease(osc);
+}
+
+- (void) testDestinations {
+  OSCRef osc = OSCCreateWithUserInfo(allocator, NULL);
+  STAssertEquals(OSCAddDestination(osc, CFSTR("127.0.0.1"), 9001), kOSCResultSuccess, @"Destination should be added");
+  STAssertEquals(OSCAddDestination(osc, CFSTR("127.0.0.1"), 9002), kOSCResultSuccess, @"Destination should be added");
+  STAssertEquals(OSCAddDestination(osc, CFSTR("127.0.0.1"), 9001), kOSCResultSuccess, @"Existing destination should be ignored");
+  STAssertEquals(OSCGetDestinationsCount(osc), (CFIndex)2, @"Destinations should be unique");
+  STAssertEquals(OSCSendTrue(osc, CFSTR("/test/true")), kOSCResultSuccess, @"Message should be sent to destinations without connecting");
+  
+  STAssertEquals(OSCRemoveDestination(osc, CFSTR("127.0.0.1"), 9001), kOSCResultSuccess, @"Destination should be removed");
+  STAssertTrue(OSCRemoveDestination(osc, CFSTR("127.0.0.1"), 9001) == kOSCResultInvalidAddressError, @"Removed destination shouldn't be found");
+  STAssertEquals(OSCGetDestinationsCount(osc), (CFIndex)1, @"One destination should be left");
+  
+  OSCRelease(osc);
+}
+
+- (void) testMetrics {
+  OSCRef osc = OSCCreateWithUserInfo(allocator, NULL);
+  CFIndex diagnostics = 0;
+  OSCSetDiagnosticCallBack(osc, TestDiagnosticCallBack, &diagnostics);
+  STAssertTrue(OSCSendTrue(osc, CFSTR("/test/true")) != kOSCResultSuccess, @"Message can't be sent without connection");
+  STAssertEquals(diagnostics, (CFIndex)1, @"Failure should be reported to diagnostic callback");
+  
+  OSCAddressHandle handle = OSCAddressesAppendWithString(osc, CFSTR("/test/float"));
+  OSCSetFloat32WithHandle(osc, handle, 1);
+  OSCSetFloat32WithHandle(osc, handle, 2);
+  OSCSetFloat32WithHandle(osc, handle, 3);
+  
+  OSCMetrics metrics;
+  OSCGetMetrics(osc, &metrics);
+  STAssertEquals(metrics.coalescedCount, (UInt64)2, @"Overwritten values should be counted");
+  STAssertEquals(metrics.packetsCount, (UInt64)0, @"Nothing should be sent");
+  
+  OSCResetMetrics(osc);
+  OSCGetMetrics(osc, &metrics);
+  STAssertEquals(metrics.coalescedCount, (UInt64)0, @"Counters should be reset");
+  
+  OSCRelease(osc);
+}
+
+- (void) testNonBlocking {
+  OSCRef osc = OSCCreateWithUserInfo(allocator, NULL);
+  OSCConnect(osc, CFSTR("127.0.0.1"), 9001);
+  STAssertEquals(OSCSetNonBlocking(osc, true), kOSCResultSuccess, @"Datagram socket can be non-blocking");
+  STAssertEquals(OSCSetSendQueue(osc, 16, kOSCOverflowPolicyCoalesce), kOSCResultSuccess, @"Send queue should be allocated");
+  STAssertTrue(OSCGetNonBlocking(osc), @"Non-blocking mode should be set");
+  STAssertEquals(OSCSendTrue(osc, CFSTR("/test/true")), kOSCResultSuccess, @"Message should be sent when socket buffer has space");
+  STAssertEquals(OSCGetSendQueueCount(osc), (CFIndex)0, @"Nothing should be queued");
+  OSCRelease(osc);
+  
+  // Slots grow with maximum datagram size, queued packets are kept in order
+  UInt16 port;
+  int sockfd = TestSocketCreate(&port);
+  osc = OSCCreateWithUserInfo(allocator, NULL);
+  OSCConnect(osc, CFSTR("127.0.0.1"), port);
+  OSCSetSendQueue(osc, 2, kOSCOverflowPolicyDropNewest);
+  static UInt8 packets[2][4096];
+  memset(packets[0], 1, sizeof(packets[0]));
+  memset(packets[1], 2, sizeof(packets[1]));
+  struct iovec iov[2] = { { packets[0], 64 }, { packets[1], 4096 } };
+  STAssertEquals(__OSCSendQueueEnqueue(osc, &iov[0], 1), kOSCResultQueued, @"Small packet should be queued");
+  STAssertEquals(__OSCSendQueueEnqueue(osc, &iov[1], 1), kOSCResultDroppedError, @"Packet longer than slot should be dropped");
+  OSCSetMaximumDatagramSize(osc, 4096);
+  STAssertEquals(__OSCSendQueueEnqueue(osc, &iov[1], 1), kOSCResultQueued, @"Packet should fit resized slot");
+  STAssertEquals(__OSCSendQueueDrain(osc), (CFIndex)0, @"Queue should drain");
+  UInt8 buffer[8192];
+  STAssertEquals((CFIndex)recv(sockfd, buffer, sizeof(buffer), 0), (CFIndex)64, @"Packet queued before resize should be sent first");
+  STAssertTrue(memcmp(buffer, packets[0], 64) == 0, @"Packet queued before resize should be intact");
+  STAssertEquals((CFIndex)recv(sockfd, buffer, sizeof(buffer), 0), (CFIndex)4096, @"Packet queued after resize should be sent");
+  STAssertTrue(memcmp(buffer, packets[1], 4096) == 0, @"Packet queued after resize should be intact");
+  OSCRelease(osc);
+  close(sockfd);
+}
+
+- (void) testSendBlob {
+  UInt16 port;
+  int sockfd = TestSocketCreate(&port);
+  UInt8 bytes[1001];
+  for (CFIndex i = 0; i < (CFIndex)sizeof(bytes); i++)
+    bytes[i] = (UInt8)(i + 1);
+  
+  // Blocking socket, send queue and destinations, blobs with 0 to 3 padding
+  // bytes compared with the same message encoded into CFData.
+  const CFIndex lengths[] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 1001 };
+  for (int mode = 0; mode < 3; mode++) {
+    OSCRef osc = OSCCreateWithUserInfo(allocator, NULL);
+    if (mode < 2)
+      OSCConnect(osc, CFSTR("127.0.0.1"), port);
+    else
+      OSCAddDestination(osc, CFSTR("127.0.0.1"), port);
+    if (mode == 1)
+      OSCSetNonBlocking(osc, true);
+    for (CFIndex i = 0; i < (CFIndex)(sizeof(lengths) / sizeof(lengths[0])); i++) {
+      STAssertEquals(OSCSendBlob(osc, CFSTR("/test/blob"), bytes, lengths[i]), kOSCResultSuccess, @"Blob should be sent");
+      CFDataRef blob = CFDataCreate(NULL, bytes, lengths[i]);
+      CFMutableDataRef data = CFDataCreateMutable(allocator, 0);
+      OSCDataAppendMessage(allocator, data, CFSTR("/test/blob"), blob);
+      UInt8 buffer[2048];
+      ssize_t length = recv(sockfd, buffer, sizeof(buffer), 0);
+      STAssertEquals((CFIndex)length, CFDataGetLength(data), @"Blob message should have padded length");
+      STAssertTrue(length == CFDataGetLength(data) && memcmp(buffer, CFDataGetBytePtr(data), length) == 0, @"Blob message should match encoded message");
+      CFRelease(data);
+      CFRelease(blob);
+    }
+    OSCRelease(osc);
+  }
+  close(sockfd);
+}
+
+- (void) testArgumentLists {
+  OSCAddress address;
+  __OSCAddressInitWithString(&address, CFSTR("/test/mixed"));
+  OSCArgumentValue values[4];
+  values[0].h = -1;
+  values[1].d = 0.5;
+  values[2].s = "test";
+  values[3].c = 'x';
+  UInt8 buffer[128];
+  CFIndex length = 0;
+  STAssertEquals(OSCEncodeMessage(buffer, sizeof(buffer), &address, "hd[sT]Nc", values, &length), kOSCResultSuccess, @"Message should encode");
+  STAssertEquals(length, (CFIndex)(12 + 12 + 8 + 8 + 8 + 4), @"Arguments should be packed in a single message");
+  STAssertEquals(OSCEncodeMessage(buffer, sizeof(buffer), &address, "[h", values, &length), kOSCResultMalformedPacketError, @"Unbalanced array should be rejected");
+  STAssertEquals(OSCEncodeMessage(buffer, 24, &address, "hd", values, &length), kOSCResultTooLongError, @"Message should not overflow the buffer");
+  
+  OSCEncodeMessage(buffer, sizeof(buffer), &address, "hd[sT]Nc", values, &length);
+  OSCPacketView packet = OSCPacketViewMake(buffer, length);
+  OSCArgumentIterator iterator = OSCArgumentIteratorMake(&packet.message);
+  OSCArgument argument;
+  CFIndex count = 0;
+  while (OSCArgumentIteratorNext(&iterator, &argument))
+    count++;
+  STAssertFalse(iterator.malformed, @"Message should decode");
+  STAssertEquals(count, (CFIndex)8, @"All type tags should be decoded");
+  STAssertEquals(argument.value.c, 'x', @"Last argument should be the character");
+  
+  OSCRef osc = OSCCreateWithUserInfo(allocator, NULL);
+  OSCConnect(osc, CFSTR("127.0.0.1"), 60000);
+  STAssertEquals(OSCSendArguments(osc, CFSTR("/test/mixed"), "hd[sT]Nc", values), kOSCResultSuccess, @"Arguments should be sent in one message");
+  OSCRelease(osc);
+}
+
+- (void) testFilters {
+  OSCRef osc = OSCCreateWithUserInfo(allocator, NULL);
+  OSCConnect(osc, CFSTR("127.0.0.1"), 60000);
+  OSCFilter filter = { 0.1, 0, 0 };
+  STAssertEquals(OSCSetFilter(osc, CFSTR("/test/"), &filter), kOSCResultSuccess, @"Filter should be set");
+  STAssertEquals(OSCSetFilter(osc, CFSTR("test"), &filter), kOSCResultInvalidAddressError, @"Prefix should be an address");
+  OSCAddressHandle handle = OSCAddressesAppendWithString(osc, CFSTR("/test/float"));
+  OSCSetFloat32WithHandle(osc, handle, 1.0);
+  __OSCRunLoopTimerCallBack(NULL, osc);
+  OSCSetFloat32WithHandle(osc, handle, 1.05);
+  __OSCRunLoopTimerCallBack(NULL, osc);
+  OSCSetFloat32WithHandle(osc, handle, 2.0);
+  OSCSetFloat32WithHandle(osc, handle, 0.95);
+  __OSCRunLoopTimerCallBack(NULL, osc);
+  OSCMetrics metrics;
+  OSCGetMetrics(osc, &metrics);
+  STAssertEquals(metrics.bundlesCount, (UInt64)1, @"Only the first value should be sent");
+  STAssertEquals(metrics.filteredCount, (UInt64)2, @"Values within deadband should be filtered");
+  OSCRelease(osc);
+}
+
+- (void) testRateClasses {
+  OSCRef osc = OSCCreateWithUserInfo(allocator, NULL);
+  OSCConnect(osc, CFSTR("127.0.0.1"), 60000);
+  STAssertEquals(OSCSetRateClass(osc, CFSTR("/test/status/"), 60, -1), kOSCResultSuccess, @"Rate class should be set");
+  STAssertEquals(OSCSetRateClass(osc, CFSTR("/test/transport/"), 0, 10), kOSCResultSuccess, @"Rate class should be set");
+  OSCAddressHandle status = OSCAddressesAppendWithString(osc, CFSTR("/test/status/cpu"));
+  OSCAddressHandle transport = OSCAddressesAppendWithString(osc, CFSTR("/test/transport/position"));
+  OSCSetFloat32WithHandle(osc, status, 1.0);
+  OSCSetFloat32WithHandle(osc, transport, 1.0);
+  __OSCRunLoopTimerCallBack(NULL, osc);
+  OSCSetFloat32WithHandle(osc, status, 2.0);
+  OSCSetFloat32WithHandle(osc, transport, 2.0);
+  __OSCRunLoopTimerCallBack(NULL, osc);
+  OSCMetrics metrics;
+  OSCGetMetrics(osc, &metrics);
+  STAssertEquals(metrics.messagesCount, (UInt64)3, @"Status should wait for its interval");
+  STAssertEquals(osc->cache.dirtyCount, (CFIndex)1, @"Status value should stay in the cache");
+  OSCRelease(osc);
+  
+  // Run loop timer and sender thread passes in the same tick both send
+  UInt16 port;
+  int sockfd = TestSocketCreate(&port);
+  osc = OSCCreateWithUserInfo(allocator, NULL);
+  OSCConnect(osc, CFSTR("127.0.0.1"), port);
+  OSCSetRateClass(osc, CFSTR("/test/status/"), 60, 0);
+  status = OSCAddressesAppendWithString(osc, CFSTR("/test/status/cpu"));
+  STAssertEquals(OSCStartSenderThread(osc, 16, 0.001), kOSCResultSuccess, @"Sender thread should start");
+  OSCSetFloat32WithHandle(osc, status, 1.0);
+  __OSCRunLoopTimerCallBack(NULL, osc);
+  OSCPushFloat32(osc, status, 2.0);
+  OSCStopSenderThread(osc);
+  CFIndex count = 0;
+  UInt8 buffer[256];
+  while (recv(sockfd, buffer, sizeof(buffer), MSG_DONTWAIT) > 0)
+    count++;
+  STAssertEquals(count, (CFIndex)2, @"Pass of one cache shouldn't hold back the other");
+  OSCRelease(osc);
+
+  // Sender cache keeps its own class timing after it grows
+  osc = OSCCreateWithUserInfo(allocator, NULL);
+  OSCConnect(osc, CFSTR("127.0.0.1"), port);
+  STAssertEquals(OSCStartSenderThread(osc, 64, 0.001), kOSCResultSuccess, @"Sender thread should start");
+  for (int i = 0; i < 40; i++) {
+    CFStringRef address = CFStringCreateWithFormat(NULL, NULL, CFSTR("/test/value/%d"), i);
+    OSCPushFloat32(osc, OSCAddressesAppendWithString(osc, address), i);
+    CFRelease(address);
+  }
+  OSCGetMetrics(osc, &metrics);
+  for (int i = 0; i < 1000 && metrics.messagesCount < 40; i++) {
+    usleep(1000);
+    OSCGetMetrics(osc, &metrics);
+  }
+  while (recv(sockfd, buffer, sizeof(buffer), MSG_DONTWAIT) > 0)
+    ;
+  OSCSetRateClass(osc, CFSTR("/test/status/"), 60, 0);
+  status = OSCAddressesAppendWithString(osc, CFSTR("/test/status/cpu"));
+  OSCSetFloat32WithHandle(osc, status, 1.0);
+  __OSCRunLoopTimerCallBack(NULL, osc);
+  OSCPushFloat32(osc, status, 2.0);
+  OSCStopSenderThread(osc);
+  count = 0;
+  while (recv(sockfd, buffer, sizeof(buffer), MSG_DONTWAIT) > 0)
+    count++;
+  STAssertEquals(count, (CFIndex)2, @"Grown sender cache shouldn't share timing with run loop timer");
+  OSCRelease(osc);
+  close(sockfd);
+}
+
+- (void) testCapture {
+  const char *path = [[NSTemporaryDirectory() stringByAppendingPathComponent: @"CoreOSCTests.capture"] fileSystemRepresentation];
+  OSCRef osc = OSCCreateWithUserInfo(allocator, NULL);
+  OSCConnect(osc, CFSTR("127.0.0.1"), 60000);
+  STAssertEquals(OSCStartCapture(osc, path, 1), kOSCResultSuccess, @"Capture should start");
+  OSCSendFloat32(osc, CFSTR("/test/float"), 1.0);
+  OSCSendTrue(osc, CFSTR("/test/true"));
+  STAssertEquals(OSCStopCapture(osc), kOSCResultSuccess, @"Capture should stop");
+  UInt64 count = 0;
+  STAssertEquals(OSCReplayCapture(osc, path, 0, kOSCCaptureAllDestinations, &count), kOSCResultSuccess, @"Capture should replay");
+  STAssertEquals(count, (UInt64)2, @"All captured packets should be replayed");
+  OSCReplayCapture(osc, path, 0, 2, &count);
+  STAssertEquals(count, (UInt64)0, @"Packets of other destinations should be skipped");
+  OSCRelease(osc);
+  unlink(path);
+}
+
+- (void) testReceiveServer {
+  CFIndex count = 0;
+  OSCRef server = OSCCreateWithUserInfo(allocator, NULL);
+  OSCSetMessageCallBack(server, TestAtomicMessageCallBack, &count);
+  STAssertEquals(OSCStartReceiveServer(server, CFSTR("127.0.0.1"), 0, 2, 8, NULL), kOSCResultSuccess, @"Receive server should start");
+  UInt16 port = OSCGetReceiveServerPort(server);
+  STAssertTrue(port != 0, @"Ephemeral port should be bound");
+  OSCRef osc = OSCCreateWithUserInfo(allocator, NULL);
+  OSCConnect(osc, CFSTR("127.0.0.1"), port);
+  for (int i = 0; i < 100; i++)
+    OSCSendSInt32(osc, CFSTR("/test/int"), i);
+  for (int i = 0; i < 100 && __atomic_load_n(&count, __ATOMIC_RELAXED) < 100; i++)
+    usleep(10000);
+  OSCStopReceiveServer(server);
+  STAssertEquals(count, (CFIndex)100, @"All messages should be received");
+  OSCMetrics metrics;
+  OSCGetMetrics(server, &metrics);
+  STAssertEquals(metrics.receivedPacketsCount, (UInt64)100, @"All datagrams should be counted");
+  OSCRelease(osc);
+  OSCRelease(server);
+}
+
+- (void) testConnectedDatagrams {
+  OSCRef osc = OSCCreateWithUserInfo(allocator, NULL);
+  STAssertTrue(OSCConnect(osc, CFSTR("127.0.0.1"), 60000) != NULL, @"Should connect");
+  STAssertEquals(OSCSetConnectedDatagrams(osc, true), kOSCResultSuccess, @"Datagram socket should be connected");
+  STAssertTrue(__OSCGetPeerAddress(osc) == NULL, @"Sends should not carry the address");
+  STAssertEquals(OSCSendTrue(osc, CFSTR("/test/true")), kOSCResultSuccess, @"Message should be sent");
+  
+  // Resolved address is applied by the next send
+  UInt16 port;
+  int sockfd = TestSocketCreate(&port);
+  STAssertEquals(OSCConnectAsync(osc, CFSTR("127.0.0.1"), port), kOSCResultQueued, @"Uncached host should be resolved in background");
+  UInt8 buffer[64];
+  ssize_t length = -1;
+  for (int i = 0; i < 100 && length <= 0; i++) {
+    usleep(10000);
+    OSCSendTrue(osc, CFSTR("/test/true"));
+    length = recv(sockfd, buffer, sizeof(buffer), MSG_DONTWAIT);
+  }
+  STAssertTrue(length > 0, @"Message should be sent to the resolved address");
+  close(sockfd);
+  STAssertEquals(OSCConnectAsync(osc, CFSTR("127.0.0.1"), 60000), kOSCResultSuccess, @"Cached host should connect right away");
+  OSCDisconnect(osc);
+  STAssertTrue(OSCSendTrue(osc, CFSTR("/test/true")) != kOSCResultSuccess, @"Message can't be sent after disconnect");
+  STAssertEquals(OSCReconnect(osc), kOSCResultInvalidAddressError, @"Nothing to reconnect to after disconnect");
+  OSCRelease(osc);
+}
+
+- (void) testSteadySendingDoesNotAllocate {
+  OSCRef osc = OSCCreateWithUserInfo(allocator, NULL);
+  OSCConnect(osc, CFSTR("127.0.0.1"), 60000);
+  OSCAddressHandle handle = OSCAddressesAppendWithString(osc, CFSTR("/test/float"));
+  CFStringRef string = CFStringCreateWithCString(NULL, "test", kCFStringEncodingUTF8);
+  Float32 value = 1;
+  CFNumberRef number = CFNumberCreate(NULL, kCFNumberFloat32Type, &value);
+  CFNumberRef numbers[3] = { number, number, number };
+  CFIndex allocationsCount = 0;
+  for (int round = 0; round < 2; round++) {
+    allocationsCount = TestAllocatorGetAllocationsCount(allocator);
+    for (int i = 0; i < 100; i++) {
+      OSCSendString(osc, CFSTR("/test/string"), string);
+      OSCSendNumbersAsFloats32(osc, CFSTR("/test/floats"), numbers, 3);
+      OSCSetFloat32WithHandle(osc, handle, i);
+      __OSCRunLoopTimerCallBack(NULL, osc);
+    }
+  }
+  STAssertTrue(TestAllocatorGetAllocationsCount(allocator) == allocationsCount, @"Warmed up sending should not allocate");
+  CFRelease(number);
+  CFRelease(string);
   OSCRelease(osc);
+  
+  CFAllocatorRef pool = OSCGetPoolAllocator();
+  void *block = CFAllocatorAllocate(pool, 40, 0);
+  CFAllocatorDeallocate(pool, block);
+  STAssertEquals(CFAllocatorAllocate(pool, 64, 0), block, @"Block of the same size class should be reused");
+  CFAllocatorDeallocate(pool, block);
+}
+
+- (void) testIOUringTransport {
+  OSCRef osc = OSCCreateWithTransport(allocator, NULL, kOSCTransportIOUring);
+  OSCTransport transport = OSCGetTransport(osc);
+  STAssertTrue(transport == kOSCTransportIOUring || transport == kOSCTransportSocket, @"Should use io_uring or fall back to socket");
+  STAssertTrue(OSCConnect(osc, CFSTR("127.0.0.1"), 60000) != NULL, @"Should connect");
+  if (transport == kOSCTransportIOUring)
+    STAssertTrue(__OSCGetPeerAddress(osc) == NULL, @"io_uring should send on connected socket");
+  OSCSetBatchCapacity(osc, 16);
+  for (int i = 0; i < 100; i++)
+    STAssertEquals(OSCSendSInt32(osc, CFSTR("/test/sint32"), i), kOSCResultSuccess, @"Message should be sent");
+  STAssertEquals(OSCFlush(osc), kOSCResultSuccess, @"Batch should be submitted");
+  OSCDisconnect(osc);
+  STAssertTrue(OSCSendTrue(osc, CFSTR("/test/true")) != kOSCResultSuccess, @"Message can't be sent after disconnect");
+  OSCRelease(osc);
+}
+
+- (void) testBatching {
+  UInt16 port = 0;
+  int sockfd = TestSocketCreate(&port);
+  OSCRef osc = OSCCreateWithUserInfo(allocator, NULL);
+  OSCConnect(osc, CFSTR("127.0.0.1"), port);
+  STAssertEquals(OSCSetBatchCapacity(osc, 4), kOSCResultSuccess, @"Batch should be allocated");
+  UInt64 packetsCount = 0, callsCount = 0;
+  for (SInt32 i = 0; i < 10; i++) {
+    STAssertEquals(OSCSendSInt32(osc, CFSTR("/test/int"), i), kOSCResultSuccess, @"Message should be batched");
+    OSCGetSendStatistics(osc, &packetsCount, &callsCount);
+    STAssertEquals(packetsCount, (UInt64)((i + 1) / 4 * 4), @"Batch should be flushed when it's full");
+  }
+  STAssertEquals(OSCFlush(osc), kOSCResultSuccess, @"Partial batch should be flushed");
+  OSCGetSendStatistics(osc, &packetsCount, &callsCount);
+  STAssertEquals(packetsCount, (UInt64)10, @"All packets should be sent");
+#if defined(__linux__)
+  STAssertEquals(callsCount, (UInt64)3, @"Each flush should be a single sendmmsg");
+#endif
+  
+  // Datagrams arrive one message each, in order
+  CFMutableDataRef data = CFDataCreateMutable(allocator, 0);
+  UInt8 buffer[256];
+  for (SInt32 i = 0; i < 10; i++) {
+    CFNumberRef number = CFNumberCreate(NULL, kCFNumberSInt32Type, &i);
+    CFDataSetLength(data, 0);
+    OSCDataAppendMessage(allocator, data, CFSTR("/test/int"), number);
+    CFRelease(number);
+    ssize_t length = recv(sockfd, buffer, sizeof(buffer), 0);
+    STAssertEquals((CFIndex)length, CFDataGetLength(data), @"Datagram should hold one message");
+    STAssertTrue(length == CFDataGetLength(data) && memcmp(buffer, CFDataGetBytePtr(data), length) == 0, @"Datagram should match encoded message");
+  }
+  CFRelease(data);
+  OSCRelease(osc);
+  close(sockfd);
+}
+
+- (void) testWriter {
+  SInt32 sint32 = -7;
+  Float32 float32 = 0.25;
+  CFNumberRef number = CFNumberCreate(NULL, kCFNumberSInt32Type, &sint32);
+  CFNumberRef fraction = CFNumberCreate(NULL, kCFNumberFloat32Type, &float32);
+  const UInt8 bytes[4] = { 'a', 'b', 'c', 'd' };
+  Float32 floats[3] = { 1, 2.5, -3 };
+  SInt32 ints[3] = { 1, -2, 3 };
+  Float64 doubles[2] = { 0.5, -1e100 };
+  SInt64 longs[2] = { 1LL << 40, -1 };
+  OSCAddress address;
+  __OSCAddressInitWithString(&address, CFSTR("/test/array"));
+  
+  // Every type the writer encodes, strings and blobs with 3 to 0 padding bytes
+  OSCWriterRef writer = OSCWriterCreate(allocator, 0);
+  STAssertTrue(OSCWriterBeginBundle(writer, 1), @"Bundle should begin");
+  STAssertTrue(OSCWriterAppendMessage(writer, CFSTR("/test/int"), number), @"Message should be appended");
+  STAssertTrue(OSCWriterAppendMessage(writer, CFSTR("/test/float"), fraction), @"Message should be appended");
+  STAssertTrue(OSCWriterAppendMessage(writer, CFSTR("/test/true"), kCFBooleanTrue), @"Message should be appended");
+  STAssertTrue(OSCWriterAppendMessage(writer, CFSTR("/test/false"), kCFBooleanFalse), @"Message should be appended");
+  for (CFIndex n = 1; n <= 4; n++) {
+    CFStringRef string = CFStringCreateWithBytes(NULL, bytes, n, kCFStringEncodingUTF8, false);
+    CFDataRef data = CFDataCreate(NULL, bytes, n);
+    STAssertTrue(OSCWriterAppendMessage(writer, CFSTR("/test/string"), string), @"Message should be appended");
+    STAssertTrue(OSCWriterAppendMessage(writer, CFSTR("/test/blob"), data), @"Message should be appended");
+    CFRelease(string);
+    CFRelease(data);
+  }
+  STAssertTrue(OSCWriterAppendArrayWithAddress(writer, &address, 'f', floats, 3), @"Array should be appended");
+  STAssertTrue(OSCWriterAppendArrayWithAddress(writer, &address, 'i', ints, 3), @"Array should be appended");
+  STAssertTrue(OSCWriterAppendArrayWithAddress(writer, &address, 'd', doubles, 2), @"Array should be appended");
+  STAssertTrue(OSCWriterAppendArrayWithAddress(writer, &address, 'h', longs, 2), @"Array should be appended");
+  STAssertTrue(OSCWriterBeginBundle(writer, 2), @"Nested bundle should begin");
+  STAssertTrue(OSCWriterAppendMessage(writer, CFSTR("/test/nested"), kCFBooleanTrue), @"Message should be appended");
+  STAssertTrue(OSCWriterEndBundle(writer), @"Nested bundle should end");
+  STAssertTrue(OSCWriterEndBundle(writer), @"Bundle should end");
+  STAssertFalse(OSCWriterEndBundle(writer), @"No bundle should be open");
+  
+  OSCPacketView packet = OSCPacketViewMake(OSCWriterGetBytePtr(writer), OSCWriterGetLength(writer));
+  STAssertTrue(packet.type == kOSCPacketTypeBundle, @"Packet should be a bundle");
+  STAssertEquals(packet.bundle.timeTag, (OSCTimeTag)1, @"Time tag should round trip");
+  OSCBundleIterator elements = OSCBundleIteratorMake(&packet.bundle);
+  OSCPacketView element;
+  OSCArgument argument;
+  CFIndex count = 0;
+  while (OSCBundleIteratorNext(&elements, &element)) {
+    OSCArgumentIterator arguments = OSCArgumentIteratorMake(&element.message);
+    CFIndex n = 0;
+    if (count < 4) {
+      const char *tags[] = { "i", "f", "T", "F" };
+      STAssertTrue(strcmp(element.message.typeTags, tags[count]) == 0, @"Type tag should round trip");
+      STAssertTrue(OSCArgumentIteratorNext(&arguments, &argument), @"Argument should decode");
+      if (count == 0)
+        STAssertEquals(argument.value.i, sint32, @"Integer should round trip");
+      if (count == 1)
+        STAssertEquals(argument.value.f, float32, @"Float should round trip");
+    } else if (count < 12) {
+      n = (count - 4) / 2 + 1;
+      STAssertTrue(OSCArgumentIteratorNext(&arguments, &argument), @"Argument should decode");
+      if (argument.type == 's') {
+        STAssertEquals(argument.value.s.length, n, @"String length should round trip");
+        STAssertTrue(memcmp(argument.value.s.pointer, bytes, n) == 0, @"String should round trip");
+        for (CFIndex i = n; i < (n + 4) / 4 * 4; i++)
+          STAssertEquals(argument.value.s.pointer[i], (char)0, @"String should be zero padded");
+      } else {
+        STAssertEquals(argument.type, 'b', @"Blob should follow string");
+        STAssertEquals(argument.value.b.length, n, @"Blob length should round trip");
+        STAssertTrue(memcmp(argument.value.b.pointer, bytes, n) == 0, @"Blob should round trip");
+        for (CFIndex i = n; i < (n + 3) / 4 * 4; i++)
+          STAssertEquals(argument.value.b.pointer[i], (UInt8)0, @"Blob should be zero padded");
+      }
+    } else if (count < 16) {
+      for (n = 0; OSCArgumentIteratorNext(&arguments, &argument); n++) {
+        switch (argument.type) {
+          case 'f': STAssertEquals(argument.value.f, floats[n], @"Float array should round trip"); break;
+          case 'i': STAssertEquals(argument.value.i, ints[n], @"Integer array should round trip"); break;
+          case 'd': STAssertEquals(argument.value.d, doubles[n], @"Double array should round trip"); break;
+          case 'h': STAssertEquals(argument.value.h, longs[n], @"Long array should round trip"); break;
+        }
+      }
+      STAssertEquals(n, (CFIndex)(count < 14 ? 3 : 2), @"All array values should decode");
+    } else {
+      STAssertTrue(element.type == kOSCPacketTypeBundle, @"Nested bundle should be an element");
+      STAssertEquals(element.bundle.timeTag, (OSCTimeTag)2, @"Nested time tag should round trip");
+    }
+    STAssertFalse(arguments.malformed, @"Arguments should decode");
+    count++;
+  }
+  STAssertFalse(elements.malformed, @"Bundle should decode");
+  STAssertEquals(count, (CFIndex)17, @"All elements should decode");
+  
+  // Nesting and growth past the limit fail without touching the contents
+  OSCWriterReset(writer);
+  for (CFIndex i = 0; i < OSC_MAXIMUM_BUNDLE_DEPTH; i++)
+    STAssertTrue(OSCWriterBeginBundle(writer, 1), @"Bundle should begin");
+  STAssertFalse(OSCWriterBeginBundle(writer, 1), @"Bundle nested too deep should fail");
+  STAssertEquals(OSCWriterGetLength(writer), (CFIndex)(16 + (OSC_MAXIMUM_BUNDLE_DEPTH - 1) * 20), @"Failed bundle should not be written");
+  OSCWriterRelease(writer);
+  
+  CFIndex limit = 256;
+  CFAllocatorContext context = { 0, &limit, NULL, NULL, NULL, TestLimitedAllocate, NULL, TestLimitedDeallocate, NULL };
+  CFAllocatorRef limited = CFAllocatorCreate(NULL, &context);
+  writer = OSCWriterCreate(limited, limit);
+  STAssertTrue(OSCWriterAppendMessage(writer, CFSTR("/test/int"), number), @"Message should fit");
+  CFIndex length = OSCWriterGetLength(writer);
+  UInt8 large[512];
+  memset(large, 1, sizeof(large));
+  CFDataRef data = CFDataCreate(NULL, large, sizeof(large));
+  STAssertFalse(OSCWriterAppendMessage(writer, CFSTR("/test/blob"), data), @"Message which can't fit should fail");
+  STAssertEquals(OSCWriterGetLength(writer), length, @"Failed message should not be written");
+  STAssertFalse(OSCWriterAppendArrayWithAddress(writer, &address, 'd', large, sizeof(large) / 8), @"Array which can't fit should fail");
+  STAssertEquals(OSCWriterGetLength(writer), length, @"Failed array should not be written");
+  packet = OSCPacketViewMake(OSCWriterGetBytePtr(writer), length);
+  STAssertTrue(packet.type == kOSCPacketTypeMessage, @"Message before the failure should be intact");
+  CFRelease(data);
+  OSCWriterRelease(writer);
+  CFRelease(limited);
+  CFRelease(number);
+  CFRelease(fraction);
+}
+
+
+- (void) testArrayEncoders {
+  static UInt8 source[8 * 300 + 1], encoded[8 * 300 + 8], expected[4096];
+  static OSCArgumentValue values[300];
+  static char tags[301];
+  for (CFIndex i = 0; i < (CFIndex)sizeof(source); i++)
+    source[i] = (UInt8)(i * 37 + 11);
+  OSCAddress address;
+  __OSCAddressInitWithString(&address, CFSTR("/test/array"));
+  OSCWriterRef writer = OSCWriterCreate(allocator, 0);
+  
+  // Empty, single, odd counts and counts past the vector loops, read from
+  // unaligned source and compared with one value at a time swaps.
+  const CFIndex counts[] = { 0, 1, 2, 3, 5, 7, 9, 15, 17, 129, 131, 257, 300 };
+  for (CFIndex c = 0; c < (CFIndex)(sizeof(counts) / sizeof(counts[0])); c++) {
+    CFIndex n = counts[c];
+    memset(encoded, 0xaa, sizeof(encoded));
+    __OSCEncodeSwapped32(encoded, source + 1, n);
+    for (CFIndex i = 0; i < n; i++) {
+      UInt32 value;
+      memcpy(&value, source + 1 + i * 4, 4);
+      value = CFSwapInt32HostToBig(value);
+      STAssertTrue(memcmp(encoded + i * 4, &value, 4) == 0, @"32 bit value should be byte swapped");
+    }
+    STAssertEquals(encoded[n * 4], (UInt8)0xaa, @"Nothing should be written past 32 bit values");
+    memset(encoded, 0xaa, sizeof(encoded));
+    __OSCEncodeSwapped64(encoded, source + 1, n);
+    for (CFIndex i = 0; i < n; i++) {
+      UInt64 value;
+      memcpy(&value, source + 1 + i * 8, 8);
+      value = CFSwapInt64HostToBig(value);
+      STAssertTrue(memcmp(encoded + i * 8, &value, 8) == 0, @"64 bit value should be byte swapped");
+    }
+    STAssertEquals(encoded[n * 8], (UInt8)0xaa, @"Nothing should be written past 64 bit values");
+    
+    const char types[] = { 'f', 'i', 'd', 'h' };
+    for (CFIndex t = 0; t < 4; t++) {
+      CFIndex size = types[t] == 'd' || types[t] == 'h' ? 8 : 4;
+      for (CFIndex i = 0; i < n; i++) {
+        memset(&values[i], 0, sizeof(OSCArgumentValue));
+        memcpy(&values[i], source + 1 + i * size, size);
+        tags[i] = types[t];
+      }
+      tags[n] = 0;
+      CFIndex length = 0;
+      STAssertEquals(OSCEncodeMessage(expected, sizeof(expected), &address, tags, values, &length), kOSCResultSuccess, @"Message should encode");
+      OSCWriterReset(writer);
+      STAssertTrue(OSCWriterAppendArrayWithAddress(writer, &address, types[t], source + 1, n), @"Array should be appended");
+      STAssertEquals(OSCWriterGetLength(writer), length, @"Array should have the length of the message");
+      STAssertTrue(memcmp(OSCWriterGetBytePtr(writer), expected, length) == 0, @"Array should match the message");
+    }
+  }
+  OSCWriterRelease(writer);
 }
 
 @end